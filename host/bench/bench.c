@@ -0,0 +1,1111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "queue_buffer.h"
+#include "temperature.h"
+#include "display.h"
+#include "config.h"
+#include "journal.h"
+#include "delta.h"
+#include "telemetry.h"
+#include "webserver.h"
+#include "tlog.h"
+#include "trace.h"
+#include "bench.h"
+#include "sim.h"
+
+/*
+ * Micro-benchmarks of the firmware's hot kernels, built from the same
+ * sources as the simulator. Each case is timed over batches long enough for
+ * the clock, the fastest of RUNS batches is reported (the least disturbed by
+ * the host). Allocations are counted through the linker's --wrap of the heap
+ * functions and are per op, they must all stay 0: a case that allocates
+ * fails the run, so does a case that finds a wrong result (bench_fail()).
+ * Cases on the simulated flash also report its reads per op (partition
+ * reads and nvs gets) and the simulated time per op, what the writes and
+ * erases cost the device.
+ *
+ * Results go to stdout as a table and, with -o, as JSON lines:
+ *   {"name":"queue_push_median","param":10,"ns_per_op":12.3,"allocs_per_op":0,...}
+ * so two commits can be compared with any line diff or a short script.
+ */
+
+#define RUNS                    5
+#define MIN_BATCH_NS            50000000    //50 ms
+#define OPS_MAX                 (1<<30)
+#define ADC_SWEEP_MARGIN        1000        //codes below/above the table
+#define TEMPERATURE_ENTRIES     166         //-40 to 125 degree
+
+typedef void (*bench_fn_t)(int param, uint32_t ops);
+
+typedef struct {
+    const char* name;
+    bench_fn_t fn;
+    int param;                  //window size, 0: none
+} bench_case_t;
+
+// anything a benchmark computes ends up here, so it cannot be optimized out
+static volatile int32_t sink;
+static uint64_t allocs;
+// first wrong result a case found, NULL: none
+static const char* failure = NULL;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    allocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    allocs++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    allocs++;
+    return __real_realloc(ptr, size);
+}
+
+// esp_restart() in the linked sim objects, never reached here
+void sim_end()
+{
+    exit(1);
+}
+
+static void bench_fail(const char* what)
+{
+    if (failure == NULL) failure = what;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000000+t.tv_nsec;
+}
+
+extern const int32_t temperature_table[];
+
+// adc codes the CS1237 delivers around the table, ops of them cycled through
+#define ADC_CODES               4096
+static int32_t adcCodes[ADC_CODES];
+static uint8_t adcFrames[ADC_CODES][4];
+
+static void inputs_init()
+{
+    int32_t lo = temperature_table[0]-ADC_SWEEP_MARGIN;
+    int32_t hi = temperature_table[TEMPERATURE_ENTRIES-1]+ADC_SWEEP_MARGIN;
+    srand(1);
+    for (int i = 0; i < ADC_CODES; i++) {
+        adcCodes[i] = lo+(int64_t)(hi-lo)*i/(ADC_CODES-1);
+        //24-bit two's complement, msb first, the 4th byte is the padding bits
+        int32_t raw = (rand()%0x1000000)-0x800000;
+        adcFrames[i][0] = raw>>16;
+        adcFrames[i][1] = raw>>8;
+        adcFrames[i][2] = raw;
+        adcFrames[i][3] = 0;
+    }
+}
+
+static void bench_queue(int size, uint32_t ops, algorithm_e algorithm)
+{
+    int32_t buffer[size];
+    queue_buffer_t queue;
+    queue_buffer_init(&queue, buffer, size);
+    int32_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        queue_buffer_push(&queue, adcCodes[i%ADC_CODES]);
+        acc += queue_get_value(&queue, algorithm);
+    }
+    sink = acc;
+}
+
+static void bench_queue_median(int size, uint32_t ops)
+{
+    bench_queue(size, ops, ALG_MEDIAN_VALUE);
+}
+
+static void bench_queue_mean(int size, uint32_t ops)
+{
+    bench_queue(size, ops, ALG_MEAN_VALUE);
+}
+
+static void bench_convert_temp(int param, uint32_t ops)
+{
+    int32_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        acc += convert_temp(adcCodes[i%ADC_CODES]);
+    }
+    sink = acc;
+}
+
+static void bench_convert_temp_x10(int param, uint32_t ops)
+{
+    int32_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        acc += convert_temp_x10(adcCodes[i%ADC_CODES]);
+    }
+    sink = acc;
+}
+
+static void bench_parse_adc_frames(int param, uint32_t ops)
+{
+    int32_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        acc += bench_parse_adc(adcFrames[i%ADC_CODES]);
+    }
+    sink = acc;
+}
+
+// digit encoding only: without display_init() there is no spi device and
+// the transfer returns right away
+static void bench_display_set_temperature(int param, uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++) {
+        display_set_temperature((int32_t)(i%161)-40);
+    }
+}
+
+// touch and slider events as the CPT112S reports them, 20 ms apart; touch
+// release is left out, it starts the key beep
+static void bench_cpt112s_parse(int param, uint32_t ops)
+{
+    key_event_t keyEvent;
+    uint8_t event[3];
+    int32_t acc = 0;
+    int64_t time = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        int step = i%32;
+        if (step == 0) {
+            event[0] = 0x00;
+            event[1] = event[2] = 0;
+        } else if (step == 31) {
+            event[0] = 0x02;
+            event[1] = event[2] = 0xff;
+        } else {
+            int pos = step*20;
+            event[0] = 0x02;
+            event[1] = pos>>8;
+            event[2] = pos;
+        }
+        event[0] |= (i&0x0f)<<4;
+        time += 20000;
+        if (bench_cpt112s_parse_event(event, time, &keyEvent)) {
+            acc += keyEvent.key_data;
+        }
+    }
+    sink = acc;
+}
+
+// settings load at boot, the per key layout before the blob and the blob
+static void settings_init()
+{
+    static bool ready = false;
+    if (ready) return;
+    bench_config_setup();
+    ready = true;
+}
+
+static void bench_config_legacy(int param, uint32_t ops)
+{
+    settings_init();
+    for (uint32_t i = 0; i < ops; i++) {
+        bench_config_load_legacy();
+    }
+    sink = config_get_target_temperature();
+}
+
+static void bench_config_blob(int param, uint32_t ops)
+{
+    settings_init();
+    for (uint32_t i = 0; i < ops; i++) {
+        sink = bench_config_load_blob(false);
+    }
+}
+
+static void bench_config_journal(int param, uint32_t ops)
+{
+    settings_init();
+    for (uint32_t i = 0; i < ops; i++) {
+        sink = bench_config_load_blob(true);
+    }
+}
+
+// string settings set and read back, two values in turn so every set is a change
+static void bench_config_set_get_str(int param, uint32_t ops)
+{
+    static char* names[2] = { "kitchen", "living room" };
+    static char* passes[2] = { "correct horse battery", "staple" };
+    settings_init();
+    int32_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        char* name = names[i%2];
+        char* pass = passes[i%2];
+        config_set_wifi_name(name, strlen(name));
+        config_set_wifi_pass(pass, strlen(pass));
+        config_set_device_name(name, strlen(name));
+        config_set_telemetry(name, strlen(name), 9000+i%2);
+        acc += config_get_wifi_name()[0]+config_get_wifi_pass()[0]+config_get_device_name()[0];
+        acc += config_get_telemetry()->port;
+    }
+    sink = acc;
+}
+
+// set, write out, back to the defaults and load again: what a settings
+// change and a reboot do, journal appends and region erases included
+static void bench_config_cycle(int param, uint32_t ops)
+{
+    settings_init();
+    int32_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        config_set_wifi_name("kitchen", 7);
+        config_set_device_name("black fire", 10);
+        config_set_target_temperature(40+i%60);
+        config_flush();
+        config_reset();
+        config_load();
+        acc += config_get_target_temperature();
+    }
+    sink = acc;
+}
+
+// change notifications: batch order by setting then subscription, an
+// observer that changes and flushes a setting gets the next batch nested in
+// its call, one that unsubscribes itself does not make the next one miss
+static char notified[16];
+static int notifiedCount;
+
+static void notify_log(char id)
+{
+    if (notifiedCount < sizeof(notified)-1) notified[notifiedCount++] = id;
+}
+
+static void observer_a(setting_e setting, void* arg)
+{
+    notify_log('A');
+}
+
+static void observer_b(setting_e setting, void* arg)
+{
+    notify_log('B');
+    char* name = config_get_wifi_name() != NULL && strcmp(config_get_wifi_name(), "kitchen") == 0 ?
+            "living room" : "kitchen";
+    config_set_wifi_name(name, strlen(name));
+    config_flush();
+}
+
+static void observer_c(setting_e setting, void* arg)
+{
+    notify_log((char)(intptr_t)arg);
+}
+
+static void observer_e(setting_e setting, void* arg)
+{
+    notify_log('E');
+    config_unsubscribe(setting, observer_e, arg);
+}
+
+static void bench_config_notify(int param, uint32_t ops)
+{
+    static bool subscribed = false;
+    settings_init();
+    if (!subscribed) {
+        //every op below changes all three from here on
+        config_set_device_name("kettle", 6);
+        config_set_target_temperature(100);
+        config_set_key_sound(1);
+        config_flush();
+        config_subscribe(SETTING_TARGET_TEMPERATURE, observer_b, NULL);
+        config_subscribe(SETTING_KEY_SOUND, observer_a, NULL);
+        config_subscribe(SETTING_WIFI_NAME, observer_c, (void*)'D');
+        config_subscribe(SETTING_KEY_SOUND, observer_c, (void*)'C');
+        subscribed = true;
+    }
+    //alternates across calls too, so every op is a change
+    static uint32_t n = 0;
+    for (uint32_t i = 0; i < ops; i++, n++) {
+        config_subscribe(SETTING_DEVICE_NAME, observer_e, NULL);
+        config_subscribe(SETTING_DEVICE_NAME, observer_c, (void*)'F');
+        notifiedCount = 0;
+        config_set_device_name(n%2 ? "kettle" : "black fire", n%2 ? 6 : 10);
+        config_set_target_temperature(40+n%2);
+        config_set_key_sound(n%2);
+        config_flush();
+        notified[notifiedCount] = 0;
+        if (strcmp(notified, "ACBDEF") != 0) bench_fail("notified out of order");
+        config_unsubscribe(SETTING_DEVICE_NAME, observer_c, (void*)'F');
+    }
+    sink = notifiedCount;
+}
+
+// power cut while the journal appends, at every byte of the record write,
+// once into a region with room and once with the region switch (erase of
+// the other region first). After the reboot the journal must read the
+// previous record, or the new one when the write completed, and take the
+// next append. Uses the settings partition, the config cases run before
+#define JOURNAL_TEST_LEN        100
+#define JOURNAL_TEST_SIZE       ((12+JOURNAL_TEST_LEN+3) & ~3)
+
+static void journal_record(uint32_t seq, uint8_t* data)
+{
+    for (int i = 0; i < JOURNAL_TEST_LEN; i++) {
+        data[i] = (uint8_t)(seq*31+i);
+    }
+}
+
+static bool journal_reads(journal_t* journal, uint32_t seq)
+{
+    uint8_t data[JOURNAL_TEST_LEN], expected[JOURNAL_TEST_LEN];
+    size_t len = sizeof(data);
+    journal_record(seq, expected);
+    return journal_read(journal, data, &len) == ESP_OK && len == JOURNAL_TEST_LEN
+            && memcmp(data, expected, len) == 0;
+}
+
+static void power_cut_once(journal_t* journal, const esp_partition_t* partition, int point)
+{
+    //points: write offsets with room, erase cuts, write offsets after the switch
+    int full = journal->region_size/JOURNAL_SLOT_SIZE;
+    int records = point <= JOURNAL_TEST_SIZE ? 3 : full;
+    int64_t bytes = -1, sectors = -1;
+    int eraseCuts = journal->region_size/SPI_FLASH_SEC_SIZE;
+    if (point <= JOURNAL_TEST_SIZE) {
+        bytes = point;
+    } else if (point-JOURNAL_TEST_SIZE-1 < eraseCuts) {
+        sectors = point-JOURNAL_TEST_SIZE-1;
+    } else {
+        bytes = point-JOURNAL_TEST_SIZE-1-eraseCuts;
+    }
+
+    uint8_t data[JOURNAL_TEST_LEN];
+    sim_flash_power_on();
+    esp_partition_erase_range(partition, 0, partition->size);
+    journal_open(journal, partition->subtype, partition->label);
+    for (int seq = 1; seq <= records; seq++) {
+        journal_record(seq, data);
+        journal_append(journal, data, sizeof(data));
+    }
+    sim_flash_power_cut(bytes, sectors);
+    journal_record(records+1, data);
+    journal_append(journal, data, sizeof(data));
+    bool complete = !sim_flash_power_off();
+
+    //reboot
+    sim_flash_power_on();
+    journal_open(journal, partition->subtype, partition->label);
+    uint32_t last = complete ? records+1 : records;
+    if (!journal_reads(journal, last)) bench_fail("lost the last record on a power cut");
+    journal_record(last+1, data);
+    if (journal_append(journal, data, sizeof(data)) != ESP_OK) bench_fail("no append after a power cut");
+    journal_open(journal, partition->subtype, partition->label);
+    if (!journal_reads(journal, last+1)) bench_fail("lost the append after a power cut");
+}
+
+static void bench_journal_power_cut(int param, uint32_t ops)
+{
+    static uint32_t n = 0;
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, 0x40, "settings");
+    journal_t journal;
+    journal_open(&journal, partition->subtype, partition->label);
+    int points = 2*(JOURNAL_TEST_SIZE+1)+journal.region_size/SPI_FLASH_SEC_SIZE;
+    for (uint32_t i = 0; i < ops; i++, n++) {
+        power_cut_once(&journal, partition, n%points);
+    }
+    sink = journal.seq;
+}
+
+// telemetry frames of a kettle heating from 20 to 100 degree and holding
+// it: a conversion every 100 ms with a ms of jitter, the adc noise on raw.
+// param is the samples per frame, 10 for the frame every second at 10 Hz,
+// TELEMETRY_BATCH_MAX after a stall. The first call encodes the whole
+// stream, decodes every frame again and prints the bytes per sample (frame
+// header included), the timed ops only encode
+#define TELEMETRY_SAMPLES       3000        //5 min
+#define TELEMETRY_NOISE         20          //adc codes, +-
+
+static telemetry_sample_t telemetrySamples[TELEMETRY_SAMPLES];
+
+static void telemetry_samples_init()
+{
+    srand(2);
+    for (int i = 0; i < TELEMETRY_SAMPLES; i++) {
+        int32_t temp = 200+i*3/10;          //0.1 degree, 0.3 degree/s
+        bool heat = temp < 1000;
+        if (!heat) temp = 1000;
+        //adc code of temp, linear between the whole degrees of the table
+        int32_t deg = temp/10+40;
+        int32_t code = temperature_table[deg]+(temperature_table[deg+1]-temperature_table[deg])*(temp%10)/10;
+        telemetrySamples[i].time = 2000+i*100+rand()%3-1;
+        telemetrySamples[i].raw = code+rand()%(2*TELEMETRY_NOISE+1)-TELEMETRY_NOISE;
+        telemetrySamples[i].temp = temp;
+        telemetrySamples[i].heat = heat;
+        telemetrySamples[i].target = 100;
+    }
+}
+
+static const uint8_t* get_varint(const uint8_t* p, uint32_t* value)
+{
+    int shift = 0;
+    *value = 0;
+    while (*p & 0x80) {
+        *value |= (uint32_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value |= (uint32_t)*p++ << shift;
+    return p;
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static bool telemetry_decodes(const uint8_t* frame, size_t len, const telemetry_sample_t* samples, int count)
+{
+    uint32_t seq, n, dropped, v;
+    const uint8_t* p = frame+2;
+    if (frame[0] != TELEMETRY_MAGIC || frame[1] != TELEMETRY_VERSION) return false;
+    p = get_varint(p, &seq);
+    p = get_varint(p, &n);
+    p = get_varint(p, &dropped);
+    if (n != count) return false;
+    telemetry_sample_t prev;
+    memset(&prev, 0, sizeof(prev));
+    for (int i = 0; i < count; i++) {
+        telemetry_sample_t s;
+        p = get_varint(p, &v);
+        s.time = prev.time+v;
+        p = get_varint(p, &v);
+        s.raw = prev.raw+unzigzag(v);
+        p = get_varint(p, &v);
+        s.temp = prev.temp+unzigzag(v);
+        p = get_varint(p, &v);
+        s.heat = v & 1;
+        s.target = prev.target+unzigzag(v >> 1);
+        if (s.time != samples[i].time || s.raw != samples[i].raw || s.temp != samples[i].temp
+                || s.heat != samples[i].heat || s.target != samples[i].target) return false;
+        prev = s;
+    }
+    return p == frame+len;
+}
+
+static void bench_telemetry_encode(int batch, uint32_t ops)
+{
+    static bool reported[TELEMETRY_BATCH_MAX+1];
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    int frames = TELEMETRY_SAMPLES/batch;
+    if (!reported[batch]) {
+        //the whole stream once, for the size
+        size_t bytes = 0;
+        for (int f = 0; f < frames; f++) {
+            const telemetry_sample_t* samples = &telemetrySamples[f*batch];
+            size_t len = telemetry_encode(samples, batch, f, 0, frame);
+            if (!telemetry_decodes(frame, len, samples, batch)) bench_fail("does not decode to the samples");
+            bytes += len;
+        }
+        printf("%s/%-*d %.2f bytes/sample, %zu in memory, %d samples in %d frames\n",
+               "telemetry_encode", 27-(int)strlen("telemetry_encode"), batch, (double)bytes/(frames*batch),
+               sizeof(telemetry_sample_t), frames*batch, frames);
+        reported[batch] = true;
+    }
+    size_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        const telemetry_sample_t* samples = &telemetrySamples[(i%frames)*batch];
+        acc += telemetry_encode(samples, batch, i, 0, frame);
+    }
+    sink = acc;
+}
+
+// the same hot path log line both ways, the info level on. ESP_LOGI
+// formats and prints in the caller, here to /dev/null; on the device the
+// caller also waits for the uart once its fifo is full, printed once as
+// the bytes per line and their time at the console baud rate. log_tlogi is
+// the call alone (the ring is taken out every TLOG_BATCH calls, nothing
+// formatted), log_tlogi_drained adds the formatting the tlog task does
+// later
+#define LOG_TAG                 "BENCH"
+#define TLOG_BATCH              32          //half the ring
+#define UART_BYTE_US            (10*1000000.0/CONFIG_CONSOLE_UART_BAUDRATE)
+
+static FILE* logNull = NULL;
+
+static void bench_log_esp_logi(int param, uint32_t ops)
+{
+    static bool reported = false;
+    uint64_t bytes = sim_log_bytes();
+    sim_log_output(logNull);
+    sim_log_level(ESP_LOG_INFO);
+    for (uint32_t i = 0; i < ops; i++) {
+        ESP_LOGI(LOG_TAG, "%s: raw %d filtered %d", __func__, i, i/2);
+    }
+    sim_log_level(ESP_LOG_WARN);
+    sim_log_output(NULL);
+    if (!reported) {
+        double perLine = (double)(sim_log_bytes()-bytes)/ops;
+        printf("%-28s %.0f bytes/line, %.1f ms of uart at %d baud on the device\n",
+               "log_esp_logi", perLine, perLine*UART_BYTE_US/1000, CONFIG_CONSOLE_UART_BAUDRATE);
+        reported = true;
+    }
+}
+
+static void tlog_ops(uint32_t ops, bool print)
+{
+    sim_log_output(logNull);
+    if (print) sim_log_level(ESP_LOG_INFO);
+    for (uint32_t i = 0; i < ops; i++) {
+        TLOGI(LOG_TAG, "%s: raw %d filtered %d", __func__, i, i/2);
+        if (i%TLOG_BATCH == TLOG_BATCH-1) tlog_flush();
+    }
+    tlog_flush();
+    sim_log_level(ESP_LOG_WARN);
+    sim_log_output(NULL);
+
+    tlog_stats_t stats;
+    tlog_get_stats(&stats);
+    if (stats.dropped > 0) bench_fail("drops entries");
+}
+
+static void bench_log_tlogi(int param, uint32_t ops)
+{
+    tlog_ops(ops, false);
+}
+
+static void bench_log_tlogi_drained(int param, uint32_t ops)
+{
+    tlog_ops(ops, true);
+}
+
+// an INT wake of the touch thread with param slider events queued on the
+// host CPT112S stand-in, all read, parsed and posted. The sim time per op is
+// the bus time from INT to the last key event posted. The first call
+// compares the read of cpt112s.c before the batching, a command link created
+// and deleted and an info line logged per event
+#define TOUCH_BATCH             8           //EVENT_BATCH_SIZE of cpt112s.c
+
+static void queue_slider_events(int events, uint32_t op)
+{
+    for (int i = 0; i < events; i++) {
+        sim_slider((op*events+i)%50*10);
+    }
+}
+
+static void bench_cpt112s_drains(int events, uint32_t ops)
+{
+    static bool reported[TOUCH_BATCH+1];
+    if (!reported[events]) {
+        uint64_t allocStart = allocs;
+        int64_t start = sim_now();
+        queue_slider_events(events, 0);
+        bench_cpt112s_drain();
+        uint64_t batchAllocs = allocs-allocStart;
+        int64_t batchUs = sim_now()-start;
+
+        uint8_t event[3];
+        uint64_t bytes = sim_log_bytes();
+        allocStart = allocs;
+        start = sim_now();
+        queue_slider_events(events, 0);
+        sim_log_output(logNull);
+        sim_log_level(ESP_LOG_INFO);
+        for (int i = 0; i < events; i++) {
+            if (!bench_cpt112s_read_unbatched(event)) bench_fail("can not read the stand-in");
+        }
+        sim_log_level(ESP_LOG_WARN);
+        sim_log_output(NULL);
+        double uartMs = (sim_log_bytes()-bytes)*UART_BYTE_US/1000;
+        char name[32];
+        snprintf(name, sizeof(name), "cpt112s_drain/%d", events);
+        printf("%-28s int to last event %.2f ms, %llu allocs; a link and a line per event %.2f ms + %.1f ms of uart, %llu allocs\n",
+               name, batchUs/1000.0, (unsigned long long)batchAllocs, (sim_now()-start)/1000.0, uartMs,
+               (unsigned long long)(allocs-allocStart));
+        reported[events] = true;
+    }
+    for (uint32_t i = 0; i < ops; i++) {
+        queue_slider_events(events, i);
+        sink = bench_cpt112s_drain();
+        if (sink < 0) bench_fail("leaves events queued");
+    }
+}
+
+// telemetry_task() sending to the udp receiver stand-in, param samples a
+// second: 10 as the adc records them, 64 (the ring) in one period, past
+// that the ring overflows. The first call starts with the endpoint's name
+// unknown for 10 s, runs a minute at the rate and stalls the link for 30 s;
+// every sample must have arrived or be counted as dropped by a later frame.
+// It prints the dns tries, the rate delivered and the failed sends. The
+// timed ops are a send period each: record, send, take off the link
+#define TELEMETRY_HOST          "telemetry.lan"
+#define TELEMETRY_PORT          9000
+
+static uint32_t telemetryReceived;          //samples in frames that arrived
+static uint32_t telemetryReported;          //dropped, per those frames
+
+static void telemetry_period(int rate, bool receive)
+{
+    for (int i = 0; i < rate; i++) {
+        telemetry_record(2000+i%50, 600, true, 100);
+        sim_sleep(1000000/rate);
+    }
+    bench_telemetry_period();
+    if (!receive) return;
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    size_t len;
+    while ((len = sim_net_udp_receive(frame, sizeof(frame))) > 0) {
+        uint32_t seq, count, dropped;
+        const uint8_t* p = get_varint(frame+2, &seq);
+        p = get_varint(p, &count);
+        get_varint(p, &dropped);
+        telemetryReceived += count;
+        telemetryReported += dropped;
+    }
+}
+
+static void bench_telemetry_sustained(int rate, uint32_t ops)
+{
+    static char host[] = TELEMETRY_HOST;
+    static int reported = 0;
+    if (reported != rate) {
+        settings_init();
+        sim_log_output(logNull);
+        sim_net_station_up();
+        sim_net_udp_listen(NULL, 0);
+        config_set_telemetry(host, strlen(host), TELEMETRY_PORT);
+        bench_telemetry_setup();
+        telemetryReceived = telemetryReported = 0;
+
+        int period = 0;
+        for (; period < 10; period++) telemetry_period(rate, true);
+        sim_net_udp_listen(TELEMETRY_HOST, TELEMETRY_PORT);
+        while (telemetryReceived == 0 && period < 100) {
+            telemetry_period(rate, true);
+            period++;
+        }
+        telemetry_stats_t stats;
+        telemetry_get_stats(&stats);
+        uint32_t tries = stats.link_errors+1;
+
+        uint32_t before = telemetryReceived;
+        for (int i = 0; i < 60; i++) telemetry_period(rate, true);
+        double delivered = (telemetryReceived-before)/60.0;
+        telemetry_get_stats(&stats);
+        double bytes = stats.bytes;
+        uint32_t frames = stats.frames;
+
+        for (int i = 0; i < 30; i++) telemetry_period(rate, false);
+        for (int i = 0; i < 3; i++) telemetry_period(rate, true);
+        telemetry_get_stats(&stats);
+        sim_log_output(NULL);
+        if (telemetryReceived+telemetryReported != stats.samples) bench_fail("loses samples without a count");
+        if (rate <= 64 && delivered != rate) bench_fail("does not keep up");
+
+        char name[32];
+        snprintf(name, sizeof(name), "telemetry_sustained/%d", rate);
+        printf("%-28s dns down 10 s: first frame after %d s, %u tries; 60 s: %.1f samples/s, %.0f bytes/frame;"
+               " 30 s stall: %u sends failed; %u samples: %u in frames, %u counted dropped\n",
+               name, period, tries, delivered, frames > 0 ? bytes/frames : 0, stats.send_errors,
+               stats.samples, telemetryReceived, telemetryReported);
+        reported = rate;
+    }
+    for (uint32_t i = 0; i < ops; i++) {
+        telemetry_period(rate, true);
+    }
+    sink = telemetryReceived;
+}
+
+// one TRACE() call site, recording and switched off with trace_enable().
+// The ring's ram is printed once
+static void bench_trace(bool enable, uint32_t ops)
+{
+    trace_enable(enable);
+    for (uint32_t i = 0; i < ops; i++) {
+        TRACE(TRACE_QUEUE_SEND, TRACE_SRC_KEY_QUEUE, i);
+    }
+    trace_enable(false);
+}
+
+static void bench_trace_record(int param, uint32_t ops)
+{
+    static bool reported = false;
+    if (!reported) {
+        printf("%-28s %zu bytes/record, %zu bytes of ring per core\n",
+               "trace_record", sizeof(trace_record_t), sizeof(trace_record_t)*TRACE_RING_SIZE);
+        reported = true;
+    }
+    bench_trace(true, ops);
+}
+
+static void bench_trace_disabled(int param, uint32_t ops)
+{
+    bench_trace(false, ops);
+}
+
+// session history on the simulated flash. history_append is the write of
+// a queued record, the page program plus a sector erase every 16 records;
+// history_get a query of a record back from the newest; history_open the
+// head scan at boot. The first history_get call fills the ring past one lap
+// and checks that every record left on flash is reachable and reads back
+#define HISTORY_FILL            1100        //1.5 laps of the 704 slots
+
+static history_record_t historyRecord;
+
+static void bench_history_append(int param, uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++) {
+        historyRecord.duration = i;
+        bench_history_write(&historyRecord);
+    }
+    sink = history_count();
+}
+
+static void bench_history_get(int param, uint32_t ops)
+{
+    static bool checked = false;
+    history_record_t record;
+    if (!checked) {
+        for (int i = 0; i < HISTORY_FILL; i++) bench_history_write(&historyRecord);
+        int count = history_count();
+        if (count != bench_history_valid_slots()) bench_fail("loses records that are on flash");
+        for (int i = 0; i < count; i++) {
+            if (history_get(i, &record) != ESP_OK) bench_fail("does not read a record back");
+        }
+        checked = true;
+    }
+    int count = history_count();
+    uint32_t acc = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        if (history_get(i%count, &record) != ESP_OK) bench_fail("does not read a record back");
+        acc += record.seq;
+    }
+    sink = acc;
+}
+
+static void bench_history_open(int param, uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++) {
+        bench_history_reopen();
+    }
+    sink = history_count();
+}
+
+// the web server under load: param clients on the websocket. ws_upgrade
+// is the whole upgrade of a page opening the socket; it first checks that
+// an upgrade from another site or under a rebound name is refused, one
+// without Origin or to the station address let in, and a client that does
+// not read its replies dropped.
+// ws_command is a heat command and its reply, the clients in turn;
+// ws_push one state frame to every client
+#define WS_ORIGIN               "http://black-fire.local"
+
+static int wsClients[WEBSERVER_CLIENT_MAX];
+static int wsClientCount = 0;
+
+// exactly count clients connected
+static void ws_clients(int count)
+{
+    while (wsClientCount > count) bench_ws_close(wsClients[--wsClientCount]);
+    while (wsClientCount < count) {
+        int s = bench_ws_connect(WS_ORIGIN);
+        if (s < 0) {
+            bench_fail("refuses a client");
+            return;
+        }
+        wsClients[wsClientCount++] = s;
+    }
+}
+
+static void bench_ws_upgrades(int param, uint32_t ops)
+{
+    static bool checked = false;
+    ws_clients(0);
+    if (!checked) {
+        //the refusal is logged as a warning
+        sim_log_level(ESP_LOG_ERROR);
+        int foreign = bench_ws_connect("http://evil.example");
+        sim_log_level(ESP_LOG_WARN);
+        if (foreign >= 0) {
+            bench_fail("lets a foreign origin in");
+            bench_ws_close(foreign);
+        }
+        int plain = bench_ws_connect(NULL);
+        if (plain < 0) bench_fail("refuses a client without origin");
+        bench_ws_close(plain);
+        //another site's name rebound to the kettle's address
+        sim_log_level(ESP_LOG_ERROR);
+        int rebound = bench_ws_connect_to("evil.example", "http://evil.example");
+        if (rebound >= 0) {
+            bench_fail("lets a rebound name in");
+            bench_ws_close(rebound);
+        }
+        sim_net_station_up();
+        int byAddress = bench_ws_connect_to("192.168.1.20", "http://192.168.1.20");
+        if (byAddress < 0) {
+            bench_fail("refuses its station address");
+        } else if (!bench_ws_flood(byAddress)) {
+            bench_fail("keeps a client that does not read");
+            bench_ws_close(byAddress);
+        }
+        sim_log_level(ESP_LOG_WARN);
+        checked = true;
+    }
+    for (uint32_t i = 0; i < ops; i++) {
+        int s = bench_ws_connect(WS_ORIGIN);
+        if (s < 0) bench_fail("refuses its own page");
+        bench_ws_close(s);
+    }
+}
+
+static void bench_ws_commands(int clients, uint32_t ops)
+{
+    static uint32_t n = 0;
+    char reply[16];
+    ws_clients(clients);
+    for (uint32_t i = 0; i < ops; i++, n++) {
+        if (!bench_ws_command(wsClients[n%clients], n%2 ? "heat off" : "heat on", reply, sizeof(reply))
+                || strcmp(reply, "ok") != 0) bench_fail("does not take the command");
+    }
+}
+
+static void bench_ws_pushes(int clients, uint32_t ops)
+{
+    int bytes = 0;
+    ws_clients(clients);
+    for (uint32_t i = 0; i < ops; i++) {
+        bytes = bench_ws_push();
+        if (bytes < 0) bench_fail("drops a client");
+    }
+    sink = bytes;
+}
+
+// round trip of a delta update: the patch tools/mkdelta.py made between the
+// two images of bench/delta_images.py (make bench builds them), applied in
+// the 4 KB chunks ota.c reads from the socket, each output byte checked
+// against the new image
+#define DELTA_CHUNK             4096
+
+typedef struct {
+    uint8_t* data;
+    long size;
+} bench_file_t;
+
+static const char* deltaDir = "build/delta";
+static bench_file_t deltaOld, deltaNew, deltaPatch;
+static uint32_t deltaChecked;
+static bool deltaMismatch;
+
+static bool load_file(const char* name, bench_file_t* file)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", deltaDir, name);
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return false;
+    fseek(f, 0, SEEK_END);
+    file->size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file->data = malloc(file->size);
+    bool ok = file->data != NULL && fread(file->data, 1, file->size, f) == file->size;
+    fclose(f);
+    return ok;
+}
+
+static esp_err_t delta_read_old(void* arg, uint32_t offset, uint8_t* data, size_t len)
+{
+    if (offset+len > deltaOld.size) return ESP_ERR_INVALID_SIZE;
+    memcpy(data, deltaOld.data+offset, len);
+    return ESP_OK;
+}
+
+static esp_err_t delta_check_new(void* arg, const uint8_t* data, size_t len)
+{
+    if (deltaChecked+len > deltaNew.size || memcmp(data, deltaNew.data+deltaChecked, len) != 0) {
+        deltaMismatch = true;
+    }
+    deltaChecked += len;
+    return ESP_OK;
+}
+
+static void bench_delta_apply(int param, uint32_t ops)
+{
+    //loaded in the first batch, before allocations are counted
+    if (deltaPatch.data == NULL) {
+        if (!load_file("old.bin", &deltaOld) || !load_file("new.bin", &deltaNew)
+                || !load_file("new.patch", &deltaPatch)) {
+            bench_fail("has no images, make bench builds them");
+            return;
+        }
+        printf("%-28s %ld byte patch for a %ld byte image (%.1f%%), applier ram %zu bytes\n",
+               "delta_apply", deltaPatch.size, deltaNew.size, 100.0*deltaPatch.size/deltaNew.size, sizeof(delta_t));
+    }
+    static delta_t delta;
+    for (uint32_t i = 0; i < ops; i++) {
+        deltaChecked = 0;
+        deltaMismatch = false;
+        esp_err_t err = delta_begin(&delta, delta_read_old, delta_check_new, NULL);
+        for (long pos = 0; err == ESP_OK && pos < deltaPatch.size; pos += DELTA_CHUNK) {
+            long len = deltaPatch.size-pos < DELTA_CHUNK ? deltaPatch.size-pos : DELTA_CHUNK;
+            err = delta_feed(&delta, deltaPatch.data+pos, len);
+        }
+        if (err == ESP_OK) err = delta_end(&delta);
+        if (err != ESP_OK) bench_fail("rejects the patch");
+        if (deltaMismatch || deltaChecked != deltaNew.size) bench_fail("does not rebuild the new image");
+    }
+    sink = deltaChecked;
+}
+
+static const bench_case_t cases[] = {
+    { "queue_push_median", bench_queue_median, 4 },
+    { "queue_push_median", bench_queue_median, 10 },
+    { "queue_push_median", bench_queue_median, 32 },
+    { "queue_push_median", bench_queue_median, 128 },
+    { "queue_push_mean", bench_queue_mean, 4 },
+    { "queue_push_mean", bench_queue_mean, 10 },
+    { "queue_push_mean", bench_queue_mean, 32 },
+    { "queue_push_mean", bench_queue_mean, 128 },
+    { "convert_temp", bench_convert_temp, 0 },
+    { "convert_temp_x10", bench_convert_temp_x10, 0 },
+    { "parse_adc", bench_parse_adc_frames, 0 },
+    { "display_set_temperature", bench_display_set_temperature, 0 },
+    { "cpt112s_parse_event", bench_cpt112s_parse, 0 },
+    { "cpt112s_drain", bench_cpt112s_drains, 1 },
+    { "cpt112s_drain", bench_cpt112s_drains, TOUCH_BATCH },
+    { "config_load_legacy", bench_config_legacy, 0 },
+    { "config_load_blob", bench_config_blob, 0 },
+    { "config_load_journal", bench_config_journal, 0 },
+    { "config_set_get_str", bench_config_set_get_str, 0 },
+    { "config_cycle", bench_config_cycle, 0 },
+    { "config_notify", bench_config_notify, 0 },
+    { "journal_power_cut", bench_journal_power_cut, 0 },
+    { "telemetry_encode", bench_telemetry_encode, 10 },
+    { "telemetry_encode", bench_telemetry_encode, TELEMETRY_BATCH_MAX },
+    { "telemetry_sustained", bench_telemetry_sustained, 10 },
+    { "telemetry_sustained", bench_telemetry_sustained, 64 },
+    { "telemetry_sustained", bench_telemetry_sustained, 100 },
+    { "log_esp_logi", bench_log_esp_logi, 0 },
+    { "log_tlogi", bench_log_tlogi, 0 },
+    { "log_tlogi_drained", bench_log_tlogi_drained, 0 },
+    { "trace_record", bench_trace_record, 0 },
+    { "trace_record_disabled", bench_trace_disabled, 0 },
+    { "history_append", bench_history_append, 0 },
+    { "history_get", bench_history_get, 0 },
+    { "history_open", bench_history_open, 0 },
+    { "ws_upgrade", bench_ws_upgrades, 0 },
+    { "ws_command", bench_ws_commands, WEBSERVER_CLIENT_MAX },
+    { "ws_push", bench_ws_pushes, 1 },
+    { "ws_push", bench_ws_pushes, WEBSERVER_CLIENT_MAX },
+    { "delta_apply", bench_delta_apply, 0 },
+};
+
+// false if the case allocated or failed a check
+static bool run_case(const bench_case_t* c, FILE* json)
+{
+    //grow the batch until it is long enough to time
+    uint32_t ops = 1;
+    uint64_t elapsed = 0;
+    while (ops < OPS_MAX) {
+        uint64_t start = now_ns();
+        c->fn(c->param, ops);
+        elapsed = now_ns()-start;
+        if (elapsed >= MIN_BATCH_NS) break;
+        ops = elapsed > 0 && MIN_BATCH_NS/elapsed < 8 ? ops*2 : ops*8;
+    }
+
+    double best = (double)elapsed/ops;
+    uint64_t allocStart = allocs;
+    sim_flash_stats_t flashStart, flashEnd;
+    sim_flash_get_stats(&flashStart);
+    int64_t simStart = sim_now();
+    for (int run = 0; run < RUNS; run++) {
+        uint64_t start = now_ns();
+        c->fn(c->param, ops);
+        double ns = (double)(now_ns()-start)/ops;
+        if (ns < best) best = ns;
+    }
+    double total = (double)ops*RUNS;
+    double allocsPerOp = (allocs-allocStart)/total;
+    sim_flash_get_stats(&flashEnd);
+    double readsPerOp = (flashEnd.reads+flashEnd.nvs_reads-flashStart.reads-flashStart.nvs_reads)/total;
+    double simUsPerOp = (sim_now()-simStart)/total;
+
+    char name[64];
+    if (c->param > 0) {
+        snprintf(name, sizeof(name), "%s/%d", c->name, c->param);
+    } else {
+        snprintf(name, sizeof(name), "%s", c->name);
+    }
+    printf("%-28s %10.2f ns/op %8.2f allocs/op %6.2f reads/op %9.1f sim us/op %12u ops\n",
+           name, best, allocsPerOp, readsPerOp, simUsPerOp, ops);
+    if (json != NULL) {
+        fprintf(json, "{\"name\":\"%s\",\"param\":%d,\"ns_per_op\":%.2f,\"allocs_per_op\":%g,"
+                "\"reads_per_op\":%g,\"sim_us_per_op\":%g,\"ops\":%u}\n",
+                c->name, c->param, best, allocsPerOp, readsPerOp, simUsPerOp, ops);
+    }
+    if (allocs != allocStart) bench_fail("allocates");
+    return failure == NULL;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-o file] [-d dir] [filter]\n"
+            "  -o file      also write the results as JSON lines\n"
+            "  -d dir       images and patch of delta_apply (build/delta)\n"
+            "  filter       only the cases whose name contains it\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    const char* jsonPath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:d:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                jsonPath = optarg;
+                break;
+            case 'd':
+                deltaDir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc-1) usage(argv[0]);
+    const char* filter = optind < argc ? argv[optind] : NULL;
+
+    FILE* json = NULL;
+    if (jsonPath != NULL) {
+        json = fopen(jsonPath, "w");
+        if (json == NULL) {
+            fprintf(stderr, "bench: cannot write %s\n", jsonPath);
+            return 2;
+        }
+    }
+    int failed = 0;
+    sim_log_level(ESP_LOG_WARN);
+    sim_flash_init(SIM_PARTITION_TABLE);
+    inputs_init();
+    telemetry_samples_init();
+    bench_ws_setup();
+    bench_history_setup();
+    bench_tlog_setup();
+    bench_cpt112s_setup();
+    logNull = fopen("/dev/null", "w");
+    for (int i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+        if (filter != NULL && strstr(cases[i].name, filter) == NULL) continue;
+        if (!run_case(&cases[i], json)) {
+            fprintf(stderr, "bench: %s %s\n", cases[i].name, failure);
+            failure = NULL;
+            failed++;
+        }
+    }
+    if (json != NULL) fclose(json);
+    return failed > 0 ? 1 : 0;
+}
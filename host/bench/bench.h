@@ -0,0 +1,63 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "key_event.h"
+#include "history.h"
+
+/*
+ * parse_adc(), cpt112s_parse_event(), the config loaders, the history
+ * writer, the tlog ring lock, the telemetry send period and the web
+ * server's client handling are
+ * static, these wrappers build their source file into the bench so they can
+ * be called as they are.
+ */
+int32_t bench_parse_adc(uint8_t data[4]);
+bool bench_cpt112s_parse_event(uint8_t* event, int64_t time, key_event_t* keyEvent);
+
+/* cpt112s.c, on the host CPT112S stand-in */
+void bench_cpt112s_setup();
+// what the touch thread does on an INT wake, the batches it took, -1 if
+// events are left
+int bench_cpt112s_drain();
+// one event read as before the batching: a command link per read, an info line
+bool bench_cpt112s_read_unbatched(uint8_t* event);
+
+/* config.c, on the simulated flash */
+void bench_config_setup();
+void bench_config_load_legacy();
+bool bench_config_load_blob(bool fromJournal);
+
+/* history.c, on the simulated flash */
+void bench_history_setup();
+// the head scan of a boot
+void bench_history_reopen();
+// what history_task() does with a queued record
+void bench_history_write(history_record_t* record);
+int bench_history_valid_slots();
+
+/* tlog.c */
+void bench_tlog_setup();
+
+/* telemetry.c, to the udp receiver stand-in */
+void bench_telemetry_setup();
+// one send period of telemetry_task(), the station up
+void bench_telemetry_period();
+
+/* webserver.c, clients on simulated lan connections */
+void bench_ws_setup();
+// a client through the upgrade, its socket or -1 if refused
+int bench_ws_connect(const char* origin);
+// the same under another Host than black-fire.local
+int bench_ws_connect_to(const char* host, const char* origin);
+void bench_ws_close(int s);
+// one text frame in, the reply out, false if none came
+bool bench_ws_command(int s, const char* command, char* reply, size_t size);
+// a state push to every client, the bytes each got, -1 if one got none
+int bench_ws_push();
+// pings on a client that never reads, true once the server dropped it
+bool bench_ws_flood(int s);
+
+#endif  /*_BENCH_H_*/
@@ -0,0 +1,36 @@
+#include "config.c"
+#include "bench.h"
+
+// the same settings three ways: legacy keys, nvs blob and journal record
+void bench_config_setup()
+{
+    config_init();
+    nvs_set_u8(config_handle, KEY_KEY_SOUND, 1);
+    nvs_set_i32(config_handle, KEY_TARGET_TEMPERATURE, 85);
+    nvs_set_str(config_handle, KEY_WIFI_NAME, "kitchen");
+    nvs_set_str(config_handle, KEY_WIFI_PASS, "correct horse battery");
+    nvs_set_str(config_handle, KEY_DEVICE_NAME, "black fire");
+
+    config_lock();
+    system_settings.key_sound = 1;
+    system_settings.target_temperature = 85;
+    copy_str(system_settings.wifi_name, "kitchen", sizeof(system_settings.wifi_name));
+    copy_str(system_settings.wifi_pass, "correct horse battery", sizeof(system_settings.wifi_pass));
+    copy_str(system_settings.device_name, "black fire", sizeof(system_settings.device_name));
+    bool journal = journalReady;
+    journalReady = false;
+    config_save_blob();
+    journalReady = journal;
+    if (journalReady) config_save_blob();
+    config_unlock();
+}
+
+void bench_config_load_legacy()
+{
+    config_load_legacy();
+}
+
+bool bench_config_load_blob(bool fromJournal)
+{
+    return config_load_blob(fromJournal);
+}
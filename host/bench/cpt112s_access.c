@@ -0,0 +1,42 @@
+#include "cpt112s.c"
+#include "bench.h"
+#include "sim.h"
+
+bool bench_cpt112s_parse_event(uint8_t* event, int64_t time, key_event_t* keyEvent)
+{
+    return cpt112s_parse_event(event, time, keyEvent);
+}
+
+void bench_cpt112s_setup()
+{
+    sim_touch_init();
+    //INT read as in the thread, no isr: the drain runs right away
+    gpio_set_direction(PIN_NUM_INT, GPIO_MODE_INPUT);
+    slider_gesture_init(&slider);
+    i2c_master_init();
+    i2c_read_cmd_init();
+}
+
+int bench_cpt112s_drain()
+{
+    int batches = 0;
+    while (!gpio_get_level(PIN_NUM_INT) && read_batch()) batches++;
+    key_event_t keyEvent;
+    while (key_event_receive(&keyEvent)) {}
+    return gpio_get_level(PIN_NUM_INT) ? batches : -1;
+}
+
+// i2c_read() and the log line per event of cpt112s.c before the batching
+bool bench_cpt112s_read_unbatched(uint8_t* event)
+{
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, ( CPT112S_SLAVE_ADDR << 1 ) | READ_BIT, ACK_CHECK_EN);
+    i2c_master_read(cmd, event, EVENT_SIZE - 1, ACK_VAL);
+    i2c_master_read_byte(cmd, event + EVENT_SIZE - 1, NACK_VAL);
+    i2c_master_stop(cmd);
+    esp_err_t ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_RATE_MS);
+    i2c_cmd_link_delete(cmd);
+    ESP_LOGI(TAG, "%s: slider: =================> %d", __func__, EVENT_SLIDER_POSITION(event[1], event[2]));
+    return ret == ESP_OK;
+}
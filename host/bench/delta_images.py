@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+#
+# Images for the delta_apply bench case: an old firmware image and a new one
+# with the kind of changes a release makes (a rewritten function, code added
+# in three places so everything after moves, pointers relocated by the
+# shift), and the patch tools/mkdelta.py makes between them:
+#
+#   bench/delta_images.py ../tools/mkdelta.py build/delta
+#
+# Prints the patch size, the time mkdelta took and its peak memory.
+#
+import os
+import random
+import resource
+import struct
+import subprocess
+import sys
+import time
+
+IMAGE_SIZE = 896 * 1024     # an ota slot is 0xE0000
+
+
+def images():
+    rnd = random.Random(1)
+    old = bytearray(rnd.getrandbits(8) for _ in range(IMAGE_SIZE))
+    old[0] = 0xE9           # image magic
+    new = bytearray(old)
+    new[100000:102048] = bytes(rnd.getrandbits(8) for _ in range(2048))
+    for pos, size in ((600000, 1000), (50000, 200), (800000, 64)):
+        new[pos:pos] = bytes(rnd.getrandbits(8) for _ in range(size))
+    # one word in 64 after the first insertion points past it
+    for off in range(50200, len(new) - 4, 256):
+        value = struct.unpack_from('<I', new, off)[0]
+        struct.pack_into('<I', new, off, (value + 200) & 0xffffffff)
+    return bytes(old), bytes(new)
+
+
+def main():
+    mkdelta, out = sys.argv[1], sys.argv[2]
+    os.makedirs(out, exist_ok=True)
+    old, new = images()
+    paths = [os.path.join(out, name) for name in ('old.bin', 'new.bin', 'new.patch')]
+    open(paths[0], 'wb').write(old)
+    open(paths[1], 'wb').write(new)
+
+    start = time.monotonic()
+    subprocess.run([sys.executable, mkdelta] + paths, check=True, stdout=subprocess.DEVNULL)
+    elapsed = time.monotonic() - start
+    peak = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss    # kB on linux
+    size = os.path.getsize(paths[2])
+    print('mkdelta: %d byte patch for a %d byte image (%.1f%%), %.2f s, peak %.1f MB'
+          % (size, len(new), 100.0 * size / len(new), elapsed, peak / 1024.0))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,30 @@
+#include "history.c"
+#include "bench.h"
+
+// the ring as after a boot, without the task: appends are written in place
+void bench_history_setup()
+{
+    history_open();
+    if (historyLock == NULL) historyLock = xSemaphoreCreateMutexStatic(&historyLockBuffer);
+}
+
+void bench_history_reopen()
+{
+    history_open();
+}
+
+void bench_history_write(history_record_t* record)
+{
+    history_write(record);
+}
+
+// records with a valid crc anywhere in the partition
+int bench_history_valid_slots()
+{
+    history_record_t record;
+    int count = 0;
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        if (read_slot(slot, &record)) count++;
+    }
+    return count;
+}
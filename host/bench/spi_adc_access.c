@@ -0,0 +1,7 @@
+#include "spi_adc.c"
+#include "bench.h"
+
+int32_t bench_parse_adc(uint8_t data[4])
+{
+    return parse_adc(data);
+}
@@ -0,0 +1,21 @@
+#include "telemetry.c"
+#include "bench.h"
+
+static telemetry_link_t benchLink = { .fd = -1 };
+
+// telemetry_task() without the task and the wifi wait: an empty ring, the
+// endpoint looked up on the next period
+void bench_telemetry_setup()
+{
+    if (benchLink.fd >= 0) close(benchLink.fd);
+    memset(&benchLink, 0, sizeof(benchLink));
+    benchLink.fd = -1;
+    ringHead = ringCount = ringDropped = 0;
+    memset(&stats, 0, sizeof(stats));
+    endpointChanged = true;
+}
+
+void bench_telemetry_period()
+{
+    telemetry_publish(&benchLink);
+}
@@ -0,0 +1,9 @@
+#include "tlog.c"
+#include "bench.h"
+
+// the rings and their lock, without the tlog task: the bench drains them
+void bench_tlog_setup()
+{
+    memset(rings, 0, sizeof(rings));
+    drainLock = xSemaphoreCreateMutexStatic(&drainLockBuffer);
+}
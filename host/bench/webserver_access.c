@@ -0,0 +1,118 @@
+#include "webserver.c"
+#include "sim.h"
+#include "bench.h"
+
+static int listenFd = -1;
+
+void bench_ws_setup()
+{
+    key_event_init();
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(WEBSERVER_PORT);
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    bind(listenFd, (struct sockaddr*)&addr, sizeof(addr));
+    listen(listenFd, 2);
+}
+
+static web_client_t* client_of(int s)
+{
+    for (int i = 0; i < WEBSERVER_CLIENT_MAX; i++) {
+        if (clients[i].state != CLIENT_FREE && clients[i].fd == s) return &clients[i];
+    }
+    return NULL;
+}
+
+// what webserver_task() does when select finds the socket readable
+static void receive(int s)
+{
+    web_client_t* client = client_of(s);
+    if (client != NULL) client_receive(client);
+}
+
+int bench_ws_connect(const char* origin)
+{
+    return bench_ws_connect_to("black-fire.local", origin);
+}
+
+int bench_ws_connect_to(const char* host, const char* origin)
+{
+    char request[256];
+    int len = snprintf(request, sizeof(request),
+            "GET /ws HTTP/1.1\r\nHost: %s\r\n%s%s%s"
+            "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+            host, origin != NULL ? "Origin: " : "", origin != NULL ? origin : "", origin != NULL ? "\r\n" : "");
+    int s = sim_net_connect(WEBSERVER_PORT);
+    if (s < 0) return -1;
+    client_accept(listenFd);
+    sim_net_peer_send(s, request, len);
+    receive(s);
+
+    char reply[160];
+    len = sim_net_peer_receive(s, reply, sizeof(reply)-1);
+    reply[len] = 0;
+    if (strncmp(reply, "HTTP/1.1 101", 12) != 0) {
+        bench_ws_close(s);
+        return -1;
+    }
+    return s;
+}
+
+void bench_ws_close(int s)
+{
+    sim_net_peer_close(s);
+    receive(s);
+}
+
+bool bench_ws_command(int s, const char* command, char* reply, size_t size)
+{
+    static const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    uint8_t frame[2+4+WS_PAYLOAD_MAX];
+    size_t len = strlen(command);
+    frame[0] = WS_FIN | WS_TEXT;
+    frame[1] = WS_MASK | len;
+    memcpy(frame+2, mask, 4);
+    for (size_t i = 0; i < len; i++) {
+        frame[6+i] = command[i] ^ mask[i&3];
+    }
+    sim_net_peer_send(s, frame, 6+len);
+    receive(s);
+    //the io loop would take the posted keys
+    key_event_t keyEvent;
+    while (key_event_receive(&keyEvent)) {}
+
+    uint8_t out[2+WS_PAYLOAD_MAX];
+    size_t outLen = sim_net_peer_receive(s, out, sizeof(out));
+    if (outLen < 2 || outLen != 2+out[1] || out[1] >= size) return false;
+    memcpy(reply, out+2, out[1]);
+    reply[out[1]] = 0;
+    return true;
+}
+
+bool bench_ws_flood(int s)
+{
+    //empty pings, every one answered with a pong nobody reads
+    static const uint8_t ping[] = { WS_FIN | WS_PING, WS_MASK, 0x37, 0xfa, 0x21, 0x3d };
+    for (int i = 0; i < 1000 && client_of(s) != NULL; i++) {
+        sim_net_peer_send(s, ping, sizeof(ping));
+        receive(s);
+    }
+    return client_of(s) == NULL;
+}
+
+int bench_ws_push()
+{
+    push_state();
+    //every client takes its frame, none must have been dropped
+    int bytes = -1;
+    for (int i = 0; i < WEBSERVER_CLIENT_MAX; i++) {
+        if (clients[i].state != CLIENT_WS) continue;
+        uint8_t frame[2+WS_PAYLOAD_MAX];
+        int len = sim_net_peer_receive(clients[i].fd, frame, sizeof(frame));
+        if (len == 0 || (bytes >= 0 && len != bytes)) return -1;
+        bytes = len;
+    }
+    return bytes;
+}
@@ -0,0 +1,85 @@
+#ifndef _HOST_DRIVER_SPI_MASTER_H_
+#define _HOST_DRIVER_SPI_MASTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+typedef enum {
+    SPI_HOST = 0,
+    HSPI_HOST = 1,
+    VSPI_HOST = 2
+} spi_host_device_t;
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_bus_config_t;
+
+#define SPI_DEVICE_TXBIT_LSBFIRST       (1<<0)
+#define SPI_DEVICE_RXBIT_LSBFIRST       (1<<1)
+#define SPI_DEVICE_BIT_LSBFIRST         (SPI_DEVICE_TXBIT_LSBFIRST|SPI_DEVICE_RXBIT_LSBFIRST)
+#define SPI_DEVICE_3WIRE                (1<<2)
+#define SPI_DEVICE_POSITIVE_CS          (1<<3)
+#define SPI_DEVICE_HALFDUPLEX           (1<<4)
+#define SPI_DEVICE_CLK_AS_CS            (1<<5)
+
+typedef struct spi_transaction_t spi_transaction_t;
+typedef void (*transaction_cb_t)(spi_transaction_t* trans);
+
+typedef struct {
+    uint8_t command_bits;
+    uint8_t address_bits;
+    uint8_t dummy_bits;
+    uint8_t mode;
+    uint8_t duty_cycle_pos;
+    uint8_t cs_ena_pretrans;
+    uint8_t cs_ena_posttrans;
+    int clock_speed_hz;
+    int spics_io_num;
+    uint32_t flags;
+    int queue_size;
+    transaction_cb_t pre_cb;
+    transaction_cb_t post_cb;
+} spi_device_interface_config_t;
+
+#define SPI_TRANS_MODE_DIO              (1<<0)
+#define SPI_TRANS_MODE_QIO              (1<<1)
+#define SPI_TRANS_USE_RXDATA            (1<<2)
+#define SPI_TRANS_USE_TXDATA            (1<<3)
+
+struct spi_transaction_t {
+    uint32_t flags;
+    uint16_t command;
+    uint64_t address;
+    size_t length;                  //bits
+    size_t rxlength;                //bits, 0: same as length
+    void* user;
+    union {
+        const void* tx_buffer;
+        uint8_t tx_data[4];
+    };
+    union {
+        void* rx_buffer;
+        uint8_t rx_data[4];
+    };
+};
+
+typedef struct spi_device_t* spi_device_handle_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t* bus_config, int dma_chan);
+esp_err_t spi_bus_free(spi_host_device_t host);
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t* dev_config, spi_device_handle_t* handle);
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle);
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t* trans_desc, TickType_t ticks_to_wait);
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t** trans_desc, TickType_t ticks_to_wait);
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t* trans_desc);
+
+#endif  /*_HOST_DRIVER_SPI_MASTER_H_*/
@@ -0,0 +1,29 @@
+#ifndef _HOST_ESP_EVENT_LOOP_H_
+#define _HOST_ESP_EVENT_LOOP_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    SYSTEM_EVENT_WIFI_READY = 0,
+    SYSTEM_EVENT_SCAN_DONE,
+    SYSTEM_EVENT_STA_START,
+    SYSTEM_EVENT_STA_STOP,
+    SYSTEM_EVENT_STA_CONNECTED,
+    SYSTEM_EVENT_STA_DISCONNECTED,
+    SYSTEM_EVENT_STA_AUTHMODE_CHANGE,
+    SYSTEM_EVENT_STA_GOT_IP,
+    SYSTEM_EVENT_STA_LOST_IP,
+    SYSTEM_EVENT_MAX
+} system_event_id_t;
+
+typedef struct {
+    system_event_id_t event_id;
+} system_event_t;
+
+typedef esp_err_t (*system_event_cb_t)(void* ctx, system_event_t* event);
+
+/* No event task: sim/net.c calls the handler from the task raising the event */
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void* ctx);
+
+#endif  /*_HOST_ESP_EVENT_LOOP_H_*/
@@ -0,0 +1,17 @@
+#ifndef _HOST_ESP_FREERTOS_HOOKS_H_
+#define _HOST_ESP_FREERTOS_HOOKS_H_
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+typedef bool (*esp_freertos_idle_cb_t)();
+typedef void (*esp_freertos_tick_cb_t)();
+
+/* Idle hooks run whenever no task is ready, tick hooks once per tick the simulated clock crossed */
+esp_err_t esp_register_freertos_idle_hook_for_cpu(esp_freertos_idle_cb_t new_idle_cb, UBaseType_t cpuid);
+esp_err_t esp_register_freertos_tick_hook_for_cpu(esp_freertos_tick_cb_t new_tick_cb, UBaseType_t cpuid);
+esp_err_t esp_register_freertos_idle_hook(esp_freertos_idle_cb_t new_idle_cb);
+esp_err_t esp_register_freertos_tick_hook(esp_freertos_tick_cb_t new_tick_cb);
+
+#endif  /*_HOST_ESP_FREERTOS_HOOKS_H_*/
@@ -0,0 +1,9 @@
+#ifndef _HOST_ESP_SLEEP_H_
+#define _HOST_ESP_SLEEP_H_
+
+#include "esp_err.h"
+
+// pins enabled by gpio_wakeup_enable() end a light sleep
+esp_err_t esp_sleep_enable_gpio_wakeup();
+
+#endif  /*_HOST_ESP_SLEEP_H_*/
@@ -0,0 +1,12 @@
+#ifndef _HOST_ESP_SPI_FLASH_H_
+#define _HOST_ESP_SPI_FLASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define SPI_FLASH_SEC_SIZE      4096
+
+size_t spi_flash_get_chip_size();
+
+#endif  /*_HOST_ESP_SPI_FLASH_H_*/
@@ -0,0 +1,18 @@
+#ifndef _HOST_ESP_SYSTEM_H_
+#define _HOST_ESP_SYSTEM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include "soc/soc.h"
+
+// ends the simulation, the report is printed like at the end of a scenario
+void esp_restart(void) __attribute__ ((noreturn));
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+uint32_t esp_random(void);
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac);
+
+#endif  /*_HOST_ESP_SYSTEM_H_*/
@@ -0,0 +1,66 @@
+#ifndef _HOST_FREERTOS_H_
+#define _HOST_FREERTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+/*
+ * FreeRTOS API on top of the simulator kernel (host/sim/rtos.c). One
+ * simulated task runs at a time, like a single core, and is only switched
+ * out when it blocks, yields or wakes a higher priority task.
+ */
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define configTICK_RATE_HZ              CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES            25
+#define configMINIMAL_STACK_SIZE        768
+#define configMAX_TASK_NAME_LEN         16
+#define configASSERT(x)                 assert(x)
+
+#define portMAX_DELAY                   ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS              ((TickType_t)1000/configTICK_RATE_HZ)
+#define portTICK_RATE_MS                portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)               ((TickType_t)((uint64_t)(ms)*configTICK_RATE_HZ/1000))
+
+#define pdFALSE                         ((BaseType_t)0)
+#define pdTRUE                          ((BaseType_t)1)
+#define pdPASS                          pdTRUE
+#define pdFAIL                          pdFALSE
+#define errQUEUE_EMPTY                  ((BaseType_t)0)
+#define errQUEUE_FULL                   ((BaseType_t)0)
+
+// the simulated board has a single core
+#define portNUM_PROCESSORS              1
+
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0, 0 }
+
+/* No other task can run inside a critical section anyway, keep the compiler from reordering */
+#define portENTER_CRITICAL(mux)         do { (void)(mux); __asm__ __volatile__("" ::: "memory"); } while (0)
+#define portEXIT_CRITICAL(mux)          do { (void)(mux); __asm__ __volatile__("" ::: "memory"); } while (0)
+#define portENTER_CRITICAL_ISR(mux)     portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)      portEXIT_CRITICAL(mux)
+#define portSET_INTERRUPT_MASK_FROM_ISR()       ((UBaseType_t)0)
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(mask) ((void)(mask))
+
+void vPortYield(void);
+void vPortYieldFromISR(void);
+#define portYIELD()                     vPortYield()
+#define portYIELD_FROM_ISR()            vPortYieldFromISR()
+
+BaseType_t xPortGetCoreID(void);
+// cpu cycles at CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ, simulated clock
+uint32_t xthal_get_ccount(void);
+
+#endif  /*_HOST_FREERTOS_H_*/
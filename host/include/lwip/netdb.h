@@ -0,0 +1,13 @@
+#ifndef _HOST_LWIP_NETDB_H_
+#define _HOST_LWIP_NETDB_H_
+
+#include <netdb.h>
+#include "lwip/sockets.h"
+
+int lwip_getaddrinfo(const char* nodename, const char* servname, const struct addrinfo* hints, struct addrinfo** res);
+void lwip_freeaddrinfo(struct addrinfo* ai);
+
+#define getaddrinfo(nodename, servname, hints, res)     lwip_getaddrinfo(nodename, servname, hints, res)
+#define freeaddrinfo(ai)                                lwip_freeaddrinfo(ai)
+
+#endif  /*_HOST_LWIP_NETDB_H_*/
@@ -0,0 +1,42 @@
+#ifndef _HOST_LWIP_SOCKETS_H_
+#define _HOST_LWIP_SOCKETS_H_
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * lwip sockets on the host types and constants, the calls go to the
+ * simulated stack in sim/net.c like LWIP_COMPAT_SOCKETS maps them on the
+ * device. Descriptors are the simulator's own, never host file descriptors.
+ */
+int lwip_socket(int domain, int type, int protocol);
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen);
+int lwip_listen(int s, int backlog);
+int lwip_accept(int s, struct sockaddr* addr, socklen_t* addrlen);
+int lwip_connect(int s, const struct sockaddr* name, socklen_t namelen);
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen);
+ssize_t lwip_send(int s, const void* data, size_t size, int flags);
+ssize_t lwip_sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen);
+ssize_t lwip_recv(int s, void* mem, size_t len, int flags);
+int lwip_select(int maxfdp1, fd_set* readset, fd_set* writeset, fd_set* exceptset, struct timeval* timeout);
+int lwip_close(int s);
+
+#define socket(domain, type, protocol)                  lwip_socket(domain, type, protocol)
+#define bind(s, name, namelen)                          lwip_bind(s, name, namelen)
+#define listen(s, backlog)                              lwip_listen(s, backlog)
+#define accept(s, addr, addrlen)                        lwip_accept(s, addr, addrlen)
+#define connect(s, name, namelen)                       lwip_connect(s, name, namelen)
+#define setsockopt(s, level, optname, optval, optlen)   lwip_setsockopt(s, level, optname, optval, optlen)
+#define send(s, data, size, flags)                      lwip_send(s, data, size, flags)
+#define sendto(s, data, size, flags, to, tolen)         lwip_sendto(s, data, size, flags, to, tolen)
+#define recv(s, mem, len, flags)                        lwip_recv(s, mem, len, flags)
+#define select(maxfdp1, readset, writeset, exceptset, timeout)  lwip_select(maxfdp1, readset, writeset, exceptset, timeout)
+#define close(s)                                        lwip_close(s)
+
+#endif  /*_HOST_LWIP_SOCKETS_H_*/
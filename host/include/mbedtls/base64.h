@@ -0,0 +1,10 @@
+#ifndef _HOST_MBEDTLS_BASE64_H_
+#define _HOST_MBEDTLS_BASE64_H_
+
+#include <stddef.h>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL     -0x002A
+
+int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen);
+
+#endif  /*_HOST_MBEDTLS_BASE64_H_*/
@@ -0,0 +1,9 @@
+#ifndef _HOST_MBEDTLS_SHA1_H_
+#define _HOST_MBEDTLS_SHA1_H_
+
+#include <stddef.h>
+
+// one shot, the only form the firmware uses (sim/mbedtls.c)
+void mbedtls_sha1(const unsigned char* input, size_t ilen, unsigned char output[20]);
+
+#endif  /*_HOST_MBEDTLS_SHA1_H_*/
@@ -0,0 +1,9 @@
+#ifndef _HOST_ROM_CRC_H_
+#define _HOST_ROM_CRC_H_
+
+#include <stdint.h>
+
+// same result as the ESP32 ROM: standard CRC-32, crc is the previous result
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif  /*_HOST_ROM_CRC_H_*/
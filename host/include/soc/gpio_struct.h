@@ -0,0 +1,7 @@
+#ifndef _HOST_SOC_GPIO_STRUCT_H_
+#define _HOST_SOC_GPIO_STRUCT_H_
+
+/* No register access on the host, the driver API in driver/gpio.h is all there is */
+#include "soc/io_mux_reg.h"
+
+#endif  /*_HOST_SOC_GPIO_STRUCT_H_*/
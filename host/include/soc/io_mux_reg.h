@@ -0,0 +1,14 @@
+#ifndef _HOST_SOC_IO_MUX_REG_H_
+#define _HOST_SOC_IO_MUX_REG_H_
+
+#include <stdint.h>
+
+/* The simulated io mux register of a pin is the pin number itself */
+#define PIN_FUNC_GPIO                   2
+#define FUNC_GPIO23_VSPID               1
+#define FUNC_GPIO23_GPIO23              2
+
+void sim_gpio_pin_func(uint32_t reg, uint32_t func);
+#define PIN_FUNC_SELECT(reg, func)      sim_gpio_pin_func(reg, func)
+
+#endif  /*_HOST_SOC_IO_MUX_REG_H_*/
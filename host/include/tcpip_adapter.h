@@ -0,0 +1,33 @@
+#ifndef _HOST_TCPIP_ADAPTER_H_
+#define _HOST_TCPIP_ADAPTER_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/* addresses in network order, as lwip keeps them */
+typedef struct {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct {
+    ip4_addr_t ip;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+} tcpip_adapter_ip_info_t;
+
+typedef enum {
+    TCPIP_ADAPTER_IF_STA = 0,
+    TCPIP_ADAPTER_IF_AP,
+    TCPIP_ADAPTER_IF_ETH,
+    TCPIP_ADAPTER_IF_MAX
+} tcpip_adapter_if_t;
+
+#define IPSTR                   "%d.%d.%d.%d"
+#define IP2STR(ipaddr)          ((const uint8_t*)&(ipaddr)->addr)[0], ((const uint8_t*)&(ipaddr)->addr)[1], \
+                                ((const uint8_t*)&(ipaddr)->addr)[2], ((const uint8_t*)&(ipaddr)->addr)[3]
+
+void tcpip_adapter_init(void);
+// 0.0.0.0 on an interface without an address
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t* ip_info);
+
+#endif  /*_HOST_TCPIP_ADAPTER_H_*/
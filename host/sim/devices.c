@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "sim.h"
+
+#define TAG                     "SIM"
+
+/* Board wiring, same numbers as the drivers in main/ */
+#define PIN_HEAT                16
+#define PIN_SPEAKER             21
+#define PIN_ADC_DATA            23
+#define PIN_TOUCH_INT           2
+#define PIN_KEY_LEFT            32
+#define TOUCH_ADDRESS           0x70
+
+#define WATER_HEAT_CAPACITY     4186.0      //J/(kg*K)
+#define BOILING                 100.0
+#define MODEL_STEP              0.1         //s, integration step
+
+#define TEMPERATURE_TABLE_SIZE  166         //temperature.c, entry i is the adc value at i-39 degree
+#define ADC_CONFIG_COMMAND      0xCA
+#define ADC_SPEED(config)       (((config)>>4)&0x3)
+#define ADC_CLOCK_PPM           3000        //own oscillator, data ready drifts against the esp32 tick
+
+#define TOUCH_FIFO_SIZE         16
+#define TOUCH_EVENT_TOUCH       0x00
+#define TOUCH_EVENT_RELEASE     0x01
+#define TOUCH_EVENT_SLIDER      0x02
+#define TOUCH_PAD               1           //cap sensor of the right pad
+
+#define KEY_BOUNCES             3
+#define KEY_BOUNCE_US           400
+
+#define DISPLAY_DIGITS          4
+#define DISPLAY_RAM             16
+#define DISPLAY_ADDRESS_0       0xC0
+#define DISPLAY_ON              0x8F
+#define DISPLAY_OFF             0x80
+#define FIRST_READING_TOLERANCE 1.5         //degree, display rounding plus noise
+
+extern const int32_t temperature_table[];
+
+static sim_kettle_t kettle;
+static double sensor;                       //degree at the probe
+static int64_t modelTime = 0;               //us, kettle state is valid up to here
+static bool heating = false;
+static double heatOnTime = 0;               //s
+static double energy = 0;                   //J
+
+static const int adcPeriods[] = { 100000, 25000, 1563, 781 };    //us, 10/40/640/1280 Hz
+static uint8_t adcConfig = 0;
+static int32_t adcLatched = 0;
+static uint32_t adcConversions = 0;
+static uint32_t adcReads = 0;
+static bool adcReady = false;
+
+static uint8_t touchFifo[TOUCH_FIFO_SIZE][3];
+static int touchHead = 0;
+static int touchCount = 0;
+static uint8_t touchCounter = 0;
+static uint32_t touchEvents = 0;
+static uint32_t touchOverflows = 0;
+
+static uint8_t displayRam[DISPLAY_RAM];
+static bool displayOn = false;
+static char displayText[DISPLAY_DIGITS+1] = "    ";
+static uint32_t displayFrames = 0;
+static uint32_t displayChanges = 0;
+static int64_t firstReading = -1;           //us, first number on the display matching the probe
+
+static uint32_t beeps = 0;
+
+static void kettle_step(int64_t now)
+{
+    while (modelTime < now) {
+        int64_t stepUs = now-modelTime;
+        if (stepUs > MODEL_STEP*1000000) stepUs = MODEL_STEP*1000000;
+        double dt = stepUs/1000000.0;
+        double power = heating ? kettle.power : 0;
+        double loss = kettle.loss*(kettle.water-kettle.ambient);
+        kettle.water += (power-loss)*dt/(kettle.mass*WATER_HEAT_CAPACITY);
+        if (kettle.water > BOILING) kettle.water = BOILING;      //the rest goes into steam
+        sensor += (kettle.water-sensor)*dt/(kettle.sensor_lag > dt ? kettle.sensor_lag : dt);
+        if (heating) {
+            heatOnTime += dt;
+            energy += power*dt;
+        }
+        modelTime += stepUs;
+    }
+}
+
+static double gaussian()
+{
+    double u1 = (esp_random()+1.0)/4294967297.0;
+    double u2 = (esp_random()+1.0)/4294967297.0;
+    return sqrt(-2*log(u1))*cos(2*M_PI*u2);
+}
+
+// inverse of convert_temp_x10()
+static int32_t adc_code(double temp)
+{
+    double position = temp+39;
+    int index = (int)floor(position);
+    if (index < 0) index = 0;
+    if (index > TEMPERATURE_TABLE_SIZE-2) index = TEMPERATURE_TABLE_SIZE-2;
+    double frac = position-index;
+    int32_t lo = temperature_table[index];
+    int32_t hi = temperature_table[index+1];
+    return (int32_t)(lo+frac*(hi-lo)+gaussian()*kettle.noise);
+}
+
+/*
+ * CS1237: DOUT falls when a conversion is ready, 24 bits two's complement
+ * are clocked out MSB first followed by status bits, then DOUT goes high.
+ */
+static void adc_task(void* arg)
+{
+    while (1) {
+        int period = adcPeriods[ADC_SPEED(adcConfig)];
+        sim_sleep(period+(int64_t)period*ADC_CLOCK_PPM/1000000);
+        kettle_step(sim_now());
+        adcLatched = adc_code(sensor);
+        adcConversions++;
+        if (adcReady) {
+            //not read in time, DOUT pulses high for the new conversion
+            sim_gpio_drive(PIN_ADC_DATA, 1);
+        }
+        adcReady = true;
+        sim_gpio_drive(PIN_ADC_DATA, 0);
+    }
+}
+
+static void adc_spi(const spi_device_interface_config_t* config, const uint8_t* tx, size_t txBits, uint8_t* rx, size_t rxBits)
+{
+    if (rx != NULL && rxBits >= 24) {
+        int32_t code = adcLatched;
+        rx[0] = (code >> 16) & 0xff;
+        rx[1] = (code >> 8) & 0xff;
+        rx[2] = code & 0xff;
+        adcReads++;
+        adcReady = false;
+        sim_gpio_drive(PIN_ADC_DATA, 1);
+    }
+    if (tx != NULL && txBits >= 16 && tx[0] == ADC_CONFIG_COMMAND) {
+        adcConfig = tx[1];
+        ESP_LOGD(TAG, "adc config 0x%02x, %d us per conversion", adcConfig, adcPeriods[ADC_SPEED(adcConfig)]);
+    }
+}
+
+/* CPT112S: events queue up while INT is low, one 3 byte event per read */
+static void touch_push(uint8_t type, uint8_t b1, uint8_t b2)
+{
+    if (touchCount >= TOUCH_FIFO_SIZE) {
+        touchOverflows++;
+        return;
+    }
+    uint8_t* event = touchFifo[(touchHead+touchCount)%TOUCH_FIFO_SIZE];
+    touchCounter = (touchCounter+1)&0x0f;
+    event[0] = touchCounter<<4 | type;
+    event[1] = b1;
+    event[2] = b2;
+    touchCount++;
+    touchEvents++;
+    if (touchCount == 1) {
+        sim_gpio_drive(PIN_TOUCH_INT, 0);
+    }
+}
+
+static bool touch_read(uint8_t* data, size_t len)
+{
+    if (touchCount == 0) return false;
+    memset(data, 0, len);
+    memcpy(data, touchFifo[touchHead], len < 3 ? len : 3);
+    touchHead = (touchHead+1)%TOUCH_FIFO_SIZE;
+    touchCount--;
+    if (touchCount == 0) {
+        sim_gpio_drive(PIN_TOUCH_INT, 1);
+    }
+    return true;
+}
+
+static const sim_i2c_slave_t touchSlave = {
+    .read = touch_read,
+    .write = NULL,
+};
+
+static char segment_char(uint8_t segments)
+{
+    static const struct {
+        uint8_t segments;
+        char c;
+    } font[] = {
+        { 0x3F, '0' }, { 0x06, '1' }, { 0x5B, '2' }, { 0x4F, '3' }, { 0x66, '4' },
+        { 0x6D, '5' }, { 0x7D, '6' }, { 0x07, '7' }, { 0x7F, '8' }, { 0x6F, '9' },
+        { 0x00, ' ' }, { 0x40, '-' }, { 0x39, 'C' }, { 0x79, 'E' }, { 0x71, 'F' },
+    };
+    segments &= 0x7f;           //decimal point
+    for (int i = 0; i < sizeof(font)/sizeof(font[0]); i++) {
+        if (font[i].segments == segments) return font[i].c;
+    }
+    return '?';
+}
+
+/* Display driver: address auto increment command, address + data, display control */
+static void display_spi(const spi_device_interface_config_t* config, const uint8_t* tx, size_t txBits, uint8_t* rx, size_t rxBits)
+{
+    if (tx == NULL || txBits < 8) return;
+    size_t len = txBits/8;
+    if (tx[0] >= DISPLAY_ADDRESS_0 && tx[0] < DISPLAY_ADDRESS_0+DISPLAY_RAM && len > 1) {
+        size_t address = tx[0]-DISPLAY_ADDRESS_0;
+        for (size_t i = 1; i < len && address < DISPLAY_RAM; i++) {
+            displayRam[address++] = tx[i];
+        }
+        return;
+    }
+    if (tx[0] == DISPLAY_ON || tx[0] == DISPLAY_OFF) {
+        displayOn = tx[0] == DISPLAY_ON;
+        displayFrames++;
+        //the digits sit at address 8, icons behind them
+        char text[DISPLAY_DIGITS+1];
+        for (int i = 0; i < DISPLAY_DIGITS; i++) {
+            text[i] = displayOn ? segment_char(displayRam[8+i]) : ' ';
+        }
+        text[DISPLAY_DIGITS] = 0;
+        if (strcmp(text, displayText) != 0) {
+            strcpy(displayText, text);
+            displayChanges++;
+            int shown;
+            if (firstReading < 0 && sim_display_value(&shown)) {
+                kettle_step(sim_now());
+                if (fabs(shown-sensor) <= FIRST_READING_TOLERANCE) firstReading = sim_now();
+            }
+            uint8_t icons1 = displayRam[8+DISPLAY_DIGITS];
+            uint8_t icons2 = displayRam[8+DISPLAY_DIGITS+1];
+            ESP_LOGI(TAG, "display [%s]%s%s%s%s  water %.1f", displayText,
+                     icons1 & 0x01 ? " heat" : "", icons1 & 0x02 ? " hold" : "",
+                     icons2 & 0x01 ? " set" : "", icons2 & 0x02 ? " wifi" : "", kettle.water);
+        }
+    }
+}
+
+static void output_changed(gpio_num_t pin, int level)
+{
+    if (pin == PIN_HEAT) {
+        kettle_step(sim_now());
+        heating = level;
+        ESP_LOGD(TAG, "heater %s at %.1f", level ? "on" : "off", kettle.water);
+    } else if (pin == PIN_SPEAKER && level) {
+        beeps++;
+    }
+}
+
+void sim_touch_init()
+{
+    sim_gpio_drive(PIN_TOUCH_INT, 1);
+    sim_i2c_attach(I2C_NUM_0, TOUCH_ADDRESS, &touchSlave);
+}
+
+void sim_devices_init(const sim_kettle_t* config)
+{
+    kettle = *config;
+    sensor = kettle.water;
+
+    //idle levels before the firmware configures the pins
+    sim_gpio_drive(PIN_ADC_DATA, 1);
+    sim_gpio_drive(PIN_KEY_LEFT, 0);
+    sim_gpio_set_listener(output_changed);
+
+    sim_spi_attach(VSPI_HOST, adc_spi);
+    sim_spi_attach(HSPI_HOST, display_spi);
+    sim_touch_init();
+    xTaskCreate(&adc_task, "sim_cs1237", 4096, NULL, SIM_TASK_PRIORITY, NULL);
+}
+
+void sim_kettle_set_water(double water)
+{
+    kettle_step(sim_now());
+    kettle.water = water;
+    sensor = water;
+}
+
+void sim_kettle_set_ambient(double ambient)
+{
+    kettle_step(sim_now());
+    kettle.ambient = ambient;
+}
+
+void sim_kettle_set_noise(double noise)
+{
+    kettle.noise = noise;
+}
+
+double sim_kettle_water()
+{
+    kettle_step(sim_now());
+    return kettle.water;
+}
+
+bool sim_heater_on()
+{
+    return heating;
+}
+
+void sim_touch(bool down)
+{
+    touch_push(down ? TOUCH_EVENT_TOUCH : TOUCH_EVENT_RELEASE, TOUCH_PAD, 0);
+}
+
+void sim_slider(int pos)
+{
+    touch_push(TOUCH_EVENT_SLIDER, (pos >> 8) & 0xff, pos & 0xff);
+}
+
+void sim_key(bool down, int bounces, int bounceUs)
+{
+    int level = down ? 1 : 0;
+    if (bounces < 0) bounces = KEY_BOUNCES;
+    if (bounceUs <= 0) bounceUs = KEY_BOUNCE_US;
+    for (int i = 0; i < bounces; i++) {
+        sim_gpio_drive(PIN_KEY_LEFT, level);
+        sim_sleep(bounceUs);
+        sim_gpio_drive(PIN_KEY_LEFT, !level);
+        sim_sleep(bounceUs);
+    }
+    sim_gpio_drive(PIN_KEY_LEFT, level);
+}
+
+bool sim_display_value(int* value)
+{
+    int v = 0;
+    bool negative = false;
+    bool digits = false;
+    for (int i = 0; i < DISPLAY_DIGITS; i++) {
+        char c = displayText[i];
+        if (c >= '0' && c <= '9') {
+            v = v*10+(c-'0');
+            digits = true;
+        } else if (c == '-' && !digits) {
+            negative = true;
+        } else if (c != ' ' || digits) {
+            return false;
+        }
+    }
+    if (!digits) return false;
+    *value = negative ? -v : v;
+    return true;
+}
+
+int64_t sim_display_first_reading()
+{
+    return firstReading;
+}
+
+uint32_t sim_display_changes()
+{
+    return displayChanges;
+}
+
+bool sim_display_hold()
+{
+    return displayOn && (displayRam[8+DISPLAY_DIGITS] & 0x02);
+}
+
+uint32_t sim_buzzer_beeps()
+{
+    return beeps;
+}
+
+void sim_devices_report()
+{
+    kettle_step(sim_now());
+    printf("kettle:  water %.1f C, probe %.1f C, heater %s, on %.0f s, %.1f kJ\n",
+           kettle.water, sensor, heating ? "on" : "off", heatOnTime, energy/1000);
+    printf("adc:     %u conversions, %u read\n", adcConversions, adcReads);
+    printf("touch:   %u events, %u lost\n", touchEvents, touchOverflows);
+    printf("display: [%s] %u frames, %u changes\n", displayText, displayFrames, displayChanges);
+    printf("buzzer:  %u beeps\n", beeps);
+    if (firstReading >= 0) {
+        printf("boot:    first reading on the display at %.1f ms\n", firstReading/1000.0);
+    } else {
+        printf("boot:    no reading on the display\n");
+    }
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sim.h"
+
+#define TIMER_TASK_PRIORITY     22          //ESP_TASK_TIMER_PRIO
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+    int64_t alarm;              //us, -1: not armed
+    uint64_t period;            //us, 0: one shot
+    struct esp_timer* next;
+};
+
+static struct esp_timer* timers = NULL;
+static TaskHandle_t timerTask = NULL;
+
+static struct esp_timer* next_alarm()
+{
+    struct esp_timer* first = NULL;
+    for (struct esp_timer* t = timers; t != NULL; t = t->next) {
+        if (t->alarm >= 0 && (first == NULL || t->alarm < first->alarm)) {
+            first = t;
+        }
+    }
+    return first;
+}
+
+/* Callbacks run one at a time from this task, like the esp_timer task on the device */
+static void timer_task(void* arg)
+{
+    while (1) {
+        struct esp_timer* t = next_alarm();
+        if (t == NULL || t->alarm > sim_now()) {
+            //woken early when a timer is started or stopped
+            sim_wait(&timers, t != NULL ? t->alarm : -1);
+            continue;
+        }
+        if (t->period > 0) {
+            t->alarm += t->period;
+        } else {
+            t->alarm = -1;
+        }
+        t->callback(t->arg);
+    }
+}
+
+esp_err_t esp_timer_init()
+{
+    if (timerTask != NULL) return ESP_ERR_INVALID_STATE;
+    xTaskCreate(&timer_task, "esp_timer", 4096, NULL, TIMER_TASK_PRIORITY, &timerTask);
+    return ESP_OK;
+}
+
+TaskHandle_t sim_timer_task()
+{
+    return timerTask;
+}
+
+esp_err_t esp_timer_deinit()
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL) return ESP_ERR_INVALID_ARG;
+    struct esp_timer* t = calloc(1, sizeof(struct esp_timer));
+    if (t == NULL) return ESP_ERR_NO_MEM;
+    t->callback = create_args->callback;
+    t->arg = create_args->arg;
+    t->name = create_args->name;
+    t->alarm = -1;
+    t->next = timers;
+    timers = t;
+    *out_handle = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->alarm >= 0) return ESP_ERR_INVALID_STATE;
+    timer->alarm = sim_now()+timeout_us;
+    timer->period = 0;
+    sim_wake(&timers);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    if (timer->alarm >= 0) return ESP_ERR_INVALID_STATE;
+    timer->alarm = sim_now()+period;
+    timer->period = period;
+    sim_wake(&timers);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer->alarm < 0) return ESP_ERR_INVALID_STATE;
+    timer->alarm = -1;
+    sim_wake(&timers);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == NULL) return ESP_ERR_INVALID_ARG;
+    if (timer->alarm >= 0) return ESP_ERR_INVALID_STATE;
+    for (struct esp_timer** link = &timers; *link != NULL; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+    free(timer);
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time()
+{
+    return sim_now();
+}
+
+int64_t esp_timer_get_next_alarm()
+{
+    struct esp_timer* t = next_alarm();
+    return t != NULL ? t->alarm : INT64_MAX;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "sim.h"
+
+typedef struct {
+    EventBits_t bits;
+} sim_event_group_t;
+
+static bool bits_match(EventBits_t value, EventBits_t bits, BaseType_t waitForAll)
+{
+    return waitForAll ? (value & bits) == bits : (value & bits) != 0;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return calloc(1, sizeof(sim_event_group_t));
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t handle, const EventBits_t bits)
+{
+    sim_event_group_t* group = handle;
+    group->bits |= bits;
+    EventBits_t value = group->bits;
+    //the waiters check their bits when they run
+    if (sim_wake(group)) sim_preempt();
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t handle, const EventBits_t bits)
+{
+    sim_event_group_t* group = handle;
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t handle)
+{
+    return ((sim_event_group_t*)handle)->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t handle, const EventBits_t bits, const BaseType_t clearOnExit,
+                                const BaseType_t waitForAll, TickType_t wait)
+{
+    sim_event_group_t* group = handle;
+    int64_t deadline = sim_tick_deadline(wait);
+    while (!bits_match(group->bits, bits, waitForAll)) {
+        if (wait == 0 || !sim_wait(group, deadline)) return group->bits;
+    }
+    EventBits_t value = group->bits;
+    if (clearOnExit) group->bits &= ~bits;
+    return value;
+}
@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "sim.h"
+
+#define PARTITION_MAX           16
+#define PAGE_SIZE               256
+#define WRITE_US_PER_PAGE       700         //typical page program time
+#define ERASE_US_PER_SECTOR     45000       //typical sector erase time
+
+#define NVS_ENTRY_MAX           64
+#define NVS_NAMESPACE_MAX       8
+#define NVS_NAME_MAX            15
+#define NVS_MAGIC               0x53564E53  //"SNVS"
+
+static uint8_t* flash = NULL;
+static size_t flashSize = 0;
+static esp_partition_t partitions[PARTITION_MAX];
+static int partitionCount = 0;
+static sim_flash_stats_t stats;
+//power cut: bytes still programmed and sectors still erased, -1: no cut armed
+static int64_t writeBudget = -1;
+static int64_t eraseBudget = -1;
+static bool powerOff = false;
+//partition writes left to fail, the flash untouched
+static int failWrites = 0;
+
+static const struct {
+    const char* name;
+    int value;
+} subtypeNames[] = {
+    { "factory", ESP_PARTITION_SUBTYPE_APP_FACTORY },
+    { "ota_0", ESP_PARTITION_SUBTYPE_APP_OTA_0 },
+    { "ota_1", ESP_PARTITION_SUBTYPE_APP_OTA_1 },
+    { "test", ESP_PARTITION_SUBTYPE_APP_TEST },
+    { "ota", ESP_PARTITION_SUBTYPE_DATA_OTA },
+    { "phy", ESP_PARTITION_SUBTYPE_DATA_PHY },
+    { "nvs", ESP_PARTITION_SUBTYPE_DATA_NVS },
+    { "coredump", ESP_PARTITION_SUBTYPE_DATA_COREDUMP },
+};
+
+static char* trim(char* s)
+{
+    while (*s == ' ' || *s == '\t') s++;
+    char* end = s+strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) end--;
+    *end = 0;
+    return s;
+}
+
+static int parse_subtype(const char* s)
+{
+    for (int i = 0; i < sizeof(subtypeNames)/sizeof(subtypeNames[0]); i++) {
+        if (strcasecmp(s, subtypeNames[i].name) == 0) return subtypeNames[i].value;
+    }
+    return (int)strtol(s, NULL, 0);
+}
+
+/* Same columns as the project partitions.csv, offsets must be given */
+void sim_flash_init(const char* partitionTable)
+{
+    flashSize = (size_t)atoi(CONFIG_ESPTOOLPY_FLASHSIZE)*1024*1024;
+    flash = malloc(flashSize);
+    assert(flash != NULL);
+    memset(flash, 0xFF, flashSize);
+
+    FILE* f = fopen(partitionTable, "r");
+    if (f == NULL) {
+        fprintf(stderr, "sim: no partition table %s\n", partitionTable);
+        exit(2);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL && partitionCount < PARTITION_MAX) {
+        char* s = trim(line);
+        if (*s == '#' || *s == 0) continue;
+        char* fields[5];
+        int count = 0;
+        for (char* field = strtok(s, ","); field != NULL && count < 5; field = strtok(NULL, ",")) {
+            fields[count++] = trim(field);
+        }
+        if (count < 5) continue;
+        esp_partition_t* p = &partitions[partitionCount++];
+        strncpy(p->label, fields[0], sizeof(p->label)-1);
+        p->type = strcasecmp(fields[1], "app") == 0 ? ESP_PARTITION_TYPE_APP
+                  : strcasecmp(fields[1], "data") == 0 ? ESP_PARTITION_TYPE_DATA : strtol(fields[1], NULL, 0);
+        p->subtype = parse_subtype(fields[2]);
+        p->address = strtoul(fields[3], NULL, 0);
+        p->size = strtoul(fields[4], NULL, 0);
+        if (p->address+p->size > flashSize) {
+            fprintf(stderr, "sim: partition %s does not fit the flash\n", p->label);
+            exit(2);
+        }
+    }
+    fclose(f);
+}
+
+bool sim_flash_load(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return false;
+    size_t len = fread(flash, 1, flashSize, f);
+    fclose(f);
+    return len == flashSize;
+}
+
+bool sim_flash_save(const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) return false;
+    size_t len = fwrite(flash, 1, flashSize, f);
+    fclose(f);
+    return len == flashSize;
+}
+
+size_t spi_flash_get_chip_size()
+{
+    return flashSize;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    for (int i = 0; i < partitionCount; i++) {
+        esp_partition_t* p = &partitions[i];
+        if (p->type != type) continue;
+        if (subtype != ESP_PARTITION_SUBTYPE_ANY && p->subtype != subtype) continue;
+        if (label != NULL && strcmp(p->label, label) != 0) continue;
+        return p;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if (partition == NULL || dst == NULL) return ESP_ERR_INVALID_ARG;
+    if (src_offset > partition->size || size > partition->size-src_offset) return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, flash+partition->address+src_offset, size);
+    stats.reads++;
+    return ESP_OK;
+}
+
+void sim_flash_power_cut(int64_t bytes, int64_t sectors)
+{
+    writeBudget = bytes;
+    eraseBudget = sectors;
+    powerOff = false;
+}
+
+void sim_flash_fail(int writes)
+{
+    failWrites = writes;
+}
+
+void sim_flash_power_on()
+{
+    writeBudget = eraseBudget = -1;
+    powerOff = false;
+}
+
+bool sim_flash_power_off()
+{
+    return powerOff;
+}
+
+/*
+ * NOR flash: a write only clears bits, an erase sets the whole sector.
+ * A power cut tears a write after the armed number of bytes, the byte
+ * under way gets only its low 4 bits programmed, and an erase between
+ * sectors (a sector erase itself is taken as atomic). Nothing reaches the
+ * flash after that until sim_flash_power_on().
+ */
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    if (partition == NULL || src == NULL) return ESP_ERR_INVALID_ARG;
+    if (dst_offset > partition->size || size > partition->size-dst_offset) return ESP_ERR_INVALID_SIZE;
+    if (powerOff) return ESP_FAIL;
+    if (failWrites > 0) {
+        failWrites--;
+        return ESP_FAIL;
+    }
+    uint8_t* dst = flash+partition->address+dst_offset;
+    const uint8_t* s = src;
+    size_t done = size;
+    if (writeBudget >= 0 && writeBudget < size) {
+        done = writeBudget;
+        powerOff = true;
+    }
+    for (size_t i = 0; i < done; i++) {
+        dst[i] &= s[i];
+    }
+    if (powerOff) {
+        dst[done] &= s[done] | 0xF0;
+        return ESP_FAIL;
+    }
+    if (writeBudget >= 0) writeBudget -= size;
+    stats.writes++;
+    sim_sleep((int64_t)(size+PAGE_SIZE-1)/PAGE_SIZE*WRITE_US_PER_PAGE);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, uint32_t start_addr, uint32_t size)
+{
+    if (partition == NULL) return ESP_ERR_INVALID_ARG;
+    if (start_addr > partition->size || size > partition->size-start_addr) return ESP_ERR_INVALID_SIZE;
+    if (start_addr%SPI_FLASH_SEC_SIZE != 0 || size%SPI_FLASH_SEC_SIZE != 0) return ESP_ERR_INVALID_SIZE;
+    if (powerOff) return ESP_FAIL;
+    if (eraseBudget >= 0 && eraseBudget < size/SPI_FLASH_SEC_SIZE) {
+        memset(flash+partition->address+start_addr, 0xFF, eraseBudget*SPI_FLASH_SEC_SIZE);
+        powerOff = true;
+        return ESP_FAIL;
+    }
+    if (eraseBudget >= 0) eraseBudget -= size/SPI_FLASH_SEC_SIZE;
+    memset(flash+partition->address+start_addr, 0xFF, size);
+    stats.erased_sectors += size/SPI_FLASH_SEC_SIZE;
+    sim_sleep((int64_t)size/SPI_FLASH_SEC_SIZE*ERASE_US_PER_SECTOR);
+    return ESP_OK;
+}
+
+/*
+ * NVS keeps its entries in memory and stores them as one plain record in
+ * the nvs partition after every change, so settings survive a saved flash
+ * image. Not the IDF page format, nothing outside the simulator reads it.
+ */
+enum {
+    NVS_TYPE_U8 = 0x01,
+    NVS_TYPE_I8 = 0x11,
+    NVS_TYPE_U16 = 0x02,
+    NVS_TYPE_I16 = 0x12,
+    NVS_TYPE_U32 = 0x04,
+    NVS_TYPE_I32 = 0x14,
+    NVS_TYPE_U64 = 0x08,
+    NVS_TYPE_I64 = 0x18,
+    NVS_TYPE_STR = 0x21,
+    NVS_TYPE_BLOB = 0x41,
+};
+
+typedef struct {
+    uint8_t ns;                 //namespace index
+    uint8_t type;
+    uint16_t len;
+    char key[NVS_NAME_MAX+1];
+    uint8_t* data;
+} nvs_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t ns;
+    uint8_t type;
+    uint16_t len;
+    char key[NVS_NAME_MAX+1];
+} nvs_record_t;
+
+static bool nvsReady = false;
+static const esp_partition_t* nvsPartition = NULL;
+static char namespaces[NVS_NAMESPACE_MAX][NVS_NAME_MAX+1];
+static int namespaceCount = 0;
+static nvs_entry_t entries[NVS_ENTRY_MAX];
+static int entryCount = 0;
+
+// handle: namespace index+1, bit 8 set when read only
+#define HANDLE_NS(handle)       ((int)((handle)&0xff)-1)
+#define HANDLE_READONLY         0x100
+
+static esp_err_t nvs_store()
+{
+    size_t size = 2*sizeof(uint32_t)+NVS_NAMESPACE_MAX*(NVS_NAME_MAX+1);
+    for (int i = 0; i < entryCount; i++) {
+        size += sizeof(nvs_record_t)+entries[i].len;
+    }
+    size = (size+SPI_FLASH_SEC_SIZE-1)/SPI_FLASH_SEC_SIZE*SPI_FLASH_SEC_SIZE;
+    if (size > nvsPartition->size) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+
+    uint8_t* image = malloc(size);
+    if (image == NULL) return ESP_ERR_NO_MEM;
+    memset(image, 0xFF, size);
+    uint8_t* p = image;
+    uint32_t header[2] = { NVS_MAGIC, entryCount };
+    memcpy(p, header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, namespaces, sizeof(namespaces));
+    p += sizeof(namespaces);
+    for (int i = 0; i < entryCount; i++) {
+        nvs_record_t record;
+        memset(&record, 0, sizeof(record));
+        record.ns = entries[i].ns;
+        record.type = entries[i].type;
+        record.len = entries[i].len;
+        strcpy(record.key, entries[i].key);
+        memcpy(p, &record, sizeof(record));
+        p += sizeof(record);
+        memcpy(p, entries[i].data, entries[i].len);
+        p += entries[i].len;
+    }
+    //the simulated nvs writes take no time, settings writes are not what the simulator measures
+    memset(flash+nvsPartition->address, 0xFF, nvsPartition->size);
+    memcpy(flash+nvsPartition->address, image, size);
+    free(image);
+    return ESP_OK;
+}
+
+static esp_err_t nvs_restore()
+{
+    const uint8_t* p = flash+nvsPartition->address;
+    const uint8_t* end = p+nvsPartition->size;
+    uint32_t header[2];
+    memcpy(header, p, sizeof(header));
+    p += sizeof(header);
+    if (header[0] == 0xFFFFFFFF) return ESP_OK;         //erased
+    if (header[0] != NVS_MAGIC || header[1] > NVS_ENTRY_MAX) return ESP_ERR_NVS_NO_FREE_PAGES;
+
+    memcpy(namespaces, p, sizeof(namespaces));
+    p += sizeof(namespaces);
+    for (namespaceCount = 0; namespaceCount < NVS_NAMESPACE_MAX && namespaces[namespaceCount][0] != (char)0xFF
+            && namespaces[namespaceCount][0] != 0; namespaceCount++);
+    for (uint32_t i = 0; i < header[1]; i++) {
+        nvs_record_t record;
+        if (p+sizeof(record) > end) return ESP_ERR_NVS_NO_FREE_PAGES;
+        memcpy(&record, p, sizeof(record));
+        p += sizeof(record);
+        if (p+record.len > end) return ESP_ERR_NVS_NO_FREE_PAGES;
+        nvs_entry_t* e = &entries[entryCount++];
+        e->ns = record.ns;
+        e->type = record.type;
+        e->len = record.len;
+        memcpy(e->key, record.key, sizeof(e->key));
+        e->key[NVS_NAME_MAX] = 0;
+        e->data = malloc(record.len ? record.len : 1);
+        memcpy(e->data, p, record.len);
+        p += record.len;
+    }
+    return ESP_OK;
+}
+
+static nvs_entry_t* nvs_find(int ns, const char* key)
+{
+    for (int i = 0; i < entryCount; i++) {
+        if (entries[i].ns == ns && strcmp(entries[i].key, key) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+static esp_err_t nvs_check(nvs_handle handle, const char* key, bool write)
+{
+    if (!nvsReady) return ESP_ERR_NVS_NOT_INITIALIZED;
+    int ns = HANDLE_NS(handle);
+    if (ns < 0 || ns >= namespaceCount) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (write && (handle & HANDLE_READONLY)) return ESP_ERR_NVS_READ_ONLY;
+    if (key != NULL && strlen(key) > NVS_NAME_MAX) return ESP_ERR_NVS_KEY_TOO_LONG;
+    return ESP_OK;
+}
+
+static esp_err_t nvs_set(nvs_handle handle, const char* key, uint8_t type, const void* value, size_t len)
+{
+    esp_err_t err = nvs_check(handle, key, true);
+    if (err != ESP_OK) return err;
+    if (len > 0xffff) return ESP_ERR_NVS_VALUE_TOO_LONG;
+    nvs_entry_t* e = nvs_find(HANDLE_NS(handle), key);
+    if (e == NULL) {
+        if (entryCount >= NVS_ENTRY_MAX) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        e = &entries[entryCount++];
+        e->ns = HANDLE_NS(handle);
+        strcpy(e->key, key);
+        e->data = NULL;
+    }
+    free(e->data);
+    e->type = type;
+    e->len = len;
+    e->data = malloc(len ? len : 1);
+    memcpy(e->data, value, len);
+    stats.nvs_writes++;
+    return nvs_store();
+}
+
+static esp_err_t nvs_get(nvs_handle handle, const char* key, uint8_t type, void* out, size_t* len, bool variable)
+{
+    esp_err_t err = nvs_check(handle, key, false);
+    if (err != ESP_OK) return err;
+    stats.nvs_reads++;
+    nvs_entry_t* e = nvs_find(HANDLE_NS(handle), key);
+    if (e == NULL || e->type != type) return ESP_ERR_NVS_NOT_FOUND;
+    if (variable) {
+        if (out == NULL) {
+            *len = e->len;
+            return ESP_OK;
+        }
+        if (*len < e->len) return ESP_ERR_NVS_INVALID_LENGTH;
+        *len = e->len;
+    }
+    memcpy(out, e->data, e->len);
+    return ESP_OK;
+}
+
+void sim_flash_get_stats(sim_flash_stats_t* out)
+{
+    *out = stats;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    nvsPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, NULL);
+    if (nvsPartition == NULL) return ESP_ERR_NOT_FOUND;
+    for (int i = 0; i < entryCount; i++) {
+        free(entries[i].data);
+    }
+    entryCount = 0;
+    namespaceCount = 0;
+    memset(namespaces, 0, sizeof(namespaces));
+    esp_err_t err = nvs_restore();
+    if (err != ESP_OK) {
+        entryCount = 0;
+        namespaceCount = 0;
+        memset(namespaces, 0, sizeof(namespaces));
+        return err;
+    }
+    nvsReady = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    nvsPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, NULL);
+    if (nvsPartition == NULL) return ESP_ERR_NOT_FOUND;
+    nvsReady = false;
+    return esp_partition_erase_range(nvsPartition, 0, nvsPartition->size);
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode open_mode, nvs_handle* out_handle)
+{
+    if (!nvsReady) return ESP_ERR_NVS_NOT_INITIALIZED;
+    if (strlen(name) > NVS_NAME_MAX) return ESP_ERR_NVS_KEY_TOO_LONG;
+    int ns;
+    for (ns = 0; ns < namespaceCount; ns++) {
+        if (strcmp(namespaces[ns], name) == 0) break;
+    }
+    if (ns == namespaceCount) {
+        if (open_mode == NVS_READONLY) return ESP_ERR_NVS_NOT_FOUND;
+        if (namespaceCount >= NVS_NAMESPACE_MAX) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        strcpy(namespaces[namespaceCount++], name);
+    }
+    *out_handle = (ns+1) | (open_mode == NVS_READONLY ? HANDLE_READONLY : 0);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    //every change is stored right away
+    esp_err_t err = nvs_check(handle, NULL, false);
+    if (err == ESP_OK) stats.nvs_commits++;
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char* key)
+{
+    esp_err_t err = nvs_check(handle, key, true);
+    if (err != ESP_OK) return err;
+    nvs_entry_t* e = nvs_find(HANDLE_NS(handle), key);
+    if (e == NULL) return ESP_ERR_NVS_NOT_FOUND;
+    free(e->data);
+    *e = entries[--entryCount];
+    stats.nvs_writes++;
+    return nvs_store();
+}
+
+esp_err_t nvs_erase_all(nvs_handle handle)
+{
+    esp_err_t err = nvs_check(handle, NULL, true);
+    if (err != ESP_OK) return err;
+    for (int i = entryCount-1; i >= 0; i--) {
+        if (entries[i].ns == HANDLE_NS(handle)) {
+            free(entries[i].data);
+            entries[i] = entries[--entryCount];
+        }
+    }
+    stats.nvs_writes++;
+    return nvs_store();
+}
+
+#define NVS_INT_ACCESSORS(name, ctype, nvstype)                                             \
+    esp_err_t nvs_set_##name(nvs_handle handle, const char* key, ctype value)               \
+    {                                                                                       \
+        return nvs_set(handle, key, nvstype, &value, sizeof(value));                        \
+    }                                                                                       \
+    esp_err_t nvs_get_##name(nvs_handle handle, const char* key, ctype* out_value)          \
+    {                                                                                       \
+        return nvs_get(handle, key, nvstype, out_value, NULL, false);                       \
+    }
+
+NVS_INT_ACCESSORS(i8, int8_t, NVS_TYPE_I8)
+NVS_INT_ACCESSORS(u8, uint8_t, NVS_TYPE_U8)
+NVS_INT_ACCESSORS(i16, int16_t, NVS_TYPE_I16)
+NVS_INT_ACCESSORS(u16, uint16_t, NVS_TYPE_U16)
+NVS_INT_ACCESSORS(i32, int32_t, NVS_TYPE_I32)
+NVS_INT_ACCESSORS(u32, uint32_t, NVS_TYPE_U32)
+NVS_INT_ACCESSORS(i64, int64_t, NVS_TYPE_I64)
+NVS_INT_ACCESSORS(u64, uint64_t, NVS_TYPE_U64)
+
+esp_err_t nvs_set_str(nvs_handle handle, const char* key, const char* value)
+{
+    return nvs_set(handle, key, NVS_TYPE_STR, value, strlen(value)+1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length)
+{
+    return nvs_set(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char* key, char* out_value, size_t* length)
+{
+    return nvs_get(handle, key, NVS_TYPE_STR, out_value, length, true);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_value, size_t* length)
+{
+    return nvs_get(handle, key, NVS_TYPE_BLOB, out_value, length, true);
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "sim.h"
+
+typedef struct {
+    gpio_mode_t mode;
+    gpio_int_type_t intr;
+    bool intrEnabled;
+    bool wakeup;                //gpio_wakeup_enable(), on the level of intr
+    bool driven;                //input level set by a device model
+    int input;
+    int output;
+    uint32_t func;              //io mux function
+    gpio_isr_t handler;
+    void* arg;
+} pin_t;
+
+const uint32_t GPIO_PIN_MUX_REG[GPIO_PIN_COUNT] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9,
+    10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+    20, 21, 22, 23, 24, 25, 26, 27, 28, 29,
+    30, 31, 32, 33, 34, 35, 36, 37, 38, 39,
+};
+
+static pin_t pins[GPIO_PIN_COUNT];
+static bool isrService = false;
+static sim_gpio_listener_t outputListener = NULL;
+
+#define PIN_VALID(pin)          ((pin) >= 0 && (pin) < GPIO_PIN_COUNT)
+
+static bool pin_triggers(const pin_t* p, int old, int level)
+{
+    switch (p->intr) {
+        case GPIO_INTR_POSEDGE:
+            return old == 0 && level == 1;
+        case GPIO_INTR_NEGEDGE:
+            return old == 1 && level == 0;
+        case GPIO_INTR_ANYEDGE:
+            return old != level;
+        case GPIO_INTR_LOW_LEVEL:
+            return level == 0;
+        case GPIO_INTR_HIGH_LEVEL:
+            return level == 1;
+        default:
+            return false;
+    }
+}
+
+static bool is_level(gpio_int_type_t intr)
+{
+    return intr == GPIO_INTR_LOW_LEVEL || intr == GPIO_INTR_HIGH_LEVEL;
+}
+
+// a pin handed to a peripheral by the io mux raises no gpio interrupt
+static bool pin_armed(const pin_t* p)
+{
+    return p->func == PIN_FUNC_GPIO && p->intrEnabled && p->handler != NULL;
+}
+
+static bool level_raised(const pin_t* p)
+{
+    return is_level(p->intr) && pin_triggers(p, p->input, p->input);
+}
+
+// a level interrupt fires as long as the level is there, also once unmasked
+static void pin_poll(pin_t* p)
+{
+    if (pin_armed(p) && level_raised(p)) {
+        p->handler(p->arg);
+    }
+}
+
+void sim_gpio_resume()
+{
+    for (int pin = 0; pin < GPIO_PIN_COUNT; pin++) {
+        pin_poll(&pins[pin]);
+    }
+}
+
+void sim_gpio_pin_func(uint32_t reg, uint32_t func)
+{
+    if (!PIN_VALID(reg)) return;
+    pins[reg].func = func;
+    pin_poll(&pins[reg]);
+}
+
+void sim_gpio_drive(gpio_num_t pin, int level)
+{
+    if (!PIN_VALID(pin)) return;
+    pin_t* p = &pins[pin];
+    int old = p->input;
+    p->input = level ? 1 : 0;
+    p->driven = true;
+    if (!pin_armed(p) || !pin_triggers(p, old, p->input)) return;
+    if (!sim_pm_gpio_interrupt(p->wakeup && level_raised(p))) {
+        //light sleep: a level is still there on the next wake, an edge is gone
+        if (!is_level(p->intr)) sim_pm_lost_irq();
+        return;
+    }
+    if (is_level(p->intr)) {
+        //after a wake up, the isr may have run already or the level be gone
+        pin_poll(p);
+    } else if (pin_armed(p)) {
+        p->handler(p->arg);
+    }
+}
+
+void sim_gpio_set_listener(sim_gpio_listener_t listener)
+{
+    outputListener = listener;
+}
+
+int sim_gpio_output(gpio_num_t pin)
+{
+    return PIN_VALID(pin) ? pins[pin].output : 0;
+}
+
+esp_err_t gpio_config(const gpio_config_t* pGPIOConfig)
+{
+    for (int pin = 0; pin < GPIO_PIN_COUNT; pin++) {
+        if (!(pGPIOConfig->pin_bit_mask & ((uint64_t)1<<pin))) continue;
+        pin_t* p = &pins[pin];
+        p->mode = pGPIOConfig->mode;
+        p->intr = pGPIOConfig->intr_type;
+        p->intrEnabled = pGPIOConfig->intr_type != GPIO_INTR_DISABLE;
+        p->func = PIN_FUNC_GPIO;
+        if (!p->driven) {
+            //nothing attached, the pull decides
+            p->input = pGPIOConfig->pull_up_en ? 1 : 0;
+        }
+        pin_poll(p);
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pin_t* p = &pins[gpio_num];
+    int old = p->output;
+    p->output = level ? 1 : 0;
+    if (old != p->output && outputListener != NULL) {
+        outputListener(gpio_num, p->output);
+    }
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (!PIN_VALID(gpio_num)) return 0;
+    pin_t* p = &pins[gpio_num];
+    return (p->mode & GPIO_MODE_INPUT) ? p->input : p->output;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].intr = intr_type;
+    pin_poll(&pins[gpio_num]);
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].intrEnabled = true;
+    pin_poll(&pins[gpio_num]);
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].intrEnabled = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (!PIN_VALID(gpio_num) || !is_level(intr_type)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].intr = intr_type;
+    pins[gpio_num].wakeup = true;
+    pin_poll(&pins[gpio_num]);
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num)
+{
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].wakeup = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if (isrService) return ESP_FAIL;
+    isrService = true;
+    return ESP_OK;
+}
+
+void gpio_uninstall_isr_service()
+{
+    isrService = false;
+    for (int pin = 0; pin < GPIO_PIN_COUNT; pin++) {
+        pins[pin].handler = NULL;
+    }
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void* args)
+{
+    if (!isrService) return ESP_ERR_INVALID_STATE;
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].handler = isr_handler;
+    pins[gpio_num].arg = args;
+    pin_poll(&pins[gpio_num]);
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    if (!isrService) return ESP_ERR_INVALID_STATE;
+    if (!PIN_VALID(gpio_num)) return ESP_ERR_INVALID_ARG;
+    pins[gpio_num].handler = NULL;
+    pins[gpio_num].arg = NULL;
+    return ESP_OK;
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/i2c.h"
+#include "sim.h"
+
+#define CMD_MAX                 16          //operations in one command link
+#define SLAVE_MAX               4
+#define DATA_MAX                64          //bytes in one transaction
+
+enum {
+    OP_START,
+    OP_WRITE,
+    OP_READ,
+    OP_STOP
+};
+
+typedef struct {
+    int op;
+    uint8_t byte;               //write_byte
+    uint8_t* data;              //write and read, kept by reference like the driver
+    size_t len;
+} cmd_op_t;
+
+typedef struct {
+    cmd_op_t ops[CMD_MAX];
+    int count;
+} cmd_link_t;
+
+typedef struct {
+    uint8_t address;
+    const sim_i2c_slave_t* slave;
+} slave_t;
+
+typedef struct {
+    bool installed;
+    uint32_t clock;
+    int failures;               //injected
+    int hangs;                  //injected, scl held low
+    slave_t slaves[SLAVE_MAX];
+    int slaveCount;
+} port_t;
+
+static port_t ports[I2C_NUM_MAX];
+
+#define PORT_VALID(port)        ((port) >= 0 && (port) < I2C_NUM_MAX)
+
+void sim_i2c_attach(i2c_port_t port, uint8_t address, const sim_i2c_slave_t* slave)
+{
+    port_t* p = &ports[port];
+    if (p->slaveCount < SLAVE_MAX) {
+        p->slaves[p->slaveCount].address = address;
+        p->slaves[p->slaveCount].slave = slave;
+        p->slaveCount++;
+    }
+}
+
+void sim_i2c_fail(i2c_port_t port, int count)
+{
+    if (PORT_VALID(port)) ports[port].failures += count;
+}
+
+void sim_i2c_hang(i2c_port_t port, int count)
+{
+    if (PORT_VALID(port)) ports[port].hangs += count;
+}
+
+static const sim_i2c_slave_t* find_slave(port_t* p, uint8_t address)
+{
+    for (int i = 0; i < p->slaveCount; i++) {
+        if (p->slaves[i].address == address) return p->slaves[i].slave;
+    }
+    return NULL;
+}
+
+static esp_err_t cmd_add(i2c_cmd_handle_t cmd_handle, int op, uint8_t byte, uint8_t* data, size_t len)
+{
+    cmd_link_t* link = cmd_handle;
+    if (link == NULL) return ESP_ERR_INVALID_ARG;
+    if (link->count >= CMD_MAX) return ESP_ERR_NO_MEM;
+    cmd_op_t* o = &link->ops[link->count++];
+    o->op = op;
+    o->byte = byte;
+    o->data = data;
+    o->len = len;
+    return ESP_OK;
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t* i2c_conf)
+{
+    if (!PORT_VALID(i2c_num) || i2c_conf->mode != I2C_MODE_MASTER) return ESP_ERR_INVALID_ARG;
+    ports[i2c_num].clock = i2c_conf->master.clk_speed;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags)
+{
+    if (!PORT_VALID(i2c_num)) return ESP_ERR_INVALID_ARG;
+    if (ports[i2c_num].installed) return ESP_FAIL;
+    ports[i2c_num].installed = true;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t i2c_num)
+{
+    if (!PORT_VALID(i2c_num)) return ESP_ERR_INVALID_ARG;
+    ports[i2c_num].installed = false;
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create()
+{
+    return calloc(1, sizeof(cmd_link_t));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle)
+{
+    free(cmd_handle);
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle)
+{
+    return cmd_add(cmd_handle, OP_START, 0, NULL, 0);
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en)
+{
+    return cmd_add(cmd_handle, OP_WRITE, data, NULL, 1);
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd_handle, uint8_t* data, size_t data_len, bool ack_en)
+{
+    return cmd_add(cmd_handle, OP_WRITE, 0, data, data_len);
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t* data, int ack)
+{
+    return cmd_add(cmd_handle, OP_READ, 0, data, 1);
+}
+
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd_handle, uint8_t* data, size_t data_len, int ack)
+{
+    return cmd_add(cmd_handle, OP_READ, 0, data, data_len);
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle)
+{
+    return cmd_add(cmd_handle, OP_STOP, 0, NULL, 0);
+}
+
+/*
+ * Runs a command link as one transaction per start condition: the first
+ * written byte addresses the slave, the rest of the writes reach it as one
+ * block, then the reads are served as one block.
+ */
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait)
+{
+    if (!PORT_VALID(i2c_num) || cmd_handle == NULL) return ESP_ERR_INVALID_ARG;
+    port_t* p = &ports[i2c_num];
+    if (!p->installed) return ESP_ERR_INVALID_STATE;
+    cmd_link_t* link = cmd_handle;
+
+    if (p->hangs > 0) {
+        //a slave holds scl low: the driver waits out ticks_to_wait for the
+        //transfer done interrupt, on a tick boundary like any FreeRTOS wait
+        p->hangs--;
+        sim_pm_bus_transfer();
+        int64_t deadline = sim_tick_deadline(ticks_to_wait);
+        if (deadline < 0) {
+            while (1) sim_wait(p, -1);
+        }
+        sim_sleep_until(deadline);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t ret = ESP_OK;
+    size_t bits = 0;
+    const sim_i2c_slave_t* slave = NULL;
+    bool addressed = false;
+    uint8_t out[DATA_MAX];
+    uint8_t in[DATA_MAX];
+    size_t outLen = 0;
+    size_t inLen = 0;
+    int segment = 0;
+    if (p->failures > 0) {
+        //injected failure, the slave never sees it
+        p->failures--;
+        ret = ESP_FAIL;
+        for (int i = 0; i < link->count; i++) {
+            bits += link->ops[i].len*9;
+        }
+    }
+    for (int i = 0; i < link->count && ret == ESP_OK; i++) {
+        cmd_op_t* o = &link->ops[i];
+        if (o->op == OP_START || o->op == OP_STOP) {
+            bits += 2;
+            if (slave != NULL && outLen > 0 && slave->write != NULL && !slave->write(out, outLen)) {
+                ret = ESP_FAIL;
+            }
+            if (slave != NULL && inLen > 0) {
+                if (slave->read == NULL || !slave->read(in, inLen)) {
+                    ret = ESP_FAIL;
+                    break;
+                }
+                //hand the bytes back to the read operations in order
+                size_t offset = 0;
+                for (int j = segment; j < i; j++) {
+                    cmd_op_t* r = &link->ops[j];
+                    if (r->op == OP_READ && r->data != NULL && r->len > 0 && offset < inLen) {
+                        memcpy(r->data, in+offset, r->len);
+                        offset += r->len;
+                    }
+                }
+            }
+            slave = NULL;
+            addressed = false;
+            segment = i+1;
+            outLen = 0;
+            inLen = 0;
+            continue;
+        }
+        bits += o->len*9;
+        if (o->op == OP_WRITE) {
+            const uint8_t* data = o->data != NULL ? o->data : &o->byte;
+            size_t start = 0;
+            if (!addressed) {
+                addressed = true;
+                slave = find_slave(p, data[0]>>1);
+                if (slave == NULL) ret = ESP_FAIL;        //no ack for the address
+                start = 1;
+            }
+            for (size_t k = start; k < o->len && outLen < DATA_MAX; k++) {
+                out[outLen++] = data[k];
+            }
+        } else if (o->op == OP_READ) {
+            if (inLen+o->len > DATA_MAX) {
+                ret = ESP_ERR_INVALID_SIZE;
+            } else {
+                inLen += o->len;
+            }
+        }
+    }
+
+    //the bus is busy for the whole transfer even when it failed
+    sim_pm_bus_transfer();
+    sim_sleep((int64_t)bits*1000000/(p->clock ? p->clock : 100000));
+    return ret;
+}
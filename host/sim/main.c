@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cpt112s.h"
+#include "key_event.h"
+#include "latency.h"
+#include "io_loop.h"
+#include "ota.h"
+#include "tlog.h"
+#include "task_table.h"
+#include "webserver.h"
+#include "sim.h"
+
+#define MAIN_TASK_PRIORITY      1           //ESP_TASK_MAIN_PRIO
+#define DEFAULT_DURATION        60          //s without a scenario
+#define SCENARIO_TAIL           1000000     //us run after the last step
+
+void app_main();
+
+static const char* flashPath = NULL;
+static struct timespec realStart;
+
+static const sim_kettle_t defaultKettle = {
+    .water = 20,
+    .ambient = 20,
+    .mass = 1.0,
+    .power = 1500,
+    .loss = 2.0,
+    .sensor_lag = 4.0,
+    .noise = 30,
+};
+
+static void main_task(void* arg)
+{
+    app_main();
+    vTaskDelete(NULL);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options] [scenario]\n"
+            "  -t seconds   simulated time to run (default: scenario end + 1 s, or %d s)\n"
+            "  -x speed     pace against the wall clock, 1: real time (default: as fast as possible)\n"
+            "  -f file      flash image, loaded if it exists and saved at the end\n"
+            "  -r seed      random seed for adc noise\n"
+            "  -v           debug log, if built with LOG_LEVEL=4\n"
+            "  -q           warnings and errors only\n",
+            name, DEFAULT_DURATION);
+    exit(2);
+}
+
+static void report()
+{
+    struct timespec realEnd;
+    clock_gettime(CLOCK_MONOTONIC, &realEnd);
+    double real = (realEnd.tv_sec-realStart.tv_sec)+(realEnd.tv_nsec-realStart.tv_nsec)/1e9;
+    double simulated = sim_now()/1e6;
+
+    //deferred log lines first, then the numbers
+    tlog_flush();
+    fflush(stdout);
+    printf("---- simulation report ----\n");
+    printf("time:    %.3f s simulated in %.3f s (%.0fx), %llu task switches\n",
+           simulated, real, real > 0 ? simulated/real : 0, (unsigned long long)sim_switches());
+    sim_devices_report();
+
+    cpt112s_stats_t touch;
+    cpt112s_get_stats(&touch);
+    printf("cpt112s: %u events in %u batches (max %u), %u i2c errors, %u retries\n",
+           touch.events, touch.batches, touch.max_batch, touch.i2c_errors, touch.i2c_retries);
+    key_event_stats_t keys;
+    key_event_get_stats(&keys);
+    printf("keys:    posted %u/%u/%u/%u dropped %u/%u/%u/%u merged %u (left/right/slider/remote), loss %.2f%%\n",
+           keys.posted[LEFT_KEY], keys.posted[RIGHT_KEY], keys.posted[SLIDER_KEY],
+           keys.posted[TARGET_KEY]+keys.posted[HEAT_KEY]+keys.posted[HOLD_KEY],
+           keys.dropped[LEFT_KEY], keys.dropped[RIGHT_KEY], keys.dropped[SLIDER_KEY],
+           keys.dropped[TARGET_KEY]+keys.dropped[HEAT_KEY]+keys.dropped[HOLD_KEY],
+           keys.merged, sim_key_loss());
+    webserver_stats_t web;
+    webserver_get_stats(&web);
+    if (web.connections > 0) {
+        printf("web:     %u connections, %u commands, %u pushes, %u foreign hosts or origins refused, %u slow clients dropped\n",
+               web.connections, web.commands, web.pushes, web.rejected, web.slow);
+    }
+    ota_stats_t ota;
+    ota_get_stats(&ota);
+    if (ota.start_time > 0) {
+        double seconds = (ota.end_time > 0 ? ota.end_time : sim_now())-ota.start_time;
+        seconds /= 1e6;
+        sim_http_stats_t http;
+        sim_net_http_get_stats(&http);
+        printf("ota:     %u of %u bytes written in %.2f s (%.1f KB/s), %u resumes, %u http requests (%u ranges)\n",
+               ota.written, ota.total, seconds, seconds > 0 ? ota.written/1024.0/seconds : 0,
+               ota.resumes, http.requests, http.ranges);
+    }
+    latency_histogram_t total;
+    latency_get(LATENCY_TOTAL, &total);
+    if (total.count > 0) {
+        printf("latency: %u inputs, input to display min %u us, avg %u us, max %u us\n",
+               total.count, total.min, (uint32_t)(total.sum/total.count), total.max);
+    }
+    static const char* ioSources[IO_SOURCE_MAX] = { "adc", "touch", "key", "event" };
+    for (int i = 0; i < IO_SOURCE_MAX; i++) {
+        io_loop_stats_t io;
+        io_loop_get_stats(i, &io);
+        printf("io:      %-5s %6u handled, notify to thread avg %u us, max %u us, step max %u us\n",
+               ioSources[i], io.handled, io.handled > 0 ? (uint32_t)(io.latency_sum/io.handled) : 0,
+               io.latency_max, io.step_max);
+    }
+    sim_pm_stats_t pm;
+    sim_pm_get_stats(&pm);
+    int64_t span = pm.sleep+pm.fast+pm.slow;
+    if (!pm.configured) {
+        printf("pm:      not configured, cpu at %d MHz throughout\n", pm.max_freq);
+    } else if (span > 0) {
+        printf("pm:      active %.1f%% (%d MHz %.1f%%, %d MHz %.1f%%), %u light sleeps, woken by %u timer %u gpio %u other\n",
+               100.0*(pm.fast+pm.slow)/span, pm.max_freq, 100.0*pm.fast/span, pm.min_freq, 100.0*pm.slow/span,
+               pm.sleeps, pm.wakes[SIM_WAKE_TIMER], pm.wakes[SIM_WAKE_GPIO], pm.wakes[SIM_WAKE_OTHER]);
+        printf("pm:      wake pin to firmware avg %u us, max %u us, %u irqs lost asleep, %u transfers without apb lock\n",
+               pm.wake_latency_count > 0 ? (uint32_t)(pm.wake_latency_sum/pm.wake_latency_count) : 0,
+               pm.wake_latency_max, pm.lost_irqs, pm.slow_transfers);
+    }
+    tlog_stats_t logs;
+    tlog_get_stats(&logs);
+    printf("tlog:    %u written, %u dropped\n", logs.written, logs.dropped);
+    //host stacks and host cpu time, see uxTaskGetSystemState() in rtos.c
+    task_table_dump();
+
+    int failures = sim_scenario_failures();
+    if (failures > 0) {
+        printf("FAILED:  %d expectation(s)\n", failures);
+    }
+    if (flashPath != NULL && !sim_flash_save(flashPath)) {
+        fprintf(stderr, "sim: cannot save flash image %s\n", flashPath);
+    }
+    fflush(stdout);
+    exit(failures > 0 ? 1 : 0);
+}
+
+void sim_end()
+{
+    sim_kernel_exit(report);
+}
+
+int main(int argc, char** argv)
+{
+    double duration = -1;
+    double speed = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:x:f:r:vqh")) != -1) {
+        switch (opt) {
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'x':
+                speed = atof(optarg);
+                break;
+            case 'f':
+                flashPath = optarg;
+                break;
+            case 'r':
+                sim_random_seed(strtoul(optarg, NULL, 0));
+                break;
+            case 'v':
+                sim_log_level(ESP_LOG_DEBUG);
+                break;
+            case 'q':
+                sim_log_level(ESP_LOG_WARN);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc-1) usage(argv[0]);
+    //line buffered even into a pipe, log lines and the report stay in order
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    sim_kernel_init();
+    sim_flash_init(SIM_PARTITION_TABLE);
+    if (flashPath != NULL && !sim_flash_load(flashPath)) {
+        printf("sim: starting from erased flash\n");
+    }
+
+    int64_t end = (int64_t)DEFAULT_DURATION*1000000;
+    if (optind < argc) {
+        if (!sim_scenario_load(argv[optind])) return 2;
+        end = sim_scenario_end()+SCENARIO_TAIL;
+    }
+    if (duration > 0) {
+        end = (int64_t)(duration*1000000);
+    }
+
+    //what the IDF startup does before app_main
+    sim_devices_init(&defaultKettle);
+    esp_timer_init();
+    xTaskCreate(&main_task, "main", 8192, NULL, MAIN_TASK_PRIORITY, NULL);
+    sim_scenario_start();
+
+    clock_gettime(CLOCK_MONOTONIC, &realStart);
+    sim_kernel_run(end, speed);
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include "mbedtls/sha1.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/base64.h"
+
+/*
+ * The three mbedtls calls the firmware makes: the websocket accept key
+ * (sha1, base64) and the ota image and delta checks (sha256). Plain
+ * implementations from the FIPS 180-4 and RFC 4648 texts, no sha224.
+ */
+
+#define ROTL(x, n)              (((x) << (n)) | ((x) >> (32-(n))))
+#define ROTR(x, n)              (((x) >> (n)) | ((x) << (32-(n))))
+
+static uint32_t get_be32(const unsigned char* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_be32(unsigned char* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void sha1_block(uint32_t state[5], const unsigned char* block)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) w[i] = get_be32(block+i*4);
+    for (int i = 16; i < 80; i++) w[i] = ROTL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = ROTL(a, 5)+f+e+k+w[i];
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void mbedtls_sha1(const unsigned char* input, size_t ilen, unsigned char output[20])
+{
+    uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    size_t done = 0;
+    for (; ilen-done >= 64; done += 64) sha1_block(state, input+done);
+
+    //padding, the bit length in the last 8 bytes
+    unsigned char last[128];
+    size_t rest = ilen-done;
+    size_t lastLen = rest < 56 ? 64 : 128;
+    memset(last, 0, sizeof(last));
+    memcpy(last, input+done, rest);
+    last[rest] = 0x80;
+    put_be32(last+lastLen-8, (uint32_t)((uint64_t)ilen >> 29));
+    put_be32(last+lastLen-4, (uint32_t)(ilen << 3));
+    for (size_t i = 0; i < lastLen; i += 64) sha1_block(state, last+i);
+
+    for (int i = 0; i < 5; i++) put_be32(output+i*4, state[i]);
+}
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_block(uint32_t state[8], const unsigned char* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) w[i] = get_be32(block+i*4);
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16]+s0+w[i-7]+s1;
+    }
+
+    uint32_t v[8];
+    memcpy(v, state, sizeof(v));
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25);
+        uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7]+s1+ch+sha256K[i]+w[i];
+        uint32_t s0 = ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22);
+        uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(v+1, v, 7*sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1+s0+maj;
+    }
+    for (int i = 0; i < 8; i++) state[i] += v[i];
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx)
+{
+    memset(ctx, 0, sizeof(mbedtls_sha256_context));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx)
+{
+    memset(ctx, 0, sizeof(mbedtls_sha256_context));
+}
+
+void mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    ctx->total[0] = ctx->total[1] = 0;
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->is224 = is224;
+}
+
+void mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen)
+{
+    size_t fill = ctx->total[0] & 0x3f;
+    ctx->total[0] += ilen;
+    if (ctx->total[0] < ilen) ctx->total[1]++;
+    if (fill > 0) {
+        size_t take = 64-fill < ilen ? 64-fill : ilen;
+        memcpy(ctx->buffer+fill, input, take);
+        input += take;
+        ilen -= take;
+        if (fill+take < 64) return;
+        sha256_block(ctx->state, ctx->buffer);
+    }
+    for (; ilen >= 64; input += 64, ilen -= 64) sha256_block(ctx->state, input);
+    memcpy(ctx->buffer, input, ilen);
+}
+
+void mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32])
+{
+    size_t fill = ctx->total[0] & 0x3f;
+    uint32_t high = ctx->total[1] << 3 | ctx->total[0] >> 29;
+    uint32_t low = ctx->total[0] << 3;
+    ctx->buffer[fill++] = 0x80;
+    if (fill > 56) {
+        memset(ctx->buffer+fill, 0, 64-fill);
+        sha256_block(ctx->state, ctx->buffer);
+        fill = 0;
+    }
+    memset(ctx->buffer+fill, 0, 56-fill);
+    put_be32(ctx->buffer+56, high);
+    put_be32(ctx->buffer+60, low);
+    sha256_block(ctx->state, ctx->buffer);
+    for (int i = 0; i < 8; i++) put_be32(output+i*4, ctx->state[i]);
+}
+
+int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t need = (slen+2)/3*4;
+    //room for the terminating 0 as well, like mbedtls
+    if (dlen < need+1) {
+        *olen = need+1;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    unsigned char* p = dst;
+    for (size_t i = 0; i < slen; i += 3) {
+        uint32_t v = (uint32_t)src[i] << 16;
+        if (i+1 < slen) v |= (uint32_t)src[i+1] << 8;
+        if (i+2 < slen) v |= src[i+2];
+        *p++ = alphabet[(v >> 18) & 0x3f];
+        *p++ = alphabet[(v >> 12) & 0x3f];
+        *p++ = i+1 < slen ? alphabet[(v >> 6) & 0x3f] : '=';
+        *p++ = i+2 < slen ? alphabet[v & 0x3f] : '=';
+    }
+    *p = 0;
+    *olen = p-dst;
+    return 0;
+}
@@ -0,0 +1,638 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_wifi.h"
+#include "esp_event_loop.h"
+#include "tcpip_adapter.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "mbedtls/sha256.h"
+#include "sim.h"
+
+#define SOCKET_MAX              10          //CONFIG_LWIP_MAX_SOCKETS
+#define PEER_BUFFER             1024        //bytes in flight each way
+#define HTTP_HEADER_MAX         256
+#define HTTP_RATE               500000      //bytes/s over the lan and the radio
+#define HTTP_RTT_US             5000        //round trip, before a connection and a response
+#define SERVER_ADDR             0xc0a8010a  //192.168.1.10
+#define RECEIVER_ADDR           0xc0a8010b  //192.168.1.11
+#define STATION_ADDR            0xc0a80114  //192.168.1.20, once up
+#define UDP_QUEUE               2048        //datagram bytes the stack holds for the link
+
+/*
+ * The radio and the ip stack under wifi.c, ota.c, telemetry.c and
+ * webserver.c. The simulated board is out of range of every access point:
+ * the station starts and never gets an address on its own, so the firmware
+ * takes the same paths as a device on a kettle base far from the router.
+ * Sockets can be created, bound and listened on; a name does not resolve,
+ * a connect or a datagram has no route.
+ *
+ * The simulator itself can connect to a listening port, as a phone on the
+ * lan would: sim_net_connect() queues the connection for accept() and the
+ * peer side talks over it with sim_net_peer_send()/_receive(). Select
+ * reports such a listener or connection readable and wakes up for it.
+ * Sends never block: once PEER_BUFFER bytes wait for the peer they fail
+ * like a full socket buffer.
+ *
+ * sim_net_station_up() gives the station an address. From then on the
+ * name of the http server stand-in (sim_net_http_serve()) resolves and a
+ * connect to it goes through. The server answers HTTP/1.0 GETs for an
+ * image and its sha256 sidecar, with range requests, at HTTP_RATE: a recv
+ * on such a connection blocks until the link has carried the next bytes.
+ * It can drop a connection part way and answer a range from the wrong
+ * start, for the ota resume paths.
+ *
+ * The udp receiver stand-in (sim_net_udp_listen()) has a name too.
+ * Datagrams to it wait in the stack until sim_net_udp_receive() takes
+ * them off the link; with UDP_QUEUE bytes waiting a sendto fails with
+ * ENOMEM, as lwip does once it is out of buffers.
+ */
+typedef enum {
+    SOCKET_FREE,
+    SOCKET_OPEN,
+    SOCKET_LISTEN,
+    SOCKET_PENDING,             //connected by the simulator, not accepted yet
+    SOCKET_CONNECTED,
+} socket_state_e;
+
+typedef struct {
+    bool ready;                 //request read, response under way
+    char header[HTTP_HEADER_MAX];
+    size_t headerLen;           //still to send
+    const uint8_t* body;
+    size_t pos;                 //next body byte
+    size_t end;                 //the connection closes here
+    size_t sent;                //body bytes on the link so far
+    int64_t start;              //us, first byte on the link
+} http_response_t;
+
+typedef struct {
+    socket_state_e state;
+    int type;                   //SOCK_STREAM, SOCK_DGRAM
+    uint16_t port;              //bound, host order
+    bool peerClosed;
+    uint8_t rx[PEER_BUFFER];    //peer to firmware
+    size_t rxLen;
+    uint8_t tx[PEER_BUFFER];    //firmware to peer
+    size_t txLen;
+    bool http;                  //connected to the http server stand-in
+    http_response_t response;
+} sim_socket_t;
+
+static struct {
+    const char* host;
+    uint16_t port;
+    const char* path;
+    const uint8_t* image;
+    size_t len;
+    char hash[65];              //sha256 in hex, the sidecar
+    int64_t dropAt;             //image offset to drop the next response at, -1: none
+    int misranges;              //range replies still to start at 0
+    sim_http_stats_t stats;
+} server = { .dropAt = -1 };
+
+static struct {
+    const char* host;
+    uint16_t port;
+    uint8_t queue[UDP_QUEUE];   //length (2 bytes) and datagram, in order
+    size_t len;
+} receiver;
+
+static sim_socket_t sockets[SOCKET_MAX];
+static bool stationUp = false;
+static system_event_cb_t eventHandler = NULL;
+static void* eventContext = NULL;
+static int readiness;           //what select waits on, woken by the peers
+
+static void post_event(system_event_id_t id)
+{
+    system_event_t event = { .event_id = id };
+    if (eventHandler != NULL) eventHandler(eventContext, &event);
+}
+
+void tcpip_adapter_init(void)
+{
+}
+
+// the station's address once up, the access point never runs
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t* ip_info)
+{
+    if (tcpip_if >= TCPIP_ADAPTER_IF_MAX || ip_info == NULL) return ESP_ERR_INVALID_ARG;
+    memset(ip_info, 0, sizeof(tcpip_adapter_ip_info_t));
+    if (tcpip_if == TCPIP_ADAPTER_IF_STA && stationUp) {
+        ip_info->ip.addr = htonl(STATION_ADDR);
+        ip_info->netmask.addr = htonl(0xffffff00);
+        ip_info->gw.addr = htonl(0xc0a80101);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void* ctx)
+{
+    eventHandler = cb;
+    eventContext = ctx;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t* conf)
+{
+    return conf != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    post_event(SYSTEM_EVENT_STA_START);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    //the scan finds no access point, the station stays disconnected
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    return ESP_OK;
+}
+
+static sim_socket_t* get_socket(int s)
+{
+    if (s < 0 || s >= SOCKET_MAX || sockets[s].state == SOCKET_FREE) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &sockets[s];
+}
+
+int lwip_socket(int domain, int type, int protocol)
+{
+    if (domain != AF_INET || (type != SOCK_STREAM && type != SOCK_DGRAM)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < SOCKET_MAX; i++) {
+        if (sockets[i].state == SOCKET_FREE) {
+            memset(&sockets[i], 0, sizeof(sim_socket_t));
+            sockets[i].state = SOCKET_OPEN;
+            sockets[i].type = type;
+            return i;
+        }
+    }
+    errno = ENFILE;
+    return -1;
+}
+
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    if (name != NULL && name->sa_family == AF_INET) {
+        socket->port = ntohs(((const struct sockaddr_in*)name)->sin_port);
+    }
+    return 0;
+}
+
+int lwip_listen(int s, int backlog)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    if (socket->type != SOCK_STREAM) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    socket->state = SOCKET_LISTEN;
+    return 0;
+}
+
+static int pending_connection(uint16_t port)
+{
+    for (int i = 0; i < SOCKET_MAX; i++) {
+        if (sockets[i].state == SOCKET_PENDING && sockets[i].port == port) return i;
+    }
+    return -1;
+}
+
+int lwip_accept(int s, struct sockaddr* addr, socklen_t* addrlen)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    int pending = socket->state == SOCKET_LISTEN ? pending_connection(socket->port) : -1;
+    if (pending < 0) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    sockets[pending].state = SOCKET_CONNECTED;
+    return pending;
+}
+
+int lwip_connect(int s, const struct sockaddr* name, socklen_t namelen)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    const struct sockaddr_in* to = (const struct sockaddr_in*)name;
+    if (!stationUp || server.image == NULL || socket->type != SOCK_STREAM || name->sa_family != AF_INET
+            || to->sin_addr.s_addr != htonl(SERVER_ADDR)) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    if (ntohs(to->sin_port) != server.port) {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    sim_sleep(HTTP_RTT_US);
+    socket->state = SOCKET_CONNECTED;
+    socket->http = true;
+    return 0;
+}
+
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen)
+{
+    return get_socket(s) != NULL ? 0 : -1;
+}
+
+static void http_respond(sim_socket_t* socket, int status, const uint8_t* body, size_t first, size_t len, size_t total)
+{
+    http_response_t* r = &socket->response;
+    const char* reason = status == 200 ? "OK" : status == 206 ? "Partial Content" : "Not Found";
+    int n = snprintf(r->header, sizeof(r->header), "HTTP/1.0 %d %s\r\nContent-Length: %u\r\n",
+            status, reason, (unsigned)len);
+    if (status == 206) {
+        n += snprintf(r->header+n, sizeof(r->header)-n, "Content-Range: bytes %u-%u/%u\r\n",
+                (unsigned)first, (unsigned)(first+len-1), (unsigned)total);
+    }
+    n += snprintf(r->header+n, sizeof(r->header)-n, "\r\n");
+    r->headerLen = n;
+    r->body = body;
+    r->pos = first;
+    r->end = first+len;
+    if (body == server.image && server.dropAt >= 0) {
+        //the server goes away part way, once
+        if (server.dropAt < r->end) r->end = server.dropAt > r->pos ? server.dropAt : r->pos;
+        server.dropAt = -1;
+    }
+    r->sent = 0;
+    r->start = sim_now()+HTTP_RTT_US;
+    r->ready = true;
+}
+
+// answer a GET once its header is complete
+static void http_request(sim_socket_t* socket)
+{
+    if (socket->response.ready) return;
+    char request[PEER_BUFFER+1];
+    memcpy(request, socket->tx, socket->txLen);
+    request[socket->txLen] = 0;
+    if (strstr(request, "\r\n\r\n") == NULL) return;
+    socket->txLen = 0;
+    server.stats.requests++;
+
+    char path[128] = "";
+    sscanf(request, "GET %127s HTTP/", path);
+    const char* range = strstr(request, "\r\nRange: bytes=");
+    size_t sidecar = strlen(server.path);
+    if (strcmp(path, server.path) == 0) {
+        size_t first = 0;
+        if (range != NULL) {
+            first = strtoul(range+15, NULL, 10);
+            server.stats.ranges++;
+            server.stats.range_start = first;
+        }
+        if (first >= server.len) {
+            http_respond(socket, 404, NULL, 0, 0, 0);
+        } else if (range == NULL) {
+            http_respond(socket, 200, server.image, 0, server.len, server.len);
+        } else if (server.misranges > 0) {
+            server.misranges--;
+            http_respond(socket, 206, server.image, 0, server.len, server.len);
+        } else {
+            http_respond(socket, 206, server.image, first, server.len-first, server.len);
+        }
+    } else if (strncmp(path, server.path, sidecar) == 0 && strcmp(path+sidecar, ".sha256") == 0) {
+        http_respond(socket, 200, (const uint8_t*)server.hash, 0, 64, 64);
+    } else {
+        http_respond(socket, 404, NULL, 0, 0, 0);
+    }
+}
+
+// move what the link carried by now into the receive buffer
+static void http_pump(sim_socket_t* socket)
+{
+    http_response_t* r = &socket->response;
+    if (!r->ready || sim_now() < r->start) return;
+    if (r->headerLen > 0) {
+        if (socket->rxLen+r->headerLen > PEER_BUFFER) return;
+        memcpy(socket->rx+socket->rxLen, r->header, r->headerLen);
+        socket->rxLen += r->headerLen;
+        r->headerLen = 0;
+    }
+    size_t carried = (sim_now()-r->start)*HTTP_RATE/1000000;
+    size_t n = PEER_BUFFER-socket->rxLen;
+    if (n > carried-r->sent) n = carried-r->sent;
+    if (n > r->end-r->pos) n = r->end-r->pos;
+    if (n > 0) memcpy(socket->rx+socket->rxLen, r->body+r->pos, n);
+    socket->rxLen += n;
+    r->pos += n;
+    r->sent += n;
+    //HTTP/1.0, the server closes after the body
+    if (r->pos == r->end) socket->peerClosed = true;
+}
+
+// when the link has carried the next buffer full
+static int64_t http_next(const sim_socket_t* socket)
+{
+    const http_response_t* r = &socket->response;
+    if (sim_now() < r->start) return r->start;
+    size_t n = r->end-r->pos < PEER_BUFFER ? r->end-r->pos : PEER_BUFFER;
+    return r->start+((int64_t)(r->sent+n)*1000000+HTTP_RATE-1)/HTTP_RATE;
+}
+
+ssize_t lwip_send(int s, const void* data, size_t size, int flags)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    if (socket->state != SOCKET_CONNECTED || socket->peerClosed) {
+        errno = socket->peerClosed ? EPIPE : ENOTCONN;
+        return -1;
+    }
+    if (socket->txLen+size > PEER_BUFFER) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    memcpy(socket->tx+socket->txLen, data, size);
+    socket->txLen += size;
+    if (socket->http) http_request(socket);
+    return size;
+}
+
+ssize_t lwip_sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    const struct sockaddr_in* addr = (const struct sockaddr_in*)to;
+    if (!stationUp || receiver.host == NULL || socket->type != SOCK_DGRAM || to->sa_family != AF_INET
+            || addr->sin_addr.s_addr != htonl(RECEIVER_ADDR) || ntohs(addr->sin_port) != receiver.port) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    if (receiver.len+2+size > UDP_QUEUE) {
+        errno = ENOMEM;
+        return -1;
+    }
+    receiver.queue[receiver.len] = size & 0xff;
+    receiver.queue[receiver.len+1] = size >> 8;
+    memcpy(receiver.queue+receiver.len+2, data, size);
+    receiver.len += 2+size;
+    return size;
+}
+
+ssize_t lwip_recv(int s, void* mem, size_t len, int flags)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    if (socket->state != SOCKET_CONNECTED) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    //a blocking socket, as ota.c uses it
+    if (socket->http) {
+        http_pump(socket);
+        while (socket->rxLen == 0 && !socket->peerClosed && socket->response.ready) {
+            sim_sleep_until(http_next(socket));
+            http_pump(socket);
+        }
+    }
+    if (socket->rxLen == 0) {
+        if (socket->peerClosed) return 0;
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    size_t n = len < socket->rxLen ? len : socket->rxLen;
+    memcpy(mem, socket->rx, n);
+    socket->rxLen -= n;
+    memmove(socket->rx, socket->rx+n, socket->rxLen);
+    return n;
+}
+
+static bool readable(int s)
+{
+    const sim_socket_t* socket = &sockets[s];
+    if (socket->state == SOCKET_LISTEN) return pending_connection(socket->port) >= 0;
+    return socket->state == SOCKET_CONNECTED && (socket->rxLen > 0 || socket->peerClosed);
+}
+
+// keeps the readable sockets in the set, their count
+static int ready_set(int maxfdp1, fd_set* readset)
+{
+    if (readset == NULL) return 0;
+    fd_set ready;
+    FD_ZERO(&ready);
+    int count = 0;
+    for (int s = 0; s < maxfdp1 && s < SOCKET_MAX; s++) {
+        if (FD_ISSET(s, readset) && readable(s)) {
+            FD_SET(s, &ready);
+            count++;
+        }
+    }
+    if (count > 0) *readset = ready;
+    return count;
+}
+
+int lwip_select(int maxfdp1, fd_set* readset, fd_set* writeset, fd_set* exceptset, struct timeval* timeout)
+{
+    int64_t deadline = -1;
+    if (timeout != NULL) {
+        deadline = sim_now()+(int64_t)timeout->tv_sec*1000000+timeout->tv_usec;
+    }
+    int ready = ready_set(maxfdp1, readset);
+    while (ready == 0 && deadline != sim_now() && sim_wait(&readiness, deadline)) {
+        ready = ready_set(maxfdp1, readset);
+    }
+    //never waits for writing, sends do not block
+    if (ready == 0 && readset != NULL) FD_ZERO(readset);
+    if (writeset != NULL) FD_ZERO(writeset);
+    if (exceptset != NULL) FD_ZERO(exceptset);
+    return ready;
+}
+
+int lwip_close(int s)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return -1;
+    socket->state = SOCKET_FREE;
+    return 0;
+}
+
+static void peer_ready()
+{
+    if (sim_wake(&readiness)) sim_preempt();
+}
+
+int sim_net_connect(uint16_t port)
+{
+    bool listening = false;
+    for (int i = 0; i < SOCKET_MAX; i++) {
+        if (sockets[i].state == SOCKET_LISTEN && sockets[i].port == port) listening = true;
+    }
+    if (!listening) return -1;
+    int s = lwip_socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    sockets[s].state = SOCKET_PENDING;
+    sockets[s].port = port;
+    peer_ready();
+    return s;
+}
+
+bool sim_net_peer_send(int s, const void* data, size_t len)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL || socket->peerClosed || socket->rxLen+len > PEER_BUFFER) return false;
+    memcpy(socket->rx+socket->rxLen, data, len);
+    socket->rxLen += len;
+    peer_ready();
+    return true;
+}
+
+size_t sim_net_peer_receive(int s, void* data, size_t len)
+{
+    if (s < 0 || s >= SOCKET_MAX) return 0;
+    sim_socket_t* socket = &sockets[s];
+    size_t n = len < socket->txLen ? len : socket->txLen;
+    memcpy(data, socket->tx, n);
+    socket->txLen -= n;
+    memmove(socket->tx, socket->tx+n, socket->txLen);
+    return n;
+}
+
+bool sim_net_peer_connected(int s)
+{
+    return s >= 0 && s < SOCKET_MAX && !sockets[s].peerClosed
+            && (sockets[s].state == SOCKET_PENDING || sockets[s].state == SOCKET_CONNECTED);
+}
+
+void sim_net_peer_close(int s)
+{
+    sim_socket_t* socket = get_socket(s);
+    if (socket == NULL) return;
+    if (socket->state == SOCKET_PENDING) {
+        socket->state = SOCKET_FREE;
+        return;
+    }
+    socket->peerClosed = true;
+    peer_ready();
+}
+
+void sim_net_station_up()
+{
+    stationUp = true;
+    post_event(SYSTEM_EVENT_STA_GOT_IP);
+}
+
+void sim_net_http_serve(const char* host, uint16_t port, const char* path, const uint8_t* image, size_t len)
+{
+    server.host = host;
+    server.port = port;
+    server.path = path;
+    server.image = image;
+    server.len = len;
+    uint8_t hash[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, image, len);
+    mbedtls_sha256_finish(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    for (int i = 0; i < sizeof(hash); i++) {
+        sprintf(server.hash+i*2, "%02x", hash[i]);
+    }
+}
+
+void sim_net_http_drop(size_t offset)
+{
+    server.dropAt = offset;
+}
+
+void sim_net_http_misrange(int count)
+{
+    server.misranges = count;
+}
+
+void sim_net_http_get_stats(sim_http_stats_t* out)
+{
+    *out = server.stats;
+}
+
+void sim_net_udp_listen(const char* host, uint16_t port)
+{
+    receiver.host = host;
+    receiver.port = port;
+    receiver.len = 0;
+}
+
+size_t sim_net_udp_receive(void* data, size_t size)
+{
+    if (receiver.len == 0) return 0;
+    size_t len = receiver.queue[0] | receiver.queue[1] << 8;
+    size_t n = len < size ? len : size;
+    memcpy(data, receiver.queue+2, n);
+    receiver.len -= 2+len;
+    memmove(receiver.queue, receiver.queue+2+len, receiver.len);
+    return n;
+}
+
+// only the stand-ins have a name, once the station is up
+int lwip_getaddrinfo(const char* nodename, const char* servname, const struct addrinfo* hints, struct addrinfo** res)
+{
+    *res = NULL;
+    uint32_t addr;
+    if (!stationUp || nodename == NULL) return EAI_FAIL;
+    if (server.host != NULL && strcmp(nodename, server.host) == 0) {
+        addr = SERVER_ADDR;
+    } else if (receiver.host != NULL && strcmp(nodename, receiver.host) == 0) {
+        addr = RECEIVER_ADDR;
+    } else {
+        return EAI_FAIL;
+    }
+    struct {
+        struct addrinfo info;
+        struct sockaddr_in addr;
+    }* entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) return EAI_MEMORY;
+    entry->addr.sin_family = AF_INET;
+    entry->addr.sin_port = htons(servname != NULL ? atoi(servname) : 0);
+    entry->addr.sin_addr.s_addr = htonl(addr);
+    entry->info.ai_family = AF_INET;
+    entry->info.ai_socktype = hints != NULL ? hints->ai_socktype : SOCK_STREAM;
+    entry->info.ai_addr = (struct sockaddr*)&entry->addr;
+    entry->info.ai_addrlen = sizeof(entry->addr);
+    *res = &entry->info;
+    return 0;
+}
+
+void lwip_freeaddrinfo(struct addrinfo* ai)
+{
+    //the address lives in the same block
+    free(ai);
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "sim.h"
+
+#define IMAGE_MAGIC             0xE9        //ESP_IMAGE_HEADER_MAGIC
+
+/*
+ * esp_ota_ops on the simulated flash: the app runs from ota_0 and one
+ * update at a time goes to the other slot. esp_ota_end() only checks the
+ * image magic, there is no image format to verify beyond it here.
+ */
+typedef struct {
+    const esp_partition_t* partition;
+    uint32_t written;
+    uint8_t first;
+} sim_ota_t;
+
+static sim_ota_t update;
+static esp_ota_handle_t updateHandle = 0;
+static const esp_partition_t* bootPartition = NULL;
+
+const esp_partition_t* esp_ota_get_running_partition(void)
+{
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from)
+{
+    const esp_partition_t* running = start_from != NULL ? start_from : esp_ota_get_running_partition();
+    if (running == NULL) return NULL;
+    esp_partition_subtype_t next = running->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_0 ?
+            ESP_PARTITION_SUBTYPE_APP_OTA_1 : ESP_PARTITION_SUBTYPE_APP_OTA_0;
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, next, NULL);
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle)
+{
+    if (partition == NULL || out_handle == NULL) return ESP_ERR_INVALID_ARG;
+    if (partition == esp_ota_get_running_partition()) return ESP_ERR_OTA_PARTITION_CONFLICT;
+    uint32_t size = image_size == OTA_SIZE_UNKNOWN ? partition->size :
+            (image_size+SPI_FLASH_SEC_SIZE-1)/SPI_FLASH_SEC_SIZE*SPI_FLASH_SEC_SIZE;
+    if (size > partition->size) return ESP_ERR_INVALID_SIZE;
+    esp_err_t err = esp_partition_erase_range(partition, 0, size);
+    if (err != ESP_OK) return err;
+
+    memset(&update, 0, sizeof(update));
+    update.partition = partition;
+    *out_handle = ++updateHandle;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size)
+{
+    if (handle != updateHandle || update.partition == NULL) return ESP_ERR_INVALID_ARG;
+    if (size == 0) return ESP_OK;
+    if (update.written == 0) update.first = *(const uint8_t*)data;
+    esp_err_t err = esp_partition_write(update.partition, update.written, data, size);
+    if (err == ESP_OK) update.written += size;
+    return err;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (handle != updateHandle || update.partition == NULL) return ESP_ERR_NOT_FOUND;
+    bool valid = update.written > 0 && update.first == IMAGE_MAGIC;
+    //the handle is gone either way
+    update.partition = NULL;
+    return valid ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+    if (partition == NULL || partition->type != ESP_PARTITION_TYPE_APP) return ESP_ERR_INVALID_ARG;
+    bootPartition = partition;
+    return ESP_OK;
+}
+
+const esp_partition_t* esp_ota_get_boot_partition(void)
+{
+    return bootPartition != NULL ? bootPartition : esp_ota_get_running_partition();
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "sim.h"
+
+#define TICK_US                 (1000000/configTICK_RATE_HZ)
+#define LOCK_MAX                8
+#define WAKE_UP_US              700         //light sleep exit, clocks and flash back up
+#ifndef CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP
+#define CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP  3
+#endif
+
+/*
+ * The chip as the power manager sees it. Light sleep starts when no
+ * firmware task is ready, no lock is held and the next task timeout is at
+ * least CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP ticks away; an esp_timer
+ * alarm only cuts it short. It ends on a timeout (the chip wakes up early
+ * by WAKE_UP_US, the timeout is on time), on the level of a wake pin (the
+ * isr runs WAKE_UP_US late) or when a device model wakes a firmware task.
+ * An edge on a pin that can not wake the chip is lost, a level stays until
+ * the next wake.
+ */
+struct esp_pm_lock {
+    esp_pm_lock_type_t type;
+    const char* name;
+    int count;
+    uint32_t taken;
+};
+
+static struct esp_pm_lock locks[LOCK_MAX];
+static int lockCount = 0;
+static int held[ESP_PM_NO_LIGHT_SLEEP+1];   //locks held per type
+static bool configured = false;
+static int maxFreq = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+static int minFreq = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+static bool lightSleep = false;
+static bool gpioWakeup = false;
+static bool asleep = false;
+static int64_t sleepStart;
+static int64_t accounted = 0;           //us, time booked into stats up to here
+static int64_t wakeReady = 0;           //us, chip up again after a pin woke it
+static int64_t wakeEvent = -1;          //us, level of the pin that woke the chip, -1: none pending
+static sim_pm_stats_t stats;
+
+static bool full_speed()
+{
+    return !configured || held[ESP_PM_CPU_FREQ_MAX] > 0 || held[ESP_PM_APB_FREQ_MAX] > 0;
+}
+
+// book the time since the last call to the current mode
+static void account(int64_t until)
+{
+    if (until <= accounted) return;
+    int64_t span = until-accounted;
+    if (asleep) {
+        stats.sleep += span;
+    } else if (full_speed()) {
+        stats.fast += span;
+    } else {
+        stats.slow += span;
+    }
+    accounted = until;
+}
+
+static void wake(sim_wake_e cause)
+{
+    int64_t now = sim_now();
+    int64_t end = now;
+    if (cause == SIM_WAKE_TIMER) {
+        end = now-WAKE_UP_US > sleepStart ? now-WAKE_UP_US : sleepStart;
+    }
+    account(end);
+    asleep = false;
+    stats.wakes[cause]++;
+}
+
+void sim_pm_idle(int64_t timeout)
+{
+    if (asleep || !lightSleep) return;
+    int64_t now = sim_now();
+    if (now < wakeReady) return;
+    if (held[ESP_PM_CPU_FREQ_MAX]+held[ESP_PM_APB_FREQ_MAX]+held[ESP_PM_NO_LIGHT_SLEEP] > 0) return;
+    //tickless idle counts ticks to the next task timeout
+    if (timeout >= 0 && timeout/TICK_US-now/TICK_US < CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP) return;
+    int64_t until = timeout;
+    int64_t alarm = esp_timer_get_next_alarm();
+    if (alarm != INT64_MAX && (until < 0 || alarm < until)) until = alarm;
+    //too short to get out in time
+    if (until >= 0 && until-now < 2*WAKE_UP_US) return;
+
+    account(now);
+    asleep = true;
+    sleepStart = now;
+    stats.sleeps++;
+}
+
+void sim_pm_wake(sim_wake_e cause)
+{
+    if (!asleep) return;
+    wake(cause);
+    //levels raised while asleep, their isrs run now
+    sim_gpio_resume();
+}
+
+bool sim_pm_asleep()
+{
+    return asleep;
+}
+
+bool sim_pm_gpio_interrupt(bool wakeSource)
+{
+    if (asleep) {
+        if (!wakeSource || !gpioWakeup) return false;
+        wake(SIM_WAKE_GPIO);
+        wakeEvent = sim_now();
+        wakeReady = wakeEvent+WAKE_UP_US;
+        sim_sleep_until(wakeReady);
+        sim_gpio_resume();
+        return true;
+    }
+    //woken by another pin a moment ago, not up yet
+    if (sim_now() < wakeReady) sim_sleep_until(wakeReady);
+    return true;
+}
+
+void sim_pm_lost_irq()
+{
+    stats.lost_irqs++;
+}
+
+void sim_pm_firmware_runs()
+{
+    if (wakeEvent < 0 || sim_now() < wakeReady) return;
+    uint32_t latency = (uint32_t)(sim_now()-wakeEvent);
+    wakeEvent = -1;
+    stats.wake_latency_sum += latency;
+    stats.wake_latency_count++;
+    if (latency > stats.wake_latency_max) stats.wake_latency_max = latency;
+}
+
+void sim_pm_bus_transfer()
+{
+    //the bus clock is divided down from apb, 40 MHz instead of 80 without a lock
+    if (!full_speed()) stats.slow_transfers++;
+}
+
+void sim_pm_get_stats(sim_pm_stats_t* out)
+{
+    account(sim_now());
+    memcpy(out, &stats, sizeof(sim_pm_stats_t));
+    out->configured = configured;
+    out->light_sleep = lightSleep;
+    out->max_freq = maxFreq;
+    out->min_freq = minFreq;
+}
+
+esp_err_t esp_pm_configure(const void* vconfig)
+{
+    const esp_pm_config_esp32_t* config = vconfig;
+    if (config == NULL || config->min_freq_mhz > config->max_freq_mhz) return ESP_ERR_INVALID_ARG;
+    account(sim_now());
+    configured = true;
+    maxFreq = config->max_freq_mhz;
+    minFreq = config->min_freq_mhz;
+    lightSleep = config->light_sleep_enable;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char* name, esp_pm_lock_handle_t* out_handle)
+{
+    if (out_handle == NULL || lock_type > ESP_PM_NO_LIGHT_SLEEP) return ESP_ERR_INVALID_ARG;
+    if (lockCount >= LOCK_MAX) return ESP_ERR_NO_MEM;
+    struct esp_pm_lock* lock = &locks[lockCount++];
+    lock->type = lock_type;
+    lock->name = name != NULL ? name : "";
+    *out_handle = lock;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_delete(esp_pm_lock_handle_t handle)
+{
+    if (handle == NULL) return ESP_ERR_INVALID_ARG;
+    return handle->count > 0 ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+    if (handle == NULL) return ESP_ERR_INVALID_ARG;
+    if (handle->count++ == 0) {
+        account(sim_now());
+        held[handle->type]++;
+    }
+    handle->taken++;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+    if (handle == NULL) return ESP_ERR_INVALID_ARG;
+    if (handle->count == 0) return ESP_ERR_INVALID_STATE;
+    if (--handle->count == 0) {
+        account(sim_now());
+        held[handle->type]--;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_dump_locks(FILE* stream)
+{
+    static const char* typeNames[] = { "CPU_FREQ_MAX", "APB_FREQ_MAX", "NO_LIGHT_SLEEP" };
+    fprintf(stream, "%-12s %-16s %8s %8s\n", "lock", "type", "count", "taken");
+    for (int i = 0; i < lockCount; i++) {
+        fprintf(stream, "%-12s %-16s %8d %8u\n", locks[i].name, typeNames[locks[i].type], locks[i].count, locks[i].taken);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup()
+{
+    gpioWakeup = true;
+    return ESP_OK;
+}
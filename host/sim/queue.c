@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "sim.h"
+
+/* Queues and semaphores share one structure, a semaphore is a queue of empty items */
+enum {
+    QUEUE_TYPE_BASE,
+    QUEUE_TYPE_SEMAPHORE,
+    QUEUE_TYPE_MUTEX,
+    QUEUE_TYPE_RECURSIVE_MUTEX
+};
+
+typedef struct {
+    int type;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t* storage;
+    TaskHandle_t holder;        //mutex owner
+    UBaseType_t depth;          //recursive mutex
+    bool heap;                  //false: static, not freed
+} sim_queue_t;
+
+_Static_assert(sizeof(StaticQueue_t) >= sizeof(sim_queue_t), "StaticQueue_t too small");
+
+static sim_queue_t* queue_init(sim_queue_t* queue, int type, UBaseType_t length, UBaseType_t itemSize, uint8_t* storage)
+{
+    memset(queue, 0, sizeof(sim_queue_t));
+    queue->type = type;
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->storage = storage;
+    return queue;
+}
+
+static sim_queue_t* queue_create(int type, UBaseType_t length, UBaseType_t itemSize)
+{
+    sim_queue_t* queue = malloc(sizeof(sim_queue_t)+length*itemSize);
+    if (queue == NULL) return NULL;
+    queue_init(queue, type, length, itemSize, (uint8_t*)(queue+1));
+    queue->heap = true;
+    return queue;
+}
+
+static void queue_push(sim_queue_t* queue, const void* item, bool front)
+{
+    if (queue->itemSize > 0) {
+        UBaseType_t slot;
+        if (front) {
+            queue->head = (queue->head+queue->length-1)%queue->length;
+            slot = queue->head;
+        } else {
+            slot = (queue->head+queue->count)%queue->length;
+        }
+        memcpy(queue->storage+slot*queue->itemSize, item, queue->itemSize);
+    }
+    queue->count++;
+}
+
+static void queue_pop(sim_queue_t* queue, void* buffer, bool peek)
+{
+    if (queue->itemSize > 0) {
+        memcpy(buffer, queue->storage+queue->head*queue->itemSize, queue->itemSize);
+    }
+    if (!peek) {
+        queue->head = (queue->head+1)%queue->length;
+        queue->count--;
+    }
+}
+
+static BaseType_t queue_send(sim_queue_t* queue, const void* item, TickType_t wait, bool front)
+{
+    int64_t deadline = sim_tick_deadline(wait);
+    while (queue->count >= queue->length) {
+        if (wait == 0 || !sim_wait(queue, deadline)) return errQUEUE_FULL;
+    }
+    queue_push(queue, item, front);
+    if (sim_wake(queue)) sim_preempt();
+    return pdPASS;
+}
+
+static BaseType_t queue_receive(sim_queue_t* queue, void* buffer, TickType_t wait, bool peek)
+{
+    int64_t deadline = sim_tick_deadline(wait);
+    while (queue->count == 0) {
+        if (wait == 0 || !sim_wait(queue, deadline)) return errQUEUE_EMPTY;
+    }
+    queue_pop(queue, buffer, peek);
+    if (!peek && sim_wake(queue)) sim_preempt();
+    return pdPASS;
+}
+
+static BaseType_t queue_send_isr(sim_queue_t* queue, const void* item, bool front, BaseType_t* woken)
+{
+    if (queue->count >= queue->length) return errQUEUE_FULL;
+    queue_push(queue, item, front);
+    if (sim_wake(queue) && woken != NULL) *woken = pdTRUE;
+    return pdPASS;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    return queue_create(QUEUE_TYPE_BASE, length, itemSize);
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t* storage, StaticQueue_t* buffer)
+{
+    return queue_init((sim_queue_t*)buffer, QUEUE_TYPE_BASE, length, itemSize, storage);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (((sim_queue_t*)queue)->heap) free(queue);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t wait)
+{
+    return queue_send(queue, item, wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t wait)
+{
+    return queue_send(queue, item, wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t wait)
+{
+    return queue_receive(queue, buffer, wait, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* buffer, TickType_t wait)
+{
+    return queue_receive(queue, buffer, wait, true);
+}
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken)
+{
+    return queue_send_isr(queue, item, false, higherPriorityTaskWoken);
+}
+
+BaseType_t xQueueSendToFrontFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken)
+{
+    return queue_send_isr(queue, item, true, higherPriorityTaskWoken);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void* buffer, BaseType_t* higherPriorityTaskWoken)
+{
+    sim_queue_t* q = queue;
+    if (q->count == 0) return pdFAIL;
+    queue_pop(q, buffer, false);
+    if (sim_wake(q) && higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdTRUE;
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return ((sim_queue_t*)queue)->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    sim_queue_t* q = queue;
+    return q->length-q->count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    sim_queue_t* q = queue;
+    q->count = 0;
+    q->head = 0;
+    //senders blocked on a full queue can go now
+    if (sim_wake(q)) sim_preempt();
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return queue_create(QUEUE_TYPE_SEMAPHORE, 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+    sim_queue_t* semaphore = queue_create(QUEUE_TYPE_SEMAPHORE, maxCount, 0);
+    if (semaphore != NULL) semaphore->count = initialCount;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    sim_queue_t* mutex = queue_create(QUEUE_TYPE_MUTEX, 1, 0);
+    if (mutex != NULL) mutex->count = 1;
+    return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    sim_queue_t* mutex = queue_create(QUEUE_TYPE_RECURSIVE_MUTEX, 1, 0);
+    if (mutex != NULL) mutex->count = 1;
+    return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer)
+{
+    return queue_init((sim_queue_t*)buffer, QUEUE_TYPE_SEMAPHORE, 1, 0, NULL);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t maxCount, UBaseType_t initialCount, StaticSemaphore_t* buffer)
+{
+    sim_queue_t* semaphore = queue_init((sim_queue_t*)buffer, QUEUE_TYPE_SEMAPHORE, maxCount, 0, NULL);
+    semaphore->count = initialCount;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer)
+{
+    sim_queue_t* mutex = queue_init((sim_queue_t*)buffer, QUEUE_TYPE_MUTEX, 1, 0, NULL);
+    mutex->count = 1;
+    return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* buffer)
+{
+    sim_queue_t* mutex = queue_init((sim_queue_t*)buffer, QUEUE_TYPE_RECURSIVE_MUTEX, 1, 0, NULL);
+    mutex->count = 1;
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    sim_queue_t* s = semaphore;
+    if (queue_receive(s, NULL, wait, false) != pdPASS) return pdFAIL;
+    if (s->type == QUEUE_TYPE_MUTEX) s->holder = xTaskGetCurrentTaskHandle();
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    sim_queue_t* s = semaphore;
+    if (s->type == QUEUE_TYPE_MUTEX) {
+        if (s->holder != xTaskGetCurrentTaskHandle()) return pdFAIL;
+        s->holder = NULL;
+    }
+    return queue_send(s, NULL, 0, false);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t wait)
+{
+    sim_queue_t* m = mutex;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (m->holder == self) {
+        m->depth++;
+        return pdPASS;
+    }
+    if (queue_receive(m, NULL, wait, false) != pdPASS) return pdFAIL;
+    m->holder = self;
+    m->depth = 1;
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+    sim_queue_t* m = mutex;
+    if (m->holder != xTaskGetCurrentTaskHandle()) return pdFAIL;
+    if (--m->depth > 0) return pdPASS;
+    m->holder = NULL;
+    return queue_send(m, NULL, 0, false);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higherPriorityTaskWoken)
+{
+    return queue_send_isr(semaphore, NULL, false, higherPriorityTaskWoken);
+}
+
+BaseType_t xSemaphoreTakeFromISR(SemaphoreHandle_t semaphore, BaseType_t* higherPriorityTaskWoken)
+{
+    return xQueueReceiveFromISR(semaphore, NULL, higherPriorityTaskWoken);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore)
+{
+    return uxQueueMessagesWaiting(semaphore);
+}
@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_freertos_hooks.h"
+#include "sim.h"
+
+#define TICK_US                 (1000000/configTICK_RATE_HZ)
+#define TASK_MAX                32
+#define TASK_STACK              (256*1024)  //host frames are larger than on the esp32
+#define HOOK_MAX                4
+#define STACK_FILL              0xa5        //untouched stack bytes
+
+enum {
+    TASK_READY,
+    TASK_BLOCKED,
+    TASK_DELETED
+};
+
+typedef struct {
+    pthread_t thread;
+    pthread_cond_t cond;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    int state;
+    const void* waitObject;     //NULL: plain delay
+    int64_t wakeTime;           //us, -1: no timeout
+    bool timedOut;
+    uint64_t readySeq;          //FIFO inside one priority
+    TaskFunction_t code;
+    void* param;
+    UBaseType_t number;
+    uint32_t stackDepth;        //bytes asked for
+    uint8_t* stack;             //host stack, lowest address
+    uint8_t* stackStart;        //frame of task_entry, host frames below it are the task's
+    uint64_t runTime;           //us of host time
+    uint32_t notifyValue;       //task notification, waited on at its address
+    bool notifyPending;
+} sim_task_t;
+
+/* Held by the running task, every API below is called with it */
+static pthread_mutex_t kernelLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idleCond = PTHREAD_COND_INITIALIZER;
+static void (*exitFn)() = NULL;         //run by the kernel thread, see sim_kernel_exit()
+static sim_task_t* tasks[TASK_MAX];
+static int taskCount = 0;
+static sim_task_t* current = NULL;
+static uint64_t readySeq = 0;
+static uint64_t switches = 0;
+static UBaseType_t taskNumber = 0;
+static uint64_t runStart;       //us, host time the run time accounting got to
+static uint64_t kernelStart;    //us, host time
+static int64_t now = 0;
+static int64_t endTime = -1;
+static double speed = 0;
+static struct timespec realStart;
+static esp_freertos_idle_cb_t idleHooks[HOOK_MAX];
+static esp_freertos_tick_cb_t tickHooks[HOOK_MAX];
+
+// firmware tasks run on the esp32, the device models and the scenario beside it
+static bool is_firmware(const sim_task_t* task)
+{
+    return task->priority < SIM_TASK_PRIORITY;
+}
+
+static uint64_t host_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000+t.tv_nsec/1000;
+}
+
+static void make_ready(sim_task_t* task)
+{
+    task->state = TASK_READY;
+    task->waitObject = NULL;
+    task->wakeTime = -1;
+    task->readySeq = ++readySeq;
+}
+
+static sim_task_t* pick_next()
+{
+    sim_task_t* best = NULL;
+    for (int i = 0; i < taskCount; i++) {
+        sim_task_t* task = tasks[i];
+        if (task->state != TASK_READY) continue;
+        if (best == NULL || task->priority > best->priority
+                || (task->priority == best->priority && task->readySeq < best->readySeq)) {
+            best = task;
+        }
+    }
+    return best;
+}
+
+static void pace(int64_t time)
+{
+    if (speed <= 0) return;
+    int64_t real = (int64_t)(time/speed);
+    struct timespec at = realStart;
+    at.tv_sec += real/1000000;
+    at.tv_nsec += (real%1000000)*1000;
+    if (at.tv_nsec >= 1000000000) {
+        at.tv_sec++;
+        at.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+}
+
+// nothing ready: run the idle hooks and move the clock to the next wake up
+static void advance()
+{
+    for (int i = 0; i < HOOK_MAX; i++) {
+        if (idleHooks[i] != NULL) idleHooks[i]();
+    }
+    if (pick_next() != NULL) return;
+
+    int64_t next = -1;
+    int64_t timeout = -1;       //of the firmware, esp_timer alarms are no ticks
+    for (int i = 0; i < taskCount; i++) {
+        sim_task_t* task = tasks[i];
+        if (task->state != TASK_BLOCKED || task->wakeTime < 0) continue;
+        if (next < 0 || task->wakeTime < next) next = task->wakeTime;
+        if (is_firmware(task) && task != sim_timer_task() && (timeout < 0 || task->wakeTime < timeout)) {
+            timeout = task->wakeTime;
+        }
+    }
+    sim_pm_idle(timeout);
+    if (next < 0) {
+        fprintf(stderr, "sim: every task blocked forever at %lld us\n", (long long)now);
+        sim_end();
+    }
+    if (endTime >= 0 && next >= endTime) {
+        now = endTime;
+        sim_end();
+    }
+    pace(next);
+
+    int64_t tick = now/TICK_US;
+    now = next;
+    for (int i = 0; i < taskCount; i++) {
+        sim_task_t* task = tasks[i];
+        if (task->state == TASK_BLOCKED && task->wakeTime >= 0 && task->wakeTime <= now) {
+            if (is_firmware(task)) sim_pm_wake(SIM_WAKE_TIMER);
+            make_ready(task);
+            task->timedOut = true;
+        }
+    }
+    for (; tick < now/TICK_US; tick++) {
+        for (int i = 0; i < HOOK_MAX; i++) {
+            if (tickHooks[i] != NULL) tickHooks[i]();
+        }
+    }
+    //host time spent here is idle, nobody's
+    runStart = host_us();
+}
+
+// hand the kernel to the best ready task, return once the caller is picked again
+static void reschedule()
+{
+    sim_task_t* self = current;
+    sim_task_t* next;
+    uint64_t host = host_us();
+    self->runTime += host-runStart;
+    runStart = host;
+    while ((next = pick_next()) == NULL) {
+        advance();
+    }
+    if (next != self) {
+        switches++;
+        if (is_firmware(next)) sim_pm_firmware_runs();
+        current = next;
+        pthread_cond_signal(&next->cond);
+    }
+    if (self->state == TASK_DELETED) {
+        pthread_mutex_unlock(&kernelLock);
+        pthread_exit(NULL);
+    }
+    while (current != self) {
+        pthread_cond_wait(&self->cond, &kernelLock);
+    }
+}
+
+static void* task_entry(void* arg)
+{
+    sim_task_t* task = arg;
+    task->stackStart = __builtin_frame_address(0);
+    pthread_mutex_lock(&kernelLock);
+    while (current != task) {
+        pthread_cond_wait(&task->cond, &kernelLock);
+    }
+    task->code(task->param);
+    //a FreeRTOS task must not return
+    fprintf(stderr, "sim: task %s returned\n", task->name);
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+int64_t sim_now()
+{
+    return now;
+}
+
+uint64_t sim_switches()
+{
+    return switches;
+}
+
+int64_t sim_tick_deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) return -1;
+    //FreeRTOS wakes on tick boundaries
+    return (now/TICK_US + ticks)*TICK_US;
+}
+
+bool sim_wait(const void* object, int64_t deadline)
+{
+    if (deadline >= 0 && deadline <= now) return false;
+    //no kernel running (the benchmarks): nothing can wake the caller, the clock jumps
+    if (current == NULL) {
+        if (deadline > now) now = deadline;
+        return false;
+    }
+    current->state = TASK_BLOCKED;
+    current->waitObject = object;
+    current->wakeTime = deadline;
+    current->timedOut = false;
+    reschedule();
+    return !current->timedOut;
+}
+
+bool sim_wake(const void* object)
+{
+    bool higher = false;
+    for (int i = 0; i < taskCount; i++) {
+        sim_task_t* task = tasks[i];
+        if (task->state == TASK_BLOCKED && task->waitObject == object && object != NULL) {
+            if (is_firmware(task)) sim_pm_wake(SIM_WAKE_OTHER);
+            make_ready(task);
+            task->timedOut = false;
+            if (current == NULL || task->priority > current->priority) {
+                higher = true;
+            }
+        }
+    }
+    return higher;
+}
+
+void sim_preempt()
+{
+    if (current == NULL) return;
+    sim_task_t* next = pick_next();
+    if (next != NULL && next != current && next->priority > current->priority) {
+        reschedule();
+    }
+}
+
+void sim_sleep_until(int64_t time)
+{
+    while (now < time) {
+        sim_wait(NULL, time);
+    }
+}
+
+void sim_sleep(int64_t us)
+{
+    sim_sleep_until(now+us);
+}
+
+void sim_kernel_init()
+{
+    //the thread setting up the simulation counts as running
+    pthread_mutex_lock(&kernelLock);
+}
+
+void sim_kernel_run(int64_t end, double pace)
+{
+    endTime = end;
+    speed = pace;
+    clock_gettime(CLOCK_MONOTONIC, &realStart);
+    kernelStart = runStart = host_us();
+    sim_task_t* first;
+    while ((first = pick_next()) == NULL) {
+        advance();
+    }
+    current = first;
+    pthread_cond_signal(&first->cond);
+    //from here on the tasks pass the kernel around, sim_end() exits the process
+    while (exitFn == NULL) {
+        pthread_cond_wait(&idleCond, &kernelLock);
+    }
+    exitFn();
+    exit(1);
+}
+
+void sim_kernel_exit(void (*fn)())
+{
+    if (current == NULL) {
+        fn();
+        exit(1);
+    }
+    //not on the stack of the task that got here, it would show in its high water mark
+    exitFn = fn;
+    pthread_cond_signal(&idleCond);
+    while (1) {
+        pthread_cond_wait(&current->cond, &kernelLock);
+    }
+}
+
+void vPortYield(void)
+{
+    if (current == NULL) return;
+    make_ready(current);
+    reschedule();
+}
+
+void vPortYieldFromISR(void)
+{
+    //isrs run inside a device model task, which gives way once it blocks
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+uint32_t xthal_get_ccount(void)
+{
+    return (uint32_t)(now*CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char* name, uint32_t stackDepth,
+                                   void* param, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core)
+{
+    if (taskCount >= TASK_MAX) return pdFAIL;
+    sim_task_t* task = calloc(1, sizeof(sim_task_t));
+    if (task == NULL) return pdFAIL;
+    //painted, the high water mark is where the paint ends
+    task->stack = malloc(TASK_STACK);
+    if (task->stack == NULL) {
+        free(task);
+        return pdFAIL;
+    }
+    memset(task->stack, STACK_FILL, TASK_STACK);
+    strncpy(task->name, name, configMAX_TASK_NAME_LEN-1);
+    task->priority = priority < configMAX_PRIORITIES ? priority : configMAX_PRIORITIES-1;
+    task->code = code;
+    task->param = param;
+    task->number = ++taskNumber;
+    task->stackDepth = stackDepth;
+    pthread_cond_init(&task->cond, NULL);
+    make_ready(task);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, TASK_STACK);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&task->thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        free(task->stack);
+        free(task);
+        return pdFAIL;
+    }
+    tasks[taskCount++] = task;
+    if (handle != NULL) *handle = task;
+    sim_preempt();
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t code, const char* name, uint32_t stackDepth, void* param,
+                                           UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer, BaseType_t core)
+{
+    if (stack == NULL || buffer == NULL) return NULL;
+    TaskHandle_t handle = NULL;
+    xTaskCreatePinnedToCore(code, name, stackDepth, param, priority, &handle, core);
+    return handle;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t code, const char* name, uint32_t stackDepth, void* param,
+                               UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer)
+{
+    return xTaskCreateStaticPinnedToCore(code, name, stackDepth, param, priority, stack, buffer, tskNO_AFFINITY);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t stackDepth,
+                       void* param, UBaseType_t priority, TaskHandle_t* handle)
+{
+    return xTaskCreatePinnedToCore(code, name, stackDepth, param, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t handle)
+{
+    sim_task_t* task = handle != NULL ? handle : current;
+    task->state = TASK_DELETED;
+    for (int i = 0; i < taskCount; i++) {
+        if (tasks[i] == task) {
+            tasks[i] = tasks[--taskCount];
+            break;
+        }
+    }
+    //the thread of another task stays parked on its condition
+    if (task == current) {
+        reschedule();
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) {
+        vPortYield();
+        return;
+    }
+    sim_sleep_until(sim_tick_deadline(ticks));
+}
+
+void vTaskDelayUntil(TickType_t* previousWakeTime, TickType_t increment)
+{
+    *previousWakeTime += increment;
+    sim_sleep_until((int64_t)*previousWakeTime*TICK_US);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now/TICK_US);
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current;
+}
+
+char* pcTaskGetTaskName(TaskHandle_t handle)
+{
+    sim_task_t* task = handle != NULL ? handle : current;
+    return task->name;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t handle)
+{
+    sim_task_t* task = handle != NULL ? handle : current;
+    return task->priority;
+}
+
+void vTaskPrioritySet(TaskHandle_t handle, UBaseType_t priority)
+{
+    sim_task_t* task = handle != NULL ? handle : current;
+    task->priority = priority < configMAX_PRIORITIES ? priority : configMAX_PRIORITIES-1;
+    sim_preempt();
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    return taskCount;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t handle)
+{
+    sim_task_t* task = handle != NULL ? handle : current;
+    uint8_t* p = task->stack;
+    while (p < task->stackStart && *p == STACK_FILL) {
+        p++;
+    }
+    uint32_t used = task->stackStart-p;
+    return used < task->stackDepth ? task->stackDepth-used : 0;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t size, uint32_t* totalRunTime)
+{
+    if (size < taskCount) return 0;
+    //bring the running task up to date
+    uint64_t host = host_us();
+    if (current != NULL) current->runTime += host-runStart;
+    runStart = host;
+
+    for (int i = 0; i < taskCount; i++) {
+        sim_task_t* task = tasks[i];
+        status[i].xHandle = task;
+        status[i].pcTaskName = task->name;
+        status[i].xTaskNumber = task->number;
+        status[i].eCurrentState = task == current ? eRunning : task->state == TASK_READY ? eReady : eBlocked;
+        status[i].uxCurrentPriority = task->priority;
+        status[i].uxBasePriority = task->priority;
+        status[i].ulRunTimeCounter = task->runTime;
+        status[i].pxStackBase = NULL;
+        status[i].usStackHighWaterMark = uxTaskGetStackHighWaterMark(task);
+    }
+    if (totalRunTime != NULL) *totalRunTime = host-kernelStart;
+    return taskCount;
+}
+
+static BaseType_t notify(sim_task_t* task, uint32_t value, eNotifyAction action)
+{
+    switch (action) {
+        case eSetBits:
+            task->notifyValue |= value;
+            break;
+        case eIncrement:
+            task->notifyValue++;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (task->notifyPending) return pdFAIL;
+            task->notifyValue = value;
+            break;
+        case eSetValueWithOverwrite:
+            task->notifyValue = value;
+            break;
+        default:
+            break;
+    }
+    task->notifyPending = true;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t handle, uint32_t value, eNotifyAction action)
+{
+    sim_task_t* task = handle;
+    BaseType_t ret = notify(task, value, action);
+    if (sim_wake(&task->notifyValue)) sim_preempt();
+    return ret;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t handle, uint32_t value, eNotifyAction action, BaseType_t* woken)
+{
+    sim_task_t* task = handle;
+    BaseType_t ret = notify(task, value, action);
+    if (sim_wake(&task->notifyValue) && woken != NULL) *woken = pdTRUE;
+    return ret;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t wait)
+{
+    sim_task_t* task = current;
+    if (!task->notifyPending) {
+        task->notifyValue &= ~clearOnEntry;
+        int64_t deadline = sim_tick_deadline(wait);
+        while (!task->notifyPending) {
+            if (wait == 0 || !sim_wait(&task->notifyValue, deadline)) break;
+        }
+    }
+    if (value != NULL) *value = task->notifyValue;
+    if (!task->notifyPending) return pdFALSE;
+    task->notifyValue &= ~clearOnExit;
+    task->notifyPending = false;
+    return pdTRUE;
+}
+
+esp_err_t esp_register_freertos_idle_hook_for_cpu(esp_freertos_idle_cb_t new_idle_cb, UBaseType_t cpuid)
+{
+    for (int i = 0; i < HOOK_MAX; i++) {
+        if (idleHooks[i] == NULL) {
+            idleHooks[i] = new_idle_cb;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_register_freertos_tick_hook_for_cpu(esp_freertos_tick_cb_t new_tick_cb, UBaseType_t cpuid)
+{
+    for (int i = 0; i < HOOK_MAX; i++) {
+        if (tickHooks[i] == NULL) {
+            tickHooks[i] = new_tick_cb;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_register_freertos_idle_hook(esp_freertos_idle_cb_t new_idle_cb)
+{
+    return esp_register_freertos_idle_hook_for_cpu(new_idle_cb, 0);
+}
+
+esp_err_t esp_register_freertos_tick_hook(esp_freertos_tick_cb_t new_tick_cb)
+{
+    return esp_register_freertos_tick_hook_for_cpu(new_tick_cb, 0);
+}
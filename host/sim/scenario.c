@@ -0,0 +1,556 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "config.h"
+#include "history.h"
+#include "io_loop.h"
+#include "key_event.h"
+#include "latency.h"
+#include "ota.h"
+#include "webserver.h"
+#include "mbedtls/sha256.h"
+#include "sim.h"
+
+#define TAG                     "SCENARIO"
+
+#define STEP_MAX                256
+#define ARG_MAX                 4
+#define SLIDER_REPORT_US        20000       //CPT112S slider report interval
+#define SLIDER_RELEASE          0xffff
+#define WS_REPLY_US             10000       //lan round trip and the web server's turn
+#define WS_TEXT_MAX             32
+#define OTA_HOST                "fw.lan"
+#define OTA_PORT                8070
+#define OTA_PATH                "/black_fire.bin"
+#define OTA_IMAGE_MAGIC         0xE9
+
+/*
+ * Scenario script, one step per line:
+ *
+ *   <seconds> <command> [args]          # comment
+ *
+ *   water <degree>                      water and probe temperature
+ *   ambient <degree>
+ *   noise <counts>                      adc noise, standard deviation (default 30)
+ *   touch [ms]                          tap the right pad (heat on/off)
+ *   slide <from> <to> [ms] [hold ms]    swipe the slider, rest on <to> before
+ *                                       the release
+ *   key [ms] [bounces] [us]             press the left key (hold), with bounce
+ *                                       pulses on both edges (default 3 of 400 us)
+ *   i2cfail <count>                     fail the next i2c transactions
+ *   i2chang <count>                     the next i2c transactions hang until
+ *                                       their timeout
+ *   keysound <0|1>                      key beep setting, flushed at once
+ *   latency_reset                       start the input latency figures over
+ *   flash_reset                         start the flash and settings counts over
+ *   flash_fail <count>                  fail the next partition writes
+ *   ws <command>                        websocket command (webserver.h) from a
+ *                                       client on the lan, connected on first
+ *                                       use; the reply must be "ok"
+ *   ota <KB> [drop at] [misranges]      bring the station up, serve an image of
+ *                                       KB over http and start the upgrade; the
+ *                                       server drops the connection once byte
+ *                                       <drop at> is sent and answers the next
+ *                                       misranges range requests from byte 0
+ *   burst <per second> <ms> [cluster]   post key events from interrupt context,
+ *                                       right key hold and slider +1/-1 in turn,
+ *                                       cluster of them per interrupt (default 1)
+ *   expect <what> <op> <value>          what: water display heat target history
+ *                                       display_changes (times the text changed)
+ *                                       first_reading (ms)
+ *                                       io_latency (us, worst notify to thread)
+ *                                       active (% of the time out of light sleep)
+ *                                       wake_latency (us, worst wake pin to firmware)
+ *                                       lost_irqs (slept through) bus_unlocked
+ *                                       (transfers without apb lock)
+ *                                       key_loss (% of queued key events dropped)
+ *                                       latency, latency_avg (us, input to display)
+ *                                       beeps (speaker turned on)
+ *                                       hold (hold icon lit)
+ *                                       config_changes config_writes (settings
+ *                                       cached, settings records written)
+ *                                       nvs_ops (nvs sets, erases, commits)
+ *                                       flash_writes (partition writes)
+ *                                       ota_state (ota.h) ota_resumes
+ *                                       ota_rate (KB/s written, start to end)
+ *                                       ota_image (1: the update slot holds the
+ *                                       served image, by sha256)
+ *                                       http_requests http_ranges http_range
+ *                                       (start of the last range request)
+ *                                       op: == != < <= > >=
+ *   end                                 stop here
+ *
+ * Steps run in file order, a gesture holds the script for its duration.
+ * A restart (esp_restart()) ends the run, the expects left in the script
+ * are checked right then, on what the firmware leaves behind.
+ */
+typedef struct {
+    int line;
+    int64_t time;               //us
+    char command[16];
+    char what[16];              //expect
+    char op[4];                 //expect
+    char text[WS_TEXT_MAX];     //ws
+    double args[ARG_MAX];
+    int argc;
+} step_t;
+
+static step_t steps[STEP_MAX];
+static int stepCount = 0;
+static int nextStep = 0;
+static int failures = 0;
+static int wsSocket = -1;
+//counts at the last flash_reset
+static config_stats_t configBase;
+static sim_flash_stats_t flashBase;
+static uint8_t* otaImage = NULL;
+static size_t otaLen = 0;
+
+bool sim_scenario_load(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "sim: cannot open scenario %s\n", path);
+        return false;
+    }
+    char line[256];
+    int number = 0;
+    int64_t last = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = 0;
+        char* tokens[8];
+        int count = 0;
+        for (char* t = strtok(line, " \t\r\n"); t != NULL && count < 8; t = strtok(NULL, " \t\r\n")) {
+            tokens[count++] = t;
+        }
+        if (count == 0) continue;
+        if (count < 2 || stepCount >= STEP_MAX) {
+            fprintf(stderr, "sim: %s:%d: bad step\n", path, number);
+            fclose(f);
+            return false;
+        }
+        step_t* step = &steps[stepCount++];
+        memset(step, 0, sizeof(step_t));
+        step->line = number;
+        step->time = (int64_t)(atof(tokens[0])*1000000);
+        if (step->time < last) {
+            fprintf(stderr, "sim: %s:%d: steps must be in time order\n", path, number);
+            fclose(f);
+            return false;
+        }
+        last = step->time;
+        strncpy(step->command, tokens[1], sizeof(step->command)-1);
+        int first = 2;
+        if (strcmp(step->command, "expect") == 0) {
+            if (count != 5) {
+                fprintf(stderr, "sim: %s:%d: expect <what> <op> <value>\n", path, number);
+                fclose(f);
+                return false;
+            }
+            strncpy(step->what, tokens[2], sizeof(step->what)-1);
+            strncpy(step->op, tokens[3], sizeof(step->op)-1);
+            first = 4;
+        } else if (strcmp(step->command, "ws") == 0) {
+            //the command as it is, numbers included
+            for (int i = 2; i < count; i++) {
+                if (i > 2) strncat(step->text, " ", sizeof(step->text)-strlen(step->text)-1);
+                strncat(step->text, tokens[i], sizeof(step->text)-strlen(step->text)-1);
+            }
+            first = count;
+        }
+        for (int i = first; i < count && step->argc < ARG_MAX; i++) {
+            step->args[step->argc++] = atof(tokens[i]);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static double arg(const step_t* step, int index, double fallback)
+{
+    return index < step->argc ? step->args[index] : fallback;
+}
+
+double sim_key_loss()
+{
+    key_event_stats_t keys;
+    key_event_get_stats(&keys);
+    uint32_t posted = 0, dropped = 0;
+    for (int i = 0; i < KEY_TYPE_MAX; i++) {
+        if (i == SLIDER_KEY) continue;
+        posted += keys.posted[i];
+        dropped += keys.dropped[i];
+    }
+    return posted+dropped > 0 ? 100.0*dropped/(posted+dropped) : 0;
+}
+
+static void flash_reset()
+{
+    config_get_stats(&configBase);
+    sim_flash_get_stats(&flashBase);
+}
+
+static void sha256(const uint8_t* data, size_t len, uint8_t hash[32])
+{
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, data, len);
+    mbedtls_sha256_finish(&sha, hash);
+    mbedtls_sha256_free(&sha);
+}
+
+// the update slot holds the served image
+static bool ota_image_written()
+{
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL || otaLen > partition->size) return false;
+    uint8_t* slot = malloc(otaLen);
+    if (slot == NULL) return false;
+    uint8_t served[32];
+    uint8_t written[32];
+    esp_partition_read(partition, 0, slot, otaLen);
+    sha256(otaImage, otaLen, served);
+    sha256(slot, otaLen, written);
+    free(slot);
+    return memcmp(served, written, sizeof(served)) == 0;
+}
+
+static bool value_of(const char* what, double* value)
+{
+    int shown;
+    sim_pm_stats_t pm;
+    config_stats_t config;
+    sim_flash_stats_t flash;
+    ota_stats_t ota;
+    sim_http_stats_t http;
+    if (strcmp(what, "water") == 0) {
+        *value = sim_kettle_water();
+    } else if (strcmp(what, "display") == 0) {
+        if (!sim_display_value(&shown)) return false;
+        *value = shown;
+    } else if (strcmp(what, "display_changes") == 0) {
+        *value = sim_display_changes();
+    } else if (strcmp(what, "heat") == 0) {
+        *value = sim_heater_on();
+    } else if (strcmp(what, "target") == 0) {
+        *value = config_get_target_temperature();
+    } else if (strcmp(what, "history") == 0) {
+        *value = history_count();
+    } else if (strcmp(what, "first_reading") == 0) {
+        if (sim_display_first_reading() < 0) return false;
+        *value = sim_display_first_reading()/1000.0;
+    } else if (strcmp(what, "io_latency") == 0) {
+        *value = 0;
+        for (int i = 0; i < IO_SOURCE_MAX; i++) {
+            io_loop_stats_t io;
+            io_loop_get_stats(i, &io);
+            if (io.latency_max > *value) *value = io.latency_max;
+        }
+    } else if (strcmp(what, "active") == 0) {
+        sim_pm_get_stats(&pm);
+        int64_t span = pm.sleep+pm.fast+pm.slow;
+        *value = span > 0 ? 100.0*(pm.fast+pm.slow)/span : 100;
+    } else if (strcmp(what, "wake_latency") == 0) {
+        sim_pm_get_stats(&pm);
+        *value = pm.wake_latency_max;
+    } else if (strcmp(what, "lost_irqs") == 0) {
+        sim_pm_get_stats(&pm);
+        *value = pm.lost_irqs;
+    } else if (strcmp(what, "bus_unlocked") == 0) {
+        sim_pm_get_stats(&pm);
+        *value = pm.slow_transfers;
+    } else if (strcmp(what, "key_loss") == 0) {
+        *value = sim_key_loss();
+    } else if (strcmp(what, "latency") == 0 || strcmp(what, "latency_avg") == 0) {
+        latency_histogram_t total;
+        latency_get(LATENCY_TOTAL, &total);
+        if (total.count == 0) return false;
+        *value = strcmp(what, "latency") == 0 ? total.max : (double)total.sum/total.count;
+    } else if (strcmp(what, "hold") == 0) {
+        *value = sim_display_hold();
+    } else if (strcmp(what, "beeps") == 0) {
+        *value = sim_buzzer_beeps();
+    } else if (strcmp(what, "config_changes") == 0) {
+        config_get_stats(&config);
+        *value = config.changes-configBase.changes;
+    } else if (strcmp(what, "config_writes") == 0) {
+        config_get_stats(&config);
+        *value = config.flash_writes-configBase.flash_writes;
+    } else if (strcmp(what, "nvs_ops") == 0) {
+        sim_flash_get_stats(&flash);
+        *value = flash.nvs_writes+flash.nvs_commits-flashBase.nvs_writes-flashBase.nvs_commits;
+    } else if (strcmp(what, "flash_writes") == 0) {
+        sim_flash_get_stats(&flash);
+        *value = flash.writes-flashBase.writes;
+    } else if (strcmp(what, "ota_state") == 0) {
+        *value = ota_get_state();
+    } else if (strcmp(what, "ota_resumes") == 0) {
+        ota_get_stats(&ota);
+        *value = ota.resumes;
+    } else if (strcmp(what, "ota_rate") == 0) {
+        ota_get_stats(&ota);
+        if (ota.end_time <= ota.start_time) return false;
+        *value = ota.written/1024.0/((ota.end_time-ota.start_time)/1e6);
+    } else if (strcmp(what, "ota_image") == 0) {
+        if (otaImage == NULL) return false;
+        *value = ota_image_written();
+    } else if (strcmp(what, "http_requests") == 0) {
+        sim_net_http_get_stats(&http);
+        *value = http.requests;
+    } else if (strcmp(what, "http_ranges") == 0) {
+        sim_net_http_get_stats(&http);
+        *value = http.ranges;
+    } else if (strcmp(what, "http_range") == 0) {
+        sim_net_http_get_stats(&http);
+        if (http.ranges == 0) return false;
+        *value = http.range_start;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool compare(double a, const char* op, double b)
+{
+    if (strcmp(op, "==") == 0) return a == b;
+    if (strcmp(op, "!=") == 0) return a != b;
+    if (strcmp(op, "<") == 0) return a < b;
+    if (strcmp(op, "<=") == 0) return a <= b;
+    if (strcmp(op, ">") == 0) return a > b;
+    if (strcmp(op, ">=") == 0) return a >= b;
+    return false;
+}
+
+static void expect(const step_t* step)
+{
+    double value = 0;
+    bool known = value_of(step->what, &value);
+    if (known && compare(value, step->op, step->args[0])) {
+        ESP_LOGI(TAG, "line %d: %s %.1f %s %g ok", step->line, step->what, value, step->op, step->args[0]);
+        return;
+    }
+    failures++;
+    if (known) {
+        ESP_LOGE(TAG, "line %d: expected %s %s %g, got %.1f", step->line, step->what, step->op, step->args[0], value);
+    } else {
+        ESP_LOGE(TAG, "line %d: expected %s %s %g, no value", step->line, step->what, step->op, step->args[0]);
+    }
+}
+
+static void slide(int from, int to, int ms, int hold)
+{
+    int reports = ms*1000/SLIDER_REPORT_US;
+    if (reports < 1) reports = 1;
+    for (int i = 0; i <= reports; i++) {
+        sim_slider(from+(to-from)*i/reports);
+        sim_sleep(SLIDER_REPORT_US);
+    }
+    //the pad keeps reporting a finger at rest
+    for (int i = 0; i < hold*1000/SLIDER_REPORT_US; i++) {
+        sim_slider(to);
+        sim_sleep(SLIDER_REPORT_US);
+    }
+    sim_slider(SLIDER_RELEASE);
+}
+
+// the event bus under load: keys go through the queue, slider deltas merge
+static void burst(int rate, int ms, int cluster)
+{
+    if (rate < 1) rate = 1;
+    if (cluster < 1) cluster = 1;
+    int64_t interval = (int64_t)1000000*cluster/rate;
+    int64_t end = sim_now()+(int64_t)ms*1000;
+    uint32_t n = 0;
+    while (sim_now() < end) {
+        for (int i = 0; i < cluster; i++, n++) {
+            key_event_t keyEvent;
+            memset(&keyEvent, 0, sizeof(keyEvent));
+            if (n%2 == 0) {
+                keyEvent.key_type = RIGHT_KEY;
+                keyEvent.key_value = KEY_HOLD;
+            } else {
+                keyEvent.key_type = SLIDER_KEY;
+                keyEvent.key_value = KEY_UP;
+                keyEvent.key_data = n%4 == 1 ? -1 : 1;
+            }
+            send_key_event(keyEvent, true);
+        }
+        sim_sleep(interval);
+    }
+}
+
+// a websocket client like the control page, from the same origin
+static bool ws_open()
+{
+    static const char upgrade[] =
+            "GET /ws HTTP/1.1\r\nHost: black-fire.local\r\nOrigin: http://black-fire.local\r\n"
+            "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    wsSocket = sim_net_connect(WEBSERVER_PORT);
+    if (wsSocket < 0 || !sim_net_peer_send(wsSocket, upgrade, sizeof(upgrade)-1)) return false;
+    sim_sleep(WS_REPLY_US);
+    char reply[160];
+    size_t len = sim_net_peer_receive(wsSocket, reply, sizeof(reply)-1);
+    reply[len] = 0;
+    return strncmp(reply, "HTTP/1.1 101", 12) == 0;
+}
+
+// first text frame that is not a state push, false if none came
+static bool ws_reply(char* text, size_t size)
+{
+    uint8_t frames[1024];
+    size_t len = sim_net_peer_receive(wsSocket, frames, sizeof(frames));
+    for (size_t pos = 0; pos+2 <= len && pos+2+frames[pos+1] <= len; pos += 2+frames[pos+1]) {
+        size_t payloadLen = frames[pos+1];
+        const char* payload = (const char*)frames+pos+2;
+        if ((frames[pos] & 0x0f) != 0x1 || (payloadLen > 0 && payload[0] == '{')) continue;
+        if (payloadLen >= size) payloadLen = size-1;
+        memcpy(text, payload, payloadLen);
+        text[payloadLen] = 0;
+        return true;
+    }
+    return false;
+}
+
+static void ws_command(const step_t* step)
+{
+    if (!sim_net_peer_connected(wsSocket) && !ws_open()) {
+        ESP_LOGE(TAG, "line %d: ws: upgrade refused", step->line);
+        failures++;
+        return;
+    }
+    //clients mask every frame
+    static const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    size_t len = strlen(step->text);
+    uint8_t frame[2+4+WS_TEXT_MAX];
+    frame[0] = 0x81;                //fin, text
+    frame[1] = 0x80 | len;
+    memcpy(frame+2, mask, 4);
+    for (size_t i = 0; i < len; i++) {
+        frame[6+i] = step->text[i] ^ mask[i&3];
+    }
+    char reply[16] = "";
+    sim_net_peer_send(wsSocket, frame, 6+len);
+    sim_sleep(WS_REPLY_US);
+    if (!ws_reply(reply, sizeof(reply)) || strcmp(reply, "ok") != 0) {
+        ESP_LOGE(TAG, "line %d: ws %s: got \"%s\"", step->line, step->text, reply);
+        failures++;
+    }
+}
+
+// an image of kbytes from the http server on the lan, a xorshift stream
+// behind the image magic
+static void ota(int kbytes, int64_t dropAt, int misranges)
+{
+    static char host[] = OTA_HOST;
+    static char path[] = OTA_PATH;
+    otaLen = (size_t)kbytes*1024;
+    otaImage = realloc(otaImage, otaLen);
+    if (otaImage == NULL) return;
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < otaLen; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        otaImage[i] = x;
+    }
+    otaImage[0] = OTA_IMAGE_MAGIC;
+
+    sim_net_station_up();
+    sim_net_http_serve(OTA_HOST, OTA_PORT, OTA_PATH, otaImage, otaLen);
+    if (dropAt >= 0) sim_net_http_drop(dropAt);
+    sim_net_http_misrange(misranges);
+    //the upgrade observer starts the download on the flush
+    config_set_firmware_upgrade(host, strlen(host), OTA_PORT, path, strlen(path));
+    config_flush();
+}
+
+static void run_step(const step_t* step)
+{
+    const char* c = step->command;
+    if (strcmp(c, "water") == 0) {
+        sim_kettle_set_water(arg(step, 0, 20));
+    } else if (strcmp(c, "ambient") == 0) {
+        sim_kettle_set_ambient(arg(step, 0, 20));
+    } else if (strcmp(c, "noise") == 0) {
+        sim_kettle_set_noise(arg(step, 0, 30));
+    } else if (strcmp(c, "touch") == 0) {
+        sim_touch(true);
+        sim_sleep((int64_t)(arg(step, 0, 100)*1000));
+        sim_touch(false);
+    } else if (strcmp(c, "slide") == 0) {
+        slide((int)arg(step, 0, 0), (int)arg(step, 1, 100), (int)arg(step, 2, 300), (int)arg(step, 3, 0));
+    } else if (strcmp(c, "key") == 0) {
+        int bounces = (int)arg(step, 1, -1);
+        int bounceUs = (int)arg(step, 2, 0);
+        sim_key(true, bounces, bounceUs);
+        sim_sleep((int64_t)(arg(step, 0, 100)*1000));
+        sim_key(false, bounces, bounceUs);
+    } else if (strcmp(c, "i2cfail") == 0) {
+        sim_i2c_fail(I2C_NUM_0, (int)arg(step, 0, 1));
+    } else if (strcmp(c, "i2chang") == 0) {
+        sim_i2c_hang(I2C_NUM_0, (int)arg(step, 0, 1));
+    } else if (strcmp(c, "keysound") == 0) {
+        //flushed right away, the observers see it before the next step
+        config_set_key_sound((uint8_t)arg(step, 0, 1));
+        config_flush();
+    } else if (strcmp(c, "latency_reset") == 0) {
+        latency_reset();
+    } else if (strcmp(c, "flash_reset") == 0) {
+        flash_reset();
+    } else if (strcmp(c, "flash_fail") == 0) {
+        sim_flash_fail((int)arg(step, 0, 1));
+    } else if (strcmp(c, "ws") == 0) {
+        ws_command(step);
+    } else if (strcmp(c, "ota") == 0) {
+        ota((int)arg(step, 0, 256), (int64_t)arg(step, 1, -1), (int)arg(step, 2, 0));
+    } else if (strcmp(c, "burst") == 0) {
+        burst((int)arg(step, 0, 1000), (int)arg(step, 1, 1000), (int)arg(step, 2, 1));
+    } else if (strcmp(c, "expect") == 0) {
+        expect(step);
+    } else if (strcmp(c, "end") == 0) {
+        sim_end();
+    } else {
+        ESP_LOGE(TAG, "line %d: unknown command %s", step->line, c);
+        failures++;
+    }
+}
+
+static void scenario_task(void* arg)
+{
+    for (; nextStep < stepCount; nextStep++) {
+        sim_sleep_until(steps[nextStep].time);
+        run_step(&steps[nextStep]);
+    }
+    vTaskDelete(NULL);
+}
+
+void sim_scenario_start()
+{
+    xTaskCreate(&scenario_task, "sim_scenario", 4096, NULL, SIM_TASK_PRIORITY, NULL);
+}
+
+int64_t sim_scenario_end()
+{
+    return stepCount > 0 ? steps[stepCount-1].time : 0;
+}
+
+int sim_scenario_failures()
+{
+    return failures;
+}
+
+void sim_scenario_restart()
+{
+    for (int i = nextStep; i < stepCount; i++) {
+        if (strcmp(steps[i].command, "expect") == 0) expect(&steps[i]);
+    }
+    nextStep = stepCount;
+}
@@ -0,0 +1,226 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "driver/i2c.h"
+#include "esp_log.h"
+
+/*
+ * Host simulator of the black fire board.
+ *
+ * Every firmware task is a pthread, but only the task holding the kernel
+ * runs; the others wait on their own condition. Time is virtual: it only
+ * moves when every task is blocked, straight to the next wake up, so a
+ * scenario runs as fast as the host allows (or paced with -x).
+ * Computation takes no simulated time, bus transfers and flash operations
+ * block the calling task for their duration on the real hardware.
+ */
+
+#define SIM_TASK_PRIORITY       (configMAX_PRIORITIES-1)    //device models and the scenario
+
+/* kernel, rtos.c */
+void sim_kernel_init();
+// run the tasks until the clock reaches end (us), never returns
+void sim_kernel_run(int64_t end, double speed) __attribute__ ((noreturn));
+// stop the tasks where they are and run fn (which exits) on the kernel thread
+void sim_kernel_exit(void (*fn)()) __attribute__ ((noreturn));
+int64_t sim_now();
+uint64_t sim_switches();
+// block the calling task until object is woken or the deadline (us, -1: none) passed, false on timeout
+bool sim_wait(const void* object, int64_t deadline);
+// ready every task waiting on object, true if one of them has a higher priority than the caller
+bool sim_wake(const void* object);
+// let a higher priority ready task run
+void sim_preempt();
+void sim_sleep_until(int64_t time);
+void sim_sleep(int64_t us);
+// deadline of a FreeRTOS wait, -1 for portMAX_DELAY
+int64_t sim_tick_deadline(TickType_t ticks);
+
+/* main.c */
+// print the report and exit, status is non zero when an expectation failed
+void sim_end() __attribute__ ((noreturn));
+
+/* gpio.c, device side of the pins */
+typedef void (*sim_gpio_listener_t)(gpio_num_t pin, int level);
+// an input pin driven by a device model, runs the isr like the hardware would
+void sim_gpio_drive(gpio_num_t pin, int level);
+// called when the firmware changes an output
+void sim_gpio_set_listener(sim_gpio_listener_t listener);
+int sim_gpio_output(gpio_num_t pin);
+// the chip woke up: isrs of the levels raised meanwhile
+void sim_gpio_resume();
+
+/* esp_timer.c */
+TaskHandle_t sim_timer_task();
+
+/* pm.c, esp_pm locks and light sleep of the chip */
+typedef enum {
+    SIM_WAKE_TIMER,             //task timeout or esp_timer alarm
+    SIM_WAKE_GPIO,              //level of a wake pin
+    SIM_WAKE_OTHER,             //a device model woke a firmware task
+    SIM_WAKE_MAX
+} sim_wake_e;
+
+typedef struct {
+    bool configured;            //esp_pm_configure() called
+    bool light_sleep;
+    int max_freq;               //MHz
+    int min_freq;
+    int64_t sleep;              //us in light sleep
+    int64_t fast;               //us awake at max_freq, a lock held
+    int64_t slow;               //us awake at min_freq
+    uint32_t sleeps;
+    uint32_t wakes[SIM_WAKE_MAX];
+    uint32_t lost_irqs;         //edges while asleep on pins that can not wake the chip
+    uint32_t slow_transfers;    //spi/i2c transfers without an apb lock
+    uint32_t wake_latency_max;  //us, wake pin level to the firmware running
+    uint64_t wake_latency_sum;
+    uint32_t wake_latency_count;
+} sim_pm_stats_t;
+
+// no firmware task ready, timeout: the earliest task timeout (us, -1: none)
+void sim_pm_idle(int64_t timeout);
+// a firmware task gets ready
+void sim_pm_wake(sim_wake_e cause);
+bool sim_pm_asleep();
+// an interrupt is raised, false if the chip sleeps through it; holds the caller while the chip wakes up
+bool sim_pm_gpio_interrupt(bool wakeSource);
+void sim_pm_lost_irq();
+// the kernel switches to a firmware task
+void sim_pm_firmware_runs();
+// spi or i2c transfer on the wire
+void sim_pm_bus_transfer();
+void sim_pm_get_stats(sim_pm_stats_t* stats);
+
+/* spi.c, a slave per bus */
+typedef void (*sim_spi_slave_t)(const spi_device_interface_config_t* config, const uint8_t* tx, size_t txBits, uint8_t* rx, size_t rxBits);
+void sim_spi_attach(spi_host_device_t host, sim_spi_slave_t slave);
+
+/* i2c.c, slaves by address */
+typedef struct {
+    // false: nack
+    bool (*read)(uint8_t* data, size_t len);
+    bool (*write)(const uint8_t* data, size_t len);
+} sim_i2c_slave_t;
+void sim_i2c_attach(i2c_port_t port, uint8_t address, const sim_i2c_slave_t* slave);
+// the next count transactions on port fail, for the retry paths
+void sim_i2c_fail(i2c_port_t port, int count);
+// the next count transactions on port hang until their ticks_to_wait ran out
+void sim_i2c_hang(i2c_port_t port, int count);
+
+/* flash.c */
+void sim_flash_init(const char* partitionTable);
+// flash image to start from and to save at the end, NULL: erased flash, nothing saved
+bool sim_flash_load(const char* path);
+bool sim_flash_save(const char* path);
+
+typedef struct {
+    uint32_t reads;             //esp_partition_read() calls
+    uint32_t writes;            //esp_partition_write() calls, nvs and the journal
+    uint32_t erased_sectors;
+    uint32_t nvs_reads;         //nvs gets, found or not
+    uint32_t nvs_writes;        //nvs sets and key erases
+    uint32_t nvs_commits;
+} sim_flash_stats_t;
+void sim_flash_get_stats(sim_flash_stats_t* stats);
+// cut the power once bytes more are programmed or sectors more erased (-1: no limit)
+void sim_flash_power_cut(int64_t bytes, int64_t sectors);
+void sim_flash_power_on();
+bool sim_flash_power_off();
+// fail the next partition writes without programming anything
+void sim_flash_fail(int writes);
+
+/* net.c, the lan side of a tcp connection to the firmware */
+// connect to a port the firmware listens on, the connection's socket or -1
+int sim_net_connect(uint16_t port);
+// false if the connection is closed or its buffer full
+bool sim_net_peer_send(int s, const void* data, size_t len);
+// what the firmware sent so far, up to len bytes
+size_t sim_net_peer_receive(int s, void* data, size_t len);
+// false once the firmware closed it
+bool sim_net_peer_connected(int s);
+void sim_net_peer_close(int s);
+
+/* net.c, the station, an http server and a udp receiver on the lan */
+// the station gets an address, the firmware sees SYSTEM_EVENT_STA_GOT_IP
+void sim_net_station_up();
+// serve image at http://host:port/path and its sha256 at path.sha256
+void sim_net_http_serve(const char* host, uint16_t port, const char* path, const uint8_t* image, size_t len);
+// the next image response drops the connection once offset is sent
+void sim_net_http_drop(size_t offset);
+// the next count range requests get a 206 from byte 0
+void sim_net_http_misrange(int count);
+typedef struct {
+    uint32_t requests;
+    uint32_t ranges;            //image requests with a Range header
+    uint32_t range_start;       //of the last one
+} sim_http_stats_t;
+void sim_net_http_get_stats(sim_http_stats_t* stats);
+// a udp receiver at host:port, nothing queued for it
+void sim_net_udp_listen(const char* host, uint16_t port);
+// the next datagram sent to the receiver, its length, 0: none waiting
+size_t sim_net_udp_receive(void* data, size_t size);
+
+/* system.c */
+void sim_log_level(esp_log_level_t level);
+// where esp_log_write() prints, NULL: stdout
+void sim_log_output(FILE* stream);
+// bytes printed so far, what goes out of the uart on the device
+uint64_t sim_log_bytes();
+void sim_random_seed(uint32_t seed);
+
+/* devices.c, the board around the esp32 */
+typedef struct {
+    double water;               //degree
+    double ambient;             //degree
+    double mass;                //kg of water
+    double power;               //W, heater on
+    double loss;                //W per degree above ambient
+    double sensor_lag;          //s, sensor time constant
+    double noise;               //adc counts, standard deviation
+} sim_kettle_t;
+
+void sim_devices_init(const sim_kettle_t* kettle);
+void sim_kettle_set_water(double water);
+void sim_kettle_set_ambient(double ambient);
+// adc counts, standard deviation
+void sim_kettle_set_noise(double noise);
+double sim_kettle_water();
+bool sim_heater_on();
+// the CPT112S alone on its bus, for the benchmarks (sim_devices_init() has it)
+void sim_touch_init();
+// right touch pad and slider of the CPT112S, pos 0xffff releases the slider
+void sim_touch(bool down);
+void sim_slider(int pos);
+// left gpio key, with contact bounce: bounces pulses of bounceUs each, <= 0: the defaults
+void sim_key(bool down, int bounces, int bounceUs);
+// number on the display, false if it shows no number
+bool sim_display_value(int* value);
+// us from reset to the first display of the probe temperature, -1: not yet
+int64_t sim_display_first_reading();
+// times the text on the display changed
+uint32_t sim_display_changes();
+// hold icon lit
+bool sim_display_hold();
+// times the speaker was turned on
+uint32_t sim_buzzer_beeps();
+void sim_devices_report();
+
+/* scenario.c */
+bool sim_scenario_load(const char* path);
+void sim_scenario_start();
+int64_t sim_scenario_end();
+int sim_scenario_failures();
+// the firmware restarted and the run ends, check the expects left in the script
+void sim_scenario_restart();
+// % of the key events offered to the queue that were dropped, slider merges are not lost
+double sim_key_loss();
+
+#endif  /*_SIM_H_*/
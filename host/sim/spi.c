@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/spi_master.h"
+#include "esp_timer.h"
+#include "sim.h"
+
+#define HOST_MAX                3
+#define TRANS_SETUP_US          5           //driver and interrupt overhead per transaction
+
+typedef struct {
+    spi_transaction_t* trans;
+    int64_t done;               //us, transfer finished on the wire
+    bool posted;                //post_cb ran
+} done_t;
+
+struct spi_device_t {
+    spi_host_device_t host;
+    spi_device_interface_config_t config;
+    int64_t busyUntil;
+    done_t* results;            //ring of queue_size
+    int head;
+    int count;
+    esp_timer_handle_t doneTimer;   //post_cb at the end of a transfer, NULL: none
+};
+
+typedef struct {
+    bool initialized;
+    spi_device_handle_t device;
+    sim_spi_slave_t slave;
+} bus_t;
+
+static bus_t buses[HOST_MAX];
+
+void sim_spi_attach(spi_host_device_t host, sim_spi_slave_t slave)
+{
+    buses[host].slave = slave;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t* bus_config, int dma_chan)
+{
+    if (host < 0 || host >= HOST_MAX || host == SPI_HOST) return ESP_ERR_INVALID_ARG;
+    if (buses[host].initialized) return ESP_ERR_INVALID_STATE;
+    buses[host].initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_free(spi_host_device_t host)
+{
+    if (host < 0 || host >= HOST_MAX) return ESP_ERR_INVALID_ARG;
+    if (buses[host].device != NULL) return ESP_ERR_INVALID_STATE;
+    buses[host].initialized = false;
+    return ESP_OK;
+}
+
+// the transfer interrupt: post_cb of every finished transaction, then armed
+// for the next one; from the esp_timer task, the sim has no interrupt context
+static void done_timer_cb(void* arg)
+{
+    spi_device_handle_t device = arg;
+    for (int i = 0; i < device->count; i++) {
+        done_t* slot = &device->results[(device->head+i)%device->config.queue_size];
+        if (slot->posted) continue;
+        if (slot->done > sim_now()) {
+            esp_timer_start_once(device->doneTimer, slot->done-sim_now());
+            return;
+        }
+        slot->posted = true;
+        device->config.post_cb(slot->trans);
+    }
+}
+
+/* One device per bus is all the board has */
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t* dev_config, spi_device_handle_t* handle)
+{
+    if (host < 0 || host >= HOST_MAX || dev_config->queue_size <= 0) return ESP_ERR_INVALID_ARG;
+    if (!buses[host].initialized) return ESP_ERR_INVALID_STATE;
+    if (buses[host].device != NULL) return ESP_ERR_NOT_FOUND;
+    spi_device_handle_t device = calloc(1, sizeof(struct spi_device_t));
+    if (device == NULL) return ESP_ERR_NO_MEM;
+    device->results = calloc(dev_config->queue_size, sizeof(done_t));
+    if (device->results == NULL) {
+        free(device);
+        return ESP_ERR_NO_MEM;
+    }
+    device->host = host;
+    device->config = *dev_config;
+    if (dev_config->post_cb != NULL) {
+        esp_timer_create_args_t timer_args = {
+            .callback = &done_timer_cb,
+            .arg = device,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "spi"
+        };
+        esp_timer_create(&timer_args, &device->doneTimer);
+    }
+    buses[host].device = device;
+    *handle = device;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+    if (handle->count > 0) return ESP_ERR_INVALID_STATE;
+    if (handle->doneTimer != NULL) {
+        esp_timer_stop(handle->doneTimer);
+        esp_timer_delete(handle->doneTimer);
+    }
+    buses[handle->host].device = NULL;
+    free(handle->results);
+    free(handle);
+    return ESP_OK;
+}
+
+// the slave sees the whole transaction at once, the caller waits for the wire time
+static int64_t transfer(spi_device_handle_t device, spi_transaction_t* trans)
+{
+    size_t rxBits = trans->rxlength;
+    if (rxBits == 0 && !(device->config.flags & SPI_DEVICE_HALFDUPLEX)) {
+        rxBits = trans->length;
+    }
+    const uint8_t* tx = (trans->flags & SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer;
+    uint8_t* rx = (trans->flags & SPI_TRANS_USE_RXDATA) ? trans->rx_data : trans->rx_buffer;
+    if (rx != NULL && rxBits > 0) {
+        memset(rx, 0, (rxBits+7)/8);
+    }
+    sim_pm_bus_transfer();
+    sim_spi_slave_t slave = buses[device->host].slave;
+    if (slave != NULL) {
+        slave(&device->config, trans->length ? tx : NULL, trans->length, rxBits ? rx : NULL, rxBits);
+    }
+
+    //half duplex clocks out then in, full duplex both at once
+    size_t bits = (device->config.flags & SPI_DEVICE_HALFDUPLEX) ? trans->length+rxBits
+                  : (trans->length > rxBits ? trans->length : rxBits);
+    int64_t start = device->busyUntil > sim_now() ? device->busyUntil : sim_now();
+    device->busyUntil = start+TRANS_SETUP_US+(int64_t)bits*1000000/device->config.clock_speed_hz;
+    return device->busyUntil;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t* trans_desc, TickType_t ticks_to_wait)
+{
+    if (handle == NULL || trans_desc == NULL) return ESP_ERR_INVALID_ARG;
+    int64_t deadline = sim_tick_deadline(ticks_to_wait);
+    while (handle->count >= handle->config.queue_size) {
+        if (ticks_to_wait == 0 || !sim_wait(handle, deadline)) return ESP_ERR_TIMEOUT;
+    }
+    done_t* slot = &handle->results[(handle->head+handle->count)%handle->config.queue_size];
+    slot->trans = trans_desc;
+    slot->done = transfer(handle, trans_desc);
+    slot->posted = false;
+    handle->count++;
+    if (handle->doneTimer != NULL) {
+        //fails while armed for an earlier transaction, which re-arms for this one
+        esp_timer_start_once(handle->doneTimer, slot->done-sim_now());
+    }
+    sim_wake(handle);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t** trans_desc, TickType_t ticks_to_wait)
+{
+    if (handle == NULL || trans_desc == NULL) return ESP_ERR_INVALID_ARG;
+    int64_t deadline = sim_tick_deadline(ticks_to_wait);
+    while (handle->count == 0) {
+        if (ticks_to_wait == 0 || !sim_wait(handle, deadline)) return ESP_ERR_TIMEOUT;
+    }
+    done_t* slot = &handle->results[handle->head];
+    if (slot->done > sim_now()) {
+        if (deadline >= 0 && slot->done > deadline) {
+            sim_sleep_until(deadline);
+            return ESP_ERR_TIMEOUT;
+        }
+        sim_sleep_until(slot->done);
+    }
+    if (handle->doneTimer != NULL && !slot->posted) {
+        //the transfer interrupt comes before the result, even if the timer task has not run yet
+        slot->posted = true;
+        handle->config.post_cb(slot->trans);
+    }
+    *trans_desc = slot->trans;
+    handle->head = (handle->head+1)%handle->config.queue_size;
+    handle->count--;
+    sim_wake(handle);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t* trans_desc)
+{
+    spi_transaction_t* done;
+    esp_err_t ret = spi_device_queue_trans(handle, trans_desc, portMAX_DELAY);
+    if (ret != ESP_OK) return ret;
+    ret = spi_device_get_trans_result(handle, &done, portMAX_DELAY);
+    if (ret != ESP_OK) return ret;
+    assert(done == trans_desc);
+    return ESP_OK;
+}
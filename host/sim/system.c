@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "rom/crc.h"
+#include "sim.h"
+
+#define HEAP_SIZE               (160*1024)  //what the firmware sees free after boot on the device
+
+static esp_log_level_t logLevel = CONFIG_LOG_DEFAULT_LEVEL;
+static FILE* logStream = NULL;          //NULL: stdout
+static uint64_t logBytes = 0;
+static uint32_t randomState = 1;
+
+void sim_log_level(esp_log_level_t level)
+{
+    logLevel = level;
+}
+
+void sim_log_output(FILE* stream)
+{
+    logStream = stream;
+}
+
+uint64_t sim_log_bytes()
+{
+    return logBytes;
+}
+
+void sim_random_seed(uint32_t seed)
+{
+    randomState = seed ? seed : 1;
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    //one level for every tag is enough here
+    if (strcmp(tag, "*") == 0) logLevel = level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(sim_now()/1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    if (level > logLevel) return;
+    va_list ap;
+    va_start(ap, format);
+    int len = vfprintf(logStream != NULL ? logStream : stdout, format, ap);
+    va_end(ap);
+    if (len > 0) logBytes += len;
+}
+
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+void esp_restart(void)
+{
+    ESP_LOGI("SIM", "esp_restart()");
+    sim_scenario_restart();
+    sim_end();
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return HEAP_SIZE;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return HEAP_SIZE;
+}
+
+// xorshift, reproducible with the same --seed
+uint32_t esp_random(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac)
+{
+    static const uint8_t simMac[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+    memcpy(mac, simMac, sizeof(simMac));
+    return ESP_OK;
+}
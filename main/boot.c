@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "boot.h"
+
+#define TAG "BOOT"
+
+static const char* stageNames[BOOT_STAGE_MAX] = {
+    "safe",
+    "storage",
+    "sensor",
+    "first reading",
+    "input",
+    "network",
+};
+
+static boot_stage_t stages[BOOT_STAGE_MAX];
+
+void boot_begin(boot_stage_e stage)
+{
+    stages[stage].begin = esp_timer_get_time();
+    stages[stage].core = xPortGetCoreID();
+    stages[stage].begun = true;
+}
+
+void boot_end(boot_stage_e stage)
+{
+    stages[stage].end = esp_timer_get_time();
+    stages[stage].ended = true;
+}
+
+void boot_get(boot_stage_e stage, boot_stage_t* out)
+{
+    memcpy(out, &stages[stage], sizeof(boot_stage_t));
+}
+
+void boot_dump()
+{
+    for (int i = 0; i < BOOT_STAGE_MAX; i++) {
+        const boot_stage_t* s = &stages[i];
+        if (!s->begun) {
+            ESP_LOGI(TAG, "%-14s: not reached", stageNames[i]);
+        } else if (!s->ended) {
+            ESP_LOGI(TAG, "%-14s: %6u ms -   running   core %d", stageNames[i], (uint32_t)(s->begin/1000), s->core);
+        } else {
+            ESP_LOGI(TAG, "%-14s: %6u ms - %6u ms (%u ms) core %d", stageNames[i], (uint32_t)(s->begin/1000),
+                    (uint32_t)(s->end/1000), (uint32_t)((s->end-s->begin)/1000), s->core);
+        }
+    }
+}
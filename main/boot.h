@@ -0,0 +1,37 @@
+#ifndef _BOOT_H_
+#define _BOOT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Boot timeline: app_main() brings the kettle up in stages, each stage
+ * records when it began and ended (us since reset) and on which core.
+ * Storage runs in its own task next to the sensor stages, so an NVS
+ * recovery does not hold back the first temperature on the display.
+ */
+typedef enum {
+    BOOT_SAFE,                  //heater off, display on
+    BOOT_STORAGE,               //nvs, settings and history, boot task
+    BOOT_SENSOR,                //adc up
+    BOOT_FIRST_READING,         //until the first temperature is on the display
+    BOOT_INPUT,                 //buzzer, session, keys and touch, needs storage
+    BOOT_NETWORK,
+    BOOT_STAGE_MAX
+} boot_stage_e;
+
+typedef struct {
+    bool begun;
+    bool ended;
+    int64_t begin;              //us
+    int64_t end;                //us
+    int core;
+} boot_stage_t;
+
+void boot_begin(boot_stage_e stage);
+void boot_end(boot_stage_e stage);
+void boot_get(boot_stage_e stage, boot_stage_t* out);
+void boot_dump();
+
+#endif  /*_BOOT_H_*/
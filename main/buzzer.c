@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "gpio_key.h"
+#include "config.h"
+#include "buzzer.h"
+
+#define TAG  "BUZZER"
+
+#define TONE_QUEUE_SIZE         4
+
+/* on, off, on, off ... ms, 0 terminated. Always end with an off gap */
+static const uint16_t tone_beep[] = { 100, 50, 0 };
+static const uint16_t tone_double_beep[] = { 80, 80, 80, 50, 0 };
+static const uint16_t tone_alarm[] = { 200, 100, 200, 100, 200, 100, 600, 200, 0 };
+
+static const uint16_t* tones[TONE_MAX] = {
+    tone_beep,
+    tone_double_beep,
+    tone_alarm,
+};
+
+static esp_timer_handle_t toneTimer = NULL;
+static portMUX_TYPE toneMux = portMUX_INITIALIZER_UNLOCKED;
+static const uint16_t* playing = NULL;
+static int step = 0;
+static const uint16_t* pending[TONE_QUEUE_SIZE];
+static int pendingHead = 0;
+static int pendingCount = 0;
+static int64_t stepEnd = 0;             //us, when the timer of this step is due
+static bool keySound = true;
+
+/*
+ * The speaker level and the timer are changed in the same critical section
+ * as the state they follow: a buzzer_play() or buzzer_stop() from another
+ * task lands either before or after a step, never between the state and
+ * the pin. A callback already on its way when a stop and a new tone came
+ * in is early for the new step and does nothing.
+ */
+static void arm_step(uint16_t ms)
+{
+    stepEnd = esp_timer_get_time()+ms*1000;
+    esp_timer_start_once(toneTimer, ms*1000);
+}
+
+static void tone_timer_cb(void* arg)
+{
+    uint32_t level = 0;
+    uint16_t next = 0;
+
+    portENTER_CRITICAL(&toneMux);
+    if (playing != NULL && esp_timer_get_time() < stepEnd) {
+        portEXIT_CRITICAL(&toneMux);
+        return;
+    }
+    if (playing != NULL) {
+        step++;
+        if (playing[step] == 0) {
+            //tone done, start the next one
+            playing = NULL;
+            if (pendingCount > 0) {
+                playing = pending[pendingHead];
+                pendingHead = (pendingHead+1)%TONE_QUEUE_SIZE;
+                pendingCount--;
+                step = 0;
+            }
+        }
+        if (playing != NULL) {
+            level = (step%2 == 0) ? 1 : 0;
+            next = playing[step];
+        }
+    }
+    gpio_set_level(GPIO_OUTPUT_IO_SPEAKER, level);
+    if (next > 0) {
+        arm_step(next);
+    }
+    portEXIT_CRITICAL(&toneMux);
+}
+
+bool buzzer_play(tone_e tone)
+{
+    if (tone >= TONE_MAX) return false;
+
+    bool queued = true;
+    portENTER_CRITICAL(&toneMux);
+    if (playing == NULL) {
+        playing = tones[tone];
+        step = 0;
+        gpio_set_level(GPIO_OUTPUT_IO_SPEAKER, 1);
+        arm_step(tones[tone][0]);
+    } else if (pendingCount < TONE_QUEUE_SIZE) {
+        pending[(pendingHead+pendingCount)%TONE_QUEUE_SIZE] = tones[tone];
+        pendingCount++;
+    } else {
+        queued = false;
+    }
+    portEXIT_CRITICAL(&toneMux);
+    return queued;
+}
+
+void buzzer_key_beep()
+{
+    if (keySound) {
+        buzzer_play(TONE_BEEP);
+    }
+}
+
+static void key_sound_changed(setting_e setting, void* arg)
+{
+    keySound = config_get_key_sound();
+}
+
+void buzzer_stop()
+{
+    portENTER_CRITICAL(&toneMux);
+    esp_timer_stop(toneTimer);
+    playing = NULL;
+    pendingCount = 0;
+    gpio_set_level(GPIO_OUTPUT_IO_SPEAKER, 0);
+    portEXIT_CRITICAL(&toneMux);
+}
+
+void buzzer_init()
+{
+    gpio_config_t io_conf={
+        .intr_type=GPIO_PIN_INTR_DISABLE,
+        .mode=GPIO_MODE_OUTPUT,
+        .pull_down_en=0,
+        .pull_up_en=0,
+        .pin_bit_mask=((uint64_t)1<<GPIO_OUTPUT_IO_SPEAKER)
+    };
+    gpio_config(&io_conf);
+    gpio_set_level(GPIO_OUTPUT_IO_SPEAKER, 0);
+
+    esp_timer_create_args_t timer_args = {
+        .callback = &tone_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "tone"
+    };
+    ESP_ERROR_CHECK( esp_timer_create(&timer_args, &toneTimer) );
+
+    keySound = config_get_key_sound();
+    config_subscribe(SETTING_KEY_SOUND, key_sound_changed, NULL);
+}
@@ -0,0 +1,25 @@
+#ifndef _BUZZER_H_
+#define _BUZZER_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* TONE */
+typedef enum {
+    TONE_BEEP,
+    TONE_DOUBLE_BEEP,
+    TONE_ALARM,
+    TONE_MAX
+} tone_e;
+
+/*
+ * Non-blocking buzzer, tones are played from an esp_timer callback.
+ * buzzer_play() returns right away, tones queue up behind the current one.
+ */
+void buzzer_init();
+bool buzzer_play(tone_e tone);
+// key click, follows the key sound setting
+void buzzer_key_beep();
+void buzzer_stop();
+
+#endif  /*_BUZZER_H_*/
@@ -14,32 +14,338 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/crc.h"
 #include "esp_partition.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "config.h"
+#include "journal.h"
 
 #define TAG "CONFIG"
 
 #define KEY_KEY_SOUND           "key sound"
-#define KEY_TARGET_TEMPERATURE  "target temperature"
+#define KEY_TARGET_TEMPERATURE  "target temp"         //nvs key is 15 chars max
 #define KEY_WIFI_NAME           "wifi name"
 #define KEY_WIFI_PASS           "wifi pass"
 #define KEY_DEVICE_NAME         "device name"
+#define KEY_SETTINGS            "settings"
+#define JOURNAL_PARTITION       "settings"
+#define JOURNAL_SUBTYPE         0x40
+
+#define FLUSH_DELAY             2000        //ms idle after the last change before writing flash
+
+#define OBSERVER_MAX            12
+
+/* dirty fields, written on the next flush */
+#define DIRTY_KEY_SOUND             (1<<SETTING_KEY_SOUND)
+#define DIRTY_TARGET_TEMPERATURE    (1<<SETTING_TARGET_TEMPERATURE)
+#define DIRTY_WIFI_NAME             (1<<SETTING_WIFI_NAME)
+#define DIRTY_WIFI_PASS             (1<<SETTING_WIFI_PASS)
+#define DIRTY_DEVICE_NAME           (1<<SETTING_DEVICE_NAME)
+#define DIRTY_FIRMWARE_UPGRADE      (1<<SETTING_FIRMWARE_UPGRADE)   //notify only, not stored
+#define DIRTY_TELEMETRY             (1<<SETTING_TELEMETRY)
+#define DIRTY_COMMIT                (1<<SETTING_MAX)                //raw config_write() values
+#define DIRTY_SETTINGS              (DIRTY_KEY_SOUND|DIRTY_TARGET_TEMPERATURE|DIRTY_WIFI_NAME|DIRTY_WIFI_PASS|DIRTY_DEVICE_NAME|DIRTY_TELEMETRY)
+
+/*
+ * Settings blob: header + payload, stored as one record of the settings
+ * journal (NVS entry on devices without the journal partition).
+ * New fields are only ever appended to the payload and the version bumped;
+ * a shorter payload from older firmware leaves the new fields at default.
+ */
+#define SETTINGS_MAGIC          0x54534642  //"BFST"
+#define SETTINGS_VERSION        2
+#define SETTINGS_BLOB_MAX       JOURNAL_DATA_MAX    //room for payloads written by newer firmware
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;              //payload bytes
+    uint32_t crc;               //crc32 of payload
+} settings_header_t;
+
+typedef struct __attribute__((packed)) {
+    //version 1
+    int32_t target_temperature;
+    uint8_t key_sound;
+    char wifi_name[WIFI_NAME_MAX+1];
+    char wifi_pass[WIFI_PASS_MAX+1];
+    char device_name[DEVICE_NAME_MAX+1];
+    //version 2
+    char telemetry_host[TELEMETRY_HOST_MAX+1];
+    uint16_t telemetry_port;
+} settings_payload_t;
 
 typedef struct {
     int target_temperature;
     uint8_t key_sound;
-    char* wifi_name;
-    char* wifi_pass;
-    char* device_name;
+    char wifi_name[WIFI_NAME_MAX+1];
+    char wifi_pass[WIFI_PASS_MAX+1];
+    char device_name[DEVICE_NAME_MAX+1];
     firmware_t firmware;
+    telemetry_endpoint_t telemetry;
 }system_settings_t;
 
 static nvs_handle config_handle;
+static journal_t journal;
+static bool journalReady = false;
 static system_settings_t system_settings;
+static SemaphoreHandle_t configLock = NULL;
+static StaticSemaphore_t configLockBuffer;
+static esp_timer_handle_t flushTimer = NULL;
+static uint32_t dirty = 0;
+static config_stats_t stats;
+
+typedef struct {
+    setting_e setting;
+    config_observer_t observer;
+    void* arg;
+} config_subscription_t;
+
+static config_subscription_t subscriptions[OBSERVER_MAX];
+static int subscriptionCount = 0;
+//one flush at a time from snapshot to dispatch, recursive so an observer may flush
+static SemaphoreHandle_t dispatchLock = NULL;
+static StaticSemaphore_t dispatchLockBuffer;
+
+static void config_lock()
+{
+    xSemaphoreTake(configLock, portMAX_DELAY);
+}
+
+static void config_unlock()
+{
+    xSemaphoreGive(configLock);
+}
+
+// mark a field dirty and restart the idle delay, called with the lock held
+static void config_mark_dirty(uint32_t field)
+{
+    dirty |= field;
+    stats.changes++;
+    esp_timer_stop(flushTimer);
+    esp_timer_start_once(flushTimer, FLUSH_DELAY*1000);
+}
+
+// bounded copy, dst always ends up with 0
+static void copy_str(char* dst, const char* src, size_t size)
+{
+    size_t len = strnlen(src, size-1);
+    memcpy(dst, src, len);
+    memset(dst+len, 0, size-len);
+}
+
+// bounded set, false if the value does not fit
+static bool set_str(char* dst, size_t size, const char* src, size_t len)
+{
+    if (len >= size || (len > 0 && src == NULL)) return false;
+    memcpy(dst, src, len);
+    memset(dst+len, 0, size-len);
+    return true;
+}
+
+static char* get_str(char* str)
+{
+    return str[0] != 0 ? str : NULL;
+}
+
+// serialize the settings into one blob, called with the lock held
+static esp_err_t config_save_blob()
+{
+    uint8_t blob[sizeof(settings_header_t)+sizeof(settings_payload_t)];
+    settings_header_t* header = (settings_header_t*)blob;
+    settings_payload_t* payload = (settings_payload_t*)(blob+sizeof(settings_header_t));
+
+    memset(blob, 0, sizeof(blob));
+    payload->target_temperature = system_settings.target_temperature;
+    payload->key_sound = system_settings.key_sound;
+    copy_str(payload->wifi_name, system_settings.wifi_name, sizeof(payload->wifi_name));
+    copy_str(payload->wifi_pass, system_settings.wifi_pass, sizeof(payload->wifi_pass));
+    copy_str(payload->device_name, system_settings.device_name, sizeof(payload->device_name));
+    copy_str(payload->telemetry_host, system_settings.telemetry.host, sizeof(payload->telemetry_host));
+    payload->telemetry_port = system_settings.telemetry.port;
+
+    header->magic = SETTINGS_MAGIC;
+    header->version = SETTINGS_VERSION;
+    header->size = sizeof(settings_payload_t);
+    header->crc = crc32_le(0, (uint8_t*)payload, sizeof(settings_payload_t));
+
+    stats.flash_writes++;
+    if (journalReady) {
+        return journal_append(&journal, blob, sizeof(blob));
+    }
+    return nvs_set_blob(config_handle, KEY_SETTINGS, blob, sizeof(blob));
+}
+
+// single read from the journal or nvs, false if there is no valid blob
+static bool config_load_blob(bool fromJournal)
+{
+    uint8_t blob[SETTINGS_BLOB_MAX];
+    size_t size = sizeof(blob);
+    esp_err_t err;
+    if (fromJournal) {
+        err = journal_read(&journal, blob, &size);
+    } else {
+        err = nvs_get_blob(config_handle, KEY_SETTINGS, blob, &size);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "%s: no settings blob in %s (%d)", __func__, fromJournal ? "journal" : "nvs", err);
+        return false;
+    }
+
+    settings_header_t* header = (settings_header_t*)blob;
+    uint8_t* data = blob+sizeof(settings_header_t);
+    if (size < sizeof(settings_header_t) || header->magic != SETTINGS_MAGIC
+            || header->size > size-sizeof(settings_header_t)) {
+        ESP_LOGE(TAG, "%s: bad settings blob\n", __func__);
+        return false;
+    }
+    if (header->crc != crc32_le(0, data, header->size)) {
+        ESP_LOGE(TAG, "%s: settings crc error\n", __func__);
+        return false;
+    }
+
+    //fields missing from an older, shorter payload keep their default
+    settings_payload_t payload;
+    memset(&payload, 0, sizeof(payload));
+    payload.target_temperature = system_settings.target_temperature;
+    payload.key_sound = system_settings.key_sound;
+    memcpy(&payload, data, header->size < sizeof(payload) ? header->size : sizeof(payload));
+
+    system_settings.target_temperature = payload.target_temperature;
+    system_settings.key_sound = payload.key_sound;
+    copy_str(system_settings.wifi_name, payload.wifi_name, sizeof(system_settings.wifi_name));
+    copy_str(system_settings.wifi_pass, payload.wifi_pass, sizeof(system_settings.wifi_pass));
+    copy_str(system_settings.device_name, payload.device_name, sizeof(system_settings.device_name));
+    copy_str(system_settings.telemetry.host, payload.telemetry_host, sizeof(system_settings.telemetry.host));
+    system_settings.telemetry.port = payload.telemetry_port;
+    ESP_LOGI(TAG, "%s: version %d, %d bytes", __func__, header->version, header->size);
+    return true;
+}
+
+static bool same_subscription(const config_subscription_t* a, const config_subscription_t* b)
+{
+    return a->setting == b->setting && a->observer == b->observer && a->arg == b->arg;
+}
+
+// notify observers of the settings in changed, called with the dispatch lock
+// held and without the config lock
+static void config_dispatch(uint32_t changed)
+{
+    for (int setting = 0; setting < SETTING_MAX; setting++) {
+        if (!(changed & (1<<setting))) continue;
+        int i = 0;
+        while (1) {
+            //copy under lock, observers may (un)subscribe
+            config_subscription_t sub;
+            config_lock();
+            bool valid = i < subscriptionCount;
+            if (valid) sub = subscriptions[i];
+            config_unlock();
+            if (!valid) break;
+            if (sub.setting == setting) {
+                sub.observer(setting, sub.arg);
+            }
+            //an unsubscribe at or before i moved the next one into i
+            config_lock();
+            if (i < subscriptionCount && same_subscription(&subscriptions[i], &sub)) i++;
+            config_unlock();
+        }
+    }
+}
+
+bool config_subscribe(setting_e setting, config_observer_t observer, void* arg)
+{
+    if (setting >= SETTING_MAX || observer == NULL) return false;
+
+    bool ok = false;
+    config_lock();
+    if (subscriptionCount < OBSERVER_MAX) {
+        subscriptions[subscriptionCount].setting = setting;
+        subscriptions[subscriptionCount].observer = observer;
+        subscriptions[subscriptionCount].arg = arg;
+        subscriptionCount++;
+        ok = true;
+    }
+    config_unlock();
+    if (!ok) {
+        ESP_LOGE(TAG, "%s: no room for observer of %d\n", __func__, setting);
+    }
+    return ok;
+}
+
+void config_unsubscribe(setting_e setting, config_observer_t observer, void* arg)
+{
+    config_lock();
+    for (int i = 0; i < subscriptionCount; i++) {
+        config_subscription_t* sub = &subscriptions[i];
+        if (sub->setting == setting && sub->observer == observer && sub->arg == arg) {
+            //keep subscription order
+            memmove(sub, sub+1, (subscriptionCount-i-1)*sizeof(config_subscription_t));
+            subscriptionCount--;
+            break;
+        }
+    }
+    config_unlock();
+}
+
+bool config_flush()
+{
+    esp_err_t err = ESP_OK;
+    //held from the dirty snapshot through the dispatch, a later flush
+    //notifies only after this one, observers see changes in commit order
+    xSemaphoreTakeRecursive(dispatchLock, portMAX_DELAY);
+    config_lock();
+    if (dirty == 0) {
+        config_unlock();
+        xSemaphoreGiveRecursive(dispatchLock);
+        return true;
+    }
+    esp_timer_stop(flushTimer);
+
+    if (dirty & DIRTY_SETTINGS) {
+        err = config_save_blob();
+    }
+
+    // one commit for everything changed since the last flush,
+    // a journal record is committed once written
+    if (err == ESP_OK && ((dirty & DIRTY_COMMIT) || !journalReady)) {
+        err = nvs_commit(config_handle);
+        stats.commits++;
+    }
+    if (err != ESP_OK) {
+        //keep the changes dirty and try again after the idle delay,
+        //observers hear about them once they are committed
+        esp_timer_start_once(flushTimer, FLUSH_DELAY*1000);
+        config_unlock();
+        xSemaphoreGiveRecursive(dispatchLock);
+        ESP_LOGE(TAG, "%s: failed (%d), retry in %d ms\n", __func__, err, FLUSH_DELAY);
+        return false;
+    }
+    uint32_t changed = dirty & ~DIRTY_COMMIT;
+    dirty = 0;
+    config_unlock();
+
+    config_dispatch(changed);
+    xSemaphoreGiveRecursive(dispatchLock);
+    return true;
+}
+
+static void flush_timer_cb(void* arg)
+{
+    config_flush();
+}
+
+void config_get_stats(config_stats_t* out)
+{
+    config_lock();
+    memcpy(out, &stats, sizeof(config_stats_t));
+    config_unlock();
+}
 
 int32_t config_read(char* name, int32_t default_value)
 {
@@ -50,14 +356,16 @@ int32_t config_read(char* name, int32_t default_value)
 
 bool config_write(char* name, int32_t value)
 {
-    esp_err_t err;
-    err = nvs_set_i32(config_handle, name, value);
-
-    // Commit written value.
-    // After setting any values, nvs_commit() must be called to ensure changes are written
-    // to flash storage. Implementations may write to storage at other times,
-    // but this is not guaranteed.
-    err = nvs_commit(config_handle);
+    int32_t current;
+    esp_err_t err = ESP_OK;
+    config_lock();
+    // skip the flash write if nothing changed, commit with the next flush
+    if (nvs_get_i32(config_handle, name, &current) != ESP_OK || current != value) {
+        stats.flash_writes++;
+        err = nvs_set_i32(config_handle, name, value);
+        config_mark_dirty(DIRTY_COMMIT);
+    }
+    config_unlock();
     return err == ESP_OK;
 }
 
@@ -80,11 +388,12 @@ uint8_t config_get_key_sound()
 bool config_set_key_sound(uint8_t enable)
 {
     ESP_LOGD(TAG, "%s: %d\n", __func__, enable);
+    config_lock();
     if (enable != system_settings.key_sound) {
         system_settings.key_sound = enable;
-        esp_err_t err = nvs_set_u8(config_handle, KEY_KEY_SOUND, enable);
-        if (err != ESP_OK) return false;
+        config_mark_dirty(DIRTY_KEY_SOUND);
     }
+    config_unlock();
     return true ;
 }
 
@@ -96,47 +405,46 @@ int config_get_target_temperature()
 bool config_set_target_temperature(int temp)
 {
     ESP_LOGD(TAG, "%s: %d\n", __func__, temp);
+    config_lock();
     if (temp != system_settings.target_temperature) {
         system_settings.target_temperature = temp;
-        esp_err_t err = nvs_set_i32(config_handle, KEY_TARGET_TEMPERATURE, temp);
-        if (err != ESP_OK) return false;
+        config_mark_dirty(DIRTY_TARGET_TEMPERATURE);
     }
+    config_unlock();
     return true ;
 }
 
 char* config_get_wifi_name()
 {
-    return system_settings.wifi_name;
+    return get_str(system_settings.wifi_name);
 }
 
 bool config_set_wifi_name(char* name, size_t len)
 {
-    if (system_settings.wifi_name != NULL) {
-        free(system_settings.wifi_name);
+    config_lock();
+    bool ok = set_str(system_settings.wifi_name, sizeof(system_settings.wifi_name), name, len);
+    if (ok) {
+        ESP_LOGD(TAG, "%s: %s\n", __func__, system_settings.wifi_name);
+        config_mark_dirty(DIRTY_WIFI_NAME);
     }
-    system_settings.wifi_name = malloc(len+1);
-    memset(system_settings.wifi_name, 0, len+1);      //make sure end up with 0
-    memcpy(system_settings.wifi_name, name, len);
-    ESP_LOGD(TAG, "%s: %s\n", __func__, system_settings.wifi_name);
-    esp_err_t err = nvs_set_str(config_handle, KEY_WIFI_NAME, system_settings.wifi_name);
-    return err == ESP_OK;
+    config_unlock();
+    return ok;
 }
 
 char* config_get_wifi_pass()
 {
-    return system_settings.wifi_pass;
+    return get_str(system_settings.wifi_pass);
 }
 
 bool config_set_wifi_pass(char* pass, size_t len)
 {
-    if (system_settings.wifi_pass != NULL) {
-        free(system_settings.wifi_pass);
+    config_lock();
+    bool ok = set_str(system_settings.wifi_pass, sizeof(system_settings.wifi_pass), pass, len);
+    if (ok) {
+        config_mark_dirty(DIRTY_WIFI_PASS);
     }
-    system_settings.wifi_pass = malloc(len+1);
-    memset(system_settings.wifi_pass, 0, len+1);      //make sure end up with 0
-    memcpy(system_settings.wifi_pass, pass, len);
-    esp_err_t err = nvs_set_str(config_handle, KEY_WIFI_PASS, system_settings.wifi_pass);
-    return err == ESP_OK;
+    config_unlock();
+    return ok;
 }
 
 firmware_t* config_get_firmware_upgrade()
@@ -144,154 +452,164 @@ firmware_t* config_get_firmware_upgrade()
     return &system_settings.firmware;
 }
 
-bool config_set_firmware_upgrade(char* host, uint8_t host_len, uint8_t port, char* path, uint8_t path_len)
+bool config_set_firmware_upgrade(char* host, uint8_t host_len, uint16_t port, char* path, uint8_t path_len)
 {
-    if (system_settings.firmware.host != NULL) {
-        free(system_settings.firmware.host);
-    }
-    if (system_settings.firmware.path != NULL) {
-        free(system_settings.firmware.path);
+    firmware_t* firmware = &system_settings.firmware;
+    if (host_len >= sizeof(firmware->host) || path_len >= sizeof(firmware->path)) {
+        return false;
     }
-    system_settings.firmware.host = malloc(host_len+1);
-    system_settings.firmware.path = malloc(path_len+1);
-    memset(system_settings.firmware.host, 0, host_len+1);      //make sure end up with 0
-    memset(system_settings.firmware.path, 0, path_len+1);      //make sure end up with 0
-    memcpy(system_settings.firmware.host, host, host_len);
-    memcpy(system_settings.firmware.path, path, path_len);
-    system_settings.firmware.port = port;
+
+    config_lock();
+    set_str(firmware->host, sizeof(firmware->host), host, host_len);
+    set_str(firmware->path, sizeof(firmware->path), path, path_len);
+    firmware->port = port;
 
     ESP_LOGD(TAG, "%s set firmware host: %s, port: %d, path:%s\n", 
-            __func__, system_settings.firmware.host, system_settings.firmware.port, system_settings.firmware.path);
+            __func__, firmware->host, firmware->port, firmware->path);
+    config_mark_dirty(DIRTY_FIRMWARE_UPGRADE);
+    config_unlock();
     return true;
 }
 
 char* config_get_device_name()
 {
-    return system_settings.device_name;
+    return get_str(system_settings.device_name);
 }
 
 bool config_set_device_name(char* name, size_t len)
 {
-    if (system_settings.device_name != NULL) {
-        free(system_settings.device_name);
+    config_lock();
+    bool ok = set_str(system_settings.device_name, sizeof(system_settings.device_name), name, len);
+    if (ok) {
+        ESP_LOGD(TAG, "%s: %s\n", __func__, system_settings.device_name);
+        config_mark_dirty(DIRTY_DEVICE_NAME);
     }
-    system_settings.device_name = malloc(len+1);
-    memset(system_settings.device_name, 0, len+1);      //make sure end up with 0
-    memcpy(system_settings.device_name, name, len);
-    ESP_LOGD(TAG, "%s: %s\n", __func__, system_settings.device_name);
-    esp_err_t err = nvs_set_str(config_handle, KEY_DEVICE_NAME, system_settings.device_name);
-    return err == ESP_OK;
+    config_unlock();
+    return ok;
 }
 
-void config_close()
+telemetry_endpoint_t* config_get_telemetry()
 {
-    if (system_settings.wifi_name != NULL) {
-        free(system_settings.wifi_name);
-    }
-    if (system_settings.wifi_pass != NULL) {
-        free(system_settings.wifi_pass);
+    return &system_settings.telemetry;
+}
+
+bool config_set_telemetry(char* host, uint8_t host_len, uint16_t port)
+{
+    telemetry_endpoint_t* telemetry = &system_settings.telemetry;
+    config_lock();
+    bool ok = set_str(telemetry->host, sizeof(telemetry->host), host, host_len);
+    if (ok) {
+        telemetry->port = port;
+        ESP_LOGD(TAG, "%s: %s:%d\n", __func__, telemetry->host, telemetry->port);
+        config_mark_dirty(DIRTY_TELEMETRY);
     }
+    config_unlock();
+    return ok;
+}
+
+void config_close()
+{
+    config_flush();
     nvs_commit(config_handle);
     nvs_close(config_handle);
 }
 
 void config_reset()
 {
-    esp_err_t err; 
-
     ESP_LOGI(TAG, "%s\n", __func__);
 
+    config_lock();
+
     //key sound enable
     system_settings.key_sound = 1;
-    err = nvs_erase_key(config_handle, KEY_KEY_SOUND);
-    assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
 
-    //wifi name
-    if (system_settings.wifi_name != NULL) {
-        free(system_settings.wifi_name);
-        system_settings.wifi_name = NULL;
-    }
-    err = nvs_erase_key(config_handle, KEY_WIFI_NAME);
-    
-    //wifi pass
-    if (system_settings.wifi_pass != NULL) {
-        free(system_settings.wifi_pass);
-        system_settings.wifi_pass = NULL;
-    }
-    err = nvs_erase_key(config_handle, KEY_WIFI_PASS);
+    //wifi name, wifi pass, device name
+    memset(system_settings.wifi_name, 0, sizeof(system_settings.wifi_name));
+    memset(system_settings.wifi_pass, 0, sizeof(system_settings.wifi_pass));
+    memset(system_settings.device_name, 0, sizeof(system_settings.device_name));
+    memset(&system_settings.telemetry, 0, sizeof(system_settings.telemetry));
 
-    //device name
-    if (system_settings.device_name != NULL) {
-        free(system_settings.device_name);
-        system_settings.device_name = NULL;
-    }
-    err = nvs_erase_key(config_handle, KEY_DEVICE_NAME);
+    //one blob write replaces all the settings
+    dirty |= DIRTY_SETTINGS;
+    config_unlock();
+    config_flush();
+}
 
-    nvs_commit(config_handle);
+// string from the legacy layout, empty if missing or too long
+static void config_load_legacy_str(const char* key, char* value, size_t size)
+{
+    size_t required_size = size;
+    esp_err_t err = nvs_get_str(config_handle, key, value, &required_size);
+    if (err != ESP_OK) {
+        memset(value, 0, size);
+        ESP_LOGI(TAG, "%s: %s is empty", __func__, key);
+    }
 }
 
-void config_load()
+// per key layout used before the settings blob
+static void config_load_legacy()
 {
     esp_err_t err;
-    //Device Info
-    char serial_num[20];
-    config_get_serial_num(serial_num, 20);
-    ESP_LOGI(TAG, "%s: serial_num: %s", __func__, serial_num);
-
-    //System Setting
-    memset(&system_settings,0,sizeof(system_settings));
-    system_settings.firmware.host = NULL;
-    system_settings.firmware.path = NULL;
 
     //key sound enable
-    system_settings.key_sound = 1;
     err = nvs_get_u8(config_handle, KEY_KEY_SOUND, &system_settings.key_sound);
     assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
     ESP_LOGI(TAG, "%s: key_sound: %d", __func__, system_settings.key_sound);
 
-    system_settings.target_temperature = 100;
     err = nvs_get_i32(config_handle, KEY_TARGET_TEMPERATURE, &system_settings.target_temperature);
     assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
     ESP_LOGI(TAG, "%s: target_temperature: %d", __func__, system_settings.target_temperature);
 
-    //wifi name
-    size_t required_size = 0;
-    err = nvs_get_str(config_handle, KEY_WIFI_NAME, NULL, &required_size);
-    assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
-    if (err == ESP_OK) {
-        system_settings.wifi_name = malloc(required_size);
-        nvs_get_str(config_handle, KEY_WIFI_NAME, system_settings.wifi_name, &required_size);
-        ESP_LOGI(TAG, "%s: wifi_name: %s", __func__, system_settings.wifi_name);
-    }else{
-        system_settings.wifi_name = NULL;
-        ESP_LOGI(TAG, "%s: wifi_name is empty", __func__);
-    }
+    config_load_legacy_str(KEY_WIFI_NAME, system_settings.wifi_name, sizeof(system_settings.wifi_name));
+    config_load_legacy_str(KEY_WIFI_PASS, system_settings.wifi_pass, sizeof(system_settings.wifi_pass));
+    config_load_legacy_str(KEY_DEVICE_NAME, system_settings.device_name, sizeof(system_settings.device_name));
+}
 
-    //wifi pass
-    required_size = 0;
-    err = nvs_get_str(config_handle, KEY_WIFI_PASS, NULL, &required_size);
-    assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
+// move nvs blob or legacy keys into the settings journal
+static void config_migrate()
+{
+    config_lock();
+    esp_err_t err = config_save_blob();
     if (err == ESP_OK) {
-        system_settings.wifi_pass = malloc(required_size);
-        nvs_get_str(config_handle, KEY_WIFI_PASS, system_settings.wifi_pass, &required_size);
-        ESP_LOGI(TAG, "%s: wifi_pass: %s\n", __func__, system_settings.wifi_pass);
-    }else{
-        system_settings.wifi_pass = NULL;
-        ESP_LOGI(TAG, "%s: wifi_pass is empty", __func__);
+        if (journalReady) {
+            nvs_erase_key(config_handle, KEY_SETTINGS);
+        }
+        nvs_erase_key(config_handle, KEY_KEY_SOUND);
+        nvs_erase_key(config_handle, KEY_TARGET_TEMPERATURE);
+        nvs_erase_key(config_handle, KEY_WIFI_NAME);
+        nvs_erase_key(config_handle, KEY_WIFI_PASS);
+        nvs_erase_key(config_handle, KEY_DEVICE_NAME);
+        err = nvs_commit(config_handle);
+        stats.commits++;
     }
+    config_unlock();
+    ESP_LOGI(TAG, "%s: %s", __func__, err == ESP_OK ? "done" : "failed");
+}
 
-    //device name
-    required_size = 0;
-    err = nvs_get_str(config_handle, KEY_DEVICE_NAME, NULL, &required_size);
-    assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
-    if (err == ESP_OK) {
-        system_settings.device_name = malloc(required_size);
-        nvs_get_str(config_handle, KEY_DEVICE_NAME, system_settings.device_name, &required_size);
-        ESP_LOGI(TAG, "%s: device_name: %s", __func__, system_settings.device_name);
-    }else{
-        system_settings.device_name = NULL;
-        ESP_LOGI(TAG, "%s: device_name is empty\n", __func__);
+void config_load()
+{
+    //Device Info
+    char serial_num[20];
+    config_get_serial_num(serial_num, 20);
+    ESP_LOGI(TAG, "%s: serial_num: %s", __func__, serial_num);
+
+    //System Setting, defaults first
+    memset(&system_settings,0,sizeof(system_settings));
+    system_settings.key_sound = 1;
+    system_settings.target_temperature = 100;
+
+    if (journalReady && config_load_blob(true)) {
+        return;
+    }
+    if (config_load_blob(false)) {
+        if (journalReady) {
+            config_migrate();
+        }
+        return;
     }
+
+    config_load_legacy();
+    config_migrate();
 }
 
 void config_init()
@@ -315,4 +633,17 @@ void config_init()
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "(%d) opening NVS handle!\n", err);
     }
+
+    // Settings journal survives the nvs erase above
+    journalReady = journal_open(&journal, JOURNAL_SUBTYPE, JOURNAL_PARTITION) == ESP_OK;
+
+    configLock = xSemaphoreCreateMutexStatic(&configLockBuffer);
+    dispatchLock = xSemaphoreCreateRecursiveMutexStatic(&dispatchLockBuffer);
+    esp_timer_create_args_t timer_args = {
+        .callback = &flush_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "config_flush"
+    };
+    ESP_ERROR_CHECK( esp_timer_create(&timer_args, &flushTimer) );
 }
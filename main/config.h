@@ -7,16 +7,63 @@
 #define FW_VERSION              "0.80.22"
 #define MODEL_NUMBER            "TES05PL"
 
+/* string capacity, not counting the terminating 0 */
+#define WIFI_NAME_MAX           32
+#define WIFI_PASS_MAX           64
+#define DEVICE_NAME_MAX         32
+#define FIRMWARE_HOST_MAX       64
+#define FIRMWARE_PATH_MAX       128
+#define TELEMETRY_HOST_MAX      64
+
 typedef struct {
-    char* host;
-    uint8_t port;
-    char* path;
+    char host[FIRMWARE_HOST_MAX+1];
+    uint16_t port;
+    char path[FIRMWARE_PATH_MAX+1];
 }firmware_t;
 
+typedef struct {
+    char host[TELEMETRY_HOST_MAX+1];    //empty: telemetry off
+    uint16_t port;
+}telemetry_endpoint_t;
+
+/* SETTING */
+typedef enum {
+    SETTING_KEY_SOUND,
+    SETTING_TARGET_TEMPERATURE,
+    SETTING_WIFI_NAME,
+    SETTING_WIFI_PASS,
+    SETTING_DEVICE_NAME,
+    SETTING_FIRMWARE_UPGRADE,
+    SETTING_TELEMETRY,
+    SETTING_MAX
+} setting_e;
+
+// called from the flushing task after the commit, once per changed setting
+typedef void (*config_observer_t)(setting_e setting, void* arg);
+
+typedef struct {
+    uint32_t changes;           //setting changes cached
+    uint32_t flash_writes;      //nvs set/erase issued
+    uint32_t commits;           //nvs commits issued
+}config_stats_t;
+
 void config_init();
 void config_load();
 void config_close();
 void config_reset();
+// write cached changes now, e.g. before reboot or OTA. Changes are flushed
+// automatically once settings stay unchanged for a while.
+bool config_flush();
+void config_get_stats(config_stats_t* stats);
+
+/*
+ * Change notifications. Observers of all settings changed by one flush are
+ * called in a batch after the commit, by setting then subscription order.
+ * An observer may read or change settings; its changes go to the next batch.
+ * It may also unsubscribe, itself included, without the others missing it.
+ */
+bool config_subscribe(setting_e setting, config_observer_t observer, void* arg);
+void config_unsubscribe(setting_e setting, config_observer_t observer, void* arg);
 
 int32_t config_read(char* name, int32_t default_value);
 bool config_write(char* name, int32_t value);
@@ -30,6 +77,8 @@ bool config_set_key_sound(uint8_t enable);
 int config_get_target_temperature();
 bool config_set_target_temperature(int temp);
 
+// string getters return NULL when the setting is empty,
+// string setters return false if len exceeds the field capacity
 char* config_get_wifi_name();
 bool config_set_wifi_name(char* name, size_t len);
 
@@ -37,9 +86,12 @@ char* config_get_wifi_pass();
 bool config_set_wifi_pass(char* pass, size_t len);
 
 firmware_t* config_get_firmware_upgrade();
-bool config_set_firmware_upgrade(char* host, uint8_t host_len, uint8_t port, char* path, uint8_t path_len);
+bool config_set_firmware_upgrade(char* host, uint8_t host_len, uint16_t port, char* path, uint8_t path_len);
 
 char* config_get_device_name();
 bool config_set_device_name(char* name, size_t len);
 
+telemetry_endpoint_t* config_get_telemetry();
+bool config_set_telemetry(char* host, uint8_t host_len, uint16_t port);
+
 #endif  /*_BF_CONFIG_H_*/
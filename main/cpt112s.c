@@ -2,15 +2,25 @@
 */
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "driver/gpio.h"
 #include "gpio_key.h"
 #include "key_event.h"
+#include "cpt112s.h"
+#include "slider_gesture.h"
+#include "latency.h"
+#include "buzzer.h"
+#include "tlog.h"
+#include "trace.h"
+#include "io_loop.h"
+#include "pm.h"
 
 #define TAG                   "CPT112S"
 
@@ -36,13 +46,38 @@
 #define EVENT_TYPE(x)                   (x&0x0f)
 #define EVENT_COUNTER(x)                ((x&0xf0)>>4)
 #define EVENT_SLIDER_POSITION(x,y)      ((x<<8|y))
-#define SLIDER_THRESHOLD                10
+#define SLIDER_RELEASE                  0xffff
 
-//The semaphore indicating the data is ready.
-static SemaphoreHandle_t rdySem = NULL;
+#define EVENT_SIZE                      3
+#define EVENT_BATCH_SIZE                8       //max events drained per wake
+#define I2C_READ_RETRY                  2
+#define I2C_TIMEOUT_MS                  10      //a read takes 0.1 ms, one tick at 100 Hz; the io loop waits meanwhile
+// a tick more than the time: the wait may start just before a tick boundary,
+// which would end a one tick wait after almost nothing
+#define I2C_TIMEOUT_TICKS               (pdMS_TO_TICKS(I2C_TIMEOUT_MS)+1 < 2 ? 2 : pdMS_TO_TICKS(I2C_TIMEOUT_MS)+1)
+#define I2C_BACKOFF_US                  100000  //events left after a failed read, try again
+
+static io_thread_t touchThread;
+
+//Pre-built read transaction, reused for every event
+static i2c_cmd_handle_t readCmd = NULL;
+static uint8_t readBuffer[EVENT_SIZE];
+static cpt112s_stats_t stats;
+static slider_gesture_t slider;
+static volatile uint32_t isrTime = 0;
+static volatile int64_t isrWakeTime = 0;
+static uint32_t wakeIsrTime = 0;
+static bool i2cFailed = false;
+//one batch, kept here rather than on the io loop stack
+static uint8_t batch[EVENT_BATCH_SIZE][EVENT_SIZE];
+//time of each event for the slider velocity: the first one of a wake was
+//there at the interrupt, any later one when it was read
+static int64_t eventTime[EVENT_BATCH_SIZE];
+static int64_t wakeEventTime = -1;
+static key_event_t keyEvents[EVENT_BATCH_SIZE];
 
 /*
-This ISR is called when the data line goes low.
+This ISR is called while the INT line is low, also to wake from light sleep.
 */
 static void data_isr_handler(void* arg)
 {
@@ -57,115 +92,165 @@ static void data_isr_handler(void* arg)
     uint32_t diff=currtime-lastDataReadyTime;
     lastDataReadyTime=currtime;
     */
+    TRACE(TRACE_ISR_ENTER, TRACE_SRC_CPT112S_INT, 0);
+    //Level triggered: masked until the events are drained and INT is high.
+    gpio_intr_disable(PIN_NUM_INT);
+
+    if (isrTime == 0) {
+        //first interrupt of this wake
+        isrTime = latency_now();
+        isrWakeTime = esp_timer_get_time();
+    }
 
-    //Give the semaphore.
+    //Wake the io loop.
     BaseType_t mustYield=false;
-    xSemaphoreGiveFromISR(rdySem, &mustYield);
+    io_loop_notify_from_isr(IO_SOURCE_TOUCH, &mustYield);
+    TRACE(TRACE_ISR_EXIT, TRACE_SRC_CPT112S_INT, 0);
     if (mustYield) portYIELD_FROM_ISR();
 }
 
 /**
- * @brief test code to read esp-i2c-slave
- *        We need to fill the buffer of esp slave device, then master can read them out.
+ * @brief build the event read command once, the command link is not consumed by
+ *        i2c_master_cmd_begin() so it is reused for every event.
  *
  * _______________________________________________________________________________________
  * | start | slave_addr + rd_bit +ack | read n-1 bytes + ack | read 1 byte + nack | stop |
  * --------|--------------------------|----------------------|--------------------|------|
  *
  */
-static esp_err_t i2c_read(i2c_port_t i2c_num, uint8_t* data_rd, size_t size)
+static void i2c_read_cmd_init()
 {
-    if (size == 0) {
-        return ESP_OK;
-    }
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, ( CPT112S_SLAVE_ADDR << 1 ) | READ_BIT, ACK_CHECK_EN);
-    if (size > 1) {
-        i2c_master_read(cmd, data_rd, size - 1, ACK_VAL);
+    readCmd = i2c_cmd_link_create();
+    i2c_master_start(readCmd);
+    i2c_master_write_byte(readCmd, ( CPT112S_SLAVE_ADDR << 1 ) | READ_BIT, ACK_CHECK_EN);
+    i2c_master_read(readCmd, readBuffer, EVENT_SIZE - 1, ACK_VAL);
+    i2c_master_read_byte(readCmd, readBuffer + EVENT_SIZE - 1, NACK_VAL);
+    i2c_master_stop(readCmd);
+}
+
+static esp_err_t i2c_read_event(i2c_port_t i2c_num, uint8_t* event)
+{
+    esp_err_t ret = ESP_FAIL;
+    //scl is divided down from apb
+    pm_lock(PM_LOCK_TOUCH);
+    for (int retry = 0; retry <= I2C_READ_RETRY; retry++) {
+        if (retry > 0) stats.i2c_retries++;
+        TRACE(TRACE_I2C_START, TRACE_SRC_CPT112S, retry);
+        ret = i2c_master_cmd_begin(i2c_num, readCmd, I2C_TIMEOUT_TICKS);
+        TRACE(TRACE_I2C_END, TRACE_SRC_CPT112S, ret);
+        if (ret == ESP_OK) {
+            memcpy(event, readBuffer, EVENT_SIZE);
+            break;
+        }
+        stats.i2c_errors++;
     }
-    i2c_master_read_byte(cmd, data_rd + size - 1, NACK_VAL);
-    i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(i2c_num, cmd, 1000 / portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
+    pm_unlock(PM_LOCK_TOUCH);
     return ret;
 }
 
-#define DIFF_100MS  (240000 * 200) 
-static void cpt112s_parse_event(uint8_t* event)
+// return true if a key event should be posted
+static bool cpt112s_parse_event(uint8_t* event, int64_t time, key_event_t* keyEvent)
 {
     int eventType = EVENT_TYPE(event[0]);
-    key_event_t keyEvent;
-    static int16_t lastSliderPos = -1;
-    static uint32_t lastSliderTime = 0;
-    uint32_t currtime=xthal_get_ccount();
-    uint32_t diff=currtime-lastSliderTime;
 
-    keyEvent.key_type = KEY_TYPE_MAX;
+    memset(keyEvent, 0, sizeof(key_event_t));
+    keyEvent->key_type = KEY_TYPE_MAX;
     if (EVENT_TOUCH == eventType) {
-        keyEvent.key_type = RIGHT_KEY;
-        keyEvent.key_value = KEY_DOWN;
+        keyEvent->key_type = RIGHT_KEY;
+        keyEvent->key_value = KEY_DOWN;
     } else if (EVENT_TOUCH_RELEASE == eventType) {
-        keyEvent.key_type = RIGHT_KEY;
-        keyEvent.key_value = KEY_UP;
-        //beap(0,100);
+        keyEvent->key_type = RIGHT_KEY;
+        keyEvent->key_value = KEY_UP;
+        buzzer_key_beep();
     } else if (EVENT_SLIDER == eventType) {
         int currentPos =  EVENT_SLIDER_POSITION(event[1], event[2]);
-        if (currentPos == 0xffff) {
-            ESP_LOGI(TAG, "%s: slider release\n", __func__);
-            //slider release, skip it
-            lastSliderPos = -1;
-            return;
+        int32_t delta;
+        if (currentPos == SLIDER_RELEASE) {
+            TLOGD(TAG, "%s: slider release", __func__);
+            delta = slider_gesture_release(&slider);
+        } else {
+            TLOGD(TAG, "%s: slider: =================> %d", __func__, currentPos);
+            delta = slider_gesture_update(&slider, currentPos, time);
+        }
+        if (delta == 0) return false;
+
+        keyEvent->key_type = SLIDER_KEY;
+        keyEvent->key_value = KEY_UP;
+        keyEvent->key_data = delta;
+    }
+    return keyEvent->key_type != KEY_TYPE_MAX;
+}
+
+// drain pending events into the batch and post them, false if there were none
+static bool read_batch()
+{
+    int count = 0;
+    while(count < EVENT_BATCH_SIZE && !gpio_get_level(PIN_NUM_INT)) {
+        if (ESP_OK != i2c_read_event(I2C_MASTER_NUM, batch[count])) {
+            //give up on this wake, the thread tries again after a back off
+            i2cFailed = true;
+            break;
         }
-        if (lastSliderPos < 0) {
-            //slider touch
-            lastSliderPos = currentPos;
-            lastSliderTime = currtime;
-            ESP_LOGI(TAG, "%s: slider touch: %d, %d\n", __func__, lastSliderPos, lastSliderTime );
-            return;
+        if (wakeEventTime >= 0) {
+            eventTime[count] = wakeEventTime;
+            wakeEventTime = -1;
+        } else {
+            eventTime[count] = esp_timer_get_time();
         }
-        ESP_LOGI(TAG, "%s: slider: =================> %d (%d)\n", __func__, currentPos, diff/240000);
-        /*
-        if ( diff < DIFF_100MS) {
-            //skip event between 100ms
-            return;
+        count++;
+    }
+    if (count == 0) return false;
+
+    stats.batches++;
+    stats.events += count;
+    if (count > stats.max_batch) stats.max_batch = count;
+
+    //parse the whole batch, then post
+    uint32_t taskTime = latency_now();
+    int keyCount = 0;
+    for (int i = 0; i < count; i++) {
+        if (cpt112s_parse_event(batch[i], eventTime[i], &keyEvents[keyCount])) {
+            keyEvents[keyCount].isr_time = wakeIsrTime;
+            keyEvents[keyCount].task_time = taskTime;
+            keyCount++;
         }
-        if (currentPos == lastSliderPos) return;
-        */
-        if (abs(currentPos-lastSliderPos) < SLIDER_THRESHOLD) return;
-
-        if (currentPos > lastSliderPos) keyEvent.key_type = SLIDER_RIGHT_KEY;
-        else keyEvent.key_type = SLIDER_LEFT_KEY;
-        keyEvent.key_value = KEY_UP;
-        keyEvent.key_data = diff/240000;
-        lastSliderPos = currentPos;
-        lastSliderTime = currtime;
     }
-    send_key_event(keyEvent, false);
+    for (int i = 0; i < keyCount; i++) {
+        send_key_event(keyEvents[i], false);
+    }
+    return true;
 }
 
-static void main_loop()
+// io loop thread, one batch per step
+static int cpt112s_thread(io_thread_t* thread)
 {
-    uint8_t event[3];
+    PT_BEGIN(&thread->pt);
     while(1) {
         //Wait until data is ready
-        xSemaphoreTake( rdySem, portMAX_DELAY );
+        IO_WAIT_SIGNAL(thread);
 
-        ESP_LOGI(TAG, "%s: *****    interrupt come in\n", __func__);
-        //gpio_isr_handler_remove(PIN_NUM_INT);
+        TLOGD(TAG, "%s: *****    interrupt come in", __func__);
+        wakeIsrTime = isrTime;
+        wakeEventTime = isrWakeTime;
+        isrTime = 0;
 
-        while(!gpio_get_level(PIN_NUM_INT)) {
-            memset(event, 0, sizeof(event));
-            if (ESP_OK == i2c_read(I2C_MASTER_NUM, event, sizeof(event))) {
-                // parse event and queue
-                cpt112s_parse_event(event);
-            }
+        i2cFailed = false;
+        while(!i2cFailed && !gpio_get_level(PIN_NUM_INT)) {
+            if (!read_batch()) break;
+            //let the other sources in between two batches
+            IO_YIELD(thread);
+        }
+        if (i2cFailed) {
+            //INT is still low: no wake source meanwhile, it would end every light sleep
+            gpio_wakeup_disable(PIN_NUM_INT);
+            IO_SLEEP(thread, I2C_BACKOFF_US);
         }
 
-        ESP_LOGI(TAG, "%s: *****     no more event\n", __func__);
-        //gpio_isr_handler_add(PIN_NUM_INT);
-        //ESP_LOGI(TAG, "%s: release\n", __func__);
+        TLOGD(TAG, "%s: *****     no more event", __func__);
+        //unmask, fires right away if INT is low again
+        pm_wake_pin_arm(PIN_NUM_INT, GPIO_INTR_LOW_LEVEL);
     }
+    PT_END(&thread->pt);
 }
 
 /**
@@ -188,9 +273,9 @@ static void i2c_master_init()
 }
 
 static void interrupt_init() {
-    //GPIO config for the data line.
+    //GPIO config for the INT line, the interrupt is armed once the handler is in
     gpio_config_t io_conf={
-        .intr_type=GPIO_INTR_NEGEDGE,
+        .intr_type=GPIO_INTR_DISABLE,
         .mode=GPIO_MODE_INPUT,
         .pull_up_en=1,
         .pin_bit_mask=(1<<PIN_NUM_INT)
@@ -199,18 +284,24 @@ static void interrupt_init() {
     gpio_config(&io_conf);
     // gpio_install_isr_service(0);
     gpio_isr_handler_add(PIN_NUM_INT, data_isr_handler, NULL);
+    //low while events are queued, wakes the chip from light sleep
+    pm_wake_pin_arm(PIN_NUM_INT, GPIO_INTR_LOW_LEVEL);
 }
 
 void cpt112s_init()
 {
     ESP_LOGI(TAG, "%s: CPT112S start!!!\n", __func__);
 
-    //Create the semaphore.
-    rdySem=xSemaphoreCreateBinary();
+    slider_gesture_init(&slider);
 
     i2c_master_init();
+    i2c_read_cmd_init();
+    //Events are read in the io loop
+    io_loop_add(&touchThread, IO_SOURCE_TOUCH, &cpt112s_thread);
     interrupt_init();
+}
 
-    //Create task
-    xTaskCreate(&main_loop, "cpt112s_main_loop", 4096, NULL, 2, NULL);
-} 
+void cpt112s_get_stats(cpt112s_stats_t* out)
+{
+    memcpy(out, &stats, sizeof(cpt112s_stats_t));
+}
@@ -2,7 +2,17 @@
 #define _CPT1123S_H_
 
 #include <stdio.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t events;            //events read over i2c
+    uint32_t batches;           //drain rounds
+    uint32_t max_batch;         //most events drained in one round
+    uint32_t i2c_errors;        //failed i2c transactions
+    uint32_t i2c_retries;       //re-issued i2c transactions
+} cpt112s_stats_t;
 
 void cpt112s_init();
+void cpt112s_get_stats(cpt112s_stats_t* stats);
 
 #endif  /*_CPT1123S_H_*/
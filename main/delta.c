@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "delta.h"
+
+#define TAG "DELTA"
+
+/* DELTA STATE */
+enum {
+    DELTA_HEADER,
+    DELTA_DIFF_LEN,
+    DELTA_EXTRA_LEN,
+    DELTA_SEEK,
+    DELTA_ZERO_RUN,
+    DELTA_LITERAL_LEN,
+    DELTA_LITERALS,
+    DELTA_EXTRA,
+    DELTA_DONE,
+};
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static esp_err_t delta_fail(delta_t* delta, esp_err_t err, const char* reason)
+{
+    if (delta->err == ESP_OK) {
+        ESP_LOGE(TAG, "%s at target %u\n", reason, delta->target_pos);
+        delta->err = err;
+    }
+    return delta->err;
+}
+
+static esp_err_t flush_output(delta_t* delta)
+{
+    if (delta->output_len == 0) return ESP_OK;
+    mbedtls_sha256_update(&delta->sha, delta->output, delta->output_len);
+    esp_err_t err = delta->write(delta->arg, delta->output, delta->output_len);
+    delta->output_len = 0;
+    if (err != ESP_OK) return delta_fail(delta, err, "write failed");
+    return ESP_OK;
+}
+
+static esp_err_t put_byte(delta_t* delta, uint8_t byte)
+{
+    if (delta->target_pos >= delta->target_size) {
+        return delta_fail(delta, ESP_ERR_INVALID_SIZE, "target overrun");
+    }
+    delta->output[delta->output_len++] = byte;
+    delta->target_pos++;
+    if (delta->output_len == DELTA_OUTPUT_BUFFER) {
+        return flush_output(delta);
+    }
+    return ESP_OK;
+}
+
+// source byte at source_pos, refills the window on a miss
+static esp_err_t get_source(delta_t* delta, uint8_t* byte)
+{
+    uint32_t pos = delta->source_pos;
+    if (pos >= delta->source_size) {
+        return delta_fail(delta, ESP_ERR_INVALID_SIZE, "source overrun");
+    }
+    if (pos < delta->source_start || pos >= delta->source_start+delta->source_len) {
+        uint32_t len = delta->source_size-pos;
+        if (len > DELTA_SOURCE_BUFFER) len = DELTA_SOURCE_BUFFER;
+        esp_err_t err = delta->read(delta->arg, pos, delta->source, len);
+        if (err != ESP_OK) {
+            delta->source_len = 0;
+            return delta_fail(delta, err, "read failed");
+        }
+        delta->source_start = pos;
+        delta->source_len = len;
+    }
+    *byte = delta->source[pos-delta->source_start];
+    delta->source_pos++;
+    return ESP_OK;
+}
+
+// the running image must be the one the patch was made against
+static esp_err_t check_source(delta_t* delta, const uint8_t* hash)
+{
+    mbedtls_sha256_context sha;
+    uint8_t digest[DELTA_HASH_SIZE];
+    esp_err_t err = ESP_OK;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t pos = 0; pos < delta->source_size && err == ESP_OK; pos += DELTA_SOURCE_BUFFER) {
+        uint32_t len = delta->source_size-pos;
+        if (len > DELTA_SOURCE_BUFFER) len = DELTA_SOURCE_BUFFER;
+        err = delta->read(delta->arg, pos, delta->source, len);
+        mbedtls_sha256_update(&sha, delta->source, len);
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+
+    if (err != ESP_OK) return delta_fail(delta, err, "read failed");
+    if (memcmp(digest, hash, DELTA_HASH_SIZE) != 0) {
+        return delta_fail(delta, ESP_ERR_INVALID_STATE, "patch is for another source image");
+    }
+    return ESP_OK;
+}
+
+static esp_err_t parse_header(delta_t* delta)
+{
+    const uint8_t* header = delta->header;
+    if (get_u32(header) != DELTA_MAGIC || (header[4] | (header[5]<<8)) != DELTA_VERSION) {
+        return delta_fail(delta, ESP_ERR_INVALID_ARG, "bad header");
+    }
+    delta->source_size = get_u32(header+8);
+    delta->target_size = get_u32(header+12);
+    ESP_LOGI(TAG, "%s: source %u, target %u bytes\n", __func__, delta->source_size, delta->target_size);
+    return check_source(delta, header+16);
+}
+
+// next record, or done once the whole target is out
+static void next_record(delta_t* delta)
+{
+    delta->state = (delta->target_pos == delta->target_size) ? DELTA_DONE : DELTA_DIFF_LEN;
+}
+
+static void diff_done(delta_t* delta)
+{
+    delta->source_pos += delta->seek;
+    if (delta->extra_len > 0) {
+        delta->state = DELTA_EXTRA;
+    } else {
+        next_record(delta);
+    }
+}
+
+// a varint field is complete, act on it
+static esp_err_t field_done(delta_t* delta, uint32_t value)
+{
+    switch (delta->state) {
+        case DELTA_DIFF_LEN:
+            delta->diff_len = value;
+            delta->state = DELTA_EXTRA_LEN;
+            break;
+        case DELTA_EXTRA_LEN:
+            delta->extra_len = value;
+            delta->state = DELTA_SEEK;
+            break;
+        case DELTA_SEEK:
+            delta->seek = (int32_t)(value>>1) ^ -(int32_t)(value&1);
+            if (delta->diff_len > 0) {
+                delta->state = DELTA_ZERO_RUN;
+            } else {
+                diff_done(delta);
+            }
+            break;
+        case DELTA_ZERO_RUN:
+            if (value > delta->diff_len) {
+                return delta_fail(delta, ESP_ERR_INVALID_SIZE, "zero run overrun");
+            }
+            delta->diff_len -= value;
+            while (value-- > 0 && delta->err == ESP_OK) {
+                uint8_t byte;
+                if (get_source(delta, &byte) == ESP_OK) {
+                    put_byte(delta, byte);
+                }
+            }
+            delta->state = DELTA_LITERAL_LEN;
+            break;
+        case DELTA_LITERAL_LEN:
+            if (value > delta->diff_len) {
+                return delta_fail(delta, ESP_ERR_INVALID_SIZE, "literal run overrun");
+            }
+            delta->run_len = value;
+            if (value > 0) {
+                delta->state = DELTA_LITERALS;
+            } else if (delta->diff_len > 0) {
+                delta->state = DELTA_ZERO_RUN;
+            } else {
+                diff_done(delta);
+            }
+            break;
+        default:
+            break;
+    }
+    return delta->err;
+}
+
+bool delta_is_patch(const uint8_t* data, size_t len)
+{
+    return len >= 4 && get_u32(data) == DELTA_MAGIC;
+}
+
+esp_err_t delta_begin(delta_t* delta, delta_read_t read, delta_write_t write, void* arg)
+{
+    memset(delta, 0, sizeof(delta_t));
+    delta->read = read;
+    delta->write = write;
+    delta->arg = arg;
+    delta->state = DELTA_HEADER;
+    mbedtls_sha256_init(&delta->sha);
+    mbedtls_sha256_starts(&delta->sha, 0);
+    return ESP_OK;
+}
+
+esp_err_t delta_feed(delta_t* delta, const uint8_t* data, size_t len)
+{
+    const uint8_t* end = data+len;
+    while (data < end && delta->err == ESP_OK) {
+        switch (delta->state) {
+            case DELTA_HEADER: {
+                uint32_t n = DELTA_HEADER_SIZE-delta->header_len;
+                if (n > end-data) n = end-data;
+                memcpy(delta->header+delta->header_len, data, n);
+                delta->header_len += n;
+                data += n;
+                if (delta->header_len == DELTA_HEADER_SIZE && parse_header(delta) == ESP_OK) {
+                    next_record(delta);
+                }
+                break;
+            }
+            case DELTA_DIFF_LEN:
+            case DELTA_EXTRA_LEN:
+            case DELTA_SEEK:
+            case DELTA_ZERO_RUN:
+            case DELTA_LITERAL_LEN: {
+                uint8_t byte = *data++;
+                if (delta->shift > 28) {
+                    return delta_fail(delta, ESP_ERR_INVALID_SIZE, "bad varint");
+                }
+                delta->varint |= (uint32_t)(byte&0x7f) << delta->shift;
+                delta->shift += 7;
+                if (byte & 0x80) break;
+                uint32_t value = delta->varint;
+                delta->varint = 0;
+                delta->shift = 0;
+                field_done(delta, value);
+                break;
+            }
+            case DELTA_LITERALS: {
+                uint8_t byte;
+                if (get_source(delta, &byte) == ESP_OK) {
+                    put_byte(delta, byte + *data);
+                }
+                data++;
+                delta->diff_len--;
+                if (--delta->run_len > 0) break;
+                if (delta->diff_len > 0) {
+                    delta->state = DELTA_ZERO_RUN;
+                } else {
+                    diff_done(delta);
+                }
+                break;
+            }
+            case DELTA_EXTRA:
+                put_byte(delta, *data++);
+                if (--delta->extra_len == 0) {
+                    next_record(delta);
+                }
+                break;
+            case DELTA_DONE:
+            default:
+                return delta_fail(delta, ESP_ERR_INVALID_SIZE, "data past the end of the patch");
+        }
+    }
+    return delta->err;
+}
+
+esp_err_t delta_end(delta_t* delta)
+{
+    uint8_t digest[DELTA_HASH_SIZE];
+
+    flush_output(delta);
+    mbedtls_sha256_finish(&delta->sha, digest);
+    mbedtls_sha256_free(&delta->sha);
+    if (delta->err != ESP_OK) return delta->err;
+    if (delta->state != DELTA_DONE) {
+        return delta_fail(delta, ESP_ERR_INVALID_SIZE, "patch truncated");
+    }
+    if (memcmp(digest, delta->header+16+DELTA_HASH_SIZE, DELTA_HASH_SIZE) != 0) {
+        return delta_fail(delta, ESP_ERR_INVALID_CRC, "target sha256 mismatch");
+    }
+    return ESP_OK;
+}
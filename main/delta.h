@@ -0,0 +1,68 @@
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "mbedtls/sha256.h"
+
+/*
+ * Streaming patch applier for delta OTA. A patch (tools/mkdelta.py) is a
+ * header followed by bsdiff style records:
+ *
+ *   header: magic "BFDP", version, source size, target size,
+ *           sha256 of the source image, sha256 of the target image
+ *   record: diff len, extra len, seek (zigzag) as varints,
+ *           diff body: { zero run, literal count, literals } until diff len,
+ *           extra bytes
+ *
+ * Diff bytes are added to the source bytes at the source position, a zero run
+ * copies the source unchanged. Extra bytes are copied as is. After the diff
+ * the source position moves by seek. Input can be fed in chunks of any size,
+ * ram use is the delta_t itself.
+ */
+#define DELTA_MAGIC             0x50444642      //"BFDP"
+#define DELTA_VERSION           1
+#define DELTA_HASH_SIZE         32
+#define DELTA_HEADER_SIZE       (16+2*DELTA_HASH_SIZE)
+#define DELTA_SOURCE_BUFFER     256
+#define DELTA_OUTPUT_BUFFER     1024
+
+typedef esp_err_t (*delta_read_t)(void* arg, uint32_t offset, uint8_t* data, size_t len);
+typedef esp_err_t (*delta_write_t)(void* arg, const uint8_t* data, size_t len);
+
+typedef struct {
+    delta_read_t read;          //source image
+    delta_write_t write;        //target image
+    void* arg;
+    esp_err_t err;              //first error, sticky
+    int state;
+    uint8_t header[DELTA_HEADER_SIZE];
+    uint32_t header_len;
+    uint32_t source_size;
+    uint32_t target_size;
+    uint32_t varint;            //varint being decoded
+    int shift;
+    uint32_t diff_len;          //left in the current record
+    uint32_t extra_len;
+    int32_t seek;
+    uint32_t run_len;           //left in the current literal run
+    uint32_t source_pos;
+    uint32_t target_pos;
+    uint8_t source[DELTA_SOURCE_BUFFER];
+    uint32_t source_start;      //source offset of source[0]
+    uint32_t source_len;
+    uint8_t output[DELTA_OUTPUT_BUFFER];
+    uint32_t output_len;
+    mbedtls_sha256_context sha; //over the target
+} delta_t;
+
+// true if data starts with a patch header rather than an image
+bool delta_is_patch(const uint8_t* data, size_t len);
+esp_err_t delta_begin(delta_t* delta, delta_read_t read, delta_write_t write, void* arg);
+esp_err_t delta_feed(delta_t* delta, const uint8_t* data, size_t len);
+// ESP_OK once the whole target is written and its sha256 matches
+esp_err_t delta_end(delta_t* delta);
+
+#endif  /*_DELTA_H_*/
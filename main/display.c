@@ -11,12 +11,16 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "driver/spi_master.h"
 #include "config.h"
 #include "display.h"
 #include "queue_buffer.h"
+#include "latency.h"
+#include "trace.h"
+#include "pm.h"
 
 /*
  * defines
@@ -74,16 +78,9 @@
 #define ICON_ADDRESS_1          5
 #define ICON_ADDRESS_2          6
 
-static uint8_t display_data[]={
+//command + 14 bytes of display ram, all of it is sent every update
+static uint8_t display_data[15]={
     COMMAND_ADDRESS_8,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0
 };
 
 static uint8_t numbers[] = {
@@ -99,15 +96,35 @@ static uint8_t numbers[] = {
     NUMBER_9,
 };
 
-static spi_device_handle_t spi;
+static spi_device_handle_t spi = NULL;
+static SemaphoreHandle_t displayLock = NULL;
+static StaticSemaphore_t displayLockBuffer;
 static bool display_enable = true;
 
-static void spi_trassfer_display() 
+//key handler and main loop both update the display: every change of
+//display_data and the transfer of it are made under displayLock, so no
+//frame goes out half written
+static void display_lock()
+{
+    if (displayLock != NULL) xSemaphoreTake(displayLock, portMAX_DELAY);
+}
+
+static void display_unlock()
+{
+    if (displayLock != NULL) xSemaphoreGive(displayLock);
+}
+
+// with displayLock held, false if there is no display
+static bool spi_trassfer_display() 
 {
     esp_err_t ret;
     spi_transaction_t trans[3];        //total 3 transactions
     spi_transaction_t *rtrans;
+
+    if (spi == NULL) return false;
     memset(trans, 0, sizeof(trans));   //Zero out the transaction
+    TRACE(TRACE_SPI_START, TRACE_SRC_DISPLAY, 0);
+    pm_lock(PM_LOCK_DISPLAY);          //spi clock from apb, the frame at full speed
 
     //AUTO address command
     trans[0].length=8;                                      //Command is 8 bits
@@ -117,7 +134,7 @@ static void spi_trassfer_display()
     assert(ret==ESP_OK);               //Should have had no issues.
 
     //Address + data
-    trans[1].length=15*8;                     //15bytes is 15*8 bits
+    trans[1].length=sizeof(display_data)*8;   //15bytes is 15*8 bits
     trans[1].tx_buffer=display_data;          //command + data
     ret=spi_device_queue_trans(spi, &trans[1], portMAX_DELAY);
     assert(ret==ESP_OK);               //Should have had no issues.
@@ -134,7 +151,17 @@ static void spi_trassfer_display()
         ret=spi_device_get_trans_result(spi, &rtrans, portMAX_DELAY);
         assert(ret==ESP_OK);
     }
+    pm_unlock(PM_LOCK_DISPLAY);
+    TRACE(TRACE_SPI_END, TRACE_SRC_DISPLAY, 0);
+    return true;
+}
 
+// send the frame, then let the other writers in
+static void transfer_and_unlock()
+{
+    bool sent = spi_trassfer_display();
+    display_unlock();
+    if (sent) latency_display_done();
 }
 
 
@@ -150,6 +177,8 @@ void display_set_temperature(int32_t temp)
 {
 
     int8_t data[DIGITAL_NUMBER];
+    bool negative = temp < 0;
+    if (negative) temp = -temp;
     //convert to array, LSB mode
     memset(data, -2, sizeof(data));
     int i;
@@ -165,9 +194,13 @@ void display_set_temperature(int32_t temp)
             break;
         }
     }
+    if (negative && i > 0) {
+        data[i-1] = -1;
+    }
 
     //set display data
     int start = 1;
+    display_lock();
     for (int j=0; j<DIGITAL_NUMBER; j++) {
         if (data[j] == -2){
             display_data[start+j] = NUMBER_OFF;
@@ -179,14 +212,30 @@ void display_set_temperature(int32_t temp)
         //display_data[3] |= 0x80;
     }
 
-    spi_trassfer_display();
+    transfer_and_unlock();
+}
+
+void display_set_busy()
+{
+    display_lock();
+    for (int j=0; j<DIGITAL_NUMBER; j++) {
+        display_data[1+j] = OPT_DASH;
+    }
+    transfer_and_unlock();
+}
+
+void display_flush()
+{
+    display_lock();
+    transfer_and_unlock();
 }
 
 void display_set_operation(int operation, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3)
 {
-    clear_display_data(true);
     int timerPos = 1+DIGITAL_NUMBER*2;
     int digitPos = 1+DIGITAL_NUMBER;
+    display_lock();
+    clear_display_data(true);
     switch(operation) {
         case OPERATION_UPGRADE:
             // show C1 at timer
@@ -195,6 +244,7 @@ void display_set_operation(int operation, uint8_t d0, uint8_t d1, uint8_t d2, ui
             display_data[timerPos] = NUMBER_1;
             break;
         default:
+            display_unlock();
             return;
             break;
     }
@@ -214,13 +264,15 @@ void display_set_operation(int operation, uint8_t d0, uint8_t d1, uint8_t d2, ui
     if (d3 < 10) {
         display_data[digitPos] = numbers[d3];
     }
+    display_unlock();
 }
 
 void display_set_error(uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3)
 {
-    clear_display_data(true);
     int timerPos = 1+DIGITAL_NUMBER*2+3;
     int digitPos = 1+DIGITAL_NUMBER;
+    display_lock();
+    clear_display_data(true);
     // show E at timer
     display_data[timerPos] = CHAR_E;
 
@@ -239,6 +291,7 @@ void display_set_error(uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3)
     if (d3 < 10) {
         display_data[digitPos] = numbers[d3];
     }
+    display_unlock();
 }
 
 void display_set_icon(int icon, bool on)
@@ -250,6 +303,7 @@ void display_set_icon(int icon, bool on)
         iconAddress = ICON_ADDRESS_2;
         icon -= ICON_SETTING;
     }
+    display_lock();
     uint8_t val = display_data[iconAddress];
 
     if (on) {
@@ -258,15 +312,18 @@ void display_set_icon(int icon, bool on)
         val &= (~(1<<icon));
     }
     display_data[iconAddress] = val;
+    display_unlock();
 }
 
 void display_turn_onoff(bool on)
 {
+    display_lock();
     if (on) {
         display_enable = true;
     } else {
         display_enable = false;
     }
+    display_unlock();
 }
 
 void display_init()
@@ -274,6 +331,7 @@ void display_init()
     ESP_LOGD(TAG,"Display Init!!!\n");
 
     esp_err_t ret;
+    displayLock = xSemaphoreCreateMutexStatic(&displayLockBuffer);
     spi_bus_config_t buscfg={
         .miso_io_num=PIN_NUM_MISO,
         .mosi_io_num=PIN_NUM_MOSI,
@@ -22,5 +22,9 @@ void display_set_icon(int icon, bool on);
 void display_set_temperature(int32_t temp);
 void display_set_operation(int opation, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
 void display_set_error(uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+// "----" until there is a temperature to show
+void display_set_busy();
+// send icons and digits set so far to the display
+void display_flush();
 
 #endif  /*_DISPLAY_H_*/
@@ -11,78 +11,183 @@
 #include <stdlib.h>
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "gpio_key.h"
 #include "key_event.h"
+#include "latency.h"
+#include "buzzer.h"
+#include "trace.h"
+#include "io_loop.h"
+#include "pm.h"
 
 #define TAG  "KEY"
 
-static TaskHandle_t xHandle = NULL;
-static xQueueHandle gpio_evt_queue = NULL;
-
-static void gpio_isr_handler(void* arg)
+#define KEY_TICK_US             5000        //5ms scan tick while a key is active
+#define DEBOUNCE_TICKS          4           //20ms stable level
+#define LONG_PRESS_TICKS        100         //500ms
+#define REPEAT_TICKS            100         //500ms between auto-repeat
+#define DOUBLE_CLICK_TICKS      60          //300ms from release to next press
+
+typedef struct {
+    gpio_num_t gpio;
+    int8_t key_type;
+    uint8_t active_level;
+} key_def_t;
+
+/* Key table, one entry per GPIO key */
+static const key_def_t keys[] = {
+    { GPIO_INPUT_IO_KEY_LEFT, LEFT_KEY, 1 },
+};
+#define KEY_NUM                 (sizeof(keys)/sizeof(keys[0]))
+
+typedef struct {
+    bool pressed;               //debounced state
+    uint8_t bounce;             //ticks the raw level differs from pressed
+    uint8_t clicks;             //releases inside the double click window
+    uint16_t held;              //ticks since press, back to the long press after each repeat
+    uint16_t released;          //ticks since release
+    uint32_t isr_time;          //last interrupt, for latency
+} key_state_t;
+
+static key_state_t key_states[KEY_NUM];
+static io_thread_t keyThread;
+static portMUX_TYPE keyMux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t changedMask = 0;
+static volatile uint32_t armedMask = 0;    //keys with their interrupt unmasked
+static uint32_t activeMask = 0;
+
+static void IRAM_ATTR gpio_isr_handler(void* arg)
 {
-    uint32_t gpio_num = (uint32_t) arg;
-    xQueueSendFromISR(gpio_evt_queue, &gpio_num, NULL);
+    uint32_t index = (uint32_t) arg;
+    TRACE(TRACE_ISR_ENTER, TRACE_SRC_GPIO_KEY, index);
+    portENTER_CRITICAL_ISR(&keyMux);
+    changedMask |= 1<<index;
+    armedMask &= ~(1<<index);
+    key_states[index].isr_time = latency_now();
+    portEXIT_CRITICAL_ISR(&keyMux);
+    //level triggered, masked until key_tick() sees the key stable
+    gpio_intr_disable(keys[index].gpio);
+    BaseType_t mustYield = false;
+    io_loop_notify_from_isr(IO_SOURCE_KEY, &mustYield);
+    TRACE(TRACE_ISR_EXIT, TRACE_SRC_GPIO_KEY, index);
+    if (mustYield) portYIELD_FROM_ISR();
 }
 
-void beap(int wait, int duration)
+static void key_send(int index, int8_t value)
 {
-    if (wait > 0) {
-        vTaskDelay(wait/portTICK_RATE_MS);
+    key_event_t keyEvent;
+    memset(&keyEvent, 0, sizeof(keyEvent));
+    keyEvent.key_type = keys[index].key_type;
+    keyEvent.key_value = value;
+    //a click counts from the release, the wait for a second press included
+    if (value == KEY_DOWN || value == KEY_UP || value == KEY_CLICK) {
+        keyEvent.isr_time = key_states[index].isr_time;
     }
-    gpio_set_level(GPIO_OUTPUT_IO_SPEAKER, 1);
-    vTaskDelay(duration/portTICK_RATE_MS);
-    gpio_set_level(GPIO_OUTPUT_IO_SPEAKER, 0);
+    keyEvent.task_time = latency_now();
+    send_key_event(keyEvent, false);
 }
 
-static void gpio_key_task(void* arg)
+// interrupt on the level the key changes to next, also wakes from light sleep
+static void key_arm(int index)
 {
-    uint32_t io_num;
-    int tick = -1;
-    TickType_t tick_type = portMAX_DELAY;
-
-    key_event_t keyEvent;
-    while(1) {
-        if(xQueueReceive(gpio_evt_queue, &io_num, tick_type)) {
-            int val = gpio_get_level(io_num);
-            if (io_num == GPIO_INPUT_IO_KEY_LEFT) {
-                int tick_value = -1;
-
-                if (val == 1) {
-                    //beap and vibrate
-                    beap(0,100);
-                    tick_value = 0;
-                }
+    const key_def_t* def = &keys[index];
+    int level = key_states[index].pressed ? !def->active_level : def->active_level;
+    //before the unmask, the isr may run right away
+    portENTER_CRITICAL(&keyMux);
+    armedMask |= 1<<index;
+    portEXIT_CRITICAL(&keyMux);
+    pm_wake_pin_arm(def->gpio, level ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+}
 
-                // detect key
-                keyEvent.key_type = LEFT_KEY;
-                keyEvent.key_value = val==1?KEY_DOWN:KEY_UP;
-                tick = tick_value;
-                send_key_event(keyEvent, false);
-
-                if (tick == -1) {
-                    //stop tick
-                    tick_type = portMAX_DELAY;
-                } else {
-                    //start tick
-                    tick_type = ( TickType_t ) 50/portTICK_RATE_MS;
+// one scan tick for a key, return true while the key still needs ticks
+static bool key_scan(int index)
+{
+    const key_def_t* def = &keys[index];
+    key_state_t* key = &key_states[index];
+    bool raw = gpio_get_level(def->gpio) == def->active_level;
+
+    if (raw != key->pressed) {
+        key->bounce++;
+        if (key->bounce >= DEBOUNCE_TICKS) {
+            key->bounce = 0;
+            key->pressed = raw;
+            if (raw) {
+                key->held = 0;
+                buzzer_key_beep();
+                key_send(index, KEY_DOWN);
+            } else {
+                key->released = 0;
+                key_send(index, KEY_UP);
+                //the release of a long press is no click
+                if (key->held < LONG_PRESS_TICKS && ++key->clicks >= 2) {
+                    key->clicks = 0;
+                    key_send(index, KEY_DOUBLE_CLICK);
                 }
             }
         }
-        if (tick >= 0) {
-            tick++;
-            if (tick > 10) {
-                //50*10 ms
-                keyEvent.key_value = KEY_HOLD;
-                keyEvent.key_type = LEFT_KEY;
-                send_key_event(keyEvent, false);
-                tick = 1;
-            }
+    } else {
+        key->bounce = 0;
+    }
+
+    if (key->pressed) {
+        key->held++;
+        if (key->held == LONG_PRESS_TICKS) {
+            key->clicks = 0;
+            key_send(index, KEY_LONG_PRESS);
+        } else if (key->held > LONG_PRESS_TICKS && (key->held-LONG_PRESS_TICKS)%REPEAT_TICKS == 0) {
+            key_send(index, KEY_HOLD);
+            //held for good: stays within one repeat of the long press, it
+            //never wraps around to a second KEY_LONG_PRESS
+            key->held = LONG_PRESS_TICKS;
+        }
+    } else if (key->clicks > 0) {
+        key->released++;
+        if (key->released >= DOUBLE_CLICK_TICKS) {
+            //no second press, a single click after all
+            key->clicks = 0;
+            key_send(index, KEY_CLICK);
+        }
+    }
+
+    return key->pressed || key->bounce > 0 || key->clicks > 0;
+}
+
+// one scan tick, return true while a key still needs ticks
+static bool key_tick()
+{
+    portENTER_CRITICAL(&keyMux);
+    uint32_t mask = changedMask | activeMask;
+    changedMask = 0;
+    portEXIT_CRITICAL(&keyMux);
+
+    //only keys with an interrupt or an ongoing press/debounce/click window
+    uint32_t active = 0;
+    for (int i = 0; i < KEY_NUM; i++) {
+        if ((mask & (1<<i)) && key_scan(i)) {
+            active |= 1<<i;
+        }
+        if (!(armedMask & (1<<i)) && key_states[i].bounce == 0) {
+            key_arm(i);
         }
     }
+    activeMask = active;
+    return active != 0;
+}
+
+// io loop thread, scans every KEY_TICK_US from an interrupt until the keys are idle
+static int key_thread(io_thread_t* thread)
+{
+    PT_BEGIN(&thread->pt);
+    while (1) {
+        IO_WAIT_SIGNAL(thread);
+        do {
+            IO_SLEEP(thread, KEY_TICK_US);
+            //interrupts since the last tick are in changedMask, this scan takes them
+            io_take_signal(thread);
+        } while (key_tick());
+    }
+    PT_END(&thread->pt);
 }
 
 void gpio_key_init()
@@ -101,25 +206,29 @@ void gpio_key_init()
     //configure GPIO with the given settings
     gpio_config(&io_conf);
 
-    //interrupt of both edge
-    io_conf.intr_type = GPIO_INTR_ANYEDGE;
-    //bit mask of the pins, use GPIO4/5 here
-    io_conf.pin_bit_mask = GPIO_INPUT_PIN_SEL;
+    //level interrupt, armed by key_arm() once the handler is in
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    //bit mask of the key pins
+    io_conf.pin_bit_mask = 0;
+    for (int i = 0; i < KEY_NUM; i++) {
+        io_conf.pin_bit_mask |= (uint64_t)1<<keys[i].gpio;
+    }
     //set as input mode    
     io_conf.mode = GPIO_MODE_INPUT;
     //enable pull_down_en mode
     io_conf.pull_down_en = 1;
     gpio_config(&io_conf);
 
-    //create a queue to handle gpio event from isr
-    gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
-    //start gpio task
-    xTaskCreate(gpio_key_task, "gpio_key_task", 2048, NULL, 4, &xHandle);
+    //scan ticks in the io loop, only while a key is active
+    memset(key_states, 0, sizeof(key_states));
+    io_loop_add(&keyThread, IO_SOURCE_KEY, &key_thread);
 
-    //install gpio isr service
-    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-    //hook isr handler for specific gpio pin
-    gpio_isr_handler_add(GPIO_INPUT_IO_KEY_LEFT, gpio_isr_handler, (void*) GPIO_INPUT_IO_KEY_LEFT);
+    //gpio isr service is installed by app_main(), the adc uses it first
+    //hook isr handler for every key
+    for (int i = 0; i < KEY_NUM; i++) {
+        gpio_isr_handler_add(keys[i].gpio, gpio_isr_handler, (void*) i);
+        key_arm(i);
+    }
 
     //set reset high
     gpio_set_level(GPIO_OUTPUT_IO_RESET, 1);
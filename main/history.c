@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "rom/crc.h"
+#include "history.h"
+#include "task_table.h"
+
+#define TAG "HISTORY"
+
+#define HISTORY_PARTITION       "history"
+#define HISTORY_SUBTYPE         0x41
+#define HISTORY_MAGIC           0x4842      //"BH"
+#define HISTORY_VERSION         2           //1: start was time(), never set
+#define HISTORY_QUEUE_SIZE      2
+#define SLOTS_PER_SECTOR        (SPI_FLASH_SEC_SIZE/HISTORY_RECORD_SIZE)
+#define SLOT_ERASED             0xFFFF
+
+static const esp_partition_t* partition = NULL;
+static uint32_t slotCount = 0;
+static uint32_t head = 0;                   //next slot to write
+static uint32_t newestSeq = 0;              //0: empty
+static SemaphoreHandle_t historyLock = NULL;
+static xQueueHandle historyQueue = NULL;
+static StaticSemaphore_t historyLockBuffer;
+static StaticQueue_t historyQueueBuffer;
+static uint8_t historyQueueStorage[HISTORY_QUEUE_SIZE*sizeof(history_record_t)];
+static history_record_t taskRecord;         //history_task's, off its stack
+
+static uint32_t record_crc(const history_record_t* record)
+{
+    return crc32_le(0, (const uint8_t*)record, offsetof(history_record_t, crc));
+}
+
+static bool read_slot(uint32_t slot, history_record_t* record)
+{
+    if (esp_partition_read(partition, slot*HISTORY_RECORD_SIZE, record, sizeof(history_record_t)) != ESP_OK) {
+        return false;
+    }
+    return record->magic == HISTORY_MAGIC && record->crc == record_crc(record);
+}
+
+static uint16_t slot_magic(uint32_t slot)
+{
+    uint16_t magic = 0;
+    esp_partition_read(partition, slot*HISTORY_RECORD_SIZE, &magic, sizeof(magic));
+    return magic;
+}
+
+// the sector a new lap starts in must be blank before it is written
+static void erase_sector_of(uint32_t slot)
+{
+    uint32_t sector = slot/SLOTS_PER_SECTOR;
+    esp_partition_erase_range(partition, sector*SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+}
+
+// records reachable: all but the erased rest of the head's sector
+static uint32_t reachable()
+{
+    uint32_t max = slotCount - (SLOTS_PER_SECTOR - head%SLOTS_PER_SECTOR);
+    return newestSeq < max ? newestSeq : max;
+}
+
+// one queued record to flash
+static void history_write(history_record_t* record)
+{
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    uint32_t slot = head;
+    record->magic = HISTORY_MAGIC;
+    record->version = HISTORY_VERSION;
+    record->seq = newestSeq+1;
+    xSemaphoreGive(historyLock);
+
+    record->crc = record_crc(record);
+    esp_err_t err = esp_partition_write(partition, slot*HISTORY_RECORD_SIZE, record, sizeof(history_record_t));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: write failed (%d)\n", __func__, err);
+    }
+
+    //a failed slot is skipped, queries report it as damaged
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    head = (slot+1) % slotCount;
+    newestSeq = record->seq;
+    xSemaphoreGive(historyLock);
+
+    if (head % SLOTS_PER_SECTOR == 0) {
+        //sector full, prepare the next one while nothing waits on it
+        erase_sector_of(head);
+    }
+    ESP_LOGI(TAG, "%s: session %u, %u s\n", __func__, record->seq, record->duration);
+}
+
+static void history_task(void* arg)
+{
+    while (1) {
+        xQueueReceive(historyQueue, &taskRecord, portMAX_DELAY);
+        history_write(&taskRecord);
+    }
+}
+
+// finds the head after a restart
+static esp_err_t history_open()
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, HISTORY_SUBTYPE, HISTORY_PARTITION);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "%s: no %s partition\n", __func__, HISTORY_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint32_t sectors = partition->size/SPI_FLASH_SEC_SIZE;
+    if (sectors < 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    slotCount = sectors*SLOTS_PER_SECTOR;
+    newestSeq = 0;
+
+    //newest sector by the first record of every sector, then the newest record in it
+    history_record_t record;
+    int newestSector = -1;
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        if (read_slot(sector*SLOTS_PER_SECTOR, &record) && record.seq > newestSeq) {
+            newestSeq = record.seq;
+            newestSector = sector;
+        }
+    }
+    head = 0;
+    if (newestSector >= 0) {
+        uint32_t first = newestSector*SLOTS_PER_SECTOR;
+        head = first+1;
+        for (uint32_t slot = first+1; slot < first+SLOTS_PER_SECTOR; slot++) {
+            if (slot_magic(slot) == SLOT_ERASED) break;
+            if (read_slot(slot, &record) && record.seq > newestSeq) {
+                newestSeq = record.seq;
+            }
+            head = slot+1;
+        }
+        head %= slotCount;
+    }
+    //power cut between filling a sector and erasing the next one
+    if (slot_magic(head) != SLOT_ERASED) {
+        erase_sector_of(head);
+    }
+    ESP_LOGI(TAG, "%s: %d sessions, newest %u\n", __func__, reachable(), newestSeq);
+    return ESP_OK;
+}
+
+esp_err_t history_init()
+{
+    esp_err_t err = history_open();
+    if (err != ESP_OK) return err;
+    historyLock = xSemaphoreCreateMutexStatic(&historyLockBuffer);
+    historyQueue = xQueueCreateStatic(HISTORY_QUEUE_SIZE, sizeof(history_record_t), historyQueueStorage, &historyQueueBuffer);
+    task_table_start(TASK_HISTORY, &history_task, NULL);
+    return ESP_OK;
+}
+
+esp_err_t history_append(const history_record_t* record)
+{
+    if (historyQueue == NULL) return ESP_ERR_INVALID_STATE;
+    if (xQueueSendToBack(historyQueue, record, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "%s: queue full, session lost\n", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+int history_count()
+{
+    if (historyLock == NULL) return 0;
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    int count = reachable();
+    xSemaphoreGive(historyLock);
+    return count;
+}
+
+esp_err_t history_get(int index, history_record_t* record)
+{
+    if (historyLock == NULL) return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    bool valid = index >= 0 && index < reachable();
+    uint32_t slot = (head+slotCount-1-index) % slotCount;
+    uint32_t seq = newestSeq-index;
+    xSemaphoreGive(historyLock);
+
+    if (!valid) return ESP_ERR_NOT_FOUND;
+    if (!read_slot(slot, record) || record->seq != seq) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
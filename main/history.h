@@ -0,0 +1,51 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Session history: ring of fixed size records on the raw history partition.
+ * One record is one flash page, appended in order and never rewritten; the
+ * sector after the head is erased ahead of time, so an append is a single
+ * page program done by the history task. Record i back from the newest is at
+ * a computed address, history_get() is one page read.
+ *
+ * Nothing sets the wall clock, so a session is placed by the boot it ran in
+ * and the seconds since that boot. The boot counter is kept in the settings
+ * and committed at every start, two sessions with the same boot are apart
+ * by their start, the boots themselves only in order.
+ */
+#define HISTORY_RECORD_SIZE     256
+#define HISTORY_CURVE_MAX       (HISTORY_RECORD_SIZE-36)
+#define HISTORY_NOT_REACHED     0xFFFF
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t points;             //curve points used
+    uint32_t seq;               //set by history_append()
+    uint32_t boot;              //boot counter
+    uint32_t start;             //s since that boot
+    uint32_t duration;          //s
+    uint32_t energy;            //J
+    uint16_t time_to_target;    //s from start, HISTORY_NOT_REACHED
+    int16_t overshoot;          //0.1 degree, max above target
+    uint16_t interval;          //s between curve points
+    uint8_t target;             //degree
+    uint8_t reserved;
+    uint8_t curve[HISTORY_CURVE_MAX];   //0.5 degree
+    uint32_t crc;
+} history_record_t;
+
+esp_err_t history_init();
+// queued for the history task, never waits for flash
+esp_err_t history_append(const history_record_t* record);
+// records available, newest first: every slot but the erased rest of the
+// head's sector, 688 to 703 of the 704 slots in the 176 KB partition
+int history_count();
+// index 0 is the newest session
+esp_err_t history_get(int index, history_record_t* record);
+
+#endif  /*_HISTORY_H_*/
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "http.h"
+
+const char* http_header_value(const char* headers, const char* name)
+{
+    size_t nameLen = strlen(name);
+    const char* line = headers;
+    while (line != NULL && *line != 0) {
+        if (strncasecmp(line, name, nameLen) == 0 && line[nameLen] == ':') {
+            const char* value = line+nameLen+1;
+            while (*value == ' ') value++;
+            return value;
+        }
+        line = strstr(line, "\r\n");
+        if (line != NULL) line += 2;
+    }
+    return NULL;
+}
+
+size_t http_value_len(const char* value)
+{
+    const char* end = strstr(value, "\r\n");
+    return end != NULL ? end-value : strlen(value);
+}
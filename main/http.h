@@ -0,0 +1,13 @@
+#ifndef _HTTP_H_
+#define _HTTP_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+// value of a header in a 0 terminated header block, NULL if missing.
+// The value runs to the next "\r\n".
+const char* http_header_value(const char* headers, const char* name);
+// length of a header value returned above
+size_t http_value_len(const char* value);
+
+#endif  /*_HTTP_H_*/
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "io_loop.h"
+#include "latency.h"
+#include "task_table.h"
+
+#define TAG  "IO"
+
+#define NOTIFY_TIMER            (1<<IO_SOURCE_MAX)
+#define NOTIFY_ALL              0xffffffff
+
+static const char* sourceNames[IO_SOURCE_MAX] = {
+    [IO_SOURCE_ADC]     = "adc",
+    [IO_SOURCE_TOUCH]   = "touch",
+    [IO_SOURCE_KEY]     = "key",
+    [IO_SOURCE_EVENT]   = "event",
+};
+
+static io_thread_t* threads[IO_SOURCE_MAX];
+static TaskHandle_t ioTask = NULL;
+static esp_timer_handle_t wakeTimer = NULL;
+static int64_t timerWake = -1;             //us, alarm of wakeTimer, -1: not armed
+static portMUX_TYPE ioMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t notifyTime[IO_SOURCE_MAX]; //first pending notification, 0: none
+static io_loop_stats_t stats[IO_SOURCE_MAX];
+
+static void wake_timer_cb(void* arg)
+{
+    xTaskNotify(ioTask, NOTIFY_TIMER, eSetBits);
+}
+
+// the earliest timed wait, armed on the esp_timer: ticks are 10 ms
+static TickType_t arm_wake(int64_t wake)
+{
+    if (wake < 0) {
+        if (timerWake >= 0) {
+            esp_timer_stop(wakeTimer);
+            timerWake = -1;
+        }
+        return portMAX_DELAY;
+    }
+    int64_t now = esp_timer_get_time();
+    if (wake <= now) return 0;
+    if (wake != timerWake) {
+        if (timerWake >= 0) esp_timer_stop(wakeTimer);
+        esp_timer_start_once(wakeTimer, wake-now);
+        timerWake = wake;
+    }
+    return portMAX_DELAY;
+}
+
+// the thread of source runs for a notification
+static void record_latency(io_source_e source)
+{
+    portENTER_CRITICAL(&ioMux);
+    uint32_t time = notifyTime[source];
+    notifyTime[source] = 0;
+    portEXIT_CRITICAL(&ioMux);
+
+    stats[source].handled++;
+    if (time != 0) {
+        uint32_t latency = latency_now()-time;
+        stats[source].latency_sum += latency;
+        if (latency > stats[source].latency_max) stats[source].latency_max = latency;
+    }
+}
+
+static void io_loop_task(void* arg)
+{
+    uint32_t bits = 0;
+    while (1) {
+        if (bits & NOTIFY_TIMER) timerWake = -1;
+
+        bool yielded = false;
+        int64_t wake = -1;
+        for (int i = 0; i < IO_SOURCE_MAX; i++) {
+            io_thread_t* thread = threads[i];
+            if (thread == NULL) continue;
+            if (bits & (1<<i)) {
+                thread->signaled = true;
+                record_latency(i);
+            }
+
+            uint32_t start = latency_now();
+            int state = thread->fn(thread);
+            uint32_t step = latency_now()-start;
+            if (step > stats[i].step_max) stats[i].step_max = step;
+
+            if (state == PT_YIELDED) yielded = true;
+            if (thread->wake >= 0 && (wake < 0 || thread->wake < wake)) wake = thread->wake;
+        }
+
+        TickType_t timeout = arm_wake(wake);
+        if (yielded) timeout = 0;
+        bits = 0;
+        xTaskNotifyWait(0, NOTIFY_ALL, &bits, timeout);
+    }
+}
+
+void io_loop_add(io_thread_t* thread, io_source_e source, io_thread_fn_t fn)
+{
+    PT_INIT(&thread->pt);
+    thread->source = source;
+    thread->fn = fn;
+    thread->signaled = false;
+    thread->wake = -1;
+    portENTER_CRITICAL(&ioMux);
+    threads[source] = thread;
+    portEXIT_CRITICAL(&ioMux);
+}
+
+void io_loop_notify(io_source_e source)
+{
+    if (ioTask == NULL) return;
+    portENTER_CRITICAL(&ioMux);
+    if (notifyTime[source] == 0) notifyTime[source] = latency_now();
+    stats[source].notified++;
+    portEXIT_CRITICAL(&ioMux);
+    xTaskNotify(ioTask, 1<<source, eSetBits);
+}
+
+void IRAM_ATTR io_loop_notify_from_isr(io_source_e source, BaseType_t* mustYield)
+{
+    if (ioTask == NULL) return;
+    portENTER_CRITICAL_ISR(&ioMux);
+    if (notifyTime[source] == 0) notifyTime[source] = latency_now();
+    stats[source].notified++;
+    portEXIT_CRITICAL_ISR(&ioMux);
+    xTaskNotifyFromISR(ioTask, 1<<source, eSetBits, mustYield);
+}
+
+bool io_take_signal(io_thread_t* thread)
+{
+    if (!thread->signaled) return false;
+    thread->signaled = false;
+    return true;
+}
+
+bool io_wake_due(io_thread_t* thread)
+{
+    if (thread->wake < 0 || esp_timer_get_time() < thread->wake) return false;
+    thread->wake = -1;
+    return true;
+}
+
+void io_loop_get_stats(io_source_e source, io_loop_stats_t* out)
+{
+    portENTER_CRITICAL(&ioMux);
+    memcpy(out, &stats[source], sizeof(io_loop_stats_t));
+    portEXIT_CRITICAL(&ioMux);
+}
+
+void io_loop_dump()
+{
+    //a source waits at most for one step of every other thread
+    uint32_t bound = 0;
+    for (int i = 0; i < IO_SOURCE_MAX; i++) {
+        bound += stats[i].step_max;
+    }
+    ESP_LOGI(TAG, "%-6s %8s %8s %8s %8s %8s", "source", "notified", "handled", "avg us", "max us", "step us");
+    for (int i = 0; i < IO_SOURCE_MAX; i++) {
+        io_loop_stats_t s;
+        io_loop_get_stats(i, &s);
+        ESP_LOGI(TAG, "%-6s %8u %8u %8u %8u %8u", sourceNames[i], s.notified, s.handled,
+                s.handled > 0 ? (uint32_t)(s.latency_sum/s.handled) : 0, s.latency_max, s.step_max);
+    }
+    ESP_LOGI(TAG, "%s: worst case wait for a step %u us", __func__, bound);
+}
+
+void io_loop_init()
+{
+    memset(stats, 0, sizeof(stats));
+    esp_timer_create_args_t timer_args = {
+        .callback = &wake_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "io"
+    };
+    ESP_ERROR_CHECK( esp_timer_create(&timer_args, &wakeTimer) );
+    ioTask = task_table_start(TASK_IO, &io_loop_task, NULL);
+}
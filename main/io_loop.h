@@ -0,0 +1,73 @@
+#ifndef _IO_LOOP_H_
+#define _IO_LOOP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "pt.h"
+
+/*
+ * One task runs the I/O state machines of the drivers: adc conversion,
+ * touch events, key scan and the key event handler. Each is a protothread
+ * (pt.h) that returns while it waits, so all of them share one stack.
+ * ISRs wake the task with a notification bit per source, timed waits end
+ * on a single esp_timer.
+ *
+ * Threads never preempt each other: a notification is handled once the
+ * step running when it came in has returned, at worst after one step of
+ * every other thread. Steps are kept short (one conversion, one touch
+ * batch, one key event) and timed, io_loop_dump() prints notify to
+ * handling latency and the longest step per source.
+ */
+typedef enum {
+    IO_SOURCE_ADC,              //CS1237 data ready
+    IO_SOURCE_TOUCH,            //CPT112S event pending
+    IO_SOURCE_KEY,              //gpio key changed
+    IO_SOURCE_EVENT,            //key event posted
+    IO_SOURCE_MAX
+} io_source_e;
+
+typedef struct io_thread io_thread_t;
+// one step, returns PT_WAITING, PT_YIELDED or PT_ENDED
+typedef int (*io_thread_fn_t)(io_thread_t* thread);
+
+struct io_thread {
+    pt_t pt;
+    io_source_e source;
+    io_thread_fn_t fn;
+    bool signaled;              //notified since the thread last took it
+    int64_t wake;               //us, end of a timed wait, -1: none
+};
+
+typedef struct {
+    uint32_t notified;          //notifications, several may fold into one wake
+    uint32_t handled;           //wakes the thread was run for
+    uint32_t latency_max;       //us, notify to the thread running
+    uint64_t latency_sum;       //us
+    uint32_t step_max;          //us, longest step of the thread
+} io_loop_stats_t;
+
+// wait for a notification of the thread's source
+#define IO_WAIT_SIGNAL(thread)  PT_WAIT_UNTIL(&(thread)->pt, io_take_signal(thread))
+// wait us, the other threads run meanwhile
+#define IO_SLEEP(thread, us) \
+    do { \
+        (thread)->wake = esp_timer_get_time()+(us); \
+        PT_WAIT_UNTIL(&(thread)->pt, io_wake_due(thread)); \
+    } while (0)
+#define IO_YIELD(thread)        PT_YIELD(&(thread)->pt)
+
+void io_loop_init();
+// run fn for source from now on, thread must stay valid
+void io_loop_add(io_thread_t* thread, io_source_e source, io_thread_fn_t fn);
+void io_loop_notify(io_source_e source);
+void io_loop_notify_from_isr(io_source_e source, BaseType_t* mustYield);
+// true once per notification, also to drop notifications a step already covered
+bool io_take_signal(io_thread_t* thread);
+bool io_wake_due(io_thread_t* thread);
+void io_loop_get_stats(io_source_e source, io_loop_stats_t* stats);
+void io_loop_dump();
+
+#endif  /*_IO_LOOP_H_*/
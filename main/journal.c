@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "rom/crc.h"
+#include "journal.h"
+
+#define TAG "JOURNAL"
+
+#define RECORD_MAGIC            0x4A42      //"BJ"
+#define SLOT_ERASED             0xFFFF
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint16_t len;
+    uint32_t seq;
+    uint32_t crc;               //crc32 of seq, len and data
+} record_header_t;
+
+static uint32_t record_crc(const record_header_t* header, const uint8_t* data)
+{
+    uint32_t crc = crc32_le(0, (const uint8_t*)&header->seq, sizeof(header->seq));
+    crc = crc32_le(crc, (const uint8_t*)&header->len, sizeof(header->len));
+    return crc32_le(crc, data, header->len);
+}
+
+static size_t slot_offset(journal_t* journal, int region, uint32_t slot)
+{
+    return region*journal->region_size + slot*JOURNAL_SLOT_SIZE;
+}
+
+// read a slot, true if it holds a valid record
+static bool read_slot(journal_t* journal, int region, uint32_t slot, record_header_t* header, uint8_t* data)
+{
+    size_t offset = slot_offset(journal, region, slot);
+    if (esp_partition_read(journal->partition, offset, header, sizeof(record_header_t)) != ESP_OK) {
+        return false;
+    }
+    if (header->magic != RECORD_MAGIC || header->len > JOURNAL_DATA_MAX) {
+        return false;
+    }
+    if (esp_partition_read(journal->partition, offset+sizeof(record_header_t), data, header->len) != ESP_OK) {
+        return false;
+    }
+    return header->crc == record_crc(header, data);
+}
+
+esp_err_t journal_open(journal_t* journal, esp_partition_subtype_t subtype, const char* label)
+{
+    memset(journal, 0, sizeof(journal_t));
+    journal->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, subtype, label);
+    if (journal->partition == NULL) {
+        ESP_LOGE(TAG, "%s: no %s partition\n", __func__, label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    journal->region_size = (journal->partition->size/2) & ~(SPI_FLASH_SEC_SIZE-1);
+    if (journal->region_size < SPI_FLASH_SEC_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    //bounded scan: every slot of both regions is looked at once
+    uint32_t slots = journal->region_size/JOURNAL_SLOT_SIZE;
+    uint32_t used[2] = { 0, 0 };
+    record_header_t header;
+    uint8_t data[JOURNAL_DATA_MAX];
+    for (int region = 0; region < 2; region++) {
+        for (uint32_t slot = 0; slot < slots; slot++) {
+            header.magic = 0;
+            if (read_slot(journal, region, slot, &header, data)) {
+                if (journal->seq == 0 || header.seq > journal->seq) {
+                    journal->seq = header.seq;
+                    journal->region = region;
+                }
+            }
+            //torn writes are not erased, skip past them too
+            if (header.magic != SLOT_ERASED) {
+                used[region] = slot+1;
+            }
+        }
+    }
+    journal->slot = used[journal->region];
+
+    ESP_LOGI(TAG, "%s: %s seq %u, region %d, slot %u", __func__, label,
+            journal->seq, journal->region, journal->slot);
+    return ESP_OK;
+}
+
+esp_err_t journal_read(journal_t* journal, void* data, size_t* len)
+{
+    if (journal->partition == NULL) return ESP_ERR_INVALID_STATE;
+    if (journal->seq == 0) return ESP_ERR_NOT_FOUND;
+
+    //newest valid record is the last valid one of the active region
+    record_header_t header;
+    uint8_t buffer[JOURNAL_DATA_MAX];
+    for (int32_t slot = journal->slot-1; slot >= 0; slot--) {
+        if (read_slot(journal, journal->region, slot, &header, buffer) && header.seq == journal->seq) {
+            if (header.len > *len) return ESP_ERR_INVALID_SIZE;
+            memcpy(data, buffer, header.len);
+            *len = header.len;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t journal_append(journal_t* journal, const void* data, size_t len)
+{
+    if (journal->partition == NULL) return ESP_ERR_INVALID_STATE;
+    if (len > JOURNAL_DATA_MAX) return ESP_ERR_INVALID_SIZE;
+
+    esp_err_t err;
+    if (journal->slot >= journal->region_size/JOURNAL_SLOT_SIZE) {
+        //active region full, the new snapshot starts the other one
+        int region = journal->region ^ 1;
+        err = esp_partition_erase_range(journal->partition, region*journal->region_size, journal->region_size);
+        if (err != ESP_OK) return err;
+        journal->erases++;
+        journal->region = region;
+        journal->slot = 0;
+    }
+
+    //header and data in one write, word aligned
+    uint8_t record[JOURNAL_SLOT_SIZE];
+    record_header_t* header = (record_header_t*)record;
+    size_t size = (sizeof(record_header_t)+len+3) & ~3;
+    memset(record, 0xFF, size);
+    header->magic = RECORD_MAGIC;
+    header->len = len;
+    header->seq = journal->seq+1;
+    memcpy(record+sizeof(record_header_t), data, len);
+    header->crc = record_crc(header, record+sizeof(record_header_t));
+
+    err = esp_partition_write(journal->partition, slot_offset(journal, journal->region, journal->slot), record, size);
+    //the slot is used even if the write failed half way
+    journal->slot++;
+    if (err != ESP_OK) return err;
+
+    journal->seq = header->seq;
+    journal->writes++;
+    return ESP_OK;
+}
@@ -0,0 +1,35 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/*
+ * Append-only record journal on a raw data partition split in two regions
+ * (A/B). Every record is a full snapshot with a sequence number and crc, so
+ * the newest valid record is the current state. When the active region is
+ * full the other one is erased and written from its first slot; a power cut
+ * at any point leaves the previous record readable.
+ */
+#define JOURNAL_SLOT_SIZE       512
+#define JOURNAL_DATA_MAX        (JOURNAL_SLOT_SIZE-12)
+
+typedef struct {
+    const esp_partition_t* partition;
+    uint32_t region_size;       //bytes per region
+    int region;                 //active region, 0 or 1
+    uint32_t slot;              //next free slot in the active region
+    uint32_t seq;               //sequence of the newest valid record, 0: none
+    uint32_t writes;            //records written since boot
+    uint32_t erases;            //region erases since boot
+} journal_t;
+
+esp_err_t journal_open(journal_t* journal, esp_partition_subtype_t subtype, const char* label);
+// newest valid record, ESP_ERR_NOT_FOUND if there is none
+esp_err_t journal_read(journal_t* journal, void* data, size_t* len);
+esp_err_t journal_append(journal_t* journal, const void* data, size_t len);
+
+#endif  /*_JOURNAL_H_*/
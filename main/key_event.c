@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "key_event.h"
+#include "io_loop.h"
+#include "latency.h"
+#include "tlog.h"
+#include "trace.h"
+
+#define TAG  "EVENT"
+
+#define KEY_QUEUE_SIZE          16
+
+static xQueueHandle keyQueue = NULL;
+static StaticQueue_t keyQueueBuffer;
+static uint8_t keyQueueStorage[KEY_QUEUE_SIZE*sizeof(key_event_t)];
+static portMUX_TYPE eventMux = portMUX_INITIALIZER_UNLOCKED;
+static bool sliderPending = false;
+static key_event_t sliderEvent;
+static key_event_stats_t stats;
+
+void key_event_init()
+{
+    keyQueue = xQueueCreateStatic(KEY_QUEUE_SIZE, sizeof(key_event_t), keyQueueStorage, &keyQueueBuffer);
+    memset(&stats, 0, sizeof(stats));
+}
+
+// fold a slider delta into the pending one, return false if there was none
+static bool merge_slider(key_event_t* keyEvent)
+{
+    bool merged = sliderPending;
+    if (sliderPending) {
+        //keep the time stamps of the oldest motion
+        sliderEvent.key_data += keyEvent->key_data;
+        stats.merged++;
+    } else {
+        sliderEvent = *keyEvent;
+        sliderPending = true;
+    }
+    stats.posted[SLIDER_KEY]++;
+    return merged;
+}
+
+// queue path outcome, caller holds eventMux
+static void count_post(int8_t keyType, bool sent)
+{
+    if (sent) {
+        stats.posted[keyType]++;
+    } else {
+        stats.dropped[keyType]++;
+    }
+}
+
+void IRAM_ATTR send_key_event(key_event_t keyEvent, bool fromIsr)
+{
+    if (keyEvent.key_type < 0 || keyEvent.key_type >= KEY_TYPE_MAX) return;
+    keyEvent.post_time = latency_now();
+
+    if (fromIsr) {
+        BaseType_t mustYield = false;
+        if (keyEvent.key_type == SLIDER_KEY) {
+            portENTER_CRITICAL_ISR(&eventMux);
+            merge_slider(&keyEvent);
+            portEXIT_CRITICAL_ISR(&eventMux);
+        } else {
+            bool sent = xQueueSendToBackFromISR(keyQueue, &keyEvent, &mustYield) == pdTRUE;
+            portENTER_CRITICAL_ISR(&eventMux);
+            count_post(keyEvent.key_type, sent);
+            portEXIT_CRITICAL_ISR(&eventMux);
+            if (sent) {
+                TRACE(TRACE_QUEUE_SEND, TRACE_SRC_KEY_QUEUE, keyEvent.key_type);
+            } else {
+                TLOGW(TAG, "%s: queue full, drop key %d", __func__, keyEvent.key_type);
+            }
+        }
+        io_loop_notify_from_isr(IO_SOURCE_EVENT, &mustYield);
+        if (mustYield) portYIELD_FROM_ISR();
+        return;
+    }
+
+    if (keyEvent.key_type == SLIDER_KEY) {
+        portENTER_CRITICAL(&eventMux);
+        merge_slider(&keyEvent);
+        portEXIT_CRITICAL(&eventMux);
+    } else {
+        //counters are shared with the isr path
+        bool sent = xQueueSendToBack(keyQueue, &keyEvent, ( TickType_t ) 0 ) == pdTRUE;
+        portENTER_CRITICAL(&eventMux);
+        count_post(keyEvent.key_type, sent);
+        portEXIT_CRITICAL(&eventMux);
+        if (sent) {
+            TRACE(TRACE_QUEUE_SEND, TRACE_SRC_KEY_QUEUE, keyEvent.key_type);
+        } else {
+            TLOGW(TAG, "%s: queue full, drop key %d", __func__, keyEvent.key_type);
+        }
+    }
+    io_loop_notify(IO_SOURCE_EVENT);
+}
+
+bool key_event_receive(key_event_t* keyEvent)
+{
+    //keys first, then the merged slider motion
+    if (xQueueReceive(keyQueue, keyEvent, 0) == pdTRUE) {
+        return true;
+    }
+
+    bool found = false;
+    portENTER_CRITICAL(&eventMux);
+    if (sliderPending) {
+        *keyEvent = sliderEvent;
+        sliderPending = false;
+        found = true;
+    }
+    portEXIT_CRITICAL(&eventMux);
+    return found;
+}
+
+void key_event_get_stats(key_event_stats_t* out)
+{
+    portENTER_CRITICAL(&eventMux);
+    memcpy(out, &stats, sizeof(key_event_stats_t));
+    portEXIT_CRITICAL(&eventMux);
+}
@@ -2,13 +2,16 @@
 #define _BF_KEY_EVENT_H_
 
 #include <stdio.h>
+#include "freertos/FreeRTOS.h"
 
 /* KEY TYPE */
 enum {
 	LEFT_KEY,
 	RIGHT_KEY,
-	SLIDER_LEFT_KEY,
-	SLIDER_RIGHT_KEY,
+	SLIDER_KEY,             //key_data: signed temperature delta
+	TARGET_KEY,             //key_data: target temperature, remote control
+	HEAT_KEY,               //key_data: 1 heater on, 0 off, remote control
+	HOLD_KEY,               //key_data: 1 hold on, 0 off, remote control
     KEY_TYPE_MAX
 };
 
@@ -17,6 +20,9 @@ enum {
     KEY_UP,
     KEY_HOLD,
     KEY_DOWN,
+    KEY_LONG_PRESS,
+    KEY_DOUBLE_CLICK,
+    KEY_CLICK,              //released, no second press in the double click window
     KEY_VALUE_MAX
 };
 
@@ -24,8 +30,27 @@ typedef struct {
 	int8_t key_type;
 	int8_t key_value;
 	int32_t key_data;
+	uint32_t isr_time;          //us, input interrupt, 0 if not stamped
+	uint32_t task_time;         //us, driver task picked the input up
+	uint32_t post_time;         //us, posted to the event bus
 } key_event_t;
 
+typedef struct {
+    uint32_t posted[KEY_TYPE_MAX];      //events accepted per key type
+    uint32_t dropped[KEY_TYPE_MAX];     //events lost per key type, queue full
+    uint32_t merged;                    //slider deltas folded into a pending one
+} key_event_stats_t;
+
+/*
+ * Key event bus. Key up/down/hold go through a FIFO and are always delivered
+ * before slider motion; consecutive slider deltas are merged in place so a
+ * burst never overflows the queue. send_key_event() is safe from ISR when
+ * fromIsr is true and wakes the io loop (IO_SOURCE_EVENT), whose handler
+ * takes the events with key_event_receive() until it returns false.
+ */
+void key_event_init();
 void send_key_event(key_event_t keyEvent, bool fromIsr);
+bool key_event_receive(key_event_t* keyEvent);
+void key_event_get_stats(key_event_stats_t* stats);
 
 #endif  /*_BF_KEY_EVENT_H_*/
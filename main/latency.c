@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "latency.h"
+
+#define TAG  "LATENCY"
+
+static const char* stage_names[LATENCY_STAGE_MAX] = {
+    "isr->task",
+    "task->queue",
+    "queue->handler",
+    "handler->display",
+    "total",
+};
+
+static portMUX_TYPE latencyMux = portMUX_INITIALIZER_UNLOCKED;
+static latency_histogram_t histograms[LATENCY_STAGE_MAX];
+//handled event waiting for the display transfer
+static bool displayPending = false;
+static uint32_t pendingIsrTime = 0;
+static uint32_t pendingHandlerTime = 0;
+
+uint32_t IRAM_ATTR latency_now()
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    //0 means not stamped
+    return now == 0 ? 1 : now;
+}
+
+static int latency_bucket(uint32_t us)
+{
+    int bucket = 0;
+    us >>= 4;
+    while (us > 0 && bucket < LATENCY_BUCKETS-1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void latency_record(int stage, uint32_t us)
+{
+    if (stage < 0 || stage >= LATENCY_STAGE_MAX) return;
+
+    portENTER_CRITICAL(&latencyMux);
+    latency_histogram_t* h = &histograms[stage];
+    if (h->count == 0 || us < h->min) h->min = us;
+    if (us > h->max) h->max = us;
+    h->count++;
+    h->sum += us;
+    h->buckets[latency_bucket(us)]++;
+    portEXIT_CRITICAL(&latencyMux);
+}
+
+void latency_event_handled(key_event_t* keyEvent, uint32_t handler_time)
+{
+    if (keyEvent->isr_time && keyEvent->task_time) {
+        latency_record(LATENCY_ISR_TO_TASK, keyEvent->task_time - keyEvent->isr_time);
+    }
+    if (keyEvent->task_time && keyEvent->post_time) {
+        latency_record(LATENCY_TASK_TO_QUEUE, keyEvent->post_time - keyEvent->task_time);
+    }
+    if (keyEvent->post_time) {
+        latency_record(LATENCY_QUEUE_TO_HANDLER, handler_time - keyEvent->post_time);
+    }
+
+    portENTER_CRITICAL(&latencyMux);
+    displayPending = true;
+    pendingIsrTime = keyEvent->isr_time;
+    pendingHandlerTime = handler_time;
+    portEXIT_CRITICAL(&latencyMux);
+}
+
+void latency_display_done()
+{
+    uint32_t now = latency_now();
+    portENTER_CRITICAL(&latencyMux);
+    bool pending = displayPending;
+    uint32_t isrTime = pendingIsrTime;
+    uint32_t handlerTime = pendingHandlerTime;
+    displayPending = false;
+    portEXIT_CRITICAL(&latencyMux);
+
+    if (!pending) return;
+    latency_record(LATENCY_HANDLER_TO_DISPLAY, now - handlerTime);
+    if (isrTime) {
+        latency_record(LATENCY_TOTAL, now - isrTime);
+    }
+}
+
+void latency_get(int stage, latency_histogram_t* histogram)
+{
+    if (stage < 0 || stage >= LATENCY_STAGE_MAX) return;
+
+    portENTER_CRITICAL(&latencyMux);
+    memcpy(histogram, &histograms[stage], sizeof(latency_histogram_t));
+    portEXIT_CRITICAL(&latencyMux);
+}
+
+void latency_reset()
+{
+    portENTER_CRITICAL(&latencyMux);
+    memset(histograms, 0, sizeof(histograms));
+    displayPending = false;
+    portEXIT_CRITICAL(&latencyMux);
+}
+
+void latency_dump()
+{
+    for (int stage = 0; stage < LATENCY_STAGE_MAX; stage++) {
+        latency_histogram_t h;
+        latency_get(stage, &h);
+        if (h.count == 0) {
+            ESP_LOGI(TAG, "%-16s: no sample", stage_names[stage]);
+            continue;
+        }
+        ESP_LOGI(TAG, "%-16s: n=%u min=%uus avg=%uus max=%uus", stage_names[stage],
+                h.count, h.min, (uint32_t)(h.sum/h.count), h.max);
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            if (h.buckets[i] == 0) continue;
+            if (i == LATENCY_BUCKETS-1) {
+                ESP_LOGI(TAG, "   >= %6uus: %u", 16u<<(i-1), h.buckets[i]);
+            } else {
+                ESP_LOGI(TAG, "    < %6uus: %u", 16u<<i, h.buckets[i]);
+            }
+        }
+    }
+}
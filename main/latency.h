@@ -0,0 +1,40 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "key_event.h"
+
+/* Input latency stages, from the ISR edge to the display transfer done */
+enum {
+    LATENCY_ISR_TO_TASK,
+    LATENCY_TASK_TO_QUEUE,
+    LATENCY_QUEUE_TO_HANDLER,
+    LATENCY_HANDLER_TO_DISPLAY,
+    LATENCY_TOTAL,
+    LATENCY_STAGE_MAX
+};
+
+// bucket 0: < 16us, bucket i: [2^(i+3), 2^(i+4)) us, last bucket: everything above
+#define LATENCY_BUCKETS         16
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;               //us
+    uint32_t max;               //us
+    uint64_t sum;               //us
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+// time stamp for key_event_t, us
+uint32_t latency_now();
+void latency_record(int stage, uint32_t us);
+// event taken by the handler at handler_time, display stage closes on the next transfer
+void latency_event_handled(key_event_t* keyEvent, uint32_t handler_time);
+// called by the display driver once a transfer completed
+void latency_display_done();
+void latency_get(int stage, latency_histogram_t* histogram);
+void latency_reset();
+void latency_dump();
+
+#endif  /*_LATENCY_H_*/
@@ -4,8 +4,10 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "config.h"
 #include "display.h"
@@ -14,20 +16,41 @@
 #include "spi_adc.h"
 #include "cpt112s.h"
 #include "temperature.h"
+#include "stabilizer.h"
+#include "latency.h"
+#include "buzzer.h"
+#include "wifi.h"
+#include "ota.h"
+#include "telemetry.h"
+#include "webserver.h"
+#include "history.h"
+#include "session.h"
+#include "tlog.h"
+#include "trace.h"
+#include "task_table.h"
+#include "boot.h"
+#include "io_loop.h"
+#include "pm.h"
 
 #define TAG  "MAIN"
 
 #define GPIO_HEAT_IO                        16      //active high
 #define MAIN_LOOP_SPEED                     50      //50ms
 #define SETTING_WAIT_TIME                   (2000/MAIN_LOOP_SPEED)    //2000ms
+#define DISPLAY_HYSTERESIS                  5       //0.5 degree
+#define DISPLAY_MIN_INTERVAL                1000    //1000ms between two temperature changes
+#define FIRST_READING_TIMEOUT               1000    //ms, adc not answering: go on without
 
-static xQueueHandle eventQueue;
 static bool mainDone = false;
 static int targetTemperature = 0;
 static bool heatEnable = false;
 static bool holdEnable = false;
 static bool setTargetTemp = false;
 static int setting_tick = -1;
+static bool targetReached = false;
+static SemaphoreHandle_t storageReady = NULL;
+static StaticSemaphore_t storageReadyBuffer;
+static io_thread_t keyEventThread;
 
 static void heat_init()
 {
@@ -52,10 +75,13 @@ static void toggle_heat()
         gpio_set_level(GPIO_HEAT_IO, 0);
         heatEnable = false;
         display_set_icon(ICON_HEAT, false);
+        session_stop();
     } else {
         gpio_set_level(GPIO_HEAT_IO, 1);
         heatEnable = true;
+        targetReached = false;
         display_set_icon(ICON_HEAT, true);
+        session_start(targetTemperature);
     }
 }
 
@@ -83,56 +109,107 @@ static void enable_setting(bool enable)
     }
 }
 
-void send_key_event(key_event_t keyEvent, bool fromIsr)
+static void handle_key_event(key_event_t* keyEvent)
 {
-    ESP_LOGI(TAG,"%s(%d, %d, %d)\n", __func__, keyEvent.key_type, keyEvent.key_value, fromIsr);
-    if (fromIsr) {
-        xQueueSendToBackFromISR(eventQueue, &keyEvent, ( TickType_t ) 0 );
-    }else{
-        xQueueSendToBack(eventQueue, &keyEvent, ( TickType_t ) 0 );
+    latency_event_handled(keyEvent, latency_now());
+    TLOGD(TAG, "%s: handle key evnet(%d, %d, %d) !!!", __func__, keyEvent->key_type, keyEvent->key_value, keyEvent->key_data);
+
+    switch(keyEvent->key_type){
+        case LEFT_KEY: 
+            //not on KEY_UP, the release may still turn into a double click
+            if (keyEvent->key_value == KEY_CLICK) {
+                toggle_hold();
+            }
+            break;
+        case RIGHT_KEY: 
+            if (keyEvent->key_value == KEY_UP) {
+                toggle_heat();
+            }
+            break;
+        case HEAT_KEY:
+            //a state, not a toggle: a repeated command changes nothing
+            if ((keyEvent->key_data != 0) != heatEnable) {
+                toggle_heat();
+            }
+            break;
+        case HOLD_KEY:
+            if ((keyEvent->key_data != 0) != holdEnable) {
+                toggle_hold();
+            }
+            break;
+        case TARGET_KEY:
+            //absolute target, same path as the slider from here
+            keyEvent->key_data -= targetTemperature;
+        case SLIDER_KEY:
+            targetTemperature += keyEvent->key_data;
+            if (targetTemperature < 0) {
+                targetTemperature = 0;
+            }
+            if (targetTemperature > 100) {
+                targetTemperature = 100;
+            }
+            enable_setting(true);
+            display_set_temperature(targetTemperature);
+            //cached, written to flash once the slider stays idle
+            config_set_target_temperature(targetTemperature);
+            return;
+        default:
+            break;
     }
-    ESP_LOGI(TAG,"exit %s\n", __func__);
+    display_flush();
 }
 
-static void handle_key_event(void *arg)
+// io loop thread, one key event per step
+static int key_event_thread(io_thread_t* thread)
 {
+    key_event_t keyEvent;
+    PT_BEGIN(&thread->pt);
     while(1) {
-        key_event_t keyEvent;
-        ESP_LOGI(TAG,"%s: wait for key evnet\n", __func__);
-        xQueueReceive(eventQueue, &keyEvent, portMAX_DELAY);
-
-        ESP_LOGI(TAG,"%s: handle key evnet(%d, %d, %d) !!!\n", __func__, keyEvent.key_type, keyEvent.key_value, keyEvent.key_data);
-
-        switch(keyEvent.key_type){
-            case LEFT_KEY: 
-                if (keyEvent.key_value == KEY_UP) {
-                    toggle_hold();
-                }
-                break;
-            case RIGHT_KEY: 
-                if (keyEvent.key_value == KEY_UP) {
-                    toggle_heat();
-                }
-                break;
-            case SLIDER_LEFT_KEY:
-                targetTemperature--;
-                if (targetTemperature < 0) {
-                    targetTemperature = 0;
-                }
-                enable_setting(true);
-                break;
-            case SLIDER_RIGHT_KEY:
-                targetTemperature++;
-                if (targetTemperature > 100) {
-                    targetTemperature = 100;
-                }
-                //ESP_LOGI(TAG, "%s: target: %d\n", __func__, targetTemperature);
-                enable_setting(true);
-                break;
-            default:
-                break;
+        IO_WAIT_SIGNAL(thread);
+        while (key_event_receive(&keyEvent)) {
+            handle_key_event(&keyEvent);
+            IO_YIELD(thread);
         }
     }
+    PT_END(&thread->pt);
+}
+
+static void target_temperature_changed(setting_e setting, void* arg)
+{
+    targetTemperature = config_get_target_temperature();
+}
+
+// adc task, every conversion
+static void adc_sample(int32_t raw, int32_t filtered)
+{
+    int32_t temp = convert_temp_x10(filtered);
+    telemetry_record(raw, temp, heatEnable, targetTemperature);
+    webserver_update(temp, heatEnable, holdEnable, targetTemperature);
+}
+
+static void firmware_upgrade_requested(setting_e setting, void* arg)
+{
+    esp_err_t err = ota_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: ota start failed (%d)\n", __func__, err);
+    }
+}
+
+// flash work that may take long (nvs recovery erases the partition)
+static void storage_boot()
+{
+    boot_begin(BOOT_STORAGE);
+    config_init();
+    config_load();
+    history_init();
+    boot_end(BOOT_STORAGE);
+    xSemaphoreGive(storageReady);
+}
+
+static void storage_task(void* arg)
+{
+    storage_boot();
+    vTaskDelete(NULL);
 }
 
 void app_main()
@@ -141,41 +218,105 @@ void app_main()
     ESP_LOGI(TAG, "version: %s", FW_VERSION);
     ESP_LOGI(TAG, "model: %s", MODEL_NUMBER);
 
-    /* start event queue */
-    eventQueue = xQueueCreate(10, sizeof(key_event_t));
-    xTaskCreate(&handle_key_event, "key_event_task", 4096, NULL, 3, NULL);
-
+    tlog_init();
+    //the trace clock
     esp_timer_init();
-    config_init();
-    gpio_key_init();
-    spi_adc_init();
+    trace_init();
+
+    //heater off and something on the display before anything slow
+    boot_begin(BOOT_SAFE);
+    //locks exist before the first display frame
+    pm_init();
+    heat_init();
     display_init();
+    display_set_busy();
+    //shared by the adc, touch and key isrs
+    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+    //the drivers run in it from their init on
+    io_loop_init();
+    boot_end(BOOT_SAFE);
+
+    //storage on the other core while the sensor comes up here
+    storageReady = xSemaphoreCreateBinaryStatic(&storageReadyBuffer);
+    if (task_table_start(TASK_BOOT, &storage_task, NULL) == NULL) {
+        //no heap for the task, in line then
+        storage_boot();
+    }
+
+    boot_begin(BOOT_SENSOR);
+    spi_adc_init();
+    boot_end(BOOT_SENSOR);
+
+    boot_begin(BOOT_FIRST_READING);
+    if (spi_adc_wait_value(FIRST_READING_TIMEOUT/portTICK_RATE_MS)) {
+        display_set_temperature(convert_temp(spi_adc_get_value()));
+    } else {
+        ESP_LOGE(TAG, "%s: no reading from the adc", __func__);
+    }
+    boot_end(BOOT_FIRST_READING);
+
+    //inputs change settings and beep, they wait for the settings
+    xSemaphoreTake(storageReady, portMAX_DELAY);
+    boot_begin(BOOT_INPUT);
+    key_event_init();
+    io_loop_add(&keyEventThread, IO_SOURCE_EVENT, &key_event_thread);
+    buzzer_init();
+    session_init();
+    gpio_key_init();
     cpt112s_init();
-    heat_init();
+    boot_end(BOOT_INPUT);
+
+    boot_begin(BOOT_NETWORK);
+    wifi_init();
+    telemetry_init();
+    webserver_init();
+    boot_end(BOOT_NETWORK);
+    spi_adc_set_listener(adc_sample);
+    boot_dump();
 
     //int direction = 1;
     targetTemperature = config_get_target_temperature();
+    config_subscribe(SETTING_TARGET_TEMPERATURE, target_temperature_changed, NULL);
+    config_subscribe(SETTING_FIRMWARE_UPGRADE, firmware_upgrade_requested, NULL);
 
-    int64_t time = 0;
+    stabilizer_t stabilizer;
+    stabilizer_init(&stabilizer, DISPLAY_HYSTERESIS, DISPLAY_MIN_INTERVAL);
+    int32_t shown = 0;
+
+    int64_t lastLoop = esp_timer_get_time();
     while(!mainDone) {
         vTaskDelay(MAIN_LOOP_SPEED/portTICK_RATE_MS);
-        time = esp_timer_get_time() - time;
-        ESP_LOGI(TAG, "time passed %ld", time);
+        int64_t now = esp_timer_get_time();
+        TLOGI(TAG, "time passed %u", (uint32_t)(now-lastLoop));
+        lastLoop = now;
 
-        /*
         if (setting_tick >= 0) {
             display_set_temperature(targetTemperature);
             setting_tick++;
             if (setting_tick >= SETTING_WAIT_TIME) {
                 enable_setting(false);
+                //show current temperature right away
+                stabilizer_reset(&stabilizer);
             }
             continue;
         }
 
+        if (ota_get_state() == OTA_RUNNING) {
+            //display shows upgrade progress
+            continue;
+        }
+
         int32_t val = spi_adc_get_value();
-        int32_t temp = convert_temp(val);
-        display_set_temperature(temp);
-        */
+        int32_t temp = convert_temp_x10(val);
+        session_sample(temp, heatEnable, targetTemperature);
+        if (stabilizer_update(&stabilizer, temp, esp_timer_get_time(), &shown)) {
+            display_set_temperature(shown);
+        }
+
+        if (heatEnable && !targetReached && shown >= targetTemperature) {
+            targetReached = true;
+            buzzer_play(TONE_ALARM);
+        }
 
         /*
         if (direction == 1) {
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "mbedtls/sha256.h"
+#include "config.h"
+#include "display.h"
+#include "wifi.h"
+#include "delta.h"
+#include "http.h"
+#include "ota.h"
+#include "task_table.h"
+
+#define TAG  "OTA"
+
+#define OTA_BUFFER_SIZE         4096
+#define OTA_BUFFER_NUM          2           //one receiving while the other is written
+#define OTA_RETRY_MAX           5
+#define OTA_RETRY_DELAY         2000        //ms
+#define OTA_RECV_TIMEOUT        10          //s
+#define OTA_WIFI_TIMEOUT        30000       //ms
+#define HTTP_HEADER_MAX         1024
+#define HASH_SIZE               32
+
+typedef struct {
+    int index;                  //buffer index
+    int len;                    //0: end of image, <0: abort
+} ota_chunk_t;
+
+static volatile ota_state_e state = OTA_IDLE;
+static ota_stats_t stats;
+static uint8_t* buffers[OTA_BUFFER_NUM];
+static xQueueHandle freeQueue = NULL;
+static xQueueHandle fullQueue = NULL;
+static SemaphoreHandle_t writerDone = NULL;
+static StaticQueue_t freeQueueBuffer;
+static StaticQueue_t fullQueueBuffer;
+static StaticSemaphore_t writerDoneBuffer;
+static uint8_t freeQueueStorage[OTA_BUFFER_NUM*sizeof(int)];
+static uint8_t fullQueueStorage[(OTA_BUFFER_NUM+1)*sizeof(ota_chunk_t)];
+static volatile bool writerFailed = false;
+static uint8_t imageHash[HASH_SIZE];
+static bool checkHash = false;          //imageHash fetched from the server
+
+static void ota_show_progress(int percent)
+{
+    if (percent > 100) percent = 100;
+    display_set_operation(OPERATION_UPGRADE, 10,
+            percent >= 100 ? 1 : 10,
+            percent >= 10 ? (percent/10)%10 : 10,
+            percent%10);
+    display_flush();
+}
+
+static int http_connect(const char* host, uint16_t port)
+{
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    char portStr[8];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(portStr, sizeof(portStr), "%u", port);
+    if (getaddrinfo(host, portStr, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGE(TAG, "%s: dns lookup failed for %s\n", __func__, host);
+        return -1;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype, 0);
+    if (fd >= 0) {
+        struct timeval timeout = { .tv_sec = OTA_RECV_TIMEOUT, .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+            ESP_LOGE(TAG, "%s: connect failed (%d)\n", __func__, errno);
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// send GET, range request if offset > 0. HTTP/1.0: the body comes
+// unchunked and the connection closes after it
+static bool http_request(int fd, const char* host, const char* path, uint32_t offset)
+{
+    char request[HTTP_HEADER_MAX];
+    int len;
+    if (offset > 0) {
+        len = snprintf(request, sizeof(request),
+                "GET %s HTTP/1.0\r\nHost: %s\r\nRange: bytes=%u-\r\n\r\n",
+                path, host, offset);
+    } else {
+        len = snprintf(request, sizeof(request),
+                "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n",
+                path, host);
+    }
+    if (len >= sizeof(request)) return false;
+    return send(fd, request, len, 0) == len;
+}
+
+/*
+ * Read the response header. Body bytes read past the header are copied to body,
+ * their count returned in bodyLen. start is the first byte of a 206 range.
+ * Returns the http status, -1 on error or a body without a plain length
+ * (chunked or no Content-Length): the image end could not be told from a
+ * dropped connection.
+ */
+static int http_read_header(int fd, uint8_t* body, int bodySize, int* bodyLen, uint32_t* contentLength,
+                            uint32_t* start, uint32_t* total)
+{
+    char header[HTTP_HEADER_MAX+1];
+    int len = 0;
+    char* end = NULL;
+    while (end == NULL) {
+        if (len >= HTTP_HEADER_MAX) return -1;
+        int n = recv(fd, header+len, HTTP_HEADER_MAX-len, 0);
+        if (n <= 0) return -1;
+        len += n;
+        header[len] = 0;
+        end = strstr(header, "\r\n\r\n");
+    }
+
+    *end = 0;
+    int headerLen = end+4-header;
+    *bodyLen = len-headerLen;
+    if (*bodyLen > bodySize) return -1;
+    memcpy(body, header+headerLen, *bodyLen);
+
+    int status = -1;
+    if (sscanf(header, "HTTP/%*d.%*d %d", &status) != 1) return -1;
+
+    *contentLength = 0;
+    *start = 0;
+    *total = 0;
+    if (http_header_value(header, "Transfer-Encoding") != NULL) {
+        ESP_LOGE(TAG, "%s: transfer encoding not supported\n", __func__);
+        return -1;
+    }
+    const char* value = http_header_value(header, "Content-Length");
+    if (value == NULL) {
+        ESP_LOGE(TAG, "%s: no content length\n", __func__);
+        return -1;
+    }
+    *contentLength = strtoul(value, NULL, 10);
+    value = http_header_value(header, "Content-Range");
+    if (value != NULL) {
+        //bytes start-end/total
+        unsigned int first, last, length;
+        if (sscanf(value, "bytes %u-%u/%u", &first, &last, &length) == 3) {
+            *start = first;
+            *total = length;
+        }
+    } else if (status == 200) {
+        *total = *contentLength;
+    }
+    return status;
+}
+
+// optional <path>.sha256 next to the image, false if not available
+static bool ota_fetch_hash(firmware_t* firmware)
+{
+    char path[FIRMWARE_PATH_MAX+8];
+    char text[HASH_SIZE*2+1];
+    int textLen = 0;
+    uint32_t contentLength, start, total;
+
+    snprintf(path, sizeof(path), "%s.sha256", firmware->path);
+    int fd = http_connect(firmware->host, firmware->port);
+    if (fd < 0) return false;
+
+    bool ok = false;
+    if (http_request(fd, firmware->host, path, 0)
+            && http_read_header(fd, (uint8_t*)text, sizeof(text)-1, &textLen, &contentLength, &start, &total) == 200) {
+        while (textLen < sizeof(text)-1) {
+            int n = recv(fd, text+textLen, sizeof(text)-1-textLen, 0);
+            if (n <= 0) break;
+            textLen += n;
+        }
+        ok = textLen == HASH_SIZE*2;
+        for (int i = 0; ok && i < HASH_SIZE; i++) {
+            unsigned int byte;
+            ok = sscanf(text+i*2, "%2x", &byte) == 1;
+            imageHash[i] = byte;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+static esp_err_t ota_source_read(void* arg, uint32_t offset, uint8_t* data, size_t len)
+{
+    return esp_partition_read(esp_ota_get_running_partition(), offset, data, len);
+}
+
+static esp_err_t ota_target_write(void* arg, const uint8_t* data, size_t len)
+{
+    esp_err_t err = esp_ota_write(*(esp_ota_handle_t*)arg, data, len);
+    if (err == ESP_OK) {
+        stats.written += len;
+    }
+    return err;
+}
+
+static void ota_writer_task(void* arg)
+{
+    const esp_partition_t* partition = (const esp_partition_t*)arg;
+    esp_ota_handle_t handle = 0;
+    mbedtls_sha256_context sha;
+    uint8_t hash[HASH_SIZE];
+    ota_chunk_t chunk;
+    delta_t* delta = NULL;
+    bool first = true;
+
+    //sha256 of the download, image or patch, for the sidecar check
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    esp_err_t err = esp_ota_begin(partition, OTA_SIZE_UNKNOWN, &handle);
+    writerFailed = err != ESP_OK;
+
+    while (1) {
+        xQueueReceive(fullQueue, &chunk, portMAX_DELAY);
+        if (chunk.len <= 0) break;
+
+        uint8_t* data = buffers[chunk.index];
+        if (first) {
+            first = false;
+            if (delta_is_patch(data, chunk.len)) {
+                ESP_LOGI(TAG, "%s: delta patch against the running image\n", __func__);
+                delta = malloc(sizeof(delta_t));
+                if (delta != NULL) {
+                    delta_begin(delta, ota_source_read, ota_target_write, &handle);
+                } else {
+                    writerFailed = true;
+                }
+            }
+        }
+
+        if (!writerFailed) {
+            mbedtls_sha256_update(&sha, data, chunk.len);
+            if (delta != NULL) {
+                err = delta_feed(delta, data, chunk.len);
+            } else {
+                err = ota_target_write(&handle, data, chunk.len);
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "%s: write failed (%d)\n", __func__, err);
+                writerFailed = true;
+            }
+        }
+        xQueueSendToBack(freeQueue, &chunk.index, portMAX_DELAY);
+    }
+
+    if (delta != NULL) {
+        //flushes the tail and checks the target sha256 from the patch header
+        if (delta_end(delta) != ESP_OK && chunk.len == 0) {
+            writerFailed = true;
+        }
+        free(delta);
+    }
+    mbedtls_sha256_finish(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    if (handle != 0 && esp_ota_end(handle) != ESP_OK) {
+        //image verification failed
+        writerFailed = true;
+    }
+    if (chunk.len == 0 && checkHash && memcmp(hash, imageHash, HASH_SIZE) != 0) {
+        ESP_LOGE(TAG, "%s: sha256 mismatch\n", __func__);
+        writerFailed = true;
+    }
+
+    xSemaphoreGive(writerDone);
+    vTaskDelete(NULL);
+}
+
+// stream the image to the writer, resume at offset after a dropped connection
+static bool ota_download(firmware_t* firmware)
+{
+    uint32_t offset = 0;
+    int retries = 0;
+    int lastPercent = -1;
+
+    while (retries <= OTA_RETRY_MAX && !writerFailed) {
+        if (retries > 0) {
+            stats.resumes++;
+            vTaskDelay(OTA_RETRY_DELAY/portTICK_RATE_MS);
+        }
+        retries++;
+
+        int fd = http_connect(firmware->host, firmware->port);
+        if (fd < 0) continue;
+        if (!http_request(fd, firmware->host, firmware->path, offset)) {
+            close(fd);
+            continue;
+        }
+
+        int index;
+        xQueueReceive(freeQueue, &index, portMAX_DELAY);
+        int len = 0;
+        uint32_t contentLength, start, total;
+        int status = http_read_header(fd, buffers[index], OTA_BUFFER_SIZE, &len, &contentLength, &start, &total);
+        //server without range support sends it all again, skip what we have
+        uint32_t skip = (status == 200) ? offset : 0;
+        if ((status != 200 && status != 206) || (status == 206 && (total == 0 || start != offset))) {
+            ESP_LOGE(TAG, "%s: http status %d, range from %u for %u\n", __func__, status, start, offset);
+            xQueueSendToBack(freeQueue, &index, portMAX_DELAY);
+            close(fd);
+            continue;
+        }
+        if (stats.total == 0) stats.total = total;
+
+        bool closed = false;
+        while (!closed && !writerFailed) {
+            while (len < OTA_BUFFER_SIZE) {
+                int n = recv(fd, buffers[index]+len, OTA_BUFFER_SIZE-len, 0);
+                if (n <= 0) {
+                    closed = true;
+                    break;
+                }
+                len += n;
+            }
+            if (skip > 0) {
+                uint32_t drop = skip < len ? skip : len;
+                memmove(buffers[index], buffers[index]+drop, len-drop);
+                len -= drop;
+                skip -= drop;
+            }
+            if (len == 0) continue;
+
+            ota_chunk_t chunk = { .index = index, .len = len };
+            xQueueSendToBack(fullQueue, &chunk, portMAX_DELAY);
+            offset += len;
+            stats.received = offset;
+            len = 0;
+            xQueueReceive(freeQueue, &index, portMAX_DELAY);
+
+            int percent = stats.total ? (uint64_t)offset*100/stats.total : 0;
+            if (percent != lastPercent) {
+                lastPercent = percent;
+                ota_show_progress(percent);
+            }
+        }
+        xQueueSendToBack(freeQueue, &index, portMAX_DELAY);
+        close(fd);
+
+        if (stats.total > 0 && offset >= stats.total) {
+            return true;
+        }
+        ESP_LOGW(TAG, "%s: connection lost at %u/%u\n", __func__, offset, stats.total);
+    }
+    return false;
+}
+
+static void ota_task(void* arg)
+{
+    firmware_t firmware;
+    memcpy(&firmware, config_get_firmware_upgrade(), sizeof(firmware_t));
+    ESP_LOGI(TAG, "%s: http://%s:%u%s\n", __func__, firmware.host, firmware.port, firmware.path);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.start_time = esp_timer_get_time();
+    bool ok = false;
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+
+    if (partition != NULL && wifi_wait_connected(OTA_WIFI_TIMEOUT/portTICK_RATE_MS)) {
+        checkHash = ota_fetch_hash(&firmware);
+        if (!checkHash) {
+            ESP_LOGW(TAG, "%s: no sha256 for the image, image check only\n", __func__);
+        }
+
+        ota_show_progress(0);
+        for (int i = 0; i < OTA_BUFFER_NUM; i++) {
+            xQueueSendToBack(freeQueue, &i, 0);
+        }
+        writerFailed = false;
+        if (task_table_start(TASK_OTA_WRITER, &ota_writer_task, (void*)partition) != NULL) {
+            bool downloaded = ota_download(&firmware);
+            ota_chunk_t chunk = { .index = 0, .len = downloaded ? 0 : -1 };
+            xQueueSendToBack(fullQueue, &chunk, portMAX_DELAY);
+            xSemaphoreTake(writerDone, portMAX_DELAY);
+
+            ok = downloaded && !writerFailed;
+        }
+    }
+    stats.end_time = esp_timer_get_time();
+
+    if (ok && esp_ota_set_boot_partition(partition) == ESP_OK) {
+        ESP_LOGI(TAG, "%s: %u bytes in %d ms, %u resumes, restart\n", __func__,
+                stats.written, (int)((stats.end_time-stats.start_time)/1000), stats.resumes);
+        state = OTA_DONE;
+        config_flush();
+        esp_restart();
+    }
+
+    ESP_LOGE(TAG, "%s: upgrade failed\n", __func__);
+    display_set_error(10, 10, 10, 1);
+    display_flush();
+    for (int i = 0; i < OTA_BUFFER_NUM; i++) {
+        free(buffers[i]);
+        buffers[i] = NULL;
+    }
+    state = OTA_FAILED;
+    vTaskDelete(NULL);
+}
+
+esp_err_t ota_start()
+{
+    if (state == OTA_RUNNING) return ESP_ERR_INVALID_STATE;
+
+    firmware_t* firmware = config_get_firmware_upgrade();
+    if (firmware->host[0] == 0 || firmware->path[0] == 0) return ESP_ERR_INVALID_ARG;
+
+    if (freeQueue == NULL) {
+        freeQueue = xQueueCreateStatic(OTA_BUFFER_NUM, sizeof(int), freeQueueStorage, &freeQueueBuffer);
+        fullQueue = xQueueCreateStatic(OTA_BUFFER_NUM+1, sizeof(ota_chunk_t), fullQueueStorage, &fullQueueBuffer);
+        writerDone = xSemaphoreCreateBinaryStatic(&writerDoneBuffer);
+    }
+    xQueueReset(freeQueue);
+    xQueueReset(fullQueue);
+    for (int i = 0; i < OTA_BUFFER_NUM; i++) {
+        if (buffers[i] == NULL) {
+            buffers[i] = malloc(OTA_BUFFER_SIZE);
+        }
+        if (buffers[i] == NULL) return ESP_ERR_NO_MEM;
+    }
+
+    state = OTA_RUNNING;
+    if (task_table_start(TASK_OTA, &ota_task, NULL) == NULL) {
+        state = OTA_FAILED;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+ota_state_e ota_get_state()
+{
+    return state;
+}
+
+void ota_get_stats(ota_stats_t* out)
+{
+    memcpy(out, &stats, sizeof(ota_stats_t));
+}
@@ -0,0 +1,38 @@
+#ifndef _OTA_H_
+#define _OTA_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* OTA STATE */
+typedef enum {
+    OTA_IDLE,
+    OTA_RUNNING,
+    OTA_DONE,
+    OTA_FAILED,
+} ota_state_e;
+
+typedef struct {
+    uint32_t total;             //image bytes, 0 until known
+    uint32_t received;          //bytes from the network
+    uint32_t written;           //image bytes written to flash
+    uint32_t resumes;           //reconnects with a range request
+    int64_t start_time;         //us
+    int64_t end_time;           //us
+} ota_stats_t;
+
+/*
+ * Download the image from the stored firmware target (config_get_firmware_upgrade())
+ * into the next OTA partition, then reboot into it. Network receive runs in one
+ * task and flash writes in another, double buffered; a dropped connection resumes
+ * at the byte offset with an http range request. If <path>.sha256 exists on the
+ * server the image sha256 is checked against it.
+ * The download can also be a delta patch (delta.h) against the running image,
+ * it is applied on the fly while writing.
+ */
+esp_err_t ota_start();
+ota_state_e ota_get_state();
+void ota_get_stats(ota_stats_t* stats);
+
+#endif  /*_OTA_H_*/
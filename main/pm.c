@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "driver/gpio.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#endif
+#include "pm.h"
+
+#define TAG  "PM"
+
+#define PM_MIN_FREQ_MHZ         40          //xtal, APB follows down to 40MHz
+
+#if CONFIG_PM_ENABLE
+static const char* lockNames[PM_LOCK_MAX] = {
+    [PM_LOCK_ADC]       = "adc",
+    [PM_LOCK_DISPLAY]   = "display",
+    [PM_LOCK_TOUCH]     = "touch",
+};
+static esp_pm_lock_handle_t locks[PM_LOCK_MAX];
+#endif
+
+void pm_lock(pm_lock_e lock)
+{
+#if CONFIG_PM_ENABLE
+    //counted, nested transfers are fine
+    esp_pm_lock_acquire(locks[lock]);
+#endif
+}
+
+void pm_unlock(pm_lock_e lock)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(locks[lock]);
+#endif
+}
+
+void pm_wake_pin_arm(gpio_num_t pin, gpio_int_type_t level)
+{
+    //sets the interrupt type of the pin as well
+    gpio_wakeup_enable(pin, level);
+    gpio_intr_enable(pin);
+}
+
+void pm_dump()
+{
+#if CONFIG_PM_ENABLE
+    //times per lock and mode only with CONFIG_PM_PROFILING
+    esp_pm_dump_locks(stdout);
+#else
+    ESP_LOGI(TAG, "%s: power management disabled", __func__);
+#endif
+}
+
+void pm_init()
+{
+#if CONFIG_PM_ENABLE
+    for (int i = 0; i < PM_LOCK_MAX; i++) {
+        ESP_ERROR_CHECK( esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, lockNames[i], &locks[i]) );
+    }
+    esp_pm_config_esp32_t config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_FREQ_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        //stays at the default cpu frequency, everything else works
+        ESP_LOGE(TAG, "%s: configure failed (%d)", __func__, err);
+        return;
+    }
+    //the pins themselves are enabled by their drivers
+    ESP_ERROR_CHECK( esp_sleep_enable_gpio_wakeup() );
+    ESP_LOGI(TAG, "%s: %d-%d MHz, light sleep %s", __func__, config.min_freq_mhz, config.max_freq_mhz,
+             config.light_sleep_enable ? "on" : "off");
+#endif
+}
@@ -0,0 +1,38 @@
+#ifndef _PM_H_
+#define _PM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "driver/gpio.h"
+
+/*
+ * Power management: the cpu scales down to PM_MIN_FREQ_MHZ whenever no lock
+ * is held and the idle task puts the chip into light sleep when nothing is
+ * due for CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP ticks.
+ *
+ * The bus clocks come from APB, which scales with the cpu: the drivers hold
+ * their lock only while a transfer is on the wire. The CS1237 data ready,
+ * CPT112S INT and the gpio key wake the chip. Light sleep only wakes on a
+ * level, so their interrupts are level triggered: the isr masks the pin
+ * and the driver arms it again once the line is back (pm_wake_pin_arm).
+ *
+ * Without CONFIG_PM_ENABLE the locks are no-ops and the pins still work
+ * as level interrupts.
+ */
+typedef enum {
+    PM_LOCK_ADC,                //CS1237 spi read or config write
+    PM_LOCK_DISPLAY,            //display spi frame
+    PM_LOCK_TOUCH,              //CPT112S i2c event read
+    PM_LOCK_MAX
+} pm_lock_e;
+
+void pm_init();
+void pm_lock(pm_lock_e lock);
+void pm_unlock(pm_lock_e lock);
+// interrupt on level (GPIO_INTR_LOW_LEVEL/HIGH_LEVEL), also wakes from light sleep
+void pm_wake_pin_arm(gpio_num_t pin, gpio_int_type_t level);
+// locks held and time spent in each mode, with CONFIG_PM_PROFILING
+void pm_dump();
+
+#endif  /*_PM_H_*/
@@ -0,0 +1,46 @@
+#ifndef _PT_H_
+#define _PT_H_
+
+#include <stdint.h>
+
+/*
+ * Stackless protothreads, after Adam Dunkels' pt.h. A protothread is a
+ * function that returns whenever it has to wait and resumes at the same
+ * place on its next call: the place is a line number kept in pt_t and
+ * jumped to by a switch.
+ *
+ * Because the function returns while it waits:
+ *  - locals do not keep their value across a wait, keep state in statics
+ *  - no switch statement around a wait, its case labels would clash
+ *  - one wait per source line
+ */
+typedef struct {
+    uint16_t lc;                //line to resume at, 0: start
+} pt_t;
+
+#define PT_WAITING              0
+#define PT_YIELDED              1
+#define PT_ENDED                2
+
+#define PT_INIT(pt)             ((pt)->lc = 0)
+
+#define PT_BEGIN(pt)            { char ptYieldFlag = 1; (void)ptYieldFlag; switch ((pt)->lc) { case 0:
+
+#define PT_END(pt)              } PT_INIT(pt); return PT_ENDED; }
+
+// return until cond holds, cond is checked on every call
+#define PT_WAIT_UNTIL(pt, cond) \
+    do { \
+        (pt)->lc = __LINE__; case __LINE__: \
+        if (!(cond)) return PT_WAITING; \
+    } while (0)
+
+// give way once, the scheduler calls again without waiting
+#define PT_YIELD(pt) \
+    do { \
+        ptYieldFlag = 0; \
+        (pt)->lc = __LINE__; case __LINE__: \
+        if (ptYieldFlag == 0) return PT_YIELDED; \
+    } while (0)
+
+#endif  /*_PT_H_*/
@@ -4,6 +4,7 @@
 #include "queue_buffer.h"
 
 #define CHECK_NULL(x)	if ((x) == NULL) return false;
+#define CHECK_NULL_VOID(x)	if ((x) == NULL) return;
 
 bool queue_buffer_init(queue_buffer_t* f, int32_t* pBuf, int32_t size)
 {
@@ -17,7 +18,7 @@ bool queue_buffer_init(queue_buffer_t* f, int32_t* pBuf, int32_t size)
 
 void queue_buffer_push(queue_buffer_t* f, int32_t data)
 {
-  CHECK_NULL(f)
+  CHECK_NULL_VOID(f)
 
   f->pData[f->head] = data;
   f->head++;
@@ -43,6 +44,12 @@ int32_t queue_last(queue_buffer_t* f)
   }
 }
 
+int32_t queue_count(queue_buffer_t* f)
+{
+  if (f == NULL) return 0;
+  return f->full ? f->size : f->head;
+}
+
 static int32_t queue_average(queue_buffer_t* f)
 {
   CHECK_NULL(f)
@@ -106,7 +113,7 @@ int32_t queue_get_value(queue_buffer_t* pqueue, algorithm_e algorithm)
 
 void queue_dump(queue_buffer_t* f)
 {
-  CHECK_NULL(f)
+  CHECK_NULL_VOID(f)
 
   int32_t end = f->head;
   if (f->full) {
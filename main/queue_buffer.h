@@ -21,6 +21,8 @@ typedef struct {
 bool queue_buffer_init(queue_buffer_t* pqueue, int32_t* pBuf, int32_t size);
 void queue_buffer_push(queue_buffer_t* pqueue, int32_t data);
 int32_t queue_last(queue_buffer_t* f);
+// values held, up to size
+int32_t queue_count(queue_buffer_t* f);
 int32_t queue_get_value(queue_buffer_t* pqueue, algorithm_e algorithm);
 void queue_dump(queue_buffer_t* pqueue);
 void queue_test();
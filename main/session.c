@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "config.h"
+#include "history.h"
+#include "session.h"
+
+#define TAG "SESSION"
+
+#define CURVE_INTERVAL          2           //s between curve points, doubles when the curve is full
+#define BOOT_COUNT_KEY          "boot_count"
+
+static history_record_t record;
+static uint32_t bootCount = 0;
+static bool active = false;
+static int64_t startTime = 0;               //us
+static int64_t lastSample = 0;
+static int64_t lastPoint = 0;
+static int64_t heatTime = 0;                //us with the heater on
+static SemaphoreHandle_t sessionLock = NULL;
+static StaticSemaphore_t sessionLockBuffer;
+
+// 0.5 degree steps, clamped to a byte
+static uint8_t curve_point(int32_t temp_x10)
+{
+    int32_t point = temp_x10/5;
+    if (point < 0) point = 0;
+    if (point > 255) point = 255;
+    return point;
+}
+
+static void add_point(int32_t temp_x10)
+{
+    if (record.points == HISTORY_CURVE_MAX) {
+        //keep every other point, halve the resolution
+        for (int i = 0; i < HISTORY_CURVE_MAX/2; i++) {
+            record.curve[i] = record.curve[i*2];
+        }
+        record.points = HISTORY_CURVE_MAX/2;
+        record.interval *= 2;
+    }
+    record.curve[record.points++] = curve_point(temp_x10);
+}
+
+static void session_lock()
+{
+    xSemaphoreTake(sessionLock, portMAX_DELAY);
+}
+
+// the settings are loaded. Committed now, not with the next change, so a
+// power cut cannot give two boots the same count
+void session_init()
+{
+    sessionLock = xSemaphoreCreateMutexStatic(&sessionLockBuffer);
+    bootCount = config_read(BOOT_COUNT_KEY, 0)+1;
+    config_write(BOOT_COUNT_KEY, bootCount);
+    config_flush();
+}
+
+void session_start(int target)
+{
+    session_lock();
+    memset(&record, 0, sizeof(record));
+    record.boot = bootCount;
+    record.start = esp_timer_get_time()/1000000;
+    record.target = target;
+    record.interval = CURVE_INTERVAL;
+    record.time_to_target = HISTORY_NOT_REACHED;
+    record.overshoot = 0;
+    startTime = esp_timer_get_time();
+    lastSample = startTime;
+    lastPoint = 0;
+    heatTime = 0;
+    active = true;
+    xSemaphoreGive(sessionLock);
+}
+
+void session_sample(int32_t temp_x10, bool heat, int target)
+{
+    session_lock();
+    if (!active) {
+        xSemaphoreGive(sessionLock);
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (heat) {
+        heatTime += now-lastSample;
+    }
+    lastSample = now;
+    record.target = target;
+
+    int32_t above = temp_x10-target*10;
+    if (record.time_to_target == HISTORY_NOT_REACHED && above >= 0) {
+        record.time_to_target = (now-startTime)/1000000;
+    }
+    if (record.time_to_target != HISTORY_NOT_REACHED && above > record.overshoot) {
+        record.overshoot = above;
+    }
+    if (lastPoint == 0 || now-lastPoint >= record.interval*1000000LL) {
+        add_point(temp_x10);
+        lastPoint = now;
+    }
+    xSemaphoreGive(sessionLock);
+}
+
+void session_stop()
+{
+    session_lock();
+    if (!active) {
+        xSemaphoreGive(sessionLock);
+        return;
+    }
+    active = false;
+    record.duration = (esp_timer_get_time()-startTime)/1000000;
+    record.energy = heatTime/1000000*HEATER_POWER;
+    history_append(&record);
+    xSemaphoreGive(sessionLock);
+}
@@ -0,0 +1,20 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Brewing session recorder. A session runs from heat on to heat off and is
+ * stored in the history ring when it ends.
+ */
+#define HEATER_POWER            1500        //W, for the energy estimate
+
+void session_init();
+void session_start(int target);
+// called from the main loop with the current temperature estimate
+void session_sample(int32_t temp_x10, bool heat, int target);
+void session_stop();
+
+#endif  /*_SESSION_H_*/
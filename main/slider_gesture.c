@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slider_gesture.h"
+
+#define SLIDER_STEP             10          //position travel for one degree at slow speed
+#define MIN_INTERVAL            10000       //us, queued events read back to back, the pad reports every 20 ms
+#define IDLE_INTERVAL           300000      //us, pause longer than this restarts velocity
+#define SLOW_VELOCITY           200         //position per second, no acceleration below
+#define FAST_VELOCITY           1500        //position per second, full acceleration above
+#define MAX_GAIN                (6*16)      //gain * 16 at full acceleration
+#define FLING_VELOCITY          800         //position per second to start a fling
+#define FLING_DIVIDER           150         //one extra degree per 150 position per second
+#define FLING_MAX               15          //degree
+
+void slider_gesture_init(slider_gesture_t* g)
+{
+    memset(g, 0, sizeof(slider_gesture_t));
+}
+
+// gain * 16, linear between slow and fast velocity
+static int32_t gesture_gain(int32_t velocity)
+{
+    int32_t v = abs(velocity);
+    if (v <= SLOW_VELOCITY) return 16;
+    if (v >= FAST_VELOCITY) return MAX_GAIN;
+    return 16 + (MAX_GAIN-16)*(v-SLOW_VELOCITY)/(FAST_VELOCITY-SLOW_VELOCITY);
+}
+
+int32_t slider_gesture_update(slider_gesture_t* g, int32_t pos, int64_t now)
+{
+    if (!g->touching) {
+        //slider touch, nothing to emit yet
+        g->touching = true;
+        g->last_pos = pos;
+        g->last_time = now;
+        g->velocity = 0;
+        g->remainder = 0;
+        return 0;
+    }
+
+    int32_t travel = pos - g->last_pos;
+    int64_t dt = now - g->last_time;
+    if (dt > IDLE_INTERVAL) {
+        g->velocity = 0;
+    } else {
+        if (dt < MIN_INTERVAL) dt = MIN_INTERVAL;
+        int32_t v = (int32_t)((int64_t)travel*1000000/dt);
+        g->velocity = (g->velocity + v)/2;
+    }
+    g->last_pos = pos;
+    g->last_time = now;
+
+    //reversing direction drops what is left from the other way
+    if ((travel > 0 && g->remainder < 0) || (travel < 0 && g->remainder > 0)) {
+        g->remainder = 0;
+    }
+    g->remainder += travel*gesture_gain(g->velocity);
+
+    int32_t delta = g->remainder/(SLIDER_STEP*16);
+    g->remainder -= delta*SLIDER_STEP*16;
+    return delta;
+}
+
+int32_t slider_gesture_release(slider_gesture_t* g)
+{
+    int32_t delta = 0;
+    if (g->touching && abs(g->velocity) >= FLING_VELOCITY) {
+        delta = g->velocity/FLING_DIVIDER;
+        if (delta > FLING_MAX) delta = FLING_MAX;
+        if (delta < -FLING_MAX) delta = -FLING_MAX;
+    }
+    g->touching = false;
+    g->velocity = 0;
+    g->remainder = 0;
+    return delta;
+}
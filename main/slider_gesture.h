@@ -0,0 +1,27 @@
+#ifndef _SLIDER_GESTURE_H_
+#define _SLIDER_GESTURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Turns timestamped slider positions into signed temperature deltas.
+ * Slow moves give one degree per SLIDER_STEP of travel, fast moves are
+ * accelerated and a fast release keeps going (fling).
+ */
+typedef struct {
+    bool touching;
+    int32_t last_pos;
+    int64_t last_time;          //us
+    int32_t velocity;           //position per second, filtered
+    int32_t remainder;          //travel not emitted yet, position * 16
+} slider_gesture_t;
+
+void slider_gesture_init(slider_gesture_t* g);
+// feed a touch position, return the signed delta to apply (0: nothing yet)
+int32_t slider_gesture_update(slider_gesture_t* g, int32_t pos, int64_t now);
+// finger lifted, return the fling delta (0: no fling)
+int32_t slider_gesture_release(slider_gesture_t* g);
+
+#endif  /*_SLIDER_GESTURE_H_*/
@@ -11,6 +11,7 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "driver/spi_master.h"
@@ -18,6 +19,10 @@
 #include "driver/gpio.h"
 #include "queue_buffer.h"
 #include "util.h"
+#include "spi_adc.h"
+#include "trace.h"
+#include "io_loop.h"
+#include "pm.h"
 
 /*
 */
@@ -77,42 +82,46 @@ PRECISION  6
 #define BUFFER_SIZE           10
 #define DEBUG_ISR_INTVAL      0
 
-#define INT_VALID_INTERVAL_10HZ      (240000 * 50)   //50ms for 10HZ
-#define INT_VALID_INTERVAL_40HZ      (240000 * 15)   //15ms for 40HZ
+#define SETTLE_TIME_US               10000           //data line back to gpio after a read
 
-//The semaphore indicating the data is ready.
-static SemaphoreHandle_t rdySem = NULL;
+static io_thread_t adcThread;
+static bool configed = false;
+static SemaphoreHandle_t valueSem = NULL;  //given once, first value
+static StaticSemaphore_t valueSemBuffer;
+static volatile bool hasValue = false;
 static spi_device_handle_t spi;
-static uint32_t lastDataReadyTime;
+static spi_transaction_t readTrans;
+static spi_transaction_t configTrans[2];
+static int configPending = 0;
 #if DEBUG_ISR_INTVAL
 static uint32_t lastIsrTime=0;
 static uint32_t isrInterval=0;
 #endif
-static TaskHandle_t xHandle = NULL;
 static int32_t spi_adc_value = 0;
+static spi_adc_listener_t adcListener = NULL;
 #if USE_QUEUE_BUFFER
 static queue_buffer_t qb_SpiAdcData;
 static int32_t spiDataBuffer[BUFFER_SIZE];
 #endif
 
 /*
-This ISR is called when the data line goes low.
+This ISR is called while the data line is low, also to wake from light sleep.
 */
 static void data_isr_handler(void* arg)
 {
-    //Sometimes due to interference or ringing or something, we get two irqs after eachother. This is solved by
-    //looking at the time between interrupts and refusing any interrupt too close to another one.
-    uint32_t currtime=xthal_get_ccount();
+    TRACE(TRACE_ISR_ENTER, TRACE_SRC_ADC_DRDY, 0);
 #if DEBUG_ISR_INTVAL
+    uint32_t currtime=xthal_get_ccount();
     isrInterval = currtime - lastIsrTime;
     lastIsrTime = currtime;
 #endif
-    uint32_t diff=currtime-lastDataReadyTime;
-    if (diff < INT_VALID_INTERVAL_40HZ) return; //ignore everything between valid interval
-    lastDataReadyTime=currtime;
-    //Give the semaphore.
+    //Level triggered: masked until the conversion is read and the line is back
+    //to gpio, so ringing on the falling edge raises no second interrupt.
+    gpio_intr_disable(PIN_NUM_DATA);
+    //Wake the io loop.
     BaseType_t mustYield=false;
-    xSemaphoreGiveFromISR(rdySem, &mustYield);
+    io_loop_notify_from_isr(IO_SOURCE_ADC, &mustYield);
+    TRACE(TRACE_ISR_EXIT, TRACE_SRC_ADC_DRDY, 0);
     if (mustYield) portYIELD_FROM_ISR();
 }
 
@@ -125,8 +134,8 @@ static void gpio_spi_switch(uint8_t mode)
         assert(ret==ESP_OK);
         //ret=gpio_set_direction(PIN_NUM_DATA,GPIO_MODE_INPUT);
         //assert(ret==ESP_OK);
-        //ret=gpio_intr_enable(PIN_NUM_DATA);
-        //assert(ret==ESP_OK);
+        //unmask, the isr masked it
+        pm_wake_pin_arm(PIN_NUM_DATA, GPIO_INTR_LOW_LEVEL);
     }else if (mode == DATA_PIN_FUNC_SPI) {
         //ret=gpio_intr_disable(PIN_NUM_DATA);
         ret = gpio_isr_handler_remove(PIN_NUM_DATA);
@@ -153,14 +162,16 @@ static int32_t parse_adc(uint8_t data[4])
     return value;
 }
 
-static void config(int8_t config)
+// queue the config write, config_done() once it is on the chip
+static void config_start(int8_t config)
 {
     esp_err_t ret;
     //Prepare spi receive buffer
-    spi_transaction_t trans[2];
-    spi_transaction_t *rtrans;
+    spi_transaction_t* trans = configTrans;
 
-    memset(trans, 0, sizeof(trans));
+    memset(configTrans, 0, sizeof(configTrans));
+    //apb at full speed until config_done()
+    pm_lock(PM_LOCK_ADC);
     trans[0].rxlength=29;
     trans[0].flags=SPI_TRANS_USE_RXDATA;
     ret=spi_device_queue_trans(spi, &trans[0], portMAX_DELAY);
@@ -173,36 +184,73 @@ static void config(int8_t config)
     trans[1].flags=SPI_TRANS_USE_TXDATA;
     ret=spi_device_queue_trans(spi, &trans[1], portMAX_DELAY);
     assert(ret==ESP_OK);
+    configPending = 2;
+}
 
-    //Wait for all 2 transactions to be done and get back the results.
-    for (int x=0; x<2; x++) {
-        ret=spi_device_get_trans_result(spi, &rtrans, portMAX_DELAY);
-        assert(ret==ESP_OK);
+static bool config_done()
+{
+    spi_transaction_t *rtrans;
+    //Get back the results of the 2 transactions as they are done.
+    while (configPending > 0 && spi_device_get_trans_result(spi, &rtrans, 0) == ESP_OK) {
+        configPending--;
+        if (configPending == 0) pm_unlock(PM_LOCK_ADC);
     }
+    return configPending == 0;
 }
 
-static int32_t read_only()
+/*
+This ISR is called when a transaction is done on the wire.
+*/
+static void IRAM_ATTR spi_post_cb(spi_transaction_t* trans)
+{
+    BaseType_t mustYield=false;
+    io_loop_notify_from_isr(IO_SOURCE_ADC, &mustYield);
+    if (mustYield) portYIELD_FROM_ISR();
+}
+
+// queue the read, the bus is busy for 270us and the io loop goes on meanwhile
+static void read_start()
 {
     esp_err_t ret;
-    spi_transaction_t t;
-    memset(&t, 0, sizeof(t));          //Zero out the transaction
-    t.rxlength=27;                     //read is 8 bits
-    t.flags=SPI_TRANS_USE_RXDATA;      //use rxdata to receive data
-    ret=spi_device_transmit(spi, &t);  //Transmit!
-    assert(ret==ESP_OK);               //Should have had no issues.
-    return parse_adc(t.rx_data);
+    memset(&readTrans, 0, sizeof(readTrans));  //Zero out the transaction
+    readTrans.rxlength=27;                     //read is 8 bits
+    readTrans.flags=SPI_TRANS_USE_RXDATA;      //use rxdata to receive data
+    TRACE(TRACE_SPI_START, TRACE_SRC_ADC, 0);
+    pm_lock(PM_LOCK_ADC);                      //until read_done()
+    ret=spi_device_queue_trans(spi, &readTrans, portMAX_DELAY);
+    assert(ret==ESP_OK);                       //Should have had no issues.
+}
+
+// false while the read is still on the bus
+static bool read_done(int32_t* value)
+{
+    spi_transaction_t *rtrans;
+    if (spi_device_get_trans_result(spi, &rtrans, 0) != ESP_OK) return false;
+    TRACE(TRACE_SPI_END, TRACE_SRC_ADC, 0);
+    pm_unlock(PM_LOCK_ADC);
+    *value = parse_adc(rtrans->rx_data);
+    return true;
 }
 
 static void push_to_buffer(int32_t value)
 {
 #if USE_QUEUE_BUFFER
     queue_buffer_push(&qb_SpiAdcData, value);
-    value = queue_get_value(&qb_SpiAdcData, ALG_MEDIAN_VALUE);
+    //the median needs 3 values, average the first ones instead of reporting 0
+    if (queue_count(&qb_SpiAdcData) < 3) {
+        value = queue_get_value(&qb_SpiAdcData, ALG_MEAN_VALUE);
+    } else {
+        value = queue_get_value(&qb_SpiAdcData, ALG_MEDIAN_VALUE);
+    }
 #endif
     if (abs(spi_adc_value - value) > 3 ) {
         spi_adc_value = value;
         //ESP_LOGD(TAG,"spi_adc_value: %d\n", spi_adc_value);
     }
+    if (!hasValue) {
+        hasValue = true;
+        xSemaphoreGive(valueSem);
+    }
 }
 
 static void spi_init()
@@ -221,6 +269,7 @@ static void spi_init()
         .spics_io_num=-1,                       //CS pin
         .queue_size=2,                          //We want to be able to queue 2 transactions at a time
         .flags=SPI_DEVICE_3WIRE|SPI_DEVICE_HALFDUPLEX,
+        .post_cb=spi_post_cb,                   //wakes the io loop
     };
 
     //Initialize the SPI bus, no DMA
@@ -233,9 +282,9 @@ static void spi_init()
 
 static void adc_gpio_init()
 {
-    //GPIO config for the data line.
+    //GPIO config for the data line, the interrupt is armed once the handler is in
     gpio_config_t io_conf={
-        .intr_type=GPIO_INTR_NEGEDGE,
+        .intr_type=GPIO_INTR_DISABLE,
         .mode=GPIO_MODE_INPUT,
         .pull_up_en=1,
         .pin_bit_mask=(1<<PIN_NUM_DATA)
@@ -244,17 +293,19 @@ static void adc_gpio_init()
     //Set up handshake line interrupt.
     gpio_config(&io_conf);
     // gpio_install_isr_service(0);
-    //gpio_set_intr_type(PIN_NUM_DATA, GPIO_INTR_NEGEDGE);
     gpio_isr_handler_add(PIN_NUM_DATA, data_isr_handler, NULL);
+    //low while a conversion waits, wakes the chip from light sleep
+    pm_wake_pin_arm(PIN_NUM_DATA, GPIO_INTR_LOW_LEVEL);
 }
 
-static void spi_adc_loop()
+// io loop thread
+static int spi_adc_thread(io_thread_t* thread)
 {
-    int32_t v = 0;
-    bool configed = false;
+    int32_t v;
+    PT_BEGIN(&thread->pt);
     while(1) {
         //Wait until data is ready
-        xSemaphoreTake( rdySem, portMAX_DELAY );
+        IO_WAIT_SIGNAL(thread);
 
 #if DEBUG_ISR_INTVAL
         int data_level = gpio_get_level(PIN_NUM_DATA);
@@ -268,18 +319,26 @@ static void spi_adc_loop()
         //Disable gpio and enable spi
         gpio_spi_switch(DATA_PIN_FUNC_SPI);
         if (!configed) {
-            config(CS1237_CONFIG);
+            config_start(CS1237_CONFIG);
+            PT_WAIT_UNTIL(&thread->pt, config_done());
             configed  = true;
         }else{
-            v = read_only();
+            read_start();
+            PT_WAIT_UNTIL(&thread->pt, read_done(&v));
             push_to_buffer(v);
+            if (adcListener != NULL) {
+                adcListener(v, spi_adc_value);
+            }
         }
 
-        vTaskDelay(10/portTICK_RATE_MS);
+        IO_SLEEP(thread, SETTLE_TIME_US);
 
+        //drop the transfer done notifications, the next one is data ready
+        io_take_signal(thread);
         //Enable gpio again and wait for data
         gpio_spi_switch(DATA_PIN_FUNC_GPIO);
     }
+    PT_END(&thread->pt);
 }
 
 int32_t spi_adc_get_value()
@@ -287,25 +346,36 @@ int32_t spi_adc_get_value()
     return spi_adc_value;
 }
 
+bool spi_adc_wait_value(TickType_t wait)
+{
+    if (hasValue) return true;
+    return xSemaphoreTake(valueSem, wait) == pdTRUE;
+}
+
+void spi_adc_set_listener(spi_adc_listener_t listener)
+{
+    adcListener = listener;
+}
+
 void spi_adc_init()
 {
     ESP_LOGI(TAG, "%s: CS1237 start!!!\n", __func__);
 
     //Create the semaphore.
-    rdySem=xSemaphoreCreateBinary();
+    valueSem=xSemaphoreCreateBinaryStatic(&valueSemBuffer);
 
     //SPI config
     spi_init();
 
-    //GPIO config
-    adc_gpio_init();
-
 #if USE_QUEUE_BUFFER
     // Queue Buffer init
     memset(spiDataBuffer,0,sizeof(spiDataBuffer));
     queue_buffer_init(&qb_SpiAdcData, spiDataBuffer, BUFFER_SIZE);
 #endif
 
-    //Create task
-    xTaskCreate(&spi_adc_loop, "spi_adc_task", 4096, NULL, 2, &xHandle);
+    //Conversions run in the io loop, in place before the first data ready
+    io_loop_add(&adcThread, IO_SOURCE_ADC, &spi_adc_thread);
+
+    //GPIO config
+    adc_gpio_init();
 }
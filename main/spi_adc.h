@@ -1,8 +1,16 @@
 #ifndef _SPI_ADC_H_
 #define _SPI_ADC_H_
 #include <stdio.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+// called from the adc task for every conversion, must not block
+typedef void (*spi_adc_listener_t)(int32_t raw, int32_t filtered);
 
 void spi_adc_init();
 int32_t spi_adc_get_value();
+// wait for the first conversion after init, false on timeout
+bool spi_adc_wait_value(TickType_t wait);
+void spi_adc_set_listener(spi_adc_listener_t listener);
 
 #endif  /*_SPI_ADC_H_*/
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stabilizer.h"
+
+#define TREND_THRESHOLD     (2*16)      //0.2 degree between fast and slow average
+#define JUMP_THRESHOLD      30          //3 degree, bypass rate limit to catch up
+
+static int32_t floor_div10(int32_t v)
+{
+    return v >= 0 ? v/10 : -((-v+9)/10);
+}
+
+void stabilizer_init(stabilizer_t* s, int32_t hysteresis, int32_t interval_ms)
+{
+    memset(s, 0, sizeof(stabilizer_t));
+    s->hysteresis = hysteresis;
+    s->min_interval = (int64_t)interval_ms*1000;
+}
+
+void stabilizer_reset(stabilizer_t* s)
+{
+    s->valid = false;
+}
+
+bool stabilizer_update(stabilizer_t* s, int32_t temp_x10, int64_t now, int32_t* shown)
+{
+    if (!s->valid) {
+        s->fast = temp_x10*16;
+        s->slow = temp_x10*16;
+        s->shown = floor_div10(temp_x10+5);
+        s->valid = true;
+        s->last_change = now;
+        s->changes++;
+        *shown = s->shown;
+        return true;
+    }
+
+    s->fast += (temp_x10*16 - s->fast)/4;
+    s->slow += (temp_x10*16 - s->slow)/32;
+
+    //heating: round down, cooling: round up, steady: round to nearest
+    int32_t trend = s->fast - s->slow;
+    int dir = 0;
+    int32_t target = floor_div10(temp_x10+5);
+    if (trend > TREND_THRESHOLD) {
+        dir = 1;
+        target = floor_div10(temp_x10);
+    } else if (trend < -TREND_THRESHOLD) {
+        dir = -1;
+        target = -floor_div10(-temp_x10);
+    }
+    if (target == s->shown) return false;
+
+    //moving against the trend must cross the hysteresis band first
+    int32_t diff = abs(temp_x10 - s->shown*10);
+    bool withTrend = (dir > 0 && target > s->shown) || (dir < 0 && target < s->shown);
+    if (!withTrend && diff < 5 + s->hysteresis) return false;
+
+    if (now - s->last_change < s->min_interval && diff < JUMP_THRESHOLD) return false;
+
+    s->shown = target;
+    s->last_change = now;
+    s->changes++;
+    *shown = s->shown;
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef _STABILIZER_H_
+#define _STABILIZER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Display stabilizer, sits between the temperature estimate and
+ * display_set_temperature(). Input is in 0.1 degree, output in degree.
+ */
+typedef struct {
+    int32_t hysteresis;         //0.1 degree, extra margin before moving against the trend
+    int64_t min_interval;       //us, minimum time between two display changes
+    int32_t shown;              //degree currently on display
+    bool valid;                 //false until the first value is shown
+    int32_t fast;               //fast moving average, 0.1 degree * 16
+    int32_t slow;               //slow moving average, 0.1 degree * 16
+    int64_t last_change;        //us
+    uint32_t changes;           //number of display changes
+} stabilizer_t;
+
+void stabilizer_init(stabilizer_t* s, int32_t hysteresis, int32_t interval_ms);
+void stabilizer_reset(stabilizer_t* s);
+// return true if the displayed value changed, new value in *shown
+bool stabilizer_update(stabilizer_t* s, int32_t temp_x10, int64_t now, int32_t* shown);
+
+#endif  /*_STABILIZER_H_*/
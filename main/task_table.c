@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "task_table.h"
+
+#define TAG "TASKS"
+
+#define DRIVER_CORE             1           //wifi and lwip run on core 0
+#define NETWORK_CORE            0
+#define STATUS_SPARE            4           //tasks created while the dump runs
+
+typedef struct {
+    const char* name;
+    uint32_t stack_size;        //bytes
+    UBaseType_t priority;
+    BaseType_t core;
+    StackType_t* stack;         //NULL: heap, created per use
+    StaticTask_t* tcb;
+} task_config_t;
+
+/*
+ * Sized from the high water marks of the host scenarios (the simulator's
+ * "tasks" dump at the end of a run) with a kilobyte or more to spare:
+ * io_loop used 3.5 KB flushing settings through the journal, history_task
+ * 1.9 KB writing and logging a session, tlog_task 2.0 KB printing drained
+ * entries, web_task 3.9 KB on an upgrade and commands, boot_storage 4.0 KB
+ * loading the config. telemetry_task stays at 3 KB: the simulated station
+ * never gets an address, so its 0.5 KB leaves out the lwip send path. The
+ * ota tasks never run on the host and keep their sizes. The host stacks
+ * hold x86-64 glibc frames; check the "tasks" command on a board after a
+ * change here.
+ */
+static StackType_t ioStack[5120];
+static StackType_t historyStack[3072];
+static StackType_t tlogStack[3072];
+static StackType_t telemetryStack[3072];
+static StackType_t webserverStack[5120];
+static StaticTask_t tcbs[TASK_ID_MAX];
+
+static const task_config_t configs[TASK_ID_MAX] = {
+    //adc, touch, keys and the key handler, see io_loop.h
+    [TASK_IO]           = { "io_loop",           sizeof(ioStack),        3, DRIVER_CORE,    ioStack,        &tcbs[TASK_IO] },
+    [TASK_HISTORY]      = { "history_task",      sizeof(historyStack),   1, tskNO_AFFINITY, historyStack,   &tcbs[TASK_HISTORY] },
+    [TASK_TLOG]         = { "tlog_task",         sizeof(tlogStack),      1, tskNO_AFFINITY, tlogStack,      &tcbs[TASK_TLOG] },
+    [TASK_TELEMETRY]    = { "telemetry_task",    sizeof(telemetryStack), 1, NETWORK_CORE,   telemetryStack, &tcbs[TASK_TELEMETRY] },
+    [TASK_WEBSERVER]    = { "web_task",          sizeof(webserverStack), 2, NETWORK_CORE,   webserverStack, &tcbs[TASK_WEBSERVER] },
+    //only during an upgrade, 7 KB of heap then rather than always in .bss
+    [TASK_OTA]          = { "ota_task",          4096,                   4, NETWORK_CORE,   NULL,           NULL },
+    [TASK_OTA_WRITER]   = { "ota_writer",        3072,                   5, tskNO_AFFINITY, NULL,           NULL },
+    //storage during boot, on the other core than app_main
+    [TASK_BOOT]         = { "boot_storage",      5120,                   1, DRIVER_CORE,    NULL,           NULL },
+};
+
+static TaskHandle_t handles[TASK_ID_MAX];
+
+TaskHandle_t task_table_start(task_id_e id, TaskFunction_t code, void* arg)
+{
+    const task_config_t* config = &configs[id];
+    TaskHandle_t handle = NULL;
+    if (config->stack != NULL) {
+        //a static stack has room for one instance only
+        if (handles[id] != NULL) {
+            ESP_LOGE(TAG, "%s: %s already started", __func__, config->name);
+            return NULL;
+        }
+        handle = xTaskCreateStaticPinnedToCore(code, config->name, config->stack_size, arg,
+                config->priority, config->stack, config->tcb, config->core);
+    } else if (xTaskCreatePinnedToCore(code, config->name, config->stack_size, arg,
+                config->priority, &handle, config->core) != pdPASS) {
+        handle = NULL;
+    }
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "%s: can not create %s", __func__, config->name);
+        return NULL;
+    }
+    handles[id] = handle;
+    return handle;
+}
+
+static const task_config_t* find_config(const char* name)
+{
+    for (int i = 0; i < TASK_ID_MAX; i++) {
+        //FreeRTOS cuts names to configMAX_TASK_NAME_LEN
+        if (strncmp(configs[i].name, name, configMAX_TASK_NAME_LEN-1) == 0) return &configs[i];
+    }
+    return NULL;
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+void task_table_dump()
+{
+    UBaseType_t size = uxTaskGetNumberOfTasks()+STATUS_SPARE;
+    TaskStatus_t* status = malloc(size*sizeof(TaskStatus_t));
+    if (status == NULL) return;
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(status, size, &total);
+
+    //cpu is the share of one core, both cores together add up to 200%
+    ESP_LOGI(TAG, "%-16s %4s %6s %6s %6s", "task", "prio", "stack", "free", "cpu%");
+    for (int i = 0; i < count; i++) {
+        const task_config_t* config = find_config(status[i].pcTaskName);
+        uint32_t percent = 0;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        if (total >= 100) {
+            percent = status[i].ulRunTimeCounter/(total/100);
+        }
+#endif
+        if (config != NULL) {
+            ESP_LOGI(TAG, "%-16s %4u %6u %6u %5u%%", status[i].pcTaskName, status[i].uxCurrentPriority,
+                    config->stack_size, status[i].usStackHighWaterMark, percent);
+        } else {
+            ESP_LOGI(TAG, "%-16s %4u %6s %6u %5u%%", status[i].pcTaskName, status[i].uxCurrentPriority,
+                    "-", status[i].usStackHighWaterMark, percent);
+        }
+    }
+    free(status);
+}
+#else
+void task_table_dump()
+{
+    //without the trace facility only the stacks of the static tasks are known
+    ESP_LOGI(TAG, "%-16s %6s %6s", "task", "stack", "free");
+    for (int i = 0; i < TASK_ID_MAX; i++) {
+        if (configs[i].stack == NULL || handles[i] == NULL) continue;
+        ESP_LOGI(TAG, "%-16s %6u %6u", configs[i].name, configs[i].stack_size,
+                uxTaskGetStackHighWaterMark(handles[i]));
+    }
+}
+#endif
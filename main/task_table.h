@@ -0,0 +1,35 @@
+#ifndef _TASK_TABLE_H_
+#define _TASK_TABLE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Every firmware task with its stack size, priority and core in one table
+ * (task_table.c). Long lived tasks get their stack and TCB from .bss
+ * through xTaskCreateStatic, so they never take from the heap wifi and OTA
+ * need; the OTA tasks and the boot storage task only exist for a while and
+ * stay on the heap.
+ * task_table_dump() prints the stack high water mark and CPU time of every
+ * task in the system, to size the stacks from.
+ */
+typedef enum {
+    TASK_IO,
+    TASK_HISTORY,
+    TASK_TLOG,
+    TASK_TELEMETRY,
+    TASK_WEBSERVER,
+    TASK_OTA,
+    TASK_OTA_WRITER,
+    TASK_BOOT,
+    TASK_ID_MAX
+} task_id_e;
+
+// NULL if the task could not be created or a static one already runs
+TaskHandle_t task_table_start(task_id_e id, TaskFunction_t code, void* arg);
+// every task in the system: priority, stack free, cpu share since boot
+void task_table_dump();
+
+#endif  /*_TASK_TABLE_H_*/
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "config.h"
+#include "wifi.h"
+#include "telemetry.h"
+#include "task_table.h"
+
+#define TAG  "TELEMETRY"
+
+#define TELEMETRY_RING          64          //6.4s at 10Hz
+#define TELEMETRY_PERIOD        1000        //ms between frames
+#define TELEMETRY_RETRY_MAX     32          //send periods between socket or dns tries, at most
+
+typedef struct {
+    int fd;
+    struct sockaddr_in addr;
+    bool addrValid;
+    uint32_t seq;
+    int retryPeriods;           //wait after the last failed try, 0: none failed
+    int retryIn;                //send periods left before the next try
+} telemetry_link_t;
+
+static telemetry_sample_t ring[TELEMETRY_RING];
+static uint32_t ringHead = 0;               //next write
+static uint32_t ringCount = 0;
+static uint32_t ringDropped = 0;            //not yet reported in a frame
+static portMUX_TYPE ringMux = portMUX_INITIALIZER_UNLOCKED;
+static telemetry_stats_t stats;
+static volatile bool endpointChanged = true;
+
+static uint8_t* put_varint(uint8_t* p, uint32_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+size_t telemetry_encode(const telemetry_sample_t* samples, int count, uint32_t seq, uint32_t dropped, uint8_t* frame)
+{
+    uint8_t* p = frame;
+    *p++ = TELEMETRY_MAGIC;
+    *p++ = TELEMETRY_VERSION;
+    p = put_varint(p, seq);
+    p = put_varint(p, count);
+    p = put_varint(p, dropped);
+
+    telemetry_sample_t prev;
+    memset(&prev, 0, sizeof(prev));
+    for (int i = 0; i < count; i++) {
+        const telemetry_sample_t* s = &samples[i];
+        p = put_varint(p, s->time-prev.time);
+        p = put_varint(p, zigzag(s->raw-prev.raw));
+        p = put_varint(p, zigzag(s->temp-prev.temp));
+        p = put_varint(p, zigzag(s->target-prev.target)<<1 | (s->heat ? 1 : 0));
+        prev = *s;
+    }
+    return p-frame;
+}
+
+void telemetry_record(int32_t raw, int32_t temp_x10, bool heat, int target)
+{
+    telemetry_sample_t sample = {
+        .time = esp_timer_get_time()/1000,
+        .raw = raw,
+        .temp = temp_x10,
+        .heat = heat,
+        .target = target,
+    };
+
+    portENTER_CRITICAL(&ringMux);
+    ring[ringHead] = sample;
+    ringHead = (ringHead+1) % TELEMETRY_RING;
+    if (ringCount < TELEMETRY_RING) {
+        ringCount++;
+    } else {
+        //publisher fell behind, lose the oldest
+        ringDropped++;
+        stats.dropped++;
+    }
+    stats.samples++;
+    portEXIT_CRITICAL(&ringMux);
+}
+
+// oldest samples out of the ring and the drops since the last take, returns the count
+static int telemetry_take(telemetry_sample_t* samples, int max, uint32_t* dropped)
+{
+    portENTER_CRITICAL(&ringMux);
+    int count = ringCount < max ? ringCount : max;
+    uint32_t tail = (ringHead+TELEMETRY_RING-ringCount) % TELEMETRY_RING;
+    for (int i = 0; i < count; i++) {
+        samples[i] = ring[(tail+i) % TELEMETRY_RING];
+    }
+    ringCount -= count;
+    //the count goes out with the next samples, an empty take keeps it
+    *dropped = count > 0 ? ringDropped : 0;
+    if (count > 0) ringDropped = 0;
+    portEXIT_CRITICAL(&ringMux);
+    return count;
+}
+
+static bool telemetry_configured()
+{
+    telemetry_endpoint_t* endpoint = config_get_telemetry();
+    return endpoint->host[0] != 0 && endpoint->port != 0;
+}
+
+static bool telemetry_resolve(struct sockaddr_in* addr)
+{
+    telemetry_endpoint_t* endpoint = config_get_telemetry();
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(endpoint->host, NULL, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGE(TAG, "%s: dns lookup failed for %s\n", __func__, endpoint->host);
+        return false;
+    }
+    memcpy(addr, res->ai_addr, sizeof(struct sockaddr_in));
+    addr->sin_port = htons(endpoint->port);
+    freeaddrinfo(res);
+    ESP_LOGI(TAG, "%s: sending to %s:%d\n", __func__, endpoint->host, endpoint->port);
+    return true;
+}
+
+// socket and endpoint address, false until both are there. A failed try
+// waits retryPeriods send periods before the next, doubled each time
+static bool telemetry_connect(telemetry_link_t* link)
+{
+    if (link->fd >= 0 && link->addrValid) return true;
+    if (link->retryIn > 0) {
+        link->retryIn--;
+        return false;
+    }
+    if (link->fd < 0) {
+        link->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    }
+    if (link->fd >= 0 && !link->addrValid) {
+        link->addrValid = telemetry_resolve(&link->addr);
+    }
+    if (link->fd >= 0 && link->addrValid) {
+        link->retryPeriods = 0;
+        return true;
+    }
+    link->retryPeriods = link->retryPeriods == 0 ? 1 : link->retryPeriods*2;
+    if (link->retryPeriods > TELEMETRY_RETRY_MAX) link->retryPeriods = TELEMETRY_RETRY_MAX;
+    link->retryIn = link->retryPeriods;
+    portENTER_CRITICAL(&ringMux);
+    stats.link_errors++;
+    portEXIT_CRITICAL(&ringMux);
+    ESP_LOGW(TAG, "%s: no %s, retry in %d s\n", __func__, link->fd < 0 ? "socket" : "endpoint",
+            link->retryPeriods*TELEMETRY_PERIOD/1000);
+    return false;
+}
+
+// one send period: the ring out in frames, with the station connected
+static void telemetry_publish(telemetry_link_t* link)
+{
+    static telemetry_sample_t samples[TELEMETRY_BATCH_MAX];
+    static uint8_t frame[TELEMETRY_FRAME_MAX];
+    uint32_t dropped;
+    int count;
+
+    if (endpointChanged) {
+        endpointChanged = false;
+        link->addrValid = false;
+        link->retryPeriods = 0;
+        link->retryIn = 0;
+    }
+    if (!telemetry_configured()) {
+        //no endpoint, discard
+        while (telemetry_take(samples, TELEMETRY_BATCH_MAX, &dropped) > 0) {}
+        return;
+    }
+    if (!telemetry_connect(link)) {
+        //samples wait in the ring, the oldest are overwritten
+        return;
+    }
+
+    while ((count = telemetry_take(samples, TELEMETRY_BATCH_MAX, &dropped)) > 0) {
+        size_t len = telemetry_encode(samples, count, link->seq++, dropped, frame);
+        //never wait for the stack, a frame that does not go out is lost
+        bool sent = sendto(link->fd, frame, len, MSG_DONTWAIT, (struct sockaddr*)&link->addr, sizeof(link->addr)) == len;
+        portENTER_CRITICAL(&ringMux);
+        if (sent) {
+            stats.frames++;
+            stats.bytes += len;
+        } else {
+            stats.send_errors++;
+            stats.dropped += count;
+            //the next frame reports them, and the drops this one carried
+            ringDropped += dropped+count;
+        }
+        portEXIT_CRITICAL(&ringMux);
+    }
+}
+
+static void telemetry_task(void* arg)
+{
+    static telemetry_link_t link = { .fd = -1 };
+    TickType_t wakeTime = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&wakeTime, TELEMETRY_PERIOD/portTICK_RATE_MS);
+        if (!wifi_is_connected()) {
+            //samples wait in the ring, the oldest are overwritten
+            continue;
+        }
+        telemetry_publish(&link);
+    }
+}
+
+static void telemetry_endpoint_changed(setting_e setting, void* arg)
+{
+    endpointChanged = true;
+}
+
+void telemetry_init()
+{
+    memset(&stats, 0, sizeof(stats));
+    config_subscribe(SETTING_TELEMETRY, telemetry_endpoint_changed, NULL);
+    task_table_start(TASK_TELEMETRY, &telemetry_task, NULL);
+}
+
+void telemetry_get_stats(telemetry_stats_t* out)
+{
+    portENTER_CRITICAL(&ringMux);
+    memcpy(out, &stats, sizeof(telemetry_stats_t));
+    portEXIT_CRITICAL(&ringMux);
+}
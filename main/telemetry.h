@@ -0,0 +1,51 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Telemetry over UDP to the endpoint stored with config_set_telemetry().
+ * Samples are batched in frames; every frame stands alone so a lost
+ * datagram only loses its own samples:
+ *
+ *   0xBF, version, seq, count, dropped       (varints)
+ *   per sample: time, raw, temp, state       (varint deltas to the previous
+ *                                             sample, 0 before the first)
+ *
+ * time is in ms, raw/temp are zigzag coded, state is zigzag(target delta)<<1
+ * | heat. dropped counts the samples lost since the last frame that went
+ * out: overwritten in the ring or in a frame the stack did not take.
+ * tools/telemetry_recv.py decodes the stream.
+ */
+#define TELEMETRY_MAGIC         0xBF
+#define TELEMETRY_VERSION       1
+#define TELEMETRY_BATCH_MAX     32
+#define TELEMETRY_FRAME_MAX     (8+TELEMETRY_BATCH_MAX*20)
+
+typedef struct {
+    uint32_t time;              //ms since boot
+    int32_t raw;                //adc conversion
+    int16_t temp;               //filtered, 0.1 degree
+    uint8_t heat;
+    uint8_t target;             //degree
+} telemetry_sample_t;
+
+typedef struct {
+    uint32_t samples;           //recorded
+    uint32_t dropped;           //overwritten or lost in a failed send
+    uint32_t frames;            //sent
+    uint32_t bytes;             //sent
+    uint32_t send_errors;
+    uint32_t link_errors;       //socket or dns tries that failed
+} telemetry_stats_t;
+
+void telemetry_init();
+// never blocks, the oldest sample is dropped when the buffer is full
+void telemetry_record(int32_t raw, int32_t temp_x10, bool heat, int target);
+void telemetry_get_stats(telemetry_stats_t* stats);
+// frame of count samples, returns its length
+size_t telemetry_encode(const telemetry_sample_t* samples, int count, uint32_t seq, uint32_t dropped, uint8_t* frame);
+
+#endif  /*_TELEMETRY_H_*/
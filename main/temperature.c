@@ -183,3 +183,18 @@ int32_t convert_temp(int32_t adcValue)
 
     return temperature;
 }
+
+int32_t convert_temp_x10(int32_t adcValue)
+{
+    if (adcValue < temperature_table[0]) return -400;
+    for(int i=1; i<166;i++) {
+        if (adcValue < temperature_table[i]) {
+            //interpolate inside the degree, same integer part as convert_temp()
+            int32_t lo = temperature_table[i-1];
+            int32_t hi = temperature_table[i];
+            return (i-40)*10 + (adcValue-lo)*10/(hi-lo);
+        }
+    }
+
+    return 1260;
+}
@@ -4,5 +4,7 @@
 #include <stdio.h>
 
 int32_t convert_temp(int32_t adcValue);
+// temperature in 0.1 degree, linear interpolation between table entries
+int32_t convert_temp_x10(int32_t adcValue);
 
 #endif  /*_TEMPERATURE_H_*/
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "tlog.h"
+#include "task_table.h"
+
+#define TLOG_RING_SIZE          64          //entries per core, power of 2
+#define TLOG_PERIOD             100         //ms between drains
+
+typedef struct {
+    const tlog_site_t* site;
+    uint32_t time;              //ms
+    uint32_t nargs;
+    uintptr_t args[TLOG_ARGS_MAX];
+} tlog_entry_t;
+
+/*
+ * One producer per ring: only its own core writes head, with interrupts
+ * masked on that core for the copy, so no lock is shared between cores.
+ * The tlog task is the only consumer and owns tail.
+ */
+typedef struct {
+    tlog_entry_t entries[TLOG_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t written;
+    uint32_t dropped;
+} tlog_ring_t;
+
+static tlog_ring_t rings[portNUM_PROCESSORS];
+static SemaphoreHandle_t drainLock = NULL;
+static StaticSemaphore_t drainLockBuffer;
+
+static const char levelChar[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+
+void IRAM_ATTR tlog_write(const tlog_site_t* site, int nargs, ...)
+{
+    uint32_t time = esp_timer_get_time()/1000;
+    va_list ap;
+
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    tlog_ring_t* ring = &rings[xPortGetCoreID()];
+    uint32_t head = ring->head;
+    if (head-ring->tail >= TLOG_RING_SIZE) {
+        ring->dropped++;
+        portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+        return;
+    }
+    tlog_entry_t* entry = &ring->entries[head & (TLOG_RING_SIZE-1)];
+    entry->site = site;
+    entry->time = time;
+    entry->nargs = nargs;
+    va_start(ap, nargs);
+    for (int i = 0; i < nargs && i < TLOG_ARGS_MAX; i++) {
+        entry->args[i] = va_arg(ap, uintptr_t);
+    }
+    va_end(ap);
+    ring->head = head+1;
+    ring->written++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+static void tlog_print(const tlog_entry_t* entry)
+{
+    const tlog_site_t* site = entry->site;
+    const uintptr_t* a = entry->args;
+    esp_log_write(site->level, site->tag, "%c (%u) %s: ", levelChar[site->level], entry->time, site->tag);
+    //unused args are 0, the format only reads what it names
+    esp_log_write(site->level, site->tag, site->format, a[0], a[1], a[2], a[3]);
+    esp_log_write(site->level, site->tag, "\n");
+}
+
+void tlog_flush()
+{
+    xSemaphoreTake(drainLock, portMAX_DELAY);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        tlog_ring_t* ring = &rings[core];
+        while (ring->tail != ring->head) {
+            tlog_entry_t entry = ring->entries[ring->tail & (TLOG_RING_SIZE-1)];
+            for (int i = entry.nargs; i < TLOG_ARGS_MAX; i++) {
+                entry.args[i] = 0;
+            }
+            ring->tail++;
+            tlog_print(&entry);
+        }
+    }
+    xSemaphoreGive(drainLock);
+}
+
+static void tlog_task(void* arg)
+{
+    while (1) {
+        vTaskDelay(TLOG_PERIOD/portTICK_RATE_MS);
+        tlog_flush();
+    }
+}
+
+void tlog_get_stats(tlog_stats_t* stats)
+{
+    stats->written = 0;
+    stats->dropped = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        stats->written += rings[core].written;
+        stats->dropped += rings[core].dropped;
+    }
+}
+
+void tlog_init()
+{
+    memset(rings, 0, sizeof(rings));
+    drainLock = xSemaphoreCreateMutexStatic(&drainLockBuffer);
+    task_table_start(TASK_TLOG, &tlog_task, NULL);
+}
@@ -0,0 +1,50 @@
+#ifndef _TLOG_H_
+#define _TLOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_log.h"
+
+/*
+ * Deferred logging for hot paths, ISR safe. A call stores a pointer to its
+ * static call site (level, tag, format) and up to 4 word sized args in a ring
+ * of the calling core; the tlog task formats and prints them later through
+ * esp_log_write(). Args are copied as words (32-bit on the esp32), so %s only
+ * works with strings that outlive the call (literals, __func__).
+ * Levels above LOG_LOCAL_LEVEL compile to nothing, like ESP_LOGx.
+ */
+#define TLOG_ARGS_MAX           4
+
+typedef struct {
+    esp_log_level_t level;
+    const char* tag;
+    const char* format;
+} tlog_site_t;
+
+typedef struct {
+    uint32_t written;
+    uint32_t dropped;           //ring full
+} tlog_stats_t;
+
+void tlog_init();
+void tlog_write(const tlog_site_t* site, int nargs, ...);
+// format everything pending now, e.g. before a restart
+void tlog_flush();
+void tlog_get_stats(tlog_stats_t* stats);
+
+#define TLOG_NARGS(...)         TLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define TLOG_NARGS_(_0, _1, _2, _3, _4, N, ...) N
+
+#define TLOG_LEVEL(level, tag, format, ...) do {                                \
+        if (LOG_LOCAL_LEVEL >= level) {                                         \
+            static const tlog_site_t _tlog_site = { level, tag, format };       \
+            tlog_write(&_tlog_site, TLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);    \
+        }                                                                       \
+    } while (0)
+
+#define TLOGE(tag, format, ...) TLOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define TLOGW(tag, format, ...) TLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define TLOGI(tag, format, ...) TLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define TLOGD(tag, format, ...) TLOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+#endif  /*_TLOG_H_*/
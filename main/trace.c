@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_freertos_hooks.h"
+#include "trace.h"
+
+#define TAG  "TRACE"
+
+#define TRACE_TASK_MAX          24
+#define TRACE_NAME_LEN          16
+
+typedef struct {
+    trace_record_t records[TRACE_RING_SIZE];
+    uint32_t head;              //records written, oldest overwritten
+    TaskHandle_t current;       //task seen on the last tick
+} trace_ring_t;
+
+static trace_ring_t rings[portNUM_PROCESSORS];
+static TaskHandle_t tasks[TRACE_TASK_MAX];
+static char taskNames[TRACE_TASK_MAX][TRACE_NAME_LEN];
+static volatile int taskCount = 0;
+static portMUX_TYPE taskMux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool enabled = false;
+static uint32_t recordNs = 0;               //measured cost of one record
+
+void IRAM_ATTR trace_record(uint8_t event, uint8_t arg, uint16_t data)
+{
+    if (!enabled) return;
+    //only this core writes its ring, masking local interrupts is enough
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    trace_ring_t* ring = &rings[xPortGetCoreID()];
+    trace_record_t* record = &ring->records[ring->head & (TRACE_RING_SIZE-1)];
+    record->time = (uint32_t)esp_timer_get_time();
+    record->event = event;
+    record->arg = arg;
+    record->data = data;
+    ring->head++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+// small index for a task handle, names are kept for the dump
+static int IRAM_ATTR task_index(TaskHandle_t task)
+{
+    int count = taskCount;
+    for (int i = 0; i < count; i++) {
+        if (tasks[i] == task) return i;
+    }
+
+    int index = TRACE_TASK_MAX;             //table full: one shared "other" slot
+    portENTER_CRITICAL_ISR(&taskMux);
+    for (int i = 0; i < taskCount; i++) {
+        if (tasks[i] == task) index = i;
+    }
+    if (index == TRACE_TASK_MAX && taskCount < TRACE_TASK_MAX) {
+        index = taskCount;
+        tasks[index] = task;
+        strncpy(taskNames[index], pcTaskGetTaskName(task), TRACE_NAME_LEN-1);
+        taskCount++;
+    }
+    portEXIT_CRITICAL_ISR(&taskMux);
+    return index;
+}
+
+// FreeRTOS offers no task switch hook to the app, sample the running task every tick
+static void IRAM_ATTR trace_tick()
+{
+    if (!enabled) return;
+    trace_ring_t* ring = &rings[xPortGetCoreID()];
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    if (task != ring->current) {
+        ring->current = task;
+        trace_record(TRACE_TASK_SWITCH, task_index(task), 0);
+    }
+}
+
+void trace_enable(bool enable)
+{
+    enabled = enable;
+}
+
+void trace_dump()
+{
+    bool wasEnabled = enabled;
+    enabled = false;
+
+    printf("TRACE begin %u\n", recordNs);
+    for (int i = 0; i < taskCount; i++) {
+        printf("TRACE task %d %s\n", i, taskNames[i]);
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        trace_ring_t* ring = &rings[core];
+        uint32_t start = ring->head > TRACE_RING_SIZE ? ring->head-TRACE_RING_SIZE : 0;
+        for (uint32_t i = start; i < ring->head; i++) {
+            trace_record_t* record = &ring->records[i & (TRACE_RING_SIZE-1)];
+            printf("TRACE %d %u %d %d %d\n", core, record->time, record->event, record->arg, record->data);
+        }
+    }
+    printf("TRACE end\n");
+
+    enabled = wasEnabled;
+}
+
+void trace_init()
+{
+#if TRACE_ENABLE
+    memset(rings, 0, sizeof(rings));
+
+    //cost of one record on this core, reported with every dump
+    enabled = true;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < 64; i++) {
+        trace_record(TRACE_QUEUE_SEND, TRACE_SRC_MAX, i);
+    }
+    recordNs = (uint32_t)((esp_timer_get_time()-start)*1000/64);
+    memset(rings, 0, sizeof(rings));
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_register_freertos_tick_hook_for_cpu(trace_tick, core);
+    }
+    ESP_LOGI(TAG, "%s: %d records per core, %u ns per record", __func__, TRACE_RING_SIZE, recordNs);
+#endif
+}
@@ -0,0 +1,66 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Event tracer: timestamped records in a fixed RAM ring per core, oldest
+ * overwritten. The time is the esp_timer clock: one time base for both
+ * cores, steady while power management changes the cpu frequency.
+ * trace_dump() prints the rings to the console, convert with
+ * tools/trace2chrome.py. Cheap enough to stay on in field builds, build with
+ * TRACE_ENABLE 0 to remove every call site.
+ */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE            1
+#endif
+
+#define TRACE_RING_SIZE         256         //records per core, power of 2
+
+/* TRACE EVENT */
+enum {
+    TRACE_ISR_ENTER,            //arg: trace source
+    TRACE_ISR_EXIT,
+    TRACE_TASK_SWITCH,          //arg: task index, sampled every tick
+    TRACE_SPI_START,            //arg: trace source
+    TRACE_SPI_END,
+    TRACE_I2C_START,
+    TRACE_I2C_END,
+    TRACE_QUEUE_SEND,           //arg: trace source, data: item
+    TRACE_EVENT_MAX
+};
+
+/* TRACE SOURCE */
+enum {
+    TRACE_SRC_ADC_DRDY,
+    TRACE_SRC_CPT112S_INT,
+    TRACE_SRC_GPIO_KEY,
+    TRACE_SRC_ADC,
+    TRACE_SRC_DISPLAY,
+    TRACE_SRC_CPT112S,
+    TRACE_SRC_KEY_QUEUE,
+    TRACE_SRC_MAX
+};
+
+typedef struct {
+    uint32_t time;              //us, esp_timer_get_time() cut to 32 bits
+    uint8_t event;
+    uint8_t arg;
+    uint16_t data;
+} trace_record_t;
+
+#if TRACE_ENABLE
+#define TRACE(event, arg, data) trace_record(event, arg, data)
+#else
+#define TRACE(event, arg, data)
+#endif
+
+void trace_init();
+void trace_record(uint8_t event, uint8_t arg, uint16_t data);
+// stop or resume recording, e.g. to keep the events before a fault
+void trace_enable(bool enable);
+void trace_dump();
+
+#endif  /*_TRACE_H_*/
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "tcpip_adapter.h"
+#include "lwip/sockets.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+#include "config.h"
+#include "key_event.h"
+#include "latency.h"
+#include "http.h"
+#include "trace.h"
+#include "webserver.h"
+#include "task_table.h"
+#include "io_loop.h"
+#include "pm.h"
+
+#define TAG  "WEB"
+
+#define REQUEST_MAX             512
+#define WS_PAYLOAD_MAX          125         //single byte length form only
+#define WS_GUID                 "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define PUSH_INTERVAL_DEFAULT   500         //ms
+#define PUSH_INTERVAL_MIN       100
+#define PUSH_INTERVAL_MAX       10000
+#define HOST_NAME_DEFAULT       "black-fire"    //without a device name
+
+/* WEBSOCKET OPCODE */
+#define WS_TEXT                 0x1
+#define WS_CLOSE                0x8
+#define WS_PING                 0x9
+#define WS_PONG                 0xA
+#define WS_FIN                  0x80
+#define WS_MASK                 0x80
+
+/* CLIENT STATE */
+typedef enum {
+    CLIENT_FREE,
+    CLIENT_HTTP,
+    CLIENT_WS,
+} client_state_e;
+
+typedef struct {
+    int fd;
+    client_state_e state;
+    int len;
+    uint8_t buf[REQUEST_MAX+1];
+} web_client_t;
+
+typedef struct {
+    int32_t temp;
+    bool heat;
+    bool hold;
+    int target;
+    uint32_t time;              //ms
+} live_state_t;
+
+static const char page[] =
+    "<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width\">"
+    "<title>Black Fire</title></head><body>"
+    "<h1 id=\"t\">--</h1><p id=\"s\"></p>"
+    "<button onclick=\"c('heat '+(d.heat?'off':'on'))\">Heat</button> "
+    "<button onclick=\"c('hold '+(d.hold?'off':'on'))\">Hold</button> "
+    "<input id=\"g\" type=\"number\" min=\"0\" max=\"100\"><button onclick=\"c('target '+g.value)\">Set</button>"
+    "<script>var d={},w=new WebSocket('ws://'+location.host+'/ws');function c(m){w.send(m)}"
+    "w.onmessage=function(e){if(e.data[0]!='{')return;d=JSON.parse(e.data);"
+    "t.textContent=d.temp+'\\u00b0C';s.textContent=(d.heat?'heating':'off')+(d.hold?', hold':'')+', target '+d.target}"
+    "</script></body></html>";
+
+static web_client_t clients[WEBSERVER_CLIENT_MAX];
+static live_state_t liveState;
+static portMUX_TYPE stateMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t pushInterval = PUSH_INTERVAL_DEFAULT;
+static webserver_stats_t stats;
+
+static void client_close(web_client_t* client)
+{
+    if (client->state == CLIENT_WS) {
+        stats.clients--;
+    }
+    close(client->fd);
+    client->state = CLIENT_FREE;
+    client->len = 0;
+}
+
+// never waits: the single server task must not stall on one client, and a
+// partial send would break the stream. The caller drops a client it fails
+static bool send_all(int fd, const void* data, size_t len)
+{
+    return send(fd, data, len, MSG_DONTWAIT) == len;
+}
+
+static void ws_send(web_client_t* client, uint8_t opcode, const char* payload, size_t len)
+{
+    uint8_t frame[2+WS_PAYLOAD_MAX];
+    if (len > WS_PAYLOAD_MAX) len = WS_PAYLOAD_MAX;
+    frame[0] = WS_FIN | opcode;
+    frame[1] = len;
+    memcpy(frame+2, payload, len);
+    if (!send_all(client->fd, frame, 2+len)) {
+        ESP_LOGW(TAG, "%s: client too slow, dropped\n", __func__);
+        stats.slow++;
+        client_close(client);
+    }
+}
+
+static bool ws_handshake(web_client_t* client, const char* headers)
+{
+    const char* key = http_header_value(headers, "Sec-WebSocket-Key");
+    if (key == NULL) return false;
+
+    char accept[64];
+    size_t keyLen = http_value_len(key);
+    if (keyLen+sizeof(WS_GUID) > sizeof(accept)) return false;
+    memcpy(accept, key, keyLen);
+    memcpy(accept+keyLen, WS_GUID, sizeof(WS_GUID)-1);
+
+    uint8_t digest[20];
+    mbedtls_sha1((uint8_t*)accept, keyLen+sizeof(WS_GUID)-1, digest);
+    size_t acceptLen = 0;
+    mbedtls_base64_encode((uint8_t*)accept, sizeof(accept), &acceptLen, digest, sizeof(digest));
+    accept[acceptLen] = 0;
+
+    char response[160];
+    int len = snprintf(response, sizeof(response),
+            "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+            "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    return send_all(client->fd, response, len);
+}
+
+// dns label of the device name, lower case with '-' for anything else
+static void host_name(char* name, size_t size)
+{
+    const char* device = config_get_device_name();
+    if (device == NULL || device[0] == 0) device = HOST_NAME_DEFAULT;
+    size_t i = 0;
+    for (; device[i] != 0 && i < size-1; i++) {
+        char c = device[i];
+        name[i] = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ? c :
+                (c >= 'A' && c <= 'Z') ? c-'A'+'a' : '-';
+    }
+    name[i] = 0;
+}
+
+// Host names this device: its name, bare or .local, or the station or ap
+// address. Anything else is a name rebound to our address by another site
+static bool host_allowed(const char* host, size_t len)
+{
+    const char* port = memchr(host, ':', len);
+    if (port != NULL) len = port-host;
+
+    char name[DEVICE_NAME_MAX+1];
+    host_name(name, sizeof(name));
+    size_t nameLen = strlen(name);
+    if (len >= nameLen && strncasecmp(host, name, nameLen) == 0
+            && (len == nameLen || (len == nameLen+6 && strncasecmp(host+nameLen, ".local", 6) == 0))) {
+        return true;
+    }
+
+    static const tcpip_adapter_if_t interfaces[] = { TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_IF_AP };
+    for (int i = 0; i < sizeof(interfaces)/sizeof(interfaces[0]); i++) {
+        tcpip_adapter_ip_info_t info;
+        if (tcpip_adapter_get_ip_info(interfaces[i], &info) != ESP_OK || info.ip.addr == 0) continue;
+        char address[16];
+        int addressLen = snprintf(address, sizeof(address), IPSTR, IP2STR(&info.ip));
+        if (len == addressLen && strncmp(host, address, len) == 0) return true;
+    }
+    return false;
+}
+
+// Host is this device, and no Origin or the one of the page served here
+static bool origin_allowed(const char* headers)
+{
+    static const char scheme[] = "http://";
+    const char* host = http_header_value(headers, "Host");
+    if (host == NULL) return false;
+    size_t hostLen = http_value_len(host);
+    if (!host_allowed(host, hostLen)) return false;
+    const char* origin = http_header_value(headers, "Origin");
+    if (origin == NULL) return true;
+    return http_value_len(origin) == sizeof(scheme)-1+hostLen
+            && strncasecmp(origin, scheme, sizeof(scheme)-1) == 0
+            && strncasecmp(origin+sizeof(scheme)-1, host, hostLen) == 0;
+}
+
+// request complete in client->buf, false closes the connection
+static bool http_handle(web_client_t* client)
+{
+    char* request = (char*)client->buf;
+    char path[32];
+    if (sscanf(request, "GET %31s HTTP/1.%*d", path) != 1) {
+        return false;
+    }
+
+    if (strcmp(path, "/ws") == 0) {
+        const char* upgrade = http_header_value(request, "Upgrade");
+        if (upgrade == NULL || strncasecmp(upgrade, "websocket", 9) != 0) {
+            return false;
+        }
+        if (!origin_allowed(request)) {
+            const char* forbidden = "HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            send_all(client->fd, forbidden, strlen(forbidden));
+            stats.rejected++;
+            ESP_LOGW(TAG, "%s: upgrade from a foreign host or origin refused\n", __func__);
+            return false;
+        }
+        if (!ws_handshake(client, request)) {
+            return false;
+        }
+        client->state = CLIENT_WS;
+        client->len = 0;
+        stats.clients++;
+        return true;
+    }
+
+    char header[128];
+    if (strcmp(path, "/") == 0) {
+        int len = snprintf(header, sizeof(header),
+                "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+                (int)sizeof(page)-1);
+        if (send_all(client->fd, header, len)) {
+            send_all(client->fd, page, sizeof(page)-1);
+        }
+    } else {
+        const char* notFound = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(client->fd, notFound, strlen(notFound));
+    }
+    return false;
+}
+
+static void post_key(int8_t type, int8_t value, int32_t data)
+{
+    key_event_t keyEvent;
+    memset(&keyEvent, 0, sizeof(keyEvent));
+    keyEvent.key_type = type;
+    keyEvent.key_value = value;
+    keyEvent.key_data = data;
+    keyEvent.task_time = latency_now();
+    send_key_event(keyEvent, false);
+}
+
+static bool ws_command(char* command)
+{
+    int value;
+    if (strcmp(command, "heat on") == 0 || strcmp(command, "heat off") == 0) {
+        post_key(HEAT_KEY, KEY_UP, strcmp(command, "heat on") == 0);
+    } else if (strcmp(command, "hold on") == 0 || strcmp(command, "hold off") == 0) {
+        post_key(HOLD_KEY, KEY_UP, strcmp(command, "hold on") == 0);
+    } else if (sscanf(command, "target %d", &value) == 1 && value >= 0 && value <= 100) {
+        post_key(TARGET_KEY, KEY_UP, value);
+    } else if (strcmp(command, "trace") == 0) {
+        trace_dump();
+    } else if (strcmp(command, "tasks") == 0) {
+        task_table_dump();
+        io_loop_dump();
+    } else if (strcmp(command, "power") == 0) {
+        pm_dump();
+    } else if (sscanf(command, "rate %d", &value) == 1 && value >= PUSH_INTERVAL_MIN && value <= PUSH_INTERVAL_MAX) {
+        pushInterval = value;
+    } else {
+        return false;
+    }
+    stats.commands++;
+    return true;
+}
+
+// frames in client->buf, false closes the connection
+static bool ws_handle(web_client_t* client)
+{
+    while (client->len >= 2) {
+        uint8_t* frame = client->buf;
+        uint8_t opcode = frame[0] & 0x0f;
+        uint8_t len = frame[1] & 0x7f;
+        //clients always mask, longer frames are not ours
+        if (!(frame[1] & WS_MASK) || len > WS_PAYLOAD_MAX) return false;
+        int frameLen = 2+4+len;
+        if (client->len < frameLen) break;
+
+        char payload[WS_PAYLOAD_MAX+1];
+        for (int i = 0; i < len; i++) {
+            payload[i] = frame[6+i] ^ frame[2+(i&3)];
+        }
+        payload[len] = 0;
+        client->len -= frameLen;
+        memmove(client->buf, client->buf+frameLen, client->len);
+
+        switch (opcode) {
+            case WS_TEXT:
+                if (ws_command(payload)) {
+                    ws_send(client, WS_TEXT, "ok", 2);
+                } else {
+                    ws_send(client, WS_TEXT, "error", 5);
+                }
+                break;
+            case WS_PING:
+                ws_send(client, WS_PONG, payload, len);
+                break;
+            case WS_CLOSE:
+                ws_send(client, WS_CLOSE, payload, len);
+                return false;
+            default:
+                break;
+        }
+        if (client->state != CLIENT_WS) return true;   //closed by a failed send
+    }
+    return true;
+}
+
+static void client_receive(web_client_t* client)
+{
+    int n = recv(client->fd, client->buf+client->len, REQUEST_MAX-client->len, 0);
+    if (n <= 0) {
+        client_close(client);
+        return;
+    }
+    client->len += n;
+
+    bool keep = true;
+    if (client->state == CLIENT_HTTP) {
+        client->buf[client->len] = 0;
+        if (strstr((char*)client->buf, "\r\n\r\n") != NULL) {
+            keep = http_handle(client);
+        } else if (client->len == REQUEST_MAX) {
+            keep = false;
+        }
+    } else {
+        keep = ws_handle(client);
+    }
+    if (!keep && client->state != CLIENT_FREE) {
+        client_close(client);
+    }
+}
+
+static void client_accept(int listenFd)
+{
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) return;
+    for (int i = 0; i < WEBSERVER_CLIENT_MAX; i++) {
+        if (clients[i].state == CLIENT_FREE) {
+            clients[i].fd = fd;
+            clients[i].state = CLIENT_HTTP;
+            clients[i].len = 0;
+            stats.connections++;
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "%s: too many clients\n", __func__);
+    close(fd);
+}
+
+/*
+ * One frame is serialized per push and the same bytes go to every client.
+ * A client that cannot take a whole frame without blocking is dropped, as
+ * on a reply, a slow phone must not hold back the others.
+ */
+static void push_state()
+{
+    live_state_t state;
+    portENTER_CRITICAL(&stateMux);
+    state = liveState;
+    portEXIT_CRITICAL(&stateMux);
+
+    uint8_t frame[2+WS_PAYLOAD_MAX];
+    int32_t temp = abs(state.temp);
+    int len = snprintf((char*)frame+2, WS_PAYLOAD_MAX+1,
+            "{\"ms\":%u,\"temp\":%s%d.%d,\"heat\":%d,\"hold\":%d,\"target\":%d}",
+            state.time, state.temp < 0 ? "-" : "", temp/10, temp%10, state.heat, state.hold, state.target);
+    frame[0] = WS_FIN | WS_TEXT;
+    frame[1] = len;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < WEBSERVER_CLIENT_MAX; i++) {
+        web_client_t* client = &clients[i];
+        if (client->state != CLIENT_WS) continue;
+        if (send(client->fd, frame, 2+len, MSG_DONTWAIT) == 2+len) {
+            stats.pushes++;
+        } else {
+            ESP_LOGW(TAG, "%s: client %d too slow, dropped\n", __func__, i);
+            stats.slow++;
+            client_close(client);
+        }
+    }
+    uint32_t elapsed = esp_timer_get_time()-start;
+    if (elapsed > stats.push_max) stats.push_max = elapsed;
+    stats.heap_min = esp_get_minimum_free_heap_size();
+}
+
+static void webserver_task(void* arg)
+{
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(WEBSERVER_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 2) != 0) {
+        ESP_LOGE(TAG, "%s: can not listen on %d\n", __func__, WEBSERVER_PORT);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    int64_t nextPush = esp_timer_get_time();
+    while (1) {
+        fd_set readFds;
+        FD_ZERO(&readFds);
+        FD_SET(listenFd, &readFds);
+        int maxFd = listenFd;
+        for (int i = 0; i < WEBSERVER_CLIENT_MAX; i++) {
+            if (clients[i].state == CLIENT_FREE) continue;
+            FD_SET(clients[i].fd, &readFds);
+            if (clients[i].fd > maxFd) maxFd = clients[i].fd;
+        }
+
+        int64_t wait = nextPush-esp_timer_get_time();
+        if (wait < 0) wait = 0;
+        struct timeval timeout = { .tv_sec = wait/1000000, .tv_usec = wait%1000000 };
+        if (select(maxFd+1, &readFds, NULL, NULL, &timeout) > 0) {
+            if (FD_ISSET(listenFd, &readFds)) {
+                client_accept(listenFd);
+            }
+            for (int i = 0; i < WEBSERVER_CLIENT_MAX; i++) {
+                if (clients[i].state != CLIENT_FREE && FD_ISSET(clients[i].fd, &readFds)) {
+                    client_receive(&clients[i]);
+                }
+            }
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (now >= nextPush) {
+            if (stats.clients > 0) {
+                push_state();
+            }
+            nextPush = now + pushInterval*1000;
+        }
+    }
+}
+
+void webserver_update(int32_t temp_x10, bool heat, bool hold, int target)
+{
+    portENTER_CRITICAL(&stateMux);
+    liveState.temp = temp_x10;
+    liveState.heat = heat;
+    liveState.hold = hold;
+    liveState.target = target;
+    liveState.time = esp_timer_get_time()/1000;
+    portEXIT_CRITICAL(&stateMux);
+}
+
+void webserver_get_stats(webserver_stats_t* out)
+{
+    memcpy(out, &stats, sizeof(webserver_stats_t));
+}
+
+void webserver_init()
+{
+    memset(clients, 0, sizeof(clients));
+    memset(&stats, 0, sizeof(stats));
+    task_table_start(TASK_WEBSERVER, &webserver_task, NULL);
+}
@@ -0,0 +1,55 @@
+#ifndef _WEBSERVER_H_
+#define _WEBSERVER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * LAN control on port 80. GET / serves a small control page, GET /ws opens a
+ * WebSocket that pushes the live state as a json text frame every push
+ * interval and takes text commands:
+ *
+ *   heat on|off        heater, what the right key toggles
+ *   hold on|off        keep warm, what the left key toggles
+ *   target <degree>    same as the slider
+ *   rate <ms>          push interval, all clients
+ *   trace              trace_dump() to the console
+ *   tasks              task_table_dump() to the console
+ *   power              pm_dump() to the console
+ *
+ * Commands are posted to the key event bus and handled by handle_key_event().
+ * They set a state rather than toggle one, so a command repeated by a
+ * reconnecting client or a double tap on the page changes nothing.
+ *
+ * An upgrade must name this device in Host: the device name as a dns label
+ * (black-fire without one), bare or .local, or the station or access point
+ * address, so a site that rebinds its own name to the kettle's address is
+ * refused. With an Origin header (every browser sends one) it must also
+ * come from the page served here, Origin http://<Host>, so no other site
+ * can drive the kettle through the browser of someone on the lan. Clients
+ * that are not browsers send no Origin and are let in.
+ *
+ * Sends never block the server task: a client that cannot take a reply or
+ * a push right away is dropped.
+ */
+#define WEBSERVER_PORT          80
+#define WEBSERVER_CLIENT_MAX    4
+
+typedef struct {
+    uint32_t connections;       //accepted
+    uint32_t clients;           //websocket clients now
+    uint32_t pushes;            //frames sent
+    uint32_t commands;
+    uint32_t rejected;          //upgrades from a foreign host or origin
+    uint32_t slow;              //clients dropped, a send would have blocked
+    uint32_t push_max;          //us, longest push to all clients
+    uint32_t heap_min;          //lowest free heap since boot, at the last push
+} webserver_stats_t;
+
+void webserver_init();
+// live state for the next push, called from the adc task
+void webserver_update(int32_t temp_x10, bool heat, bool hold, int target);
+void webserver_get_stats(webserver_stats_t* stats);
+
+#endif  /*_WEBSERVER_H_*/
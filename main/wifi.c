@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_event_loop.h"
+#include "tcpip_adapter.h"
+#include "config.h"
+#include "display.h"
+#include "wifi.h"
+
+#define TAG  "WIFI"
+
+#define CONNECTED_BIT       BIT0
+
+static EventGroupHandle_t wifiEventGroup = NULL;
+static bool wifiStarted = false;
+
+static esp_err_t event_handler(void *ctx, system_event_t *event)
+{
+    switch(event->event_id) {
+        case SYSTEM_EVENT_STA_START:
+            esp_wifi_connect();
+            break;
+        case SYSTEM_EVENT_STA_GOT_IP:
+            ESP_LOGI(TAG, "%s: connected\n", __func__);
+            xEventGroupSetBits(wifiEventGroup, CONNECTED_BIT);
+            display_set_icon(ICON_WIFI, true);
+            break;
+        case SYSTEM_EVENT_STA_DISCONNECTED:
+            xEventGroupClearBits(wifiEventGroup, CONNECTED_BIT);
+            display_set_icon(ICON_WIFI, false);
+            esp_wifi_connect();
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+// apply stored credentials, false if there are none
+static bool wifi_configure()
+{
+    char* name = config_get_wifi_name();
+    char* pass = config_get_wifi_pass();
+    if (name == NULL) {
+        ESP_LOGI(TAG, "%s: no wifi configured\n", __func__);
+        return false;
+    }
+
+    wifi_config_t wifi_config;
+    memset(&wifi_config, 0, sizeof(wifi_config));
+    strncpy((char*)wifi_config.sta.ssid, name, sizeof(wifi_config.sta.ssid));
+    if (pass != NULL) {
+        strncpy((char*)wifi_config.sta.password, pass, sizeof(wifi_config.sta.password));
+    }
+    ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
+    return true;
+}
+
+static void wifi_setting_changed(setting_e setting, void* arg)
+{
+    if (!wifi_configure()) return;
+
+    if (wifiStarted) {
+        //disconnect event connects again with the new credentials
+        esp_wifi_disconnect();
+    } else {
+        ESP_ERROR_CHECK( esp_wifi_start() );
+        wifiStarted = true;
+    }
+}
+
+bool wifi_is_connected()
+{
+    return wifiEventGroup != NULL && (xEventGroupGetBits(wifiEventGroup) & CONNECTED_BIT);
+}
+
+bool wifi_wait_connected(TickType_t wait)
+{
+    if (wifiEventGroup == NULL) return false;
+    EventBits_t bits = xEventGroupWaitBits(wifiEventGroup, CONNECTED_BIT, false, true, wait);
+    return bits & CONNECTED_BIT;
+}
+
+void wifi_init()
+{
+    wifiEventGroup = xEventGroupCreate();
+
+    tcpip_adapter_init();
+    ESP_ERROR_CHECK( esp_event_loop_init(event_handler, NULL) );
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
+    //credentials live in the settings, not in the wifi nvs namespace
+    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
+    ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
+#if CONFIG_PM_ENABLE
+    //the radio sleeps between beacons, otherwise it keeps the chip out of light sleep
+    ESP_ERROR_CHECK( esp_wifi_set_ps(WIFI_PS_MIN_MODEM) );
+#endif
+
+    config_subscribe(SETTING_WIFI_NAME, wifi_setting_changed, NULL);
+    config_subscribe(SETTING_WIFI_PASS, wifi_setting_changed, NULL);
+
+    if (wifi_configure()) {
+        ESP_ERROR_CHECK( esp_wifi_start() );
+        wifiStarted = true;
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef _BF_WIFI_H_
+#define _BF_WIFI_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+// station mode with the stored credentials, reconnects on its own
+void wifi_init();
+bool wifi_is_connected();
+bool wifi_wait_connected(TickType_t wait);
+
+#endif  /*_BF_WIFI_H_*/
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+#
+# Make a delta OTA patch (format in main/delta.h) turning the firmware image
+# running on the device into a new one:
+#
+#   tools/mkdelta.py old.bin new.bin out.patch
+#
+# Serve the patch at the firmware path like a full image, the device tells
+# the two apart by the header.
+#
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = 0x50444642          # "BFDP"
+VERSION = 1
+BLOCK = 8                   # index key length
+STRIDE = 4                  # old image indexed every STRIDE bytes
+MIN_MATCH = 16              # shorter exact matches go to extra
+MERGE_GAP = 256             # same alignment matches closer than this share one diff
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) ^ (value >> 31) if value >= 0 else ((-value - 1) << 1) | 1
+
+
+def build_index(old):
+    index = {}
+    for pos in range(0, len(old) - BLOCK + 1, STRIDE):
+        index.setdefault(old[pos:pos + BLOCK], pos)
+    return index
+
+
+def match_len(old, new, o, n):
+    length = 0
+    limit = min(len(old) - o, len(new) - n)
+    while length < limit and old[o + length] == new[n + length]:
+        length += 1
+    return length
+
+
+def find_matches(old, new):
+    """exact matches (new pos, old pos, length), greedy, in new order"""
+    index = build_index(old)
+    matches = []
+    pos = 0
+    align = None
+    while pos <= len(new) - BLOCK:
+        best_old, best_len = -1, 0
+        # keep the current alignment while it still matches, like bsdiff
+        if align is not None and 0 <= pos + align < len(old):
+            best_len = match_len(old, new, pos + align, pos)
+            best_old = pos + align
+        if best_len < MIN_MATCH:
+            for k in range(STRIDE):
+                cand = index.get(new[pos + k:pos + k + BLOCK])
+                if cand is None or cand < k:
+                    continue
+                length = match_len(old, new, cand - k, pos)
+                if length > best_len:
+                    best_old, best_len = cand - k, length
+        if best_len >= MIN_MATCH:
+            matches.append([pos, best_old, best_len])
+            align = best_old - pos
+            pos += best_len
+        else:
+            pos += 1
+    return matches
+
+
+def merge(matches):
+    merged = []
+    for m in matches:
+        if merged:
+            last = merged[-1]
+            gap = m[0] - (last[0] + last[2])
+            if m[1] - m[0] == last[1] - last[0] and gap <= MERGE_GAP:
+                last[2] = m[0] + m[2] - last[0]
+                continue
+        merged.append(list(m))
+    return merged
+
+
+def diff_body(old, new, o, n, length):
+    """{zero run, literal count, literals} pairs covering length bytes"""
+    out = bytearray()
+    i = 0
+    while i < length:
+        start = i
+        while i < length and new[n + i] == old[o + i]:
+            i += 1
+        zeros = i - start
+        start = i
+        # a literal run ends at 4 equal bytes, shorter runs are cheaper inline
+        while i < length and not (i + 4 <= length and new[n + i:n + i + 4] == old[o + i:o + i + 4]):
+            i += 1
+        out += varint(zeros) + varint(i - start)
+        out += bytes((new[n + j] - old[o + j]) & 0xff for j in range(start, i))
+    return out
+
+
+def make_patch(old, new):
+    matches = merge(find_matches(old, new))
+    out = bytearray(struct.pack('<IHHII', MAGIC, VERSION, 0, len(old), len(new)))
+    out += hashlib.sha256(old).digest() + hashlib.sha256(new).digest()
+
+    old_pos = 0
+    new_pos = 0
+    if not matches or matches[0][0] > 0:
+        # leading extra bytes before the first match
+        first_old = matches[0][1] if matches else 0
+        first_new = matches[0][0] if matches else len(new)
+        out += varint(0) + varint(first_new) + varint(zigzag(first_old))
+        out += new[:first_new]
+        old_pos, new_pos = first_old, first_new
+
+    for i, (n, o, length) in enumerate(matches):
+        assert n == new_pos and o == old_pos
+        end = n + length
+        next_new, next_old = (matches[i + 1][0], matches[i + 1][1]) if i + 1 < len(matches) else (len(new), o + length)
+        out += varint(length) + varint(next_new - end) + varint(zigzag(next_old - (o + length)))
+        out += diff_body(old, new, o, n, length)
+        out += new[end:next_new]
+        old_pos, new_pos = next_old, next_new
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='make a delta OTA patch')
+    parser.add_argument('old', help='image running on the device')
+    parser.add_argument('new', help='image to upgrade to')
+    parser.add_argument('patch', help='output patch')
+    args = parser.parse_args()
+
+    old = open(args.old, 'rb').read()
+    new = open(args.new, 'rb').read()
+    patch = make_patch(old, new)
+    open(args.patch, 'wb').write(patch)
+    print('%s: %d bytes, %.1f%% of %d' % (args.patch, len(patch), 100.0 * len(patch) / len(new), len(new)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
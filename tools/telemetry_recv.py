@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+#
+# Receive the telemetry stream (format in main/telemetry.h) and print one
+# csv line per sample:
+#
+#   tools/telemetry_recv.py [--port 5005] > samples.csv
+#
+import argparse
+import socket
+import sys
+
+MAGIC = 0xBF
+VERSION = 1
+
+
+def varint(frame, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = frame[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode(frame):
+    """(seq, dropped, [(time, raw, temp, heat, target)])"""
+    if len(frame) < 2 or frame[0] != MAGIC or frame[1] != VERSION:
+        raise ValueError('not a telemetry frame')
+    pos = 2
+    seq, pos = varint(frame, pos)
+    count, pos = varint(frame, pos)
+    dropped, pos = varint(frame, pos)
+    samples = []
+    time = raw = temp = target = 0
+    for _ in range(count):
+        value, pos = varint(frame, pos)
+        time += value
+        value, pos = varint(frame, pos)
+        raw += unzigzag(value)
+        value, pos = varint(frame, pos)
+        temp += unzigzag(value)
+        value, pos = varint(frame, pos)
+        target += unzigzag(value >> 1)
+        samples.append((time, raw, temp, value & 1, target))
+    return seq, dropped, samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description='receive device telemetry')
+    parser.add_argument('--port', type=int, default=5005)
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', args.port))
+    print('device,seq,time_ms,raw,temp_x10,heat,target')
+    expected = {}
+    while True:
+        frame, addr = sock.recvfrom(2048)
+        try:
+            seq, dropped, samples = decode(frame)
+        except (ValueError, IndexError) as e:
+            print('# %s: %s' % (addr[0], e), file=sys.stderr)
+            continue
+        if addr[0] in expected and seq != expected[addr[0]]:
+            print('# %s: %d frames lost' % (addr[0], seq - expected[addr[0]]), file=sys.stderr)
+        if dropped:
+            print('# %s: %d samples dropped on the device' % (addr[0], dropped), file=sys.stderr)
+        expected[addr[0]] = seq + 1
+        for sample in samples:
+            print('%s,%d,%d,%d,%d,%d,%d' % ((addr[0], seq) + sample))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
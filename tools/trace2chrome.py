@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+#
+# Convert a trace_dump() console capture (main/trace.h) to Chrome trace_event
+# json, open it in chrome://tracing or ui.perfetto.dev:
+#
+#   tools/trace2chrome.py console.log trace.json
+#
+# Every core is a process; tasks, interrupts, bus transfers and queue sends
+# are separate threads of it. Times are esp_timer microseconds, the same
+# clock on both cores, cut to 32 bits: they wrap every 71.6 minutes, so
+# records of one core must be less than one wrap apart.
+#
+import argparse
+import json
+import sys
+
+EVENTS = ['isr_enter', 'isr_exit', 'task_switch', 'spi_start', 'spi_end',
+          'i2c_start', 'i2c_end', 'queue_send']
+SOURCES = ['adc_drdy', 'cpt112s_int', 'gpio_key', 'adc', 'display', 'cpt112s', 'key_queue']
+LANES = {'task': 0, 'isr': 1, 'bus': 2, 'queue': 3}
+BEGIN_END = {
+    'isr_enter': ('isr', 'B'), 'isr_exit': ('isr', 'E'),
+    'spi_start': ('bus', 'B'), 'spi_end': ('bus', 'E'),
+    'i2c_start': ('bus', 'B'), 'i2c_end': ('bus', 'E'),
+}
+
+
+def parse(lines):
+    cost, tasks, records = 0, {}, []
+    for line in lines:
+        pos = line.find('TRACE ')
+        if pos < 0:
+            continue
+        fields = line[pos:].split()
+        if fields[1] == 'begin':
+            cost, tasks, records = int(fields[2]), {}, []
+        elif fields[1] == 'task':
+            tasks[int(fields[2])] = ' '.join(fields[3:])
+        elif fields[1] == 'end':
+            break
+        else:
+            core, time, event, arg, data = (int(f) for f in fields[1:6])
+            records.append((core, time, event, arg, data))
+    return cost, tasks, records
+
+
+# microseconds since the first record, wraps undone per core
+def unwrap(records):
+    times, last, wraps = [], {}, {}
+    for core, time, _, _, _ in records:
+        if core in last and time < last[core]:
+            wraps[core] = wraps.get(core, 0) + 1
+        last[core] = time
+        times.append(time + (wraps.get(core, 0) << 32))
+    base = min(times)
+    return [t - base for t in times]
+
+
+def convert(tasks, records):
+    events = []
+    stamps = unwrap(records)
+    for core in sorted(set(r[0] for r in records)):
+        for lane, tid in LANES.items():
+            events.append({'ph': 'M', 'name': 'thread_name', 'pid': core, 'tid': tid,
+                           'args': {'name': lane}})
+        events.append({'ph': 'M', 'name': 'process_name', 'pid': core, 'tid': 0,
+                       'args': {'name': 'core %d' % core}})
+
+        running = None
+        for (record_core, _, event, arg, data), ts in zip(records, stamps):
+            if record_core != core:
+                continue
+            name = EVENTS[event] if event < len(EVENTS) else 'event%d' % event
+            source = SOURCES[arg] if arg < len(SOURCES) else str(arg)
+
+            if name == 'task_switch':
+                if running is not None:
+                    events.append({'ph': 'X', 'name': running[0], 'pid': core, 'tid': LANES['task'],
+                                   'ts': running[1], 'dur': ts - running[1]})
+                running = (tasks.get(arg, 'task%d' % arg), ts)
+            elif name in BEGIN_END:
+                lane, ph = BEGIN_END[name]
+                events.append({'ph': ph, 'name': source, 'pid': core, 'tid': LANES[lane], 'ts': ts,
+                               'args': {'data': data}})
+            else:
+                events.append({'ph': 'i', 's': 't', 'name': '%s %s' % (name, source), 'pid': core,
+                               'tid': LANES['queue'], 'ts': ts, 'args': {'data': data}})
+        if running is not None:
+            events.append({'ph': 'X', 'name': running[0], 'pid': core, 'tid': LANES['task'],
+                           'ts': running[1], 'dur': ts - running[1]})
+    return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='trace dump to chrome trace_event json')
+    parser.add_argument('dump', help='console capture with a trace_dump()')
+    parser.add_argument('json', help='output file')
+    args = parser.parse_args()
+
+    with open(args.dump, errors='replace') as f:
+        cost, tasks, records = parse(f)
+    if not records:
+        print('no trace records in %s' % args.dump, file=sys.stderr)
+        return 1
+    with open(args.json, 'w') as f:
+        json.dump(convert(tasks, records), f)
+    print('%d records, %d ns per record' % (len(records), cost))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())